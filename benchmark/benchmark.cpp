@@ -15,6 +15,10 @@ std::map<std::string, std::function<void()>> features {
    { "key", key_benchmarking },
    { "hash", hash_benchmarking },
    { "blake2", blake2_benchmarking },
+   { "undo_session", undo_session_benchmarking },
+   { "resource_usage", resource_usage_benchmarking },
+   { "iterator_cache", iterator_cache_benchmarking },
+   { "host_copy", host_copy_benchmarking },
 };
 
 // values to control cout format
@@ -19,6 +19,10 @@ void modexp_benchmarking();
 void key_benchmarking();
 void hash_benchmarking();
 void blake2_benchmarking();
+void undo_session_benchmarking();
+void resource_usage_benchmarking();
+void iterator_cache_benchmarking();
+void host_copy_benchmarking();
 
 void benchmarking(std::string name, const std::function<void()>& func);
 
@@ -0,0 +1,91 @@
+#include <eosio/chain/transaction.hpp>
+
+#include <fc/io/raw.hpp>
+
+#include <cstring>
+#include <random>
+
+#include <benchmark.hpp>
+
+namespace benchmark {
+
+using namespace eosio::chain;
+
+namespace {
+
+   /// action data as a contract receives it, incompressible bytes rather than a repeated character
+   bytes make_payload( size_t size, std::mt19937& gen ) {
+      std::uniform_int_distribution<int> dist( 0, 255 );
+      bytes data( size );
+      for( auto& c : data )
+         c = static_cast<char>( dist( gen ) );
+      return data;
+   }
+
+   /// body of interface::read_action_data: the action data is copied straight into linear memory
+   size_t read_action_data( const action& act, char* memory, size_t memory_size ) {
+      auto s = act.data.size();
+      if( memory_size == 0 ) return s;
+
+      auto copy_size = std::min( memory_size, s );
+      std::memcpy( memory, act.data.data(), copy_size );
+      return copy_size;
+   }
+
+   /// body of interface::read_transaction before: the transaction was packed to a temporary, then copied
+   size_t read_transaction_through_temporary( const transaction& trx, char* memory, size_t memory_size ) {
+      bytes packed = fc::raw::pack( trx );
+      size_t copy_size = std::min( memory_size, packed.size() );
+      std::memcpy( memory, packed.data(), copy_size );
+      return copy_size;
+   }
+
+   /// body of interface::read_transaction now: a buffer holding the whole transaction is packed into directly
+   size_t read_transaction_direct( const transaction& trx, char* memory, size_t memory_size ) {
+      const size_t trx_size = fc::raw::pack_size( trx );
+      if( memory_size >= trx_size ) {
+         fc::datastream<char*> ds( memory, trx_size );
+         fc::raw::pack( ds, trx );
+         return trx_size;
+      }
+      return read_transaction_through_temporary( trx, memory, memory_size );
+   }
+
+}
+
+// the host functions which copy action data and transactions into the linear memory of a contract, for payloads
+// of 1KB to 64KB. The buffer is sized the way contracts do it, with action_data_size() or transaction_size().
+void host_copy_benchmarking() {
+   std::mt19937 gen( 42 );
+   std::vector<char> memory( 128 * 1024 ); // stands in for the linear memory of the contract
+
+   for( uint32_t kb : { 1, 4, 16, 64 } ) {
+      const std::string size = " (" + std::to_string( kb ) + "KB)";
+
+      // a transaction as contracts see it: tapos, a context free action and the action carrying the payload
+      transaction trx;
+      trx.expiration       = fc::time_point_sec( fc::time_point::now() ) + 60;
+      trx.ref_block_num    = 0x1234;
+      trx.ref_block_prefix = 0x89abcdef;
+      trx.context_free_actions.emplace_back( vector<permission_level>{}, config::null_account_name, "nonce"_n,
+                                             make_payload( 16, gen ) );
+      trx.actions.emplace_back( vector<permission_level>{{"alice"_n, config::active_name}}, "store"_n, "put"_n,
+                                make_payload( kb * 1024, gen ) );
+      const action& act = trx.actions.back();
+
+      const size_t act_size = read_action_data( act, nullptr, 0 );
+      benchmarking( "read_action_data" + size, [&]() {
+         read_action_data( act, memory.data(), act_size );
+      } );
+
+      const size_t trx_size = fc::raw::pack_size( trx );
+      benchmarking( "read_transaction tmp" + size, [&]() {
+         read_transaction_through_temporary( trx, memory.data(), trx_size );
+      } );
+      benchmarking( "read_transaction" + size, [&]() {
+         read_transaction_direct( trx, memory.data(), trx_size );
+      } );
+   }
+}
+
+} // benchmark
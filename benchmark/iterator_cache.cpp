@@ -0,0 +1,135 @@
+#include <eosio/chain/iterator_cache.hpp>
+
+#include <map>
+
+#include <benchmark.hpp>
+
+namespace benchmark {
+
+using namespace eosio::chain;
+
+namespace {
+
+   struct bench_table {
+      struct id_type { int64_t _id = 0; };
+      id_type id;
+   };
+
+   struct bench_row {
+      uint64_t primary_key = 0;
+   };
+
+   /// the tree based cache contract table contexts used before, allocating every node
+   template<typename T>
+   class map_iterator_cache {
+      public:
+         map_iterator_cache() {
+            _end_iterator_to_table.reserve(8);
+            _iterator_to_object.reserve(32);
+         }
+
+         int cache_table( const bench_table& tobj ) {
+            auto itr = _table_cache.find(tobj.id._id);
+            if( itr != _table_cache.end() )
+               return itr->second.second;
+
+            int ei = -(int(_end_iterator_to_table.size()) + 2);
+            _end_iterator_to_table.push_back( &tobj );
+            _table_cache.emplace( tobj.id._id, std::make_pair(&tobj, ei) );
+            return ei;
+         }
+
+         const T& get( int iterator ) {
+            return *_iterator_to_object.at(iterator);
+         }
+
+         int add( const T& obj ) {
+            auto itr = _object_to_iterator.find( &obj );
+            if( itr != _object_to_iterator.end() )
+               return itr->second;
+
+            _iterator_to_object.push_back( &obj );
+            _object_to_iterator[&obj] = _iterator_to_object.size() - 1;
+            return _iterator_to_object.size() - 1;
+         }
+
+      private:
+         std::map<int64_t, std::pair<const bench_table*, int>> _table_cache;
+         std::vector<const bench_table*>                        _end_iterator_to_table;
+         std::vector<const T*>                                  _iterator_to_object;
+         std::map<const T*, int>                                _object_to_iterator;
+   };
+
+   template<template<typename> class Cache>
+   struct bench_caches {
+      // a context holds a cache for the primary index and each of the five secondary index types
+      Cache<bench_row> keyval, idx64, idx128, idx256, idx_double, idx_long_double;
+
+      void reset() {
+         for( auto* c : { &keyval, &idx64, &idx128, &idx256, &idx_double, &idx_long_double } )
+            c->reset();
+      }
+   };
+
+   template<typename T>
+   using flat_cache = iterator_cache<T, bench_table>;
+
+   /// before: every action constructed the caches of its context
+   struct map_lease {
+      bench_caches<map_iterator_cache> caches;
+   };
+
+   /// after: every action leases the caches of its context from the thread pool
+   struct pool_lease {
+      using pool = iterator_cache_pool<bench_caches<flat_cache>>;
+      bench_caches<flat_cache>& caches = pool::thread_pool().acquire();
+      ~pool_lease() { pool::thread_pool().release(); }
+   };
+
+   constexpr uint32_t calls_per_run = 1000;
+
+   /// a token transfer: find, read and write back the balances of two accounts, in their own scopes
+   template<typename Lease>
+   void transfer_actions( const std::vector<bench_table>& tables, const std::vector<bench_row>& rows ) {
+      constexpr uint32_t calls_per_action = 8;
+      for( uint32_t a = 0; a < calls_per_run / calls_per_action; ++a ) {
+         Lease lease;
+         auto& cache = lease.caches.keyval;
+         for( uint32_t i = 0; i < 2; ++i ) {
+            const auto& row = rows[(a * 2 + i) % rows.size()];
+            cache.cache_table( tables[i] );                 // db_find_i64
+            int itr = cache.add( row );
+            cache.get( itr );                               // db_get_i64
+            cache.cache_table( tables[i] );                 // db_update_i64
+            cache.get( cache.add( row ) );
+         }
+      }
+   }
+
+   /// a single action walking a table with db_next_i64
+   template<typename Lease>
+   void scan_action( const std::vector<bench_table>& tables, const std::vector<bench_row>& rows ) {
+      Lease lease;
+      auto& cache = lease.caches.keyval;
+      cache.cache_table( tables[0] );
+      for( uint32_t i = 0; i < calls_per_run; ++i )
+         cache.get( cache.add( rows[i % rows.size()] ) );
+   }
+
+}
+
+// latency of the iterator cache behind the db intrinsics, every run makes 1000 intrinsic calls so
+// the reported time in us is the per call latency in ns
+void iterator_cache_benchmarking() {
+   std::vector<bench_table> tables( 2 );
+   for( size_t i = 0; i < tables.size(); ++i )
+      tables[i].id._id = i;
+   std::vector<bench_row> rows( calls_per_run );
+
+   benchmarking( "itr_cache map transfer", [&]() { transfer_actions<map_lease>( tables, rows ); } );
+   benchmarking( "itr_cache flat transfer", [&]() { transfer_actions<pool_lease>( tables, rows ); } );
+   benchmarking( "itr_cache map scan", [&]() { scan_action<map_lease>( tables, rows ); } );
+   benchmarking( "itr_cache flat scan", [&]() { scan_action<pool_lease>( tables, rows ); } );
+}
+
+} // benchmark
@@ -0,0 +1,100 @@
+#include <eosio/chain/database_manager.hpp>
+#include <eosio/chain/resource_limits.hpp>
+#include <eosio/chain/resource_limits_private.hpp>
+#include <eosio/chain/shard_object.hpp>
+
+#include <fc/filesystem.hpp>
+
+#include <algorithm>
+#include <thread>
+
+#include <benchmark.hpp>
+
+namespace benchmark {
+
+using namespace eosio::chain;
+using namespace eosio::chain::resource_limits;
+
+// every shard bills its transactions into its own resource_limits_shard_state_object on its own thread, only reading
+// the shared db, then the block is finalized by merging the shard accumulators on one thread; with one thread per
+// shard the time for a block of transactions per shard should stay flat as shards are added
+void resource_usage_benchmarking() {
+   constexpr uint64_t db_size       = 8 * 1024 * 1024;
+   constexpr uint32_t trxs_per_shard = 1000;
+
+   const uint32_t max_shards = std::max<uint32_t>( std::thread::hardware_concurrency(), 1 );
+   for( uint32_t num_shards : { 1u, 2u, 4u, 8u, 16u } ) {
+      if( num_shards > max_shards )
+         break;
+
+      fc::temp_directory tempdir;
+      database_manager dbm( tempdir.path(), chainbase::database::read_write, db_size, db_size );
+      resource_limits_manager rlm( dbm, []( bool ) -> deep_mind_handler* { return nullptr; }, []() { return true; } );
+
+      // the main db holds the chain-wide state merged into at finalize, the shared db the copy shard threads read
+      auto& main_db = dbm.main_db();
+      auto& shared_db = dbm.shared_db();
+      resource_limits_manager::add_indices( main_db );
+      resource_limits_manager::add_shared_indices( shared_db );
+      shared_db.add_index<shard_index>();
+      for( auto* db : { &main_db, &shared_db } ) {
+         const auto& config = db->create<resource_limits_config_object>( []( auto& ) {} );
+         db->create<resource_limits_state_object>( [&]( auto& state ) {
+            state.virtual_cpu_limit = config.cpu_limit_parameters.max;
+            state.virtual_net_limit = config.net_limit_parameters.max;
+            state.total_cpu_weight  = num_shards;
+            state.total_net_weight  = num_shards;
+         } );
+      }
+      const auto& state = shared_db.get<resource_limits_state_object>();
+
+      std::vector<std::pair<chainbase::database*, flat_set<account_name>>> shards;
+      for( uint32_t i = 0; i < num_shards; ++i ) {
+         const name shard_name( "shard"_n.to_uint64_t() + i + 1 );
+         const name account( "account"_n.to_uint64_t() + i + 1 );
+         auto* db = dbm.add_shard_db( shard_name, db_size );
+         resource_limits_manager::add_indices( *db );
+         db->create<resource_limits_shard_state_object>( [&]( auto& ss ) {
+            ss.virtual_cpu_limit = state.virtual_cpu_limit;
+            ss.virtual_net_limit = state.virtual_net_limit;
+         } );
+         shared_db.create<shard_object>( [&]( auto& s ) { s.name = shard_name; } );
+         shared_db.create<resource_limits_object>( [&]( auto& l ) {
+            l.owner      = account;
+            l.cpu_weight = 1;
+            l.net_weight = 1;
+         } );
+         shards.emplace_back( db, flat_set<account_name>{ account } );
+      }
+
+      auto apply_block = [&]() {
+         std::vector<chainbase::database::session> block_sessions;
+         block_sessions.reserve( shards.size() + 1 );
+         block_sessions.push_back( main_db.start_undo_session( true ) );
+         for( auto& shard : shards )
+            block_sessions.push_back( shard.first->start_undo_session( true ) );
+
+         std::vector<std::thread> threads;
+         threads.reserve( shards.size() );
+         for( auto& shard : shards ) {
+            threads.emplace_back( [&rlm, &shared_db, &shard]() {
+               auto& db = *shard.first;
+               for( uint32_t t = 0; t < trxs_per_shard; ++t ) {
+                  auto trx_session = db.start_undo_session( true );
+                  rlm.add_transaction_usage( shard.second, 10, 128, 1, db, shared_db );
+                  trx_session.squash();
+               }
+            } );
+         }
+         for( auto& t : threads )
+            t.join();
+
+         rlm.process_block_usage( 1 );
+         for( auto& session : block_sessions )
+            session.undo();
+      };
+      benchmarking( "resource_usage " + std::to_string( num_shards ) + " shards", apply_block );
+   }
+}
+
+} // benchmark
@@ -0,0 +1,48 @@
+#include <eosio/chain/database_manager.hpp>
+#include <eosio/chain/shard_object.hpp>
+
+#include <fc/filesystem.hpp>
+
+#include <benchmark.hpp>
+
+namespace benchmark {
+
+using namespace eosio::chain;
+
+// a block with a single transaction writing to one shard, the cost should not depend on the number of shards
+void undo_session_benchmarking() {
+   constexpr uint64_t db_size = 8 * 1024 * 1024;
+
+   for( uint32_t num_shards : { 1, 16, 128, 512 } ) {
+      fc::temp_directory tempdir;
+      database_manager dbm( tempdir.path(), chainbase::database::read_write, db_size, db_size );
+      dbm.add_index<shard_index>();
+
+      std::vector<std::pair<name, chainbase::database*>> shard_dbs;
+      for( uint32_t i = 0; i < num_shards; ++i ) {
+         const name shard_name( "shard"_n.to_uint64_t() + i + 1 );
+         auto* db = dbm.add_shard_db( shard_name, db_size );
+         db->add_index<shard_index>();
+         db->create<shard_object>( [&]( auto& s ) { s.name = shard_name; } );
+         shard_dbs.emplace_back( shard_name, db );
+      }
+
+      uint32_t next = 0;
+      auto apply_block = [&]() {
+         const auto& [shard_name, db_ptr] = shard_dbs[next++ % shard_dbs.size()];
+         auto& db = *db_ptr;
+         auto block_session = dbm.start_undo_session( true );
+         dbm.start_shard_undo_session( shard_name );
+         {
+            auto trx_session = db.start_undo_session( true );
+            db.modify( *db.get_index<shard_index>().begin(), []( auto& s ) { ++s.version; } );
+            trx_session.squash();
+         }
+         block_session.push();
+         dbm.commit( dbm.revision() );
+      };
+      benchmarking( "undo_session " + std::to_string( num_shards ) + " shards", apply_block );
+   }
+}
+
+} // benchmark
@@ -94,7 +94,15 @@ namespace eosio { namespace chain {
    }
 
    void authorization_manager::add_to_snapshot( const snapshot_writer_ptr& snapshot ) const {
-      authorization_index_set::walk_indices([this, &snapshot]( auto utils ){
+      add_to_snapshot( _db, snapshot );
+   }
+
+   void authorization_manager::read_from_snapshot( const snapshot_reader_ptr& snapshot ) {
+      read_from_snapshot( _db, snapshot );
+   }
+
+   void authorization_manager::add_to_snapshot( const chainbase::database& db, const snapshot_writer_ptr& snapshot ) {
+      authorization_index_set::walk_indices([&db, &snapshot]( auto utils ){
          using section_t = typename decltype(utils)::index_t::value_type;
 
          // skip the permission_usage_index as its inlined with permission_index
@@ -102,16 +110,16 @@ namespace eosio { namespace chain {
             return;
          }
 
-         snapshot->write_section<section_t>([this]( auto& section ){
-            decltype(utils)::walk(_db, [this, &section]( const auto &row ) {
-               section.add_row(row, _db);
+         snapshot->write_section<section_t>([&db]( auto& section ){
+            decltype(utils)::walk(db, [&db, &section]( const auto &row ) {
+               section.add_row(row, db);
             });
          });
       });
    }
 
-   void authorization_manager::read_from_snapshot( const snapshot_reader_ptr& snapshot ) {
-      authorization_index_set::walk_indices([this, &snapshot]( auto utils ){
+   void authorization_manager::read_from_snapshot( chainbase::database& db, const snapshot_reader_ptr& snapshot ) {
+      authorization_index_set::walk_indices([&db, &snapshot]( auto utils ){
          using section_t = typename decltype(utils)::index_t::value_type;
 
          // skip the permission_usage_index as its inlined with permission_index
@@ -119,11 +127,11 @@ namespace eosio { namespace chain {
             return;
          }
 
-         snapshot->read_section<section_t>([this]( auto& section ) {
+         snapshot->read_section<section_t>([&db]( auto& section ) {
             bool more = !section.empty();
             while(more) {
-               decltype(utils)::create(_db, [this, &section, &more]( auto &row ) {
-                  more = section.read_row(row, _db);
+               decltype(utils)::create(db, [&db, &section, &more]( auto &row ) {
+                  more = section.read_row(row, db);
                });
             }
          });
@@ -175,7 +175,8 @@ namespace eosio { namespace chain {
                                                       const checksum256_type& action_mroot,
                                                       const std::optional<producer_authority_schedule>& new_producers,
                                                       vector<digest_type>&& new_protocol_feature_activations,
-                                                      const protocol_feature_set& pfs
+                                                      const protocol_feature_set& pfs,
+                                                      flat_map<shard_name, checksum256_type>&& shard_transaction_mroots
    )const
    {
       signed_block_header h;
@@ -218,6 +219,14 @@ namespace eosio { namespace chain {
          }
       }
 
+      if( shard_transaction_mroots.size() > 1 ) {
+         emplace_extension(
+               h.header_extensions,
+               shard_transaction_mroots_extension::extension_id(),
+               fc::raw::pack( shard_transaction_mroots_extension{ std::move(shard_transaction_mroots) } )
+         );
+      }
+
       return h;
    }
 
@@ -27,6 +27,7 @@
 #include <eosio/chain/deep_mind.hpp>
 #include <eosio/chain/shard_object.hpp>
 #include <eosio/chain/xshard_object.hpp>
+#include <eosio/chain/xshard_queue.hpp>
 
 #include <chainbase/chainbase.hpp>
 #include <eosio/vm/allocator.hpp>
@@ -36,7 +37,12 @@
 #include <fc/variant_object.hpp>
 #include <eosio/chain/database_manager.hpp>
 
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
+
+#include <condition_variable>
 #include <new>
+#include <cstring>
 #include <shared_mutex>
 
 namespace eosio { namespace chain {
@@ -150,13 +156,46 @@ class maybe_session {
 using dbm_maybe_session = maybe_session<database_manager>;
 using db_maybe_session = maybe_session<database>;
 
-struct xsh_out_action
-{
-   chain::xshout                 xsh_out;
-   xshard_id_type                xsh_id;
-   transaction_id_type           scheduled_xshin_trx_id;
-   bytes                         scheduled_xshin_trx_packed;
+/**
+ * Seekable output buffer that writes straight into a bytes vector. A sub-shard database is serialized into it
+ * and the vector is then written as a snapshot row as is, without copying the stream out of a string stream.
+ */
+class bytes_streambuf : public std::streambuf {
+   public:
+      bytes& data() { return _data; }
+
+   protected:
+      std::streamsize xsputn( const char* s, std::streamsize n ) override {
+         if( _pos + n > _data.size() )
+            _data.resize( _pos + n );
+         std::memcpy( _data.data() + _pos, s, n );
+         _pos += n;
+         return n;
+      }
 
+      int_type overflow( int_type c ) override {
+         if( traits_type::eq_int_type( c, traits_type::eof() ) )
+            return traits_type::not_eof( c );
+         char ch = traits_type::to_char_type( c );
+         xsputn( &ch, 1 );
+         return c;
+      }
+
+      pos_type seekoff( off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which ) override {
+         off_type base = dir == std::ios_base::beg ? 0 : dir == std::ios_base::cur ? _pos : _data.size();
+         return seekpos( pos_type( base + off ), which );
+      }
+
+      pos_type seekpos( pos_type pos, std::ios_base::openmode which ) override {
+         if( !(which & std::ios_base::out) || off_type( pos ) < 0 || size_t( off_type( pos ) ) > _data.size() )
+            return pos_type( off_type( -1 ) );
+         _pos = off_type( pos );
+         return pos;
+      }
+
+   private:
+      bytes    _data;
+      size_t   _pos = 0;
 };
 
 struct building_shard {
@@ -165,17 +204,39 @@ struct building_shard {
    database&                                    _shared_db;
    deque<transaction_metadata_ptr>              _pending_trx_metas;
    deque<transaction_receipt>                   _pending_trx_receipts; // boost deque in 1.71 with 1024 elements performs better
-   digests_t                                    _trx_mroot_or_receipt_digests;
+   const bool                                   _shard_mroots; // SHARD_MERKLE_ROOTS is active for the block
+   // merkle roots of the shard, appended on the shard thread as receipts are added
+   incremental_merkle                           _trx_receipt_merkle; // not maintained when the block provides its _trx_mroot
+   incremental_merkle                           _action_receipt_merkle;
+   // before SHARD_MERKLE_ROOTS the block roots are merkles over the receipt digests of all shards
+   digests_t                                    _trx_receipt_digests;
    digests_t                                    _action_receipt_digests;
    deque<xshard_id_type>                        _xsh_ins;
    flat_set<xshard_id_type>                     _xsh_in_set;
    deque<xsh_out_action>                       _xsh_out_actions;
 
-   building_shard(const shard_name& name, database& db, database& shared_db):
-      _name(name), _db(db), _shared_db(shared_db) {}
+   building_shard(const shard_name& name, database& db, database& shared_db, bool shard_mroots):
+      _name(name), _db(db), _shared_db(shared_db), _shard_mroots(shard_mroots) {}
    building_shard(const building_shard&) = delete;
    building_shard() = delete;
    building_shard& operator=(const building_shard&) = delete;
+
+   inline void append_trx_receipt_digest( const digest_type& digest ) {
+      if( _shard_mroots )
+         _trx_receipt_merkle.append( digest );
+      else
+         _trx_receipt_digests.emplace_back( digest );
+   }
+
+   inline void append_action_receipt_digests( digests_t&& digests ) {
+      if( !_shard_mroots ) {
+         fc::move_append( _action_receipt_digests, std::move(digests) );
+         return;
+      }
+      for( const auto& d : digests )
+         _action_receipt_merkle.append( d );
+      digests.clear();
+   }
 };
 
 struct shard_transaction_metadata {
@@ -189,8 +250,24 @@ struct shard_transaction_metadata {
 struct block_shard_context {
    vector<shard_transaction_metadata> trx_metas;
    building_shard             &pending_shard;
+   uint64_t                   cpu_usage_us = 0; // summed from receipts, used to schedule heaviest shards first
+   fc::time_point             posted_time;
+   fc::time_point             start_time;
+   fc::time_point             end_time;
+   fc::microseconds           recovery_wait_time; // time parked waiting on key recovery
+
+   // trx_metas are applied strictly in order, next_trx is only modified by the thread executing the shard
+   size_t                     next_trx = 0;
+   std::mutex                 mtx;
+   bool                       waiting_recovery = false; // protected by mtx, executor parked on recovery of next_trx
+   fc::time_point             waiting_since;
+   std::promise<void>         done;
+
    block_shard_context(building_shard &pending_shard): pending_shard(pending_shard) {}
+   block_shard_context(const block_shard_context&) = delete;
+   block_shard_context& operator=(const block_shard_context&) = delete;
 };
+using block_shard_context_ptr = std::shared_ptr<block_shard_context>;
 
 struct building_block {
    building_block( const block_header_state& prev,
@@ -206,6 +283,8 @@ struct building_block {
    vector<digest_type>                        _new_protocol_feature_activations;
    size_t                                     _num_new_protocol_features_that_have_activated = 0;
    std::optional<checksum256_type>            _trx_mroot;
+   flat_map<shard_name, checksum256_type>     _shard_trx_mroots; // provided along with _trx_mroot
+   bool                                       _shard_mroots = false; // SHARD_MERKLE_ROOTS is active, set by start_block
    std::map<shard_name, building_shard>       _shards;
 
    inline transaction_metadata_map extract_trx_metas() {
@@ -228,11 +307,26 @@ struct building_block {
       return result;
    }
 
+   /// roots of the shards that have transaction receipts in this block
+   inline flat_map<shard_name, checksum256_type> extract_trx_mroots() {
+      if (_trx_mroot) {
+         return std::move(_shard_trx_mroots);
+      }
+      flat_map<shard_name, checksum256_type> result;
+      for (auto& shard : _shards) {
+         if (shard.second._trx_receipt_merkle._node_count > 0) {
+            result.emplace(shard.first, shard.second._trx_receipt_merkle.get_root());
+         }
+      }
+      return result;
+   }
+
+   /// receipt digests of all shards in shard name order, before SHARD_MERKLE_ROOTS
    inline digests_t extract_receipt_digests() {
       digests_t result;
       for (auto& shard : _shards) {
-         if (!shard.second._trx_mroot_or_receipt_digests.empty()) {
-            fc::move_append( result, std::move(shard.second._trx_mroot_or_receipt_digests) );
+         if (!shard.second._trx_receipt_digests.empty()) {
+            fc::move_append( result, std::move(shard.second._trx_receipt_digests) );
          }
       }
       return result;
@@ -248,8 +342,20 @@ struct building_block {
       return result;
    }
 
-   inline void set_trx_mroot(const checksum256_type& value) {
+   /// roots of the shards that have action receipts in this block
+   inline flat_map<shard_name, checksum256_type> extract_action_mroots() {
+      flat_map<shard_name, checksum256_type> result;
+      for (auto& shard : _shards) {
+         if (shard.second._action_receipt_merkle._node_count > 0) {
+            result.emplace(shard.first, shard.second._action_receipt_merkle.get_root());
+         }
+      }
+      return result;
+   }
+
+   inline void set_trx_mroot(const checksum256_type& value, flat_map<shard_name, checksum256_type> shard_trx_mroots) {
       _trx_mroot = value;
+      _shard_trx_mroots = std::move(shard_trx_mroots);
    }
 
 };
@@ -370,6 +476,10 @@ struct controller_impl {
    named_thread_pool<chain>        thread_pool;
    struct shard; // shard is a namespace so use an embedded type for the named_thread_pool tag
    named_thread_pool<shard>        shard_thread_pool;
+   size_t                          shard_thread_pool_size = 0;
+   xshard_queue                    xsh_queue; // main thread only
+   shard_db_catalog                boot_catalog; // shard dbs being opened until startup
+   shard_routing_index             shard_routing;
    deep_mind_handler*              deep_mind_logger = nullptr;
    bool                            okay_to_print_integrity_hash_on_stop = false;
 
@@ -378,9 +488,7 @@ struct controller_impl {
 #if defined(EOSIO_EOS_VM_RUNTIME_ENABLED) || defined(EOSIO_EOS_VM_JIT_RUNTIME_ENABLED)
    thread_local static vm::wasm_allocator wasm_alloc; // a copy for main thread and each read-only thread
 #endif
-   wasm_interface  wasmif;  // used by main thread and all threads for EOSVMOC
-   std::mutex threaded_wasmifs_mtx;
-   std::unordered_map<std::thread::id, std::unique_ptr<wasm_interface>> threaded_wasmifs; // one for each read-only thread, used by eos-vm and eos-vm-jit
+   wasm_interface  wasmif;  // shared by the main thread, shard threads and read-only threads, its instantiation cache is thread safe
    app_window_type app_window = app_window_type::write;
 
    typedef pair<scope_name,action_name>                   handler_key;
@@ -433,7 +541,8 @@ struct controller_impl {
         cfg.state_size, cfg.state_size, false, cfg.db_map_mode ),
     blog( cfg.blocks_dir, cfg.blog ),
     fork_db( cfg.blocks_dir / config::reversible_blocks_dir_name ),
-    resource_limits( dbm, [&s](bool is_trx_transient) { return s.get_deep_mind_logger(is_trx_transient); }),
+    resource_limits( dbm, [&s](bool is_trx_transient) { return s.get_deep_mind_logger(is_trx_transient); },
+                     [&s]() { return s.is_builtin_activated( builtin_protocol_feature_t::shard_resource_accounting ); } ),
     authorization( s, dbm.main_db() ),
     protocol_features( std::move(pfs), [&s](bool is_trx_transient) { return s.get_deep_mind_logger(is_trx_transient); } ),
     conf( cfg ),
@@ -442,7 +551,7 @@ struct controller_impl {
     thread_pool(),
     shard_thread_pool(),
     main_thread_id( std::this_thread::get_id() ),
-    wasmif( conf.wasm_runtime, conf.eosvmoc_tierup, conf.state_dir, conf.eosvmoc_config, !conf.profile_accounts.empty() )
+    wasmif( conf.wasm_runtime, conf.eosvmoc_tierup, conf.state_dir, conf.eosvmoc_config, !conf.profile_accounts.empty(), conf.wasm_cache_max_size )
    {
       fork_db.open( [this]( block_timestamp_type timestamp,
                             const flat_set<digest_type>& cur_features,
@@ -453,17 +562,20 @@ struct controller_impl {
          elog( "Exception in chain thread pool, exiting: ${e}", ("e", e.to_detail_string()) );
          if( shutdown ) shutdown();
       } );
+      dbm.set_thread_pool( &thread_pool.get_executor() );
 
-      // TODO: add cfg.shard_thread_pool_size
-      size_t shard_thread_pool_size = 8;
+      shard_thread_pool_size = resolve_thread_pool_size( cfg.shard_thread_pool_size );
+      thread_affinity shard_affinity( cfg.shard_thread_affinity );
       shard_thread_pool.start( shard_thread_pool_size, [this]( const fc::exception& e ) {
             elog( "Exception in shard thread pool, exiting: ${e}", ("e", e.to_detail_string()) );
             if( shutdown ) shutdown();
          },
          [&]() {
+            shard_affinity.pin_current_thread();
             init_thread_local_data();
          }
       );
+      ilog( "shard thread pool started with ${n} threads", ("n", shard_thread_pool_size) );
 
 
       set_activation_handler<builtin_protocol_feature_t::preactivate_feature>();
@@ -482,9 +594,6 @@ struct controller_impl {
          // producer_plugin has already asserted irreversible_block signal is
          // called in write window
          wasmif.current_lib(bsp->block_num);
-         for (auto& w: threaded_wasmifs) {
-            w.second->current_lib(bsp->block_num);
-         }
       });
 
 
@@ -732,6 +841,7 @@ struct controller_impl {
    void startup(std::function<void()> shutdown, std::function<bool()> check_shutdown, const snapshot_reader_ptr& snapshot) {
       EOS_ASSERT( snapshot, snapshot_exception, "No snapshot reader provided" );
       this->shutdown = shutdown;
+      open_catalog_shard_dbs();
       try {
          snapshot->validate();
          if( auto blog_head = blog.head() ) {
@@ -765,6 +875,7 @@ struct controller_impl {
       );
 
       this->shutdown = shutdown;
+      open_catalog_shard_dbs();
       if( fork_db.head() ) {
          if( read_mode == db_read_mode::IRREVERSIBLE && fork_db.head()->id != fork_db.root()->id ) {
             fork_db.rollback_head_to_root();
@@ -794,6 +905,7 @@ struct controller_impl {
       EOS_ASSERT( fork_db.head(), fork_database_exception, "No existing fork database despite existing chain state. Replay required." );
 
       this->shutdown = shutdown;
+      open_catalog_shard_dbs();
       uint32_t lib_num = fork_db.root()->block_num;
       auto first_block_num = blog.first_block_num();
       if( auto blog_head = blog.head() ) {
@@ -871,6 +983,15 @@ struct controller_impl {
       // TODO: shared_db() instead?
       protocol_features.init( dbm.main_db() );
 
+      // routing hints of the contracts already in state, replayed blocks add to them as they create tables
+      shard_routing.clear();
+      shard_routing.add_shard_db( config::main_shard_name, dbm.main_db() );
+      for( const auto& [name, db] : dbm.shard_dbs() ) {
+         shard_routing.add_shard_db( name, db );
+      }
+
+      preload_hot_codes();
+
       // At startup, no transaction specific logging is possible
       if (auto dm_logger = get_deep_mind_logger(false)) {
          // TODO: shared_db()?
@@ -908,11 +1029,16 @@ struct controller_impl {
 
    ~controller_impl() {
       shard_thread_pool.stop();
-      thread_pool.stop();
       pending.reset();
+      wasm_interface::save_hot_codes( conf.state_dir / config::wasm_hot_codes_filename, wasmif.get_hot_codes() );
+      // flushed while the chain thread pool still runs so the databases are written back concurrently
+      dbm.flush();
       //only log this not just if configured to, but also if initialization made it to the point we'd log the startup too
+      //computed before the chain thread pool stops as sub-shard databases are serialized on it
       if(okay_to_print_integrity_hash_on_stop && conf.integrity_hash_on_stop)
          ilog( "chain database stopped with hash: ${hash}", ("hash", calculate_integrity_hash()) );
+      dbm.set_thread_pool( nullptr );
+      thread_pool.stop();
    }
 
    void init_db() {
@@ -923,13 +1049,55 @@ struct controller_impl {
 
       add_indices_to_shard_db(dbm.main_db());
 
-      auto catalog = shard_db_catalog::load(conf.state_dir);
-      for (const auto& shard : catalog.shards) {
-         add_shard_db(shard);
-         // TODO: validate shard dbs?
+      // the shard dbs are opened and validated in parallel on the chain thread pool while the other plugins
+      // initialize, startup links them in
+      boot_catalog = shard_db_catalog::load(conf.state_dir);
+      for (const auto& info : boot_catalog.shards) {
+         dbm.prepare_shard_db(info.name, std::max(shard_state_size(info.name), info.size), catalog_shard_db_init(info));
       }
+   }
 
-      dbm.enable_saving_catalog(); // TODO: Is it appropriate to call here
+   /// adds the indices of a shard db of the catalog and checks it against its catalog entry
+   database_manager::shard_db_init catalog_shard_db_init(const shard_db_info& info) {
+      return [this, info, allow_dirty{dbm.allow_dirty}](database& db) {
+         add_indices_to_shard_db(db);
+         shard_db_catalog::validate(info, db, allow_dirty);
+      };
+   }
+
+   /// instantiates the codes used most before the last shutdown on the chain thread pool while blocks are replayed
+   /// and applied, a block executing a code still being instantiated waits for it
+   void preload_hot_codes() {
+      if( conf.wasm_preload_budget == 0 )
+         return;
+
+      const auto hot_codes = wasm_interface::load_hot_codes( conf.state_dir / config::wasm_hot_codes_filename );
+      uint64_t bytes = 0;
+      size_t preloading = 0;
+      for( const auto& hc : hot_codes ) {
+         // the code is copied as the shared db is modified by the blocks applied meanwhile
+         const auto* co = dbm.shared_db().find<code_object, by_code_hash>( boost::make_tuple( hc.code_hash, hc.vm_type, hc.vm_version ) );
+         if( !co )
+            continue;
+         if( bytes + co->code.size() > conf.wasm_preload_budget )
+            break;
+         bytes += co->code.size();
+         ++preloading;
+         wasmif.preload_async( thread_pool.get_executor(), hc,
+                               std::make_shared<std::vector<char>>( co->code.data(), co->code.data() + co->code.size() ) );
+      }
+      ilog( "preloading ${n} of ${t} codes used before shutdown, ${b} bytes of wasm",
+            ("n", preloading)("t", hot_codes.size())("b", bytes) );
+   }
+
+   /// links in the shard dbs of the catalog, opening those which could not be prepared
+   void open_catalog_shard_dbs() {
+      for (const auto& info : boot_catalog.shards) {
+         dbm.add_shard_db(info.name, std::max(shard_state_size(info.name), info.size), catalog_shard_db_init(info));
+      }
+      boot_catalog.shards.clear();
+      // only written once every shard db of the catalog is open, so an early shutdown keeps the catalog as it was
+      dbm.enable_saving_catalog();
    }
 
    // TODO: rename to init_db?
@@ -946,15 +1114,30 @@ struct controller_impl {
       resource_limits_manager::add_indices(db);
    }
 
+   uint64_t shard_state_size(const shard_name& name) const {
+      auto itr = conf.shard_state_sizes.find(name);
+      return itr != conf.shard_state_sizes.end() ? itr->second : conf.shard_state_size;
+   }
+
    void add_shard_db(const shard_name& name) {
-      // TODO: conf.shard_state_size
-      auto db_ptr = dbm.find_shard_db(name);
-      if (!db_ptr) {
-         db_ptr = dbm.add_shard_db(name, conf.state_size);
-         add_indices_to_shard_db(*db_ptr);
+      if (!dbm.find_shard_db(name)) {
+         dbm.add_shard_db(name, shard_state_size(name), [this](database& db) { add_indices_to_shard_db(db); });
+      }
+   }
+
+   /// opens the db of a shard registered in a reversible block on the chain thread pool, see add_shard_db()
+   void prepare_shard_db(const shard_name& name) {
+      if (!dbm.find_shard_db(name)) {
+         dbm.prepare_shard_db(name, shard_state_size(name), [this](database& db) { add_indices_to_shard_db(db); });
       }
    }
 
+   /// unmaps the dbs prepared for shards whose registration was undone by a fork switch
+   void drop_unregistered_shard_dbs() {
+      const auto& idx = dbm.main_db().get_index<shard_change_index, by_name>();
+      dbm.drop_prepared_shard_dbs([&](const shard_name& name) { return idx.find(name) != idx.end(); });
+   }
+
    inline building_shard& init_building_shard(const shard_name& name) {
       // must run in main thread
       auto& bb = std::get<building_block>(pending->_block_stage);
@@ -963,10 +1146,12 @@ struct controller_impl {
          check_shard_available( name );
          auto db_ptr = dbm.find_shard_db(name);
          EOS_ASSERT( db_ptr, unavailable_shard_exception, "shard db not found" );
+         // sub-shard dbs only get undo state in the blocks that write to them
+         dbm.start_shard_undo_session( name );
          auto& shared_db = (name == config::main_shard_name) ? dbm.main_db() : dbm.shared_db();
          auto new_ret = bb._shards.emplace( std::piecewise_construct,
                                         std::forward_as_tuple( name ),
-                                        std::forward_as_tuple( name, *db_ptr, shared_db ) );
+                                        std::forward_as_tuple( name, *db_ptr, shared_db, bb._shard_mroots ) );
          itr = new_ret.first;
       }
       return itr->second;
@@ -998,7 +1183,7 @@ struct controller_impl {
                   */
    }
 
-   void add_contract_tables_to_snapshot( database& db, const snapshot_writer_ptr& snapshot ) const {
+   void add_contract_tables_to_snapshot( const database& db, const snapshot_writer_ptr& snapshot ) const {
       // TODO: support shared_table_id_multi_index
       snapshot->write_section("contract_tables", [&db]( auto& section ) {
          index_utils<table_id_multi_index>::walk(db, [&db, &section]( const table_id_object& table_row ){
@@ -1055,20 +1240,8 @@ struct controller_impl {
       });
    }
 
-   void add_to_snapshot( const snapshot_writer_ptr& snapshot ) {
-      // clear in case the previous call to clear did not finish in time of deadline
-      clear_expired_input_transactions( fc::time_point::maximum() );
-      // TODO: write shared_db and every shard db to snapshot
-
-      auto& db = dbm.main_db();
-      snapshot->write_section<chain_snapshot_header>([&db]( auto &section ){
-         section.add_row(chain_snapshot_header(), db);
-      });
-
-      snapshot->write_section<block_state>([&db, this]( auto &section ){
-         section.template add_row<block_header_state>(*head, db);
-      });
-
+   /// sections of one shard database, used for the main database and for each sub-shard database stream
+   void add_database_to_snapshot( const database& db, const snapshot_writer_ptr& snapshot ) const {
       controller_index_set::walk_indices([&db, &snapshot]( auto utils ){
          using value_t = typename decltype(utils)::index_t::value_type;
 
@@ -1091,9 +1264,69 @@ struct controller_impl {
 
       add_contract_tables_to_snapshot(db, snapshot);
 
-      // TODO: shared_db and sub shard db
-      authorization.add_to_snapshot(snapshot);
-      resource_limits.add_to_snapshot(snapshot);
+      authorization_manager::add_to_snapshot(db, snapshot);
+      resource_limits_manager::add_to_snapshot(db, snapshot);
+   }
+
+   void add_to_snapshot( const snapshot_writer_ptr& snapshot ) {
+      // clear in case the previous call to clear did not finish in time of deadline
+      clear_expired_input_transactions( fc::time_point::maximum() );
+
+      // every sub-shard database is serialized into its own stream on the chain thread pool while the
+      // main database is written on this thread
+      std::vector<std::pair<db_name, std::future<std::pair<bytes, fc::sha256>>>> shard_streams;
+      for( auto& shard_db : dbm.shard_dbs() ) {
+         shard_streams.emplace_back( shard_db.first, post_async_task( thread_pool.get_executor(), [this, &db = shard_db.second]() {
+            bytes_streambuf buf;
+            std::ostream out( &buf );
+            auto writer = std::make_shared<ostream_snapshot_writer>( out );
+            add_database_to_snapshot( db, writer );
+            writer->finalize();
+            EOS_ASSERT( out, snapshot_exception, "Failed to serialize shard database" );
+            auto digest = fc::sha256::hash( buf.data().data(), buf.data().size() );
+            return std::make_pair( std::move( buf.data() ), digest );
+         } ) );
+      }
+
+      std::exception_ptr except;
+      try {
+         auto& db = dbm.main_db();
+         snapshot->write_section<chain_snapshot_header>([&db]( auto &section ){
+            section.add_row(chain_snapshot_header(), db);
+         });
+
+         snapshot->write_section<block_state>([&db, this]( auto &section ){
+            section.template add_row<block_header_state>(*head, db);
+         });
+
+         add_database_to_snapshot(db, snapshot);
+      } catch( ... ) {
+         except = std::current_exception();
+      }
+
+      // the tasks refer to the shard databases, wait for all of them before rethrowing
+      shard_db_snapshot_manifest manifest;
+      std::vector<bytes> streams;
+      for( auto& s : shard_streams ) {
+         try {
+            auto stream = s.second.get();
+            manifest.shard_dbs.push_back( { s.first, stream.first.size(), stream.second } );
+            streams.emplace_back( std::move(stream.first) );
+         } catch( ... ) {
+            if( !except )
+               except = std::current_exception();
+         }
+      }
+      if( except )
+         std::rethrow_exception( except );
+
+      snapshot->write_section("shard_databases", [&]( auto& section ) {
+         auto& db = dbm.main_db();
+         section.add_row(manifest, db);
+         for( const auto& stream : streams ) {
+            section.add_row(stream, db);
+         }
+      });
    }
 
    static std::optional<genesis_state> extract_legacy_genesis_state( snapshot_reader& snapshot, uint32_t version ) {
@@ -1109,44 +1342,8 @@ struct controller_impl {
       return genesis;
    }
 
-   void read_from_snapshot( const snapshot_reader_ptr& snapshot, uint32_t blog_start, uint32_t blog_end ) {
-      // TODO: global_db and sub shard db
-      auto& db = dbm.main_db();
-      chain_snapshot_header header;
-      snapshot->read_section<chain_snapshot_header>([&db, &header]( auto &section ){
-         section.read_row(header, db);
-         header.validate();
-      });
-
-      { /// load and upgrade the block header state
-         block_header_state head_header_state;
-         using v2 = legacy::snapshot_block_header_state_v2;
-
-         if (std::clamp(header.version, v2::minimum_version, v2::maximum_version) == header.version ) {
-            snapshot->read_section<block_state>([&db, &head_header_state]( auto &section ) {
-               legacy::snapshot_block_header_state_v2 legacy_header_state;
-               section.read_row(legacy_header_state, db);
-               head_header_state = block_header_state(std::move(legacy_header_state));
-            });
-         } else {
-            snapshot->read_section<block_state>([&db,&head_header_state]( auto &section ){
-               section.read_row(head_header_state, db);
-            });
-         }
-
-         snapshot_head_block = head_header_state.block_num;
-         EOS_ASSERT( blog_start <= (snapshot_head_block + 1) && snapshot_head_block <= blog_end,
-                     block_log_exception,
-                     "Block log is provided with snapshot but does not contain the head block from the snapshot nor a block right after it",
-                     ("snapshot_head_block", snapshot_head_block)
-                     ("block_log_first_num", blog_start)
-                     ("block_log_last_num", blog_end)
-         );
-
-         head = std::make_shared<block_state>();
-         static_cast<block_header_state&>(*head) = head_header_state;
-      }
-
+   /// counterpart of add_database_to_snapshot
+   void read_database_from_snapshot( database& db, const snapshot_reader_ptr& snapshot, const chain_snapshot_header& header ) {
       controller_index_set::walk_indices([&db, &snapshot, &header]( auto utils ){
          using value_t = typename decltype(utils)::index_t::value_type;
 
@@ -1221,8 +1418,91 @@ struct controller_impl {
 
       read_contract_tables_from_snapshot(db, snapshot);
 
-      authorization.read_from_snapshot(snapshot);
-      resource_limits.read_from_snapshot(snapshot);
+      authorization_manager::read_from_snapshot(db, snapshot);
+      resource_limits_manager::read_from_snapshot(db, snapshot, header);
+   }
+
+   void read_from_snapshot( const snapshot_reader_ptr& snapshot, uint32_t blog_start, uint32_t blog_end ) {
+      auto& db = dbm.main_db();
+      chain_snapshot_header header;
+      snapshot->read_section<chain_snapshot_header>([&db, &header]( auto &section ){
+         section.read_row(header, db);
+         header.validate();
+      });
+
+      { /// load and upgrade the block header state
+         block_header_state head_header_state;
+         using v2 = legacy::snapshot_block_header_state_v2;
+
+         if (std::clamp(header.version, v2::minimum_version, v2::maximum_version) == header.version ) {
+            snapshot->read_section<block_state>([&db, &head_header_state]( auto &section ) {
+               legacy::snapshot_block_header_state_v2 legacy_header_state;
+               section.read_row(legacy_header_state, db);
+               head_header_state = block_header_state(std::move(legacy_header_state));
+            });
+         } else {
+            snapshot->read_section<block_state>([&db,&head_header_state]( auto &section ){
+               section.read_row(head_header_state, db);
+            });
+         }
+
+         snapshot_head_block = head_header_state.block_num;
+         EOS_ASSERT( blog_start <= (snapshot_head_block + 1) && snapshot_head_block <= blog_end,
+                     block_log_exception,
+                     "Block log is provided with snapshot but does not contain the head block from the snapshot nor a block right after it",
+                     ("snapshot_head_block", snapshot_head_block)
+                     ("block_log_first_num", blog_start)
+                     ("block_log_last_num", blog_end)
+         );
+
+         head = std::make_shared<block_state>();
+         static_cast<block_header_state&>(*head) = head_header_state;
+      }
+
+      // sub-shard databases are loaded on the chain thread pool while the main database is loaded on this thread
+      std::vector<std::future<void>> shard_loads;
+      std::exception_ptr except;
+      try {
+         if( header.version >= chain_snapshot_header::first_sharded_version ) {
+            snapshot->read_section("shard_databases", [&]( auto& section ) {
+               shard_db_snapshot_manifest manifest;
+               bool more = section.read_row(manifest, db);
+               for( const auto& entry : manifest.shard_dbs ) {
+                  EOS_ASSERT( more, snapshot_exception, "Snapshot is missing the stream of shard database ${n}", ("n", entry.name) );
+                  auto stream = std::make_shared<bytes>();
+                  more = section.read_row(*stream, db);
+                  EOS_ASSERT( stream->size() == entry.size && fc::sha256::hash( stream->data(), stream->size() ) == entry.digest,
+                              snapshot_exception, "Snapshot stream of shard database ${n} is corrupted", ("n", entry.name) );
+
+                  add_shard_db( entry.name );
+                  auto* shard_db = dbm.find_shard_db( entry.name );
+                  shard_loads.emplace_back( post_async_task( thread_pool.get_executor(), [this, shard_db, stream, &header]() {
+                     // read in place from the row, the stream is not copied again
+                     boost::iostreams::stream<boost::iostreams::array_source> in( stream->data(), stream->size() );
+                     auto reader = std::make_shared<istream_snapshot_reader>( in );
+                     reader->validate();
+                     read_database_from_snapshot( *shard_db, reader, header );
+                     shard_db->set_revision( head->block_num );
+                  } ) );
+               }
+            });
+         }
+
+         read_database_from_snapshot(db, snapshot, header);
+      } catch( ... ) {
+         except = std::current_exception();
+      }
+      // the tasks refer to the header and the shard databases, wait for all of them before rethrowing
+      for( auto& fut : shard_loads ) {
+         try {
+            fut.get();
+         } catch( ... ) {
+            if( !except )
+               except = std::current_exception();
+         }
+      }
+      if( except )
+         std::rethrow_exception( except );
 
       db.set_revision( head->block_num );
       db.create<database_header_object>([](const auto& header){
@@ -1234,6 +1514,12 @@ struct controller_impl {
                   "chain ID in snapshot (${snapshot_chain_id}) does not match the chain ID that controller was constructed with (${controller_chain_id})",
                   ("snapshot_chain_id", gpo.chain_id)("controller_chain_id", chain_id)
       );
+
+      // the shared database only replicates indices of the main database
+      shared_index_set::copy_data(dbm.main_db(), dbm.shared_db());
+      contract_shared_database_index_set::copy_data(dbm.main_db(), dbm.shared_db());
+      resource_limits_manager::copy_data(dbm.main_db(), dbm.shared_db());
+      dbm.shared_db().set_revision( head->block_num );
    }
 
    sha256 calculate_integrity_hash() {
@@ -1359,13 +1645,18 @@ struct controller_impl {
       auto& bb = std::get<building_block>(pending->_block_stage);
       auto orig_trx_receipts_size           = shard._pending_trx_receipts.size();
       auto orig_trx_metas_size              = shard._pending_trx_metas.size();
-      auto orig_trx_receipt_digests_size    = !bb._trx_mroot ? shard._trx_mroot_or_receipt_digests.size() : 0;
+      // the merkles only hold O(log n) active nodes, so they are restored by copy
+      auto orig_trx_receipt_merkle          = !bb._trx_mroot ? shard._trx_receipt_merkle : incremental_merkle();
+      auto orig_action_receipt_merkle       = shard._action_receipt_merkle;
+      auto orig_trx_receipt_digests_size    = shard._trx_receipt_digests.size();
       auto orig_action_receipt_digests_size = shard._action_receipt_digests.size();
       auto orig_recv_msgs_size = shard._xsh_ins.size();
       auto orig_posted_msgs_size = shard._xsh_out_actions.size();
       std::function<void()> callback = [this, &shard,
             orig_trx_receipts_size,
             orig_trx_metas_size,
+            orig_trx_receipt_merkle{std::move(orig_trx_receipt_merkle)},
+            orig_action_receipt_merkle{std::move(orig_action_receipt_merkle)},
             orig_trx_receipt_digests_size,
             orig_action_receipt_digests_size,
             orig_recv_msgs_size,
@@ -1375,7 +1666,9 @@ struct controller_impl {
          shard._pending_trx_receipts.resize(orig_trx_receipts_size);
          shard._pending_trx_metas.resize(orig_trx_metas_size);
          if( !bb._trx_mroot )
-            shard._trx_mroot_or_receipt_digests.resize(orig_trx_receipt_digests_size);
+            shard._trx_receipt_merkle = orig_trx_receipt_merkle;
+         shard._action_receipt_merkle = orig_action_receipt_merkle;
+         shard._trx_receipt_digests.resize(orig_trx_receipt_digests_size);
          shard._action_receipt_digests.resize(orig_action_receipt_digests_size);
          for(size_t i = shard._xsh_ins.size() - 1; i > orig_recv_msgs_size - 1; i-- ) {
             shard._xsh_in_set.erase(shard._xsh_ins[i]);
@@ -1444,8 +1737,7 @@ struct controller_impl {
          auto restore = make_block_restore_point(shard);
          trace->receipt = push_receipt( shard, gtrx.trx_id, transaction_receipt::soft_fail,
                                         trx_context.billed_cpu_time_us, trace->net_usage );
-         fc::move_append( shard._action_receipt_digests,
-                          std::move(trx_context.executed_action_receipt_digests) );
+         shard.append_action_receipt_digests( std::move(trx_context.executed_action_receipt_digests) );
 
          trx_context.squash();
          restore.cancel();
@@ -1649,8 +1941,7 @@ struct controller_impl {
                                         trx_context.billed_cpu_time_us,
                                         trace->net_usage );
 
-         fc::move_append( shard._action_receipt_digests,
-                          std::move(trx_context.executed_action_receipt_digests) );
+         shard.append_action_receipt_digests( std::move(trx_context.executed_action_receipt_digests) );
 
          if (gtrx.is_xshard) {
             shard._xsh_in_set.insert(xsh_id);
@@ -1785,7 +2076,7 @@ struct controller_impl {
       r.net_usage_words      = net_usage_words;
       r.status               = status;
       if (!bb._trx_mroot)
-         shard._trx_mroot_or_receipt_digests.emplace_back( r.digest() );
+         shard.append_trx_receipt_digest( r.digest() );
 
       return r;
    }
@@ -1937,8 +2228,7 @@ struct controller_impl {
             }
 
             if ( !trx->is_read_only() ) {
-               fc::move_append( shard._action_receipt_digests,
-                                std::move(trx_context.executed_action_receipt_digests) );
+               shard.append_action_receipt_digests( std::move(trx_context.executed_action_receipt_digests) );
 
                if (!xsh_ins.empty()) {
                   for (const auto& xsh_in : xsh_ins) {
@@ -2052,6 +2342,7 @@ struct controller_impl {
       auto& bb = std::get<building_block>(pending->_block_stage);
       const auto& pbhs = bb._pending_block_header_state;
       auto& main_db = dbm.main_db(); // TODO: shared_db?
+      bb._shard_mroots = self.is_builtin_activated( builtin_protocol_feature_t::shard_merkle_roots );
 
       // block status is either ephemeral or incomplete. Modify state of speculative block only if we are building a
       // speculative incomplete block (otherwise we need clean state for head mode, ephemeral block)
@@ -2110,6 +2401,7 @@ struct controller_impl {
          EOS_ASSERT( handled_all_preactivated_features, block_validate_exception,
                      "There are pre-activated protocol features that were not activated at the start of this block"
          );
+         bb._shard_mroots = self.is_builtin_activated( builtin_protocol_feature_t::shard_merkle_roots );
 
          if( new_protocol_feature_activations.size() > 0 ) {
             main_db.modify( pso, [&]( auto& ps ) {
@@ -2197,61 +2489,61 @@ struct controller_impl {
 
       auto& bb = std::get<building_block>(pending->_block_stage);
 
-      auto action_merkle_fut = post_async_task( thread_pool.get_executor(),
-                                                [ids{bb.extract_action_receipt_digests()}]() mutable {
-                                                   return merkle( std::move( ids ) );
-                                                } );
-
-      std::future<checksum256_type> trx_merkle_fut;
-      if( !bb._trx_mroot ) {
-         trx_merkle_fut = post_async_task( thread_pool.get_executor(),
-                                           [ids{bb.extract_receipt_digests()}]() mutable {
-                                              return merkle( std::move( ids ) );
-                                           } );
+      // shard roots were maintained on the shard threads as receipts were appended, only the top level is left
+      flat_map<shard_name, checksum256_type> shard_trx_mroots;
+      checksum256_type trx_mroot;
+      checksum256_type action_mroot;
+      if( bb._shard_mroots ) {
+         shard_trx_mroots = bb.extract_trx_mroots();
+         trx_mroot = bb._trx_mroot ? *bb._trx_mroot : merkle( shard_trx_mroots );
+         action_mroot = merkle( bb.extract_action_mroots() );
+      } else {
+         trx_mroot = bb._trx_mroot ? *bb._trx_mroot : merkle( bb.extract_receipt_digests() );
+         action_mroot = merkle( bb.extract_action_receipt_digests() );
       }
 
-      // process xshard
+      // process xshard, messages are queued per source shard and delivered batched per target shard
+      const auto& gpo = dbm.main_db().get<global_property_object>();
+      const bool xshin_on_target_shard = self.is_builtin_activated( builtin_protocol_feature_t::xshard_target_shard );
       for (auto& shard : bb._shards) {
-         // xshout
-         const auto& shard_name = shard.first;
-         for (const auto& act : shard.second._xsh_out_actions) {
-            const auto& xsh_out = act.xsh_out;
-            // TODO: generate in trx exection
-
-            const auto& new_xsh = dbm.main_db().create<xshard_object>( [&]( auto& xsh ) {
-
-               xsh.xsh_id              = act.xsh_id;
-               xsh.owner               = xsh_out.owner;
-               xsh.from_shard          = shard.second._name;
-               xsh.to_shard            = xsh_out.to_shard;
-               xsh.contract            = xsh_out.contract;
-               xsh.action_type         = xsh_out.action_type;
-               xsh.action_data.assign(xsh_out.action_data.data(), xsh_out.action_data.size());
-               xsh.scheduled_xshin_trx = act.scheduled_xshin_trx_id;
-            } );
-
-            const auto& gpo = dbm.main_db().get<global_property_object>();
-            dbm.main_db().create<generated_transaction_object>( [&]( auto& gtx ) {
-               gtx.trx_id      = act.scheduled_xshin_trx_id;
-               gtx.sender      = xsh_out.owner;
-               gtx.sender_id   = new_xsh.get_sender_id();
-               gtx.payer       = name();
-               gtx.published   = bb._pending_block_header_state.timestamp;
-               gtx.delay_until = gtx.published + fc::milliseconds(config::block_interval_ms);
-               gtx.expiration  = gtx.delay_until + fc::seconds(gpo.configuration.deferred_trx_expiration_window);
-
-               gtx.packed_trx.assign(act.scheduled_xshin_trx_packed.data(), act.scheduled_xshin_trx_packed.size());
-               gtx.shard_name = shard_name;
-               gtx.is_xshard = true;
-
-               // TODO: on_send_xshard
-               // if (auto dm_logger = get_deep_mind_logger(trx_context.is_transient())) {
-               //    dm_logger->on_send_deferred(deep_mind_handler::operation_qualifier::none, gtx);
-               //    dm_logger->on_ram_trace(RAM_EVENT_ID("${id}", ("id", gtx.id)), "deferred_trx", "add", "deferred_trx_add");
-               // }
-            } );
-         }
+         xsh_queue.post(shard.first, std::move(shard.second._xsh_out_actions));
+      }
+      xsh_queue.deliver( [&]( const shard_name& from_shard, const xsh_out_action& act ) {
+         const auto& xsh_out = act.xsh_out;
+         const auto& new_xsh = dbm.main_db().create<xshard_object>( [&]( auto& xsh ) {
+            xsh.xsh_id              = act.xsh_id;
+            xsh.owner               = xsh_out.owner;
+            xsh.from_shard          = from_shard;
+            xsh.to_shard            = xsh_out.to_shard;
+            xsh.contract            = xsh_out.contract;
+            xsh.action_type         = xsh_out.action_type;
+            xsh.action_data.assign(xsh_out.action_data.data(), xsh_out.action_data.size());
+            xsh.scheduled_xshin_trx = act.scheduled_xshin_trx_id;
+         } );
+
+         dbm.main_db().create<generated_transaction_object>( [&]( auto& gtx ) {
+            gtx.trx_id      = act.scheduled_xshin_trx_id;
+            gtx.sender      = xsh_out.owner;
+            gtx.sender_id   = new_xsh.get_sender_id();
+            gtx.payer       = name();
+            gtx.published   = bb._pending_block_header_state.timestamp;
+            gtx.delay_until = gtx.published + fc::milliseconds(config::block_interval_ms);
+            gtx.expiration  = gtx.delay_until + fc::seconds(gpo.configuration.deferred_trx_expiration_window);
+
+            gtx.packed_trx.assign(act.scheduled_xshin_trx_packed.data(), act.scheduled_xshin_trx_packed.size());
+            // the xshin is executed by the target shard, producers schedule it on that shard
+            gtx.shard_name = xshin_on_target_shard ? xsh_out.to_shard : from_shard;
+            gtx.is_xshard = true;
+
+            // TODO: on_send_xshard
+            // if (auto dm_logger = get_deep_mind_logger(trx_context.is_transient())) {
+            //    dm_logger->on_send_deferred(deep_mind_handler::operation_qualifier::none, gtx);
+            //    dm_logger->on_ram_trace(RAM_EVENT_ID("${id}", ("id", gtx.id)), "deferred_trx", "add", "deferred_trx_add");
+            // }
+         } );
+      } );
 
+      for (auto& shard : bb._shards) {
          // xshin
          for (const auto& xsh_id : shard.second._xsh_ins) {
             const auto *xsh = dbm.main_db().find<xshard_object, by_xshard_id>(xsh_id);
@@ -2260,6 +2552,8 @@ struct controller_impl {
 
             const auto *gto = dbm.main_db().find<generated_transaction_object, by_trx_id>(xsh->scheduled_xshin_trx);
             if (gto) {
+               xsh_queue.record_delivery( xsh->from_shard, xsh->to_shard,
+                                          pbhs.timestamp.slot - block_timestamp_type(gto->published).slot );
                if (auto dm_logger = get_deep_mind_logger(false)) {
                   dm_logger->on_ram_trace(RAM_EVENT_ID("${id}", ("id", gto->id)), "scheduled_xshard_trx", "remove", "scheduledxshard_trx_removed");
                }
@@ -2271,7 +2565,6 @@ struct controller_impl {
          }
       }
 
-
       // Update resource limits:
       resource_limits.process_account_limit_updates();
       const auto& chain_config = self.get_global_properties().configuration;
@@ -2305,15 +2598,22 @@ struct controller_impl {
          }
          dbm.main_db().remove( *itr );
       }
+      // shards still waiting for irreversibility get their db opened ahead, so adding it above only links it in
+      for( const auto& change : sc_indx ) {
+         if( dbm.main_db().find<shard_object, by_name>( change.name ) == nullptr )
+            prepare_shard_db( change.name );
+      }
+      drop_unregistered_shard_dbs();
       sync_shared_db();
 
       // Create (unsigned) block:
       auto block_ptr = std::make_shared<signed_block>( pbhs.make_block_header(
-         bb._trx_mroot ? *bb._trx_mroot : trx_merkle_fut.get(),
-         action_merkle_fut.get(),
+         trx_mroot,
+         action_mroot,
          bb._new_pending_producer_schedule,
          std::move( bb._new_protocol_feature_activations ),
-         protocol_features.get_protocol_feature_set()
+         protocol_features.get_protocol_feature_set(),
+         std::move( shard_trx_mroots )
       ) );
 
       block_ptr->transactions = bb.extract_trx_receipt_map();
@@ -2471,6 +2771,95 @@ struct controller_impl {
    }
 
 
+   // Recover keys of trx trx_index of a block shard on thread_pool. If the shard executor is parked waiting on exactly
+   // this trx, it is resumed on the shard thread pool once the keys are available.
+   recover_keys_future start_block_shard_recover_keys( const block_shard_context_ptr& shard_context, size_t trx_index,
+                                                       packed_transaction_ptr ptrx, const block_state_ptr& bsp ) {
+      auto recovered = std::make_shared<std::promise<transaction_metadata_ptr>>();
+      auto fut = recovered->get_future();
+      boost::asio::post( thread_pool.get_executor(), [this, recovered, shard_context, trx_index, ptrx{std::move(ptrx)}, bsp]() mutable {
+         try {
+            recovered->set_value( transaction_metadata::recover_keys( std::move( ptrx ), chain_id, fc::microseconds::maximum(),
+                                                                      transaction_metadata::trx_type::input ) );
+         } catch( ... ) {
+            recovered->set_exception( std::current_exception() );
+         }
+
+         std::unique_lock g( shard_context->mtx );
+         if( shard_context->waiting_recovery && shard_context->next_trx == trx_index ) {
+            shard_context->waiting_recovery = false;
+            shard_context->recovery_wait_time += fc::time_point::now() - shard_context->waiting_since;
+            g.unlock();
+            boost::asio::post( shard_thread_pool.get_executor(), [this, shard_context, bsp]() {
+               execute_block_shard( shard_context, bsp );
+            });
+         }
+      });
+      return fut;
+   }
+
+   // Apply the trxs of a block shard in order on a shard thread. Rather than blocking the thread when the keys of the
+   // next trx are still being recovered, the shard is parked and start_block_shard_recover_keys() resumes it, leaving
+   // the thread free for other shards. Completion or failure is reported through shard_context->done.
+   void execute_block_shard( const block_shard_context_ptr& shard_context, const block_state_ptr& bsp ) {
+      try {
+         if( shard_context->start_time == fc::time_point() )
+            shard_context->start_time = fc::time_point::now();
+         auto& pending_receipts = shard_context->pending_shard._pending_trx_receipts;
+         auto& trx_metas = shard_context->trx_metas;
+         for( ; shard_context->next_trx < trx_metas.size(); ++shard_context->next_trx ) {
+            auto& shard_trx = trx_metas[shard_context->next_trx];
+            const auto& receipt = *shard_trx.trx_receipt;
+            transaction_trace_ptr trace;
+            auto num_pending_receipts = pending_receipts.size();
+            if( std::holds_alternative<packed_transaction>(receipt.trx) ) {
+               if( !shard_trx.trx_meta ) {
+                  if( shard_trx.trx_meta_future.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready ) {
+                     std::lock_guard g( shard_context->mtx );
+                     // check again under the lock, recovery completes the future before taking the lock
+                     if( shard_trx.trx_meta_future.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready ) {
+                        shard_context->waiting_recovery = true;
+                        shard_context->waiting_since = fc::time_point::now();
+                        return;
+                     }
+                  }
+                  shard_trx.trx_meta = shard_trx.trx_meta_future.get();
+               }
+               trace = push_transaction( shard_context->pending_shard, shard_trx.trx_meta, fc::time_point::maximum(), fc::microseconds::maximum(), receipt.cpu_usage_us, true, 0 );
+            } else if( std::holds_alternative<transaction_id_type>(receipt.trx) ) {
+               trace = push_scheduled_transaction( shard_context->pending_shard, std::get<transaction_id_type>(receipt.trx), fc::time_point::maximum(), fc::microseconds::maximum(), receipt.cpu_usage_us, true );
+            } else {
+               EOS_ASSERT( false, block_validate_exception, "encountered unexpected receipt type" );
+            }
+
+            bool transaction_failed =  trace && trace->except;
+            bool transaction_can_fail = receipt.status == transaction_receipt_header::hard_fail && std::holds_alternative<transaction_id_type>(receipt.trx);
+            if( transaction_failed && !transaction_can_fail) {
+               edump((*trace));
+               throw *trace->except;
+            }
+
+            EOS_ASSERT( pending_receipts.size() > 0,
+                        block_validate_exception, "expected a receipt, block_num ${bn}, block_id ${id}, receipt ${e}",
+                        ("bn", bsp->block_num)("id", bsp->id)("e", receipt)
+                     );
+            EOS_ASSERT( pending_receipts.size() == num_pending_receipts + 1,
+                        block_validate_exception, "expected receipt was not added, block_num ${bn}, block_id ${id}, receipt ${e}",
+                        ("bn", bsp->block_num)("id", bsp->id)("e", receipt)
+                     );
+            const transaction_receipt_header& r = pending_receipts.back();
+            EOS_ASSERT( r == static_cast<const transaction_receipt_header&>(receipt),
+                        block_validate_exception, "receipt does not match, ${lhs} != ${rhs}",
+                        ("lhs", r)("rhs", static_cast<const transaction_receipt_header&>(receipt)) );
+         }
+         shard_context->end_time = fc::time_point::now();
+         shard_context->done.set_value();
+      } catch( ... ) {
+         shard_context->end_time = fc::time_point::now();
+         shard_context->done.set_exception( std::current_exception() );
+      }
+   }
+
    void apply_block( controller::block_report& br, const block_state_ptr& bsp, controller::block_status s,
                      const trx_meta_cache_lookup& trx_lookup )
    { try {
@@ -2483,7 +2872,7 @@ struct controller_impl {
          start_block( b->timestamp, b->confirmed, new_protocol_feature_activations, s, producer_block_id, fc::time_point::maximum() );
 
          // validated in create_block_state_future()
-         std::get<building_block>(pending->_block_stage).set_trx_mroot( b->transaction_mroot );
+         std::get<building_block>(pending->_block_stage).set_trx_mroot( b->transaction_mroot, get_shard_trx_mroots( bsp->header_exts ) );
 
          const auto& bsp_cache_map = bsp->trxs_metas();
          const bool existing_trxs_metas = !bsp_cache_map.empty();
@@ -2493,7 +2882,7 @@ struct controller_impl {
          bool use_bsp_cached = pub_keys_recovered || (skip_auth_checks && existing_trxs_metas);
 
          // TODO: set max size of shard num?
-         std::vector<block_shard_context> shard_contexts;
+         std::vector<block_shard_context_ptr> shard_contexts;
          shard_contexts.reserve(b->transactions.size());
          for (const auto& trx_receipts_pair :  b->transactions) {
             const auto& shard_name = trx_receipts_pair.first;
@@ -2502,7 +2891,8 @@ struct controller_impl {
 
             auto& pending_shard = init_building_shard(shard_name);
 
-            auto& shard_context = shard_contexts.emplace_back(pending_shard);
+            const auto& shard_context_ptr = shard_contexts.emplace_back(std::make_shared<block_shard_context>(pending_shard));
+            auto& shard_context = *shard_context_ptr;
             auto cache_map_itr = bsp_cache_map.end();
             if( use_bsp_cached ) {
                cache_map_itr = bsp_cache_map.find(shard_name);
@@ -2518,6 +2908,7 @@ struct controller_impl {
                const auto& bsp_caches = cache_map_itr->second;
                auto trx_receipt = transaction_receipt_ptr( b, &receipt ); // alias signed_block_ptr
                auto& shard_trx = shard_context.trx_metas.emplace_back(std::move(trx_receipt));
+               shard_context.cpu_usage_us += receipt.cpu_usage_us;
 
                // TODO: delayed transaction can only run in main shard
                if( std::holds_alternative<packed_transaction>(receipt.trx)) {
@@ -2534,8 +2925,7 @@ struct controller_impl {
                         shard_trx.trx_meta = transaction_metadata::create_no_recover_keys( std::move(ptrx), transaction_metadata::trx_type::input );
                      } else {
                         packed_transaction_ptr ptrx( b, &pt ); // alias signed_block_ptr
-                        shard_trx.trx_meta_future = transaction_metadata::start_recover_keys(
-                              std::move( ptrx ), thread_pool.get_executor(), chain_id, microseconds::maximum(), transaction_metadata::trx_type::input  );
+                        shard_trx.trx_meta_future = start_block_shard_recover_keys( shard_context_ptr, i, std::move( ptrx ), bsp );
                      }
                   }
                } else if( std::holds_alternative<transaction_id_type>(receipt.trx) ) {
@@ -2546,56 +2936,56 @@ struct controller_impl {
             }
          }
 
-         std::vector<std::future<bool>> trx_futures;
-
-         for (auto& shard_context : shard_contexts) {
-            // TODO: how to set shard thread pool size??
-            trx_futures.emplace_back(post_async_task( shard_thread_pool.get_executor(), [&shard_context, &bsp, this]() {
-               auto& pending_receipts = shard_context.pending_shard._pending_trx_receipts;
-               for( auto& shard_trx : shard_context.trx_metas ) {
-                  const auto& receipt = *shard_trx.trx_receipt;
-                  transaction_trace_ptr trace;
-                  auto num_pending_receipts = pending_receipts.size();
-                  if( std::holds_alternative<packed_transaction>(receipt.trx) ) {
-                     const auto& trx_meta = ( bool(shard_trx.trx_meta ) ?
-                                                                  shard_trx.trx_meta
-                                                                  : shard_trx.trx_meta_future.get() );
-                     trace = push_transaction( shard_context.pending_shard, trx_meta, fc::time_point::maximum(), fc::microseconds::maximum(), receipt.cpu_usage_us, true, 0 );
-                  } else if( std::holds_alternative<transaction_id_type>(receipt.trx) ) {
-                     trace = push_scheduled_transaction( shard_context.pending_shard, std::get<transaction_id_type>(receipt.trx), fc::time_point::maximum(), fc::microseconds::maximum(), receipt.cpu_usage_us, true );
-                  } else {
-                     EOS_ASSERT( false, block_validate_exception, "encountered unexpected receipt type" );
-                  }
-
-                  bool transaction_failed =  trace && trace->except;
-                  bool transaction_can_fail = receipt.status == transaction_receipt_header::hard_fail && std::holds_alternative<transaction_id_type>(receipt.trx);
-                  if( transaction_failed && !transaction_can_fail) {
-                     edump((*trace));
-                     throw *trace->except;
-                  }
-
-                  EOS_ASSERT( pending_receipts.size() > 0,
-                              block_validate_exception, "expected a receipt, block_num ${bn}, block_id ${id}, receipt ${e}",
-                              ("bn", bsp->block_num)("id", bsp->id)("e", receipt)
-                           );
-                  EOS_ASSERT( pending_receipts.size() == num_pending_receipts + 1,
-                              block_validate_exception, "expected receipt was not added, block_num ${bn}, block_id ${id}, receipt ${e}",
-                              ("bn", bsp->block_num)("id", bsp->id)("e", receipt)
-                           );
-                  const transaction_receipt_header& r = pending_receipts.back();
-                  EOS_ASSERT( r == static_cast<const transaction_receipt_header&>(receipt),
-                              block_validate_exception, "receipt does not match, ${lhs} != ${rhs}",
-                              ("lhs", r)("rhs", static_cast<const transaction_receipt_header&>(receipt)) );
-               }
-               return true;
-            }));
+         // Longest-processing-time-first: dispatch the heaviest shards first so a large shard does not start last
+         // and set the wall time of the block on its own. Shards are independent so the order does not affect results.
+         std::vector<block_shard_context_ptr> shard_schedule( shard_contexts );
+         std::stable_sort(shard_schedule.begin(), shard_schedule.end(), [](const block_shard_context_ptr& a, const block_shard_context_ptr& b) {
+            if (a->cpu_usage_us != b->cpu_usage_us)
+               return a->cpu_usage_us > b->cpu_usage_us;
+            return a->trx_metas.size() > b->trx_metas.size();
+         });
 
-         };
+         std::vector<std::future<void>> shard_futures;
+         shard_futures.reserve(shard_schedule.size());
 
+         for (uint32_t i = 0; i < shard_schedule.size(); ++i) {
+            const auto& shard_context = shard_schedule[i];
+            pending->_block_report.shard_reports[shard_context->pending_shard._name].dispatch_order = i;
+            shard_context->posted_time = fc::time_point::now();
+            shard_futures.emplace_back(shard_context->done.get_future());
+            boost::asio::post( shard_thread_pool.get_executor(), [this, shard_context, &bsp]() {
+               execute_block_shard( shard_context, bsp );
+            });
+         }
 
-         for( auto& f: trx_futures )
+         // wait for every shard before rethrowing so no shard is still running when the block is aborted
+         for( auto& f: shard_futures )
+            f.wait();
+         for( auto& f: shard_futures )
             f.get();
 
+         fc::microseconds total_shard_exec_time;
+         fc::microseconds longest_shard_exec_time;
+         for( const auto& shard_context : shard_contexts ) {
+            auto& sr = pending->_block_report.shard_reports[shard_context->pending_shard._name];
+            sr.num_trxs = shard_context->trx_metas.size();
+            sr.queue_wait_time = shard_context->start_time - shard_context->posted_time;
+            sr.recovery_wait_time = shard_context->recovery_wait_time;
+            sr.exec_time = shard_context->end_time - shard_context->start_time - shard_context->recovery_wait_time;
+            pending->_block_report.recovery_wait_time += sr.recovery_wait_time;
+            total_shard_exec_time += sr.exec_time;
+            longest_shard_exec_time = std::max( longest_shard_exec_time, sr.exec_time );
+         }
+         if( !shard_schedule.empty() ) {
+            auto last_end = std::max_element( shard_contexts.begin(), shard_contexts.end(), []( const auto& a, const auto& b ) {
+               return a->end_time < b->end_time;
+            } )->get()->end_time;
+            pending->_block_report.shard_critical_path_time = last_end - shard_schedule.front()->posted_time;
+            auto threads = std::min( shard_thread_pool_size, shard_contexts.size() );
+            pending->_block_report.shard_ideal_parallel_time =
+                  std::max( longest_shard_exec_time, fc::microseconds( total_shard_exec_time.count() / static_cast<int64_t>( threads ) ) );
+         }
+
          finalize_block();
 
          auto& ab = std::get<assembled_block>(pending->_block_stage);
@@ -2635,10 +3025,6 @@ struct controller_impl {
 
    // thread safe, expected to be called from thread other than the main thread
    block_state_ptr create_block_state_i( const block_id_type& id, const signed_block_ptr& b, const block_header_state& prev ) {
-      auto trx_mroot = calculate_trx_merkle( b->transactions );
-      EOS_ASSERT( b->transaction_mroot == trx_mroot, block_validate_exception,
-                  "invalid block transaction merkle root ${b} != ${c}", ("b", b->transaction_mroot)("c", trx_mroot) );
-
       const bool skip_validate_signee = false;
       auto bsp = std::make_shared<block_state>(
             prev,
@@ -2653,6 +3039,32 @@ struct controller_impl {
 
       EOS_ASSERT( id == bsp->id, block_validate_exception,
                   "provided id ${id} does not match block id ${bid}", ("id", id)("bid", bsp->id) );
+
+      // the features of the block, including the ones it activates, decide how its roots are computed
+      auto header_shard_trx_mroots = get_shard_trx_mroots( bsp->header_exts );
+      if( !detail::is_builtin_activated( bsp->activated_protocol_features, protocol_features.get_protocol_feature_set(),
+                                         builtin_protocol_feature_t::shard_merkle_roots ) ) {
+         auto trx_mroot = calculate_trx_merkle( b->transactions );
+         EOS_ASSERT( b->transaction_mroot == trx_mroot, block_validate_exception,
+                     "invalid block transaction merkle root ${b} != ${c}", ("b", b->transaction_mroot)("c", trx_mroot) );
+         EOS_ASSERT( header_shard_trx_mroots.empty(), block_validate_exception,
+                     "shard transaction merkle roots before activation of SHARD_MERKLE_ROOTS" );
+         return bsp;
+      }
+
+      auto shard_trx_mroots = calculate_shard_trx_merkles( b->transactions );
+      auto trx_mroot = merkle( shard_trx_mroots );
+      EOS_ASSERT( b->transaction_mroot == trx_mroot, block_validate_exception,
+                  "invalid block transaction merkle root ${b} != ${c}", ("b", b->transaction_mroot)("c", trx_mroot) );
+
+      // per-shard roots are carried only by blocks with transactions of more than one shard
+      if( shard_trx_mroots.size() > 1 ) {
+         EOS_ASSERT( header_shard_trx_mroots == shard_trx_mroots, block_validate_exception,
+                     "invalid shard transaction merkle roots ${b} != ${c}", ("b", header_shard_trx_mroots)("c", shard_trx_mroots) );
+      } else {
+         EOS_ASSERT( header_shard_trx_mroots.empty(), block_validate_exception,
+                     "unexpected shard transaction merkle roots in block with a single shard" );
+      }
       return bsp;
    }
 
@@ -2864,6 +3276,7 @@ struct controller_impl {
             } // end if exception
          } /// end for each block in branch
 
+         drop_unregistered_shard_dbs();
          ilog("successfully switched fork to new head ${new_head_id}", ("new_head_id", new_head->id));
       } else {
          head_changed = false;
@@ -2884,13 +3297,69 @@ struct controller_impl {
       return applied_trxs;
    }
 
-   static checksum256_type calculate_trx_merkle( const std::map<shard_name, deque<transaction_receipt>>& trxs ) {
+   // thread safe, the shard roots are computed in parallel on the thread pool. The calling thread takes part in the work,
+   // so it only ever waits on roots that are already being computed and never on a task still queued behind it.
+   flat_map<shard_name, checksum256_type> calculate_shard_trx_merkles( const transaction_receipt_map& trxs ) {
+      struct shard_merkle_job {
+         std::vector<std::pair<shard_name, const deque<transaction_receipt>*>> shards;
+         std::vector<checksum256_type> roots;
+         std::atomic<size_t>           next{0};
+         std::atomic<size_t>           done{0};
+         std::mutex                    mtx;
+         std::condition_variable       cv;
+
+         void run() {
+            for( size_t i = next++; i < shards.size(); i = next++ ) {
+               deque<digest_type> trx_digests;
+               for( const auto& a : *shards[i].second )
+                  trx_digests.emplace_back( a.digest() );
+               roots[i] = merkle( std::move(trx_digests) );
+               if( ++done == shards.size() ) {
+                  std::lock_guard g( mtx );
+                  cv.notify_all();
+               }
+            }
+         }
+      };
+
+      auto job = std::make_shared<shard_merkle_job>();
+      for( const auto& receipts : trxs ) {
+         if( !receipts.second.empty() )
+            job->shards.emplace_back( receipts.first, &receipts.second );
+      }
+      job->roots.resize( job->shards.size() );
+
+      size_t helpers = job->shards.size() > 1 ? std::min<size_t>( job->shards.size() - 1, conf.thread_pool_size ) : 0;
+      for( size_t i = 0; i < helpers; ++i ) {
+         boost::asio::post( thread_pool.get_executor(), [job]() { job->run(); } );
+      }
+      job->run();
+      {
+         std::unique_lock g( job->mtx );
+         job->cv.wait( g, [&]() { return job->done == job->shards.size(); } );
+      }
+
+      flat_map<shard_name, checksum256_type> result;
+      result.reserve( job->shards.size() );
+      for( size_t i = 0; i < job->shards.size(); ++i )
+         result.emplace( job->shards[i].first, job->roots[i] );
+      return result;
+   }
+
+   static checksum256_type calculate_trx_merkle( const transaction_receipt_map& trxs ) {
       deque<digest_type> trx_digests;
       for ( const auto& receipts : trxs )
          for( const auto& a : receipts.second )
             trx_digests.emplace_back( a.digest() );
 
-      return merkle( move(trx_digests) );
+      return merkle( std::move(trx_digests) );
+   }
+
+   static flat_map<shard_name, checksum256_type> get_shard_trx_mroots( const flat_multimap<uint16_t, block_header_extension>& header_exts ) {
+      auto itr = header_exts.find( shard_transaction_mroots_extension::extension_id() );
+      if( itr == header_exts.end() )
+         return {};
+      return std::get<shard_transaction_mroots_extension>( itr->second ).transaction_mroots;
    }
 
    void update_producers_authority() {
@@ -2944,12 +3413,14 @@ struct controller_impl {
 
    void clear_expired_input_transactions(const fc::time_point& deadline) {
       //Look for expired transactions in the deduplication list, and remove them.
-      auto  remove_from_shard = [=]( chainbase::database& db, shard_name sname ) {
+      auto now = self.is_building_block() ? self.pending_block_time() : self.head_block_time();
+      auto  remove_from_shard = [&]( chainbase::database& db, shard_name sname ) {
          auto& transaction_idx = db.get_mutable_index<transaction_multi_index>();
          const auto& dedupe_index = transaction_idx.indices().get<by_expiration>();
-         auto now = self.is_building_block() ? self.pending_block_time() : self.head_block_time();
          const auto total = dedupe_index.size();
          uint32_t num_removed = 0;
+         if( !dedupe_index.empty() && now > fc::time_point(dedupe_index.begin()->expiration) )
+            dbm.start_shard_undo_session( sname );
          while( (!dedupe_index.empty()) && ( now > fc::time_point(dedupe_index.begin()->expiration) ) ) {
             transaction_idx.remove(*dedupe_index.begin());
             ++num_removed;
@@ -2964,11 +3435,9 @@ struct controller_impl {
       auto& db = dbm.main_db();
       remove_from_shard( db , "main"_n );
 
-      //Look for expired transactions in the deduplication list in sub shard, and remove them.
-      for( auto& sdb : dbm.shard_dbs() ) {
-         auto sname = sdb.first;
-         auto& db = dbm.shard_db( sname );
-         remove_from_shard( db , sname );
+      //Look for expired transactions in the deduplication list of the sub shards which have any, and remove them.
+      for( const auto& sname : dbm.shards_with_expired_transactions( now ) ) {
+         remove_from_shard( dbm.shard_db( sname ), sname );
       }
    }
 
@@ -3176,15 +3645,8 @@ struct controller_impl {
       if ( is_eos_vm_oc_enabled() )
          // EOSVMOC needs further initialization of its thread local data
          wasmif.init_thread_local_data();
-      else
 #endif
-      {
-         // TODO: readonly threads, must supply shared_db and sub shard db
-         // auto& db = dbm.shared_db();
-         std::lock_guard g(threaded_wasmifs_mtx);
-         // Non-EOSVMOC needs a wasmif per thread
-         threaded_wasmifs[std::this_thread::get_id()]  = std::make_unique<wasm_interface>( conf.wasm_runtime, conf.eosvmoc_tierup, conf.state_dir, conf.eosvmoc_config, !conf.profile_accounts.empty());
-      }
+      // eos-vm and eos-vm-jit lease instantiated modules from the shared wasmif, nothing to initialize per thread
    }
 
    bool is_on_main_thread() { return main_thread_id == std::this_thread::get_id(); };
@@ -3200,24 +3662,12 @@ struct controller_impl {
    }
 
    wasm_interface& get_wasm_interface() {
-      if ( is_on_main_thread()
-#ifdef EOSIO_EOS_VM_OC_RUNTIME_ENABLED
-          || is_eos_vm_oc_enabled()
-#endif
-         )
-         return wasmif;
-      else
-         return *threaded_wasmifs[std::this_thread::get_id()];
+      return wasmif;
    }
 
    void code_block_num_last_used(const digest_type& code_hash, uint8_t vm_type, uint8_t vm_version, uint32_t block_num) {
-      // The caller of this function apply_eosio_setcode has already asserted that
-      // the transaction is not a read-only trx, which implies we are
-      // in write window. Safe to call threaded_wasmifs's code_block_num_last_used
+      // may run on a shard thread, the update is queued and applied by wasmif at the next LIB
       wasmif.code_block_num_last_used(code_hash, vm_type, vm_version, block_num);
-      for (auto& w: threaded_wasmifs) {
-         w.second->code_block_num_last_used(code_hash, vm_type, vm_version, block_num);
-      }
    }
 
    block_state_ptr fork_db_head() const;
@@ -3305,6 +3755,18 @@ chainbase::database& controller::mutable_db()const { return my->dbm.main_db(); }
 const database_manager& controller::dbm()const { return my->dbm; }
 database_manager& controller::mutable_dbm()const { return my->dbm; };
 
+const std::map<xshard_queue::route, xshard_latency_histogram>& controller::xshard_latencies()const {
+   return my->xsh_queue.latencies();
+}
+
+shard_routing_index& controller::get_shard_routing() {
+   return my->shard_routing;
+}
+
+const shard_routing_index& controller::get_shard_routing()const {
+   return my->shard_routing;
+}
+
 const fork_database& controller::fork_db()const { return my->fork_db; }
 
 void controller::preactivate_feature( const digest_type& feature_digest, bool is_trx_transient ) {
@@ -1,13 +1,18 @@
 #include <eosio/chain/database_manager.hpp>
 #include <eosio/chain/config.hpp>
 #include <eosio/chain/shard_object.hpp>
+#include <eosio/chain/transaction_object.hpp>
+#include <eosio/chain/thread_utils.hpp>
 #include <boost/array.hpp>
 
+#include <cerrno>
+#include <future>
 #include <iostream>
 #include <fc/io/fstream.hpp>
 
 #ifndef _WIN32
 #include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 namespace eosio { namespace chain {
@@ -15,7 +20,7 @@ namespace eosio { namespace chain {
 
    const uint32_t shard_db_catalog::magic_number              = 0x30510FDB;
    const uint32_t shard_db_catalog::min_supported_version     = 1;
-   const uint32_t shard_db_catalog::max_supported_version     = 1;
+   const uint32_t shard_db_catalog::max_supported_version     = 2;
 
    database_manager::database_manager(const database_manager::path& dir, open_flags flags,
                      uint64_t shared_file_size, uint64_t main_file_size, bool allow_dirty,
@@ -34,19 +39,93 @@ namespace eosio { namespace chain {
    database_manager::~database_manager()
    {
       if (_is_saving_catalog) {
-         shard_db_catalog::save(*this);
+         try_save_catalog();
          _is_saving_catalog = false;
       }
    }
 
+   bool database_manager::try_save_catalog() noexcept {
+      try {
+         shard_db_catalog::save( *this );
+         return true;
+      } catch( const fc::exception& e ) {
+         elog( "unable to save shard db catalog: ${e}", ("e", e.to_detail_string()) );
+      } catch( const std::exception& e ) {
+         elog( "unable to save shard db catalog: ${e}", ("e", e.what()) );
+      } catch( ... ) {
+         elog( "unable to save shard db catalog" );
+      }
+      return false;
+   }
+
+   namespace {
+      /// @return true if the database has undo state which has not been committed yet
+      bool has_undo_state( const chainbase::database& db ) {
+         auto range = db.get_index<shard_index>().undo_stack_revision_range();
+         return range.first != range.second;
+      }
+   }
+
+   database_manager::session::session( database_manager& dbm, std::vector<std::unique_ptr<database::session>>&& s )
+   :_dbm( &dbm ), _db_sessions( std::move(s) )
+   {
+      _dbm->_active_session = this;
+   }
+
+   database_manager::session::session( session&& s )
+   :_dbm( s._dbm ), _db_sessions( std::move(s._db_sessions) ), _shard_names( std::move(s._shard_names) )
+   {
+      s._dbm = nullptr;
+      if( _dbm && _dbm->_active_session == &s )
+         _dbm->_active_session = this;
+   }
+
+   void database_manager::session::push()
+   {
+      for( auto& i : _db_sessions ) i->push();
+      _db_sessions.clear();
+      detach();
+   }
+
+   void database_manager::session::squash()
+   {
+      for( auto& i : _db_sessions ) i->squash();
+      _db_sessions.clear();
+      detach();
+   }
+
+   void database_manager::session::undo()
+   {
+      for( auto& i : _db_sessions ) i->undo();
+      _db_sessions.clear();
+      if( _dbm )
+         _dbm->_dedup_changed_shards.insert( _shard_names.begin(), _shard_names.end() );
+      detach();
+   }
+
+   void database_manager::session::detach()
+   {
+      if( _dbm && _dbm->_active_session == this )
+         _dbm->_active_session = nullptr;
+      _dbm = nullptr;
+   }
+
+   // A sub-shard database only has undo levels for the blocks which wrote to it, so its revision can lag behind
+   // the revision of the main database. The levels it has are always contiguous and end at its own revision,
+   // which lets undo and squash of the top level skip every database that is not at the top revision.
+
    void database_manager::undo()
    {
       if ( _read_only_mode )
          BOOST_THROW_EXCEPTION( std::logic_error( "attempting to undo in read-only mode" ) );
+      const int64_t top = _main_db.revision();
       _shared_db.undo();
       _main_db.undo();
       for ( auto& db : _shard_db_map ) {
-         db.second.undo();
+         if( db.second.revision() == top && has_undo_state( db.second ) ) {
+            db.second.undo();
+            _dedup_changed_shards.insert( db.first );
+         }
       }
    }
 
@@ -54,22 +133,102 @@ namespace eosio { namespace chain {
    {
       if ( _read_only_mode )
          BOOST_THROW_EXCEPTION( std::logic_error( "attempting to squash in read-only mode" ) );
+      const int64_t top = _main_db.revision();
       _shared_db.squash();
       _main_db.squash();
       for( auto& db: _shard_db_map ) {
-         db.second.squash();
+         if( db.second.revision() == top && has_undo_state( db.second ) )
+            db.second.squash();
+      }
+   }
+
+   template<typename F>
+   void database_manager::for_each_db_parallel( const std::vector<database_entry>& dbs, fc::microseconds db_timing::* timing, F&& f )
+   {
+      // entries are created up front so the workers only write to their own entry
+      std::vector<db_timing*> timings;
+      timings.reserve( dbs.size() );
+      for( const auto& entry : dbs ) {
+         timings.push_back( &_db_timings[entry.first] );
+      }
+
+      auto run = [&]( size_t i ) {
+         auto start = fc::time_point::now();
+         f( *dbs[i].second );
+         timings[i]->*timing = fc::time_point::now() - start;
+      };
+
+      // the calling thread takes the first database, the rest go to the pool
+      std::vector<std::future<void>> futures;
+      if( _thread_pool ) {
+         futures.reserve( dbs.size() );
+         for( size_t i = 1; i < dbs.size(); ++i ) {
+            futures.emplace_back( post_async_task( *_thread_pool, [&run, i]() { run( i ); } ) );
+         }
+      }
+
+      std::exception_ptr except;
+      try {
+         if( !dbs.empty() )
+            run( 0 );
+         if( !_thread_pool ) {
+            for( size_t i = 1; i < dbs.size(); ++i )
+               run( i );
+         }
+      } catch( ... ) {
+         except = std::current_exception();
+      }
+      // every task refers to the locals above, wait for all of them before rethrowing
+      for( auto& fut : futures ) {
+         try {
+            fut.get();
+         } catch( ... ) {
+            if( !except )
+               except = std::current_exception();
+         }
       }
+      if( except )
+         std::rethrow_exception( except );
    }
 
    void database_manager::commit( int64_t revision )
    {
       if ( _read_only_mode )
          BOOST_THROW_EXCEPTION( std::logic_error( "attempting to commit in read-only mode" ) );
-      _shared_db.commit( revision );
-      _main_db.commit( revision );
+
+      std::vector<database_entry> dbs{ { config::main_shard_name, &_main_db }, { config::share_db_name, &_shared_db } };
+      for ( auto& db : _shard_db_map ) {
+         if( has_undo_state( db.second ) )
+            dbs.emplace_back( db.first, &db.second );
+      }
+      for_each_db_parallel( dbs, &db_timing::commit_time, [revision]( database& db ) {
+         db.commit( revision );
+      } );
+
+      // a failed write is retried on the next commit
+      if( _is_saving_catalog && _catalog_dirty && try_save_catalog() )
+         _catalog_dirty = false;
+   }
+
+   void database_manager::flush()
+   {
+#ifndef _WIN32
+      if( db_map_mode != pinnable_mapped_file::map_mode::mapped || _read_only )
+         return;
+
+      std::vector<database_entry> dbs{ { config::main_shard_name, &_main_db }, { config::share_db_name, &_shared_db } };
       for ( auto& db : _shard_db_map ) {
-         db.second.commit( revision );
+         dbs.emplace_back( db.first, &db.second );
       }
+      const uintptr_t page_size = sysconf( _SC_PAGESIZE );
+      for_each_db_parallel( dbs, &db_timing::flush_time, [page_size]( database& db ) {
+         auto* segment_manager = db.get_segment_manager();
+         auto* begin = reinterpret_cast<char*>( reinterpret_cast<uintptr_t>( segment_manager ) & ~(page_size - 1) );
+         auto* end = reinterpret_cast<char*>( segment_manager ) + segment_manager->get_size();
+         if( msync( begin, end - begin, MS_SYNC ) != 0 )
+            wlog( "unable to flush database, error ${e}", ("e", errno) );
+      } );
+#endif
    }
 
    void database_manager::undo_all()
@@ -80,7 +239,10 @@ namespace eosio { namespace chain {
       _shared_db.undo_all();
       _main_db.undo_all();
       for ( auto& db : _shard_db_map ) {
-         db.second.undo_all();
+         if( has_undo_state( db.second ) ) {
+            db.second.undo_all();
+            _dedup_changed_shards.insert( db.first );
+         }
       }
    }
 
@@ -90,29 +252,147 @@ namespace eosio { namespace chain {
          BOOST_THROW_EXCEPTION( std::logic_error( "attempting to start_undo_session in read-only mode" ) );
       if( enabled ) {
          std::vector< std::unique_ptr<database::session> > _db_sessions;
-         _db_sessions.reserve( 2 + _shard_db_map.size() );
+         _db_sessions.reserve( 2 );
          _db_sessions.push_back(std::make_unique<database::session>(_shared_db.start_undo_session(enabled)));
          _db_sessions.push_back(std::make_unique<database::session>(_main_db.start_undo_session(enabled)));
-         for( auto& db : _shard_db_map ) {
-            _db_sessions.push_back(std::make_unique<database::session>(db.second.start_undo_session(enabled)));
-         }
-         return session( std::move( _db_sessions ) );
+         return session( *this, std::move( _db_sessions ) );
       } else {
          return session();
       }
    }
 
-   database_manager::database* database_manager::add_shard_db( const shard_name& name, uint64_t file_size ) {
+   void database_manager::start_shard_undo_session( const shard_name& name )
+   {
+      if( name == config::main_shard_name )
+         return;
+      _dedup_changed_shards.insert( name );
+      if( !_active_session )
+         return;
+
+      auto& db = shard_db( name );
+
+      const int64_t block_revision = _main_db.revision();
+      if( db.revision() == block_revision )
+         return; // already opened by the active session
+
+      if( !has_undo_state( db ) ) {
+         // nothing to undo below this block, the revision can simply be moved up to the previous block
+         db.set_revision( block_revision - 1 );
+      } else {
+         EOS_ASSERT( db.revision() < block_revision, database_exception,
+                     "shard db revision ${r} is ahead of the block revision ${b}", ("r", db.revision())("b", block_revision) );
+         // fill the blocks which did not write to the database so its undo levels stay aligned with the main database,
+         // bounded by the number of reversible blocks
+         while( db.revision() < block_revision - 1 ) {
+            db.start_undo_session( true ).push();
+         }
+      }
+      _active_session->_db_sessions.push_back( std::make_unique<database::session>( db.start_undo_session( true ) ) );
+      _active_session->_shard_names.push_back( name );
+   }
+
+   std::vector<shard_name> database_manager::shards_with_expired_transactions( const fc::time_point& now )
+   {
+      for( const auto& name : _dedup_changed_shards ) {
+         auto itr = _dedup_expirations.find( name );
+         if( itr != _dedup_expirations.end() ) {
+            _dedup_expirations_by_time.erase( { itr->second, name } );
+            _dedup_expirations.erase( itr );
+         }
+         const auto* db = find_shard_db( name );
+         if( !db )
+            continue;
+         const auto& dedupe_index = db->get_index<transaction_multi_index, by_expiration>();
+         if( !dedupe_index.empty() ) {
+            _dedup_expirations.emplace( name, dedupe_index.begin()->expiration );
+            _dedup_expirations_by_time.emplace( dedupe_index.begin()->expiration, name );
+         }
+      }
+      _dedup_changed_shards.clear();
+
+      std::vector<shard_name> expired;
+      for( const auto& [expiration, name] : _dedup_expirations_by_time ) {
+         if( now <= fc::time_point( expiration ) )
+            break;
+         expired.push_back( name );
+      }
+      return expired;
+   }
+
+   void database_manager::set_thread_pool( boost::asio::io_context* thread_pool ) {
+      if( thread_pool != _thread_pool ) {
+         for( auto& p : _prepared_shard_dbs )
+            p.second.wait();
+      }
+      _thread_pool = thread_pool;
+   }
+
+   database_manager::database* database_manager::add_shard_db( const shard_name& name, uint64_t file_size, const shard_db_init& init ) {
       auto itr = _shard_db_map.find(name);
-      if (itr == _shard_db_map.end()) {
-         // TODO: should add sub shard root dir 'dir/"shards"/name.to_string()'
-         auto new_ret = _shard_db_map.emplace(std::piecewise_construct,std::forward_as_tuple(name),
-            std::forward_as_tuple(dir / name.to_string(), flags, file_size, allow_dirty, db_map_mode) );
-         itr = new_ret.first;
+      if (itr != _shard_db_map.end())
+         return &itr->second;
+
+      auto prepared = _prepared_shard_dbs.find(name);
+      if (prepared != _prepared_shard_dbs.end()) {
+         auto fut = std::move(prepared->second);
+         _prepared_shard_dbs.erase(prepared);
+         try {
+            // a node moves between maps without touching the database, so linking it in does not depend on its size
+            auto ret = _shard_db_map.insert( fut.get() );
+            _catalog_dirty = true;
+            _dedup_changed_shards.insert( name );
+            return &ret.position->second;
+         } catch( const std::exception& e ) {
+            wlog( "preparing shard db ${n} failed, opening it again: ${e}", ("n", name)("e", e.what()) );
+         } catch( ... ) {
+            wlog( "preparing shard db ${n} failed, opening it again", ("n", name) );
+         }
       }
+
+      // TODO: should add sub shard root dir 'dir/"shards"/name.to_string()'
+      auto new_ret = _shard_db_map.emplace(std::piecewise_construct,std::forward_as_tuple(name),
+         std::forward_as_tuple(dir / name.to_string(), flags, file_size, allow_dirty, db_map_mode) );
+      itr = new_ret.first;
+      _catalog_dirty = true;
+      _dedup_changed_shards.insert( name );
+      if (init)
+         init(itr->second);
       return &itr->second;
    }
+
+   void database_manager::prepare_shard_db( const shard_name& name, uint64_t file_size, shard_db_init init ) {
+      if( !_thread_pool || _shard_db_map.count( name ) || _prepared_shard_dbs.count( name ) )
+         return;
+
+      // the task only uses copies, it may still run when the shard is dropped by a fork
+      _prepared_shard_dbs.emplace( name, post_async_task( *_thread_pool,
+         [name, file_size, init{std::move(init)}, path{dir / name.to_string()}, db_flags{flags}, dirty{allow_dirty}, map_mode{db_map_mode}]() {
+            std::map<db_name, database> staging;
+            auto itr = staging.emplace( std::piecewise_construct, std::forward_as_tuple( name ),
+                                        std::forward_as_tuple( path, db_flags, file_size, dirty, map_mode ) ).first;
+            if( init )
+               init( itr->second );
+            return staging.extract( itr );
+         } ) );
+   }
    
+   void database_manager::drop_prepared_shard_dbs( const std::function<bool(const shard_name&)>& keep ) {
+      for( auto itr = _prepared_shard_dbs.begin(); itr != _prepared_shard_dbs.end(); ) {
+         if( keep( itr->first ) ) {
+            ++itr;
+            continue;
+         }
+         try {
+            // the node owns the db, it is unmapped as it goes out of scope
+            itr->second.get();
+         } catch( ... ) {
+            // a failed preparation left nothing mapped
+         }
+         dlog( "dropped prepared shard db ${n}", ("n", itr->first) );
+         itr = _prepared_shard_dbs.erase( itr );
+      }
+   }
+
    const database_manager::database& database_manager::shard_db(db_name shard_name) const {
       auto itr = _shard_db_map.find(shard_name);
       EOS_ASSERT(itr != _shard_db_map.end(), eosio::chain::database_exception,"${sname} db not found",("sname", shard_name));
@@ -149,20 +429,26 @@ namespace eosio { namespace chain {
       return nullptr;
    }
 
+   digest_type shard_db_info::calc_row_count_digest( const chainbase::database& db ) {
+      // row counts are kept by every index, so this is cheap even for a large db
+      digest_type::encoder enc;
+      for( const auto& i : db.row_count_per_index() ) {
+         fc::raw::pack( enc, i.second );
+         fc::raw::pack( enc, i.first );
+      }
+      return enc.result();
+   }
+
    void shard_db_catalog::save(database_manager& dbm) {
       auto catalog_dat = dbm.dir / config::shard_db_catalog_filename;
 
-      // TODO: backup the existed file?
-
-      std::ofstream out( catalog_dat.generic_string().c_str(), std::ios::out | std::ios::binary | std::ofstream::trunc );
+      // written next to the catalog and renamed over it so a crash never leaves a partially written catalog
+      auto catalog_tmp = dbm.dir / (std::string( config::shard_db_catalog_filename ) + ".tmp");
+      std::ofstream out( catalog_tmp.generic_string().c_str(), std::ios::out | std::ios::binary | std::ofstream::trunc );
       fc::raw::pack( out, shard_db_catalog::magic_number );
       fc::raw::pack( out, shard_db_catalog::max_supported_version ); // write out current version which is always max_supported_version
 
-
-      // TODO: shard_db_info {
-      //    name, approved_block_num
-      // }
-      std::vector<shard_name> shards;
+      std::vector<shard_db_info> shards;
       const auto& shared_db = dbm.shared_db();
       std::string error_msg;
 
@@ -175,12 +461,21 @@ namespace eosio { namespace chain {
             elog( error_msg );
             continue;
          }
-         shards.push_back(itr->name);
+         shards.push_back( shard_db_info{ itr->name, db_ptr->revision(), db_ptr->get_segment_manager()->get_size(),
+                                          shard_db_info::calc_row_count_digest( *db_ptr ) } );
       }
 
-      fc::raw::pack( out, shards );
-      fc::raw::pack( out, error_msg );
-      // TODO: calc and pack check sum
+      auto payload = fc::raw::pack( shards );
+      auto packed_error_msg = fc::raw::pack( error_msg );
+      payload.insert( payload.end(), packed_error_msg.begin(), packed_error_msg.end() );
+      out.write( payload.data(), payload.size() );
+      fc::raw::pack( out, digest_type::hash( payload.data(), payload.size() ) );
+      out.flush();
+      out.close();
+      // a short write must not replace a good catalog
+      EOS_ASSERT( out.good(), shard_db_catalog_exception, "failed to write shard db catalog file '${f}'",
+                  ("f", catalog_tmp.generic_string()) );
+      boost::filesystem::rename( catalog_tmp, catalog_dat );
    }
 
    shard_db_catalog shard_db_catalog::load(const fc::path& dir) {
@@ -224,9 +519,23 @@ namespace eosio { namespace chain {
                      ("max", shard_db_catalog::max_supported_version)
          );
 
-
-         fc::raw::unpack( ds, catalog.shards );
-         fc::raw::unpack( ds, catalog.error_msg );
+         if( version == 1 ) {
+            std::vector<shard_name> names;
+            fc::raw::unpack( ds, names );
+            for( const auto& n : names )
+               catalog.shards.push_back( shard_db_info{ n } );
+            fc::raw::unpack( ds, catalog.error_msg );
+         } else {
+            const char* payload_begin = ds.pos();
+            fc::raw::unpack( ds, catalog.shards );
+            fc::raw::unpack( ds, catalog.error_msg );
+            const auto computed = digest_type::hash( payload_begin, ds.pos() - payload_begin );
+            digest_type checksum;
+            fc::raw::unpack( ds, checksum );
+            EOS_ASSERT( checksum == computed, shard_db_catalog_exception,
+                        "Shard db catalog file '${filename}' is corrupted, checksum ${actual} does not match ${expected}",
+                        ("filename", catalog_dat.generic_string())("actual", computed)("expected", checksum) );
+         }
 
          if (!catalog.error_msg.empty()) {
             EOS_ASSERT( totem == shard_db_catalog::magic_number, shard_db_catalog_exception,
@@ -240,4 +549,25 @@ namespace eosio { namespace chain {
       return catalog;
    }
 
+   void shard_db_catalog::validate( const shard_db_info& info, const chainbase::database& db, bool allow_dirty ) {
+      if( info.row_count_digest == digest_type() )
+         return;
+
+      std::string mismatch;
+      if( db.revision() != info.revision ) {
+         mismatch = "revision " + std::to_string( db.revision() ) + " but the catalog recorded " + std::to_string( info.revision );
+      } else if( shard_db_info::calc_row_count_digest( db ) != info.row_count_digest ) {
+         mismatch = "index row counts which do not match the catalog";
+      }
+      if( mismatch.empty() )
+         return;
+
+      if( allow_dirty ) {
+         wlog( "shard db ${n} has ${m}", ("n", info.name)("m", mismatch) );
+         return;
+      }
+      EOS_THROW( shard_db_catalog_exception, "shard db ${n} has ${m}, replay or restore from a snapshot",
+                 ("n", info.name)("m", mismatch) );
+   }
+
 }}  // namespace eosio::chain
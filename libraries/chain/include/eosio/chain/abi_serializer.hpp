@@ -679,6 +679,11 @@ namespace impl {
                   std::get<producer_schedule_change_extension>(header_exts.lower_bound(producer_schedule_change_extension::extension_id())->second);
             mvo("new_producer_schedule", new_producer_schedule);
          }
+         if ( header_exts.count(shard_transaction_mroots_extension::extension_id())) {
+            const auto& shard_mroots =
+                  std::get<shard_transaction_mroots_extension>(header_exts.lower_bound(shard_transaction_mroots_extension::extension_id())->second);
+            mvo("shard_transaction_mroots", shard_mroots.transaction_mroots);
+         }
 
          mvo("producer_signature", block.producer_signature);
          add(mvo, "transactions", block.transactions, resolver, ctx);
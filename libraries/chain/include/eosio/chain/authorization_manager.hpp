@@ -26,6 +26,9 @@ namespace eosio { namespace chain {
          void initialize_database();
          void add_to_snapshot( const snapshot_writer_ptr& snapshot ) const;
          void read_from_snapshot( const snapshot_reader_ptr& snapshot );
+         /// authorization sections of any shard database
+         static void add_to_snapshot( const chainbase::database& db, const snapshot_writer_ptr& snapshot );
+         static void read_from_snapshot( chainbase::database& db, const snapshot_reader_ptr& snapshot );
 
          const permission_object& create_permission( account_name account,
                                                      permission_name name,
@@ -15,9 +15,23 @@ namespace eosio { namespace chain {
       };
    }
 
+   /**
+    * Merkle roots of the transaction receipts of every shard in the block. The transaction_mroot of the block is
+    * the merkle of these roots, so one shard's transactions can be proven without the receipts of other shards.
+    * Only present when the block carries transactions of more than one shard, otherwise transaction_mroot
+    * already is the root of that shard.
+    */
+   struct shard_transaction_mroots_extension {
+      static constexpr uint16_t extension_id() { return 2; }
+      static constexpr bool     enforce_unique() { return true; }
+
+      flat_map<shard_name, checksum256_type> transaction_mroots;
+   };
+
    using block_header_extension_types = detail::block_header_extension_types<
       protocol_feature_activation,
-      producer_schedule_change_extension
+      producer_schedule_change_extension,
+      shard_transaction_mroots_extension
    >;
 
    using block_header_extension = block_header_extension_types::block_header_extension_t;
@@ -84,3 +98,4 @@ FC_REFLECT(eosio::chain::block_header,
            (schedule_version)(new_producers)(header_extensions))
 
 FC_REFLECT_DERIVED(eosio::chain::signed_block_header, (eosio::chain::block_header), (producer_signature))
+FC_REFLECT(eosio::chain::shard_transaction_mroots_extension, (transaction_mroots))
@@ -85,7 +85,8 @@ struct pending_block_header_state : public detail::block_header_state_common {
                                           const checksum256_type& action_mroot,
                                           const std::optional<producer_authority_schedule>& new_producers,
                                           vector<digest_type>&& new_protocol_feature_activations,
-                                          const protocol_feature_set& pfs)const;
+                                          const protocol_feature_set& pfs,
+                                          flat_map<shard_name, checksum256_type>&& shard_transaction_mroots = {} )const;
 
    block_header_state  finish_next( const signed_block_header& h,
                                     vector<signature_type>&& additional_signatures,
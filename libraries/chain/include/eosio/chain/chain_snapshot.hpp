@@ -1,6 +1,7 @@
 #pragma once
 
 #include <eosio/chain/exceptions.hpp>
+#include <eosio/chain/types.hpp>
 
 namespace eosio { namespace chain {
 
@@ -23,10 +24,15 @@ struct chain_snapshot_header {
     *   5: Updated for v3.0.0 eos features:
     *         - chain_config update
     *   6: Updated for v3.1.0 release
+    *   7: Sharding:
+    *         - forwards compatible with versions 2 to 6
+    *         - sub-shard databases embedded in the shard_databases section
+    *         - block usage and elastic limits of a sub-shard in its resource_limits_shard_state_object section
     */
 
    static constexpr uint32_t minimum_compatible_version = 2;
-   static constexpr uint32_t current_version = 6;
+   static constexpr uint32_t first_sharded_version = 7;
+   static constexpr uint32_t current_version = 7;
 
    uint32_t version = current_version;
 
@@ -40,6 +46,23 @@ struct chain_snapshot_header {
    }
 };
 
+/**
+ * First row of the shard_databases section. Every entry is followed by one row holding a complete binary
+ * snapshot stream of that sub-shard database, in manifest order. The shared database is not included,
+ * it is rebuilt from the main database.
+ */
+struct shard_db_snapshot_manifest {
+   struct entry {
+      db_name        name;
+      uint64_t       size = 0;
+      fc::sha256     digest;
+   };
+
+   std::vector<entry> shard_dbs;
+};
+
 } }
 
 FC_REFLECT(eosio::chain::chain_snapshot_header,(version))
+FC_REFLECT(eosio::chain::shard_db_snapshot_manifest::entry,(name)(size)(digest))
+FC_REFLECT(eosio::chain::shard_db_snapshot_manifest,(shard_dbs))
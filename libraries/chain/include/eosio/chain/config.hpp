@@ -13,8 +13,10 @@ const static auto reversible_blocks_dir_name = "reversible";
 const static auto default_state_dir_name     = "state";
 const static auto forkdb_filename            = "fork_db.dat";
 const static auto shard_db_catalog_filename  = "shard_db_catalog.dat";
+const static auto wasm_hot_codes_filename    = "wasm_hot_codes.dat";
 const static auto default_state_size            = 1*1024*1024*1024ll;
 const static auto default_state_guard_size      =    128*1024*1024ll;
+const static auto default_shard_state_size      = 1*1024*1024*1024ll;
 
 
 const static name system_account_name    { "gax"_n };
@@ -50,6 +52,7 @@ static const uint32_t account_net_usage_average_window_ms  = 24*60*60*1000l;
 static const uint32_t block_cpu_usage_average_window_ms    = 60*1000l;
 static const uint32_t block_size_average_window_ms         = 60*1000l;
 static const uint32_t maximum_elastic_resource_multiplier  = 1000;
+static const uint32_t maximum_block_shard_usage_multiplier = 8; ///< the usage of all shards in a block is capped at this multiple of the block limits
 
 //const static uint64_t   default_max_storage_size       = 10 * 1024;
 //const static uint32_t   default_max_trx_runtime        = 10*1000;
@@ -82,6 +85,7 @@ const static uint16_t   default_max_auth_depth                       = 6;
 const static uint32_t   default_sig_cpu_bill_pct                     = 50 * percent_1; // billable percentage of signature recovery
 const static uint32_t   default_block_cpu_effort_pct                 = 80 * percent_1; // percentage of block time used for producing block
 const static uint16_t   default_controller_thread_pool_size          = 2;
+const static uint16_t   default_shard_thread_pool_size               = 0; // 0 = one thread per available hardware thread
 const static uint32_t   default_max_variable_signature_length        = 16384u;
 const static uint32_t   default_max_nonprivileged_inline_action_size = 4 * 1024; // 4 KB
 const static uint32_t   default_max_action_return_value_size         = 256;
@@ -3,10 +3,12 @@
 #include <eosio/chain/transaction.hpp>
 #include <eosio/chain/contract_table_objects.hpp>
 #include <eosio/chain/deep_mind.hpp>
+#include <eosio/chain/iterator_cache.hpp>
 #include <fc/utility.hpp>
 #include <sstream>
 #include <algorithm>
 #include <set>
+#include <type_traits>
 
 namespace chainbase { class database; }
 
@@ -28,87 +30,27 @@ class contract_table_context_base {
    using key_value_index = typename chainbase::get_index_type<key_value_object>::type;
    public:
       template<typename T>
-      class iterator_cache {
-         public:
-            iterator_cache(){
-               _end_iterator_to_table.reserve(8);
-               _iterator_to_object.reserve(32);
-            }
-
-            /// Returns end iterator of the table.
-            int cache_table( const table_id_object& tobj ) {
-               auto itr = _table_cache.find(tobj.id);
-               if( itr != _table_cache.end() )
-                  return itr->second.second;
-
-               auto ei = index_to_end_iterator(_end_iterator_to_table.size());
-               _end_iterator_to_table.push_back( &tobj );
-               _table_cache.emplace( tobj.id, make_pair(&tobj, ei) );
-               return ei;
-            }
-
-            const table_id_object& get_table( table_id_object_id_type i )const {
-               auto itr = _table_cache.find(i);
-               EOS_ASSERT( itr != _table_cache.end(), table_not_in_cache, "an invariant was broken, table should be in cache" );
-               return *itr->second.first;
-            }
-
-            int get_end_iterator_by_table_id( table_id_object_id_type i )const {
-               auto itr = _table_cache.find(i);
-               EOS_ASSERT( itr != _table_cache.end(), table_not_in_cache, "an invariant was broken, table should be in cache" );
-               return itr->second.second;
-            }
-
-            const table_id_object* find_table_by_end_iterator( int ei )const {
-               EOS_ASSERT( ei < -1, invalid_table_iterator, "not an end iterator" );
-               auto indx = end_iterator_to_index(ei);
-               if( indx >= _end_iterator_to_table.size() ) return nullptr;
-               return _end_iterator_to_table[indx];
-            }
-
-            const T& get( int iterator ) {
-               EOS_ASSERT( iterator != -1, invalid_table_iterator, "invalid iterator" );
-               EOS_ASSERT( iterator >= 0, table_operation_not_permitted, "dereference of end iterator" );
-               EOS_ASSERT( (size_t)iterator < _iterator_to_object.size(), invalid_table_iterator, "iterator out of range" );
-               auto result = _iterator_to_object[iterator];
-               EOS_ASSERT( result, table_operation_not_permitted, "dereference of deleted object" );
-               return *result;
-            }
-
-            void remove( int iterator ) {
-               EOS_ASSERT( iterator != -1, invalid_table_iterator, "invalid iterator" );
-               EOS_ASSERT( iterator >= 0, table_operation_not_permitted, "cannot call remove on end iterators" );
-               EOS_ASSERT( (size_t)iterator < _iterator_to_object.size(), invalid_table_iterator, "iterator out of range" );
-
-               auto obj_ptr = _iterator_to_object[iterator];
-               if( !obj_ptr ) return;
-               _iterator_to_object[iterator] = nullptr;
-               _object_to_iterator.erase( obj_ptr );
-            }
-
-            int add( const T& obj ) {
-               auto itr = _object_to_iterator.find( &obj );
-               if( itr != _object_to_iterator.end() )
-                    return itr->second;
-
-               _iterator_to_object.push_back( &obj );
-               _object_to_iterator[&obj] = _iterator_to_object.size() - 1;
-
-               return _iterator_to_object.size() - 1;
-            }
-
-         private:
-            map<table_id_object_id_type, pair<const table_id_object*, int>> _table_cache;
-            vector<const table_id_object*>                  _end_iterator_to_table;
-            vector<const T*>                                _iterator_to_object;
-            map<const T*,int>                               _object_to_iterator;
-
-            /// Precondition: std::numeric_limits<int>::min() < ei < -1
-            /// Iterator of -1 is reserved for invalid iterators (i.e. when the appropriate table has not yet been created).
-            inline size_t end_iterator_to_index( int ei )const { return (-ei - 2); }
-            /// Precondition: indx < _end_iterator_to_table.size() <= std::numeric_limits<int>::max()
-            inline int index_to_end_iterator( size_t indx )const { return -(indx + 2); }
-      }; /// class iterator_cache
+      using iterator_cache = chain::iterator_cache<T, table_id_object>;
+
+      /// iterator caches of one context, leased from a per thread pool and reset instead of freed between actions
+      struct table_iterator_caches {
+         iterator_cache<key_value_object>          keyval;
+         iterator_cache<index64_object>            idx64;
+         iterator_cache<index128_object>           idx128;
+         iterator_cache<index256_object>           idx256;
+         iterator_cache<index_double_object>       idx_double;
+         iterator_cache<index_long_double_object>  idx_long_double;
+
+         void reset() {
+            keyval.reset();
+            idx64.reset();
+            idx128.reset();
+            idx256.reset();
+            idx_double.reset();
+            idx_long_double.reset();
+         }
+      };
+      using table_iterator_cache_pool = iterator_cache_pool<table_iterator_caches>;
 
       template<typename>
       struct array_size;
@@ -182,7 +124,7 @@ class contract_table_context_base {
 
             using secondary_key_helper_t = secondary_key_helper<secondary_key_type, secondary_key_proxy_type, secondary_key_proxy_const_type>;
 
-            generic_index( contract_table_context_base& c ):context(c){}
+            generic_index( contract_table_context_base& c, iterator_cache<ObjectType>& cache ):context(c),itr_cache(cache){}
 
             int store( uint64_t scope, uint64_t table, const account_name& payer,
                        uint64_t id, secondary_key_proxy_const_type value )
@@ -495,7 +437,7 @@ class contract_table_context_base {
 
          private:
             contract_table_context_base&              context;
-            iterator_cache<ObjectType>  itr_cache;
+            iterator_cache<ObjectType>&               itr_cache;
       }; /// class generic_index
 
    public:
@@ -508,7 +450,8 @@ class contract_table_context_base {
       chainbase::database&                db;
       const account_name&                 receiver;
 
-      key_value_cache                     keyval_cache;
+      table_iterator_caches&              caches;
+      key_value_cache&                    keyval_cache;
 
       generic_index<index64_object>                                  idx64;
       generic_index<index128_object>                                 idx128;
@@ -522,13 +465,22 @@ class contract_table_context_base {
       ,control(c.control)
       ,db(c.db)
       ,receiver(c.get_receiver())
-      ,idx64(*this)
-      ,idx128(*this)
-      ,idx256(*this)
-      ,idx_double(*this)
-      ,idx_long_double(*this)
+      ,caches(table_iterator_cache_pool::thread_pool().acquire())
+      ,keyval_cache(caches.keyval)
+      ,idx64(*this, caches.idx64)
+      ,idx128(*this, caches.idx128)
+      ,idx256(*this, caches.idx256)
+      ,idx_double(*this, caches.idx_double)
+      ,idx_long_double(*this, caches.idx_long_double)
       {}
 
+      contract_table_context_base( const contract_table_context_base& ) = delete;
+      contract_table_context_base& operator=( const contract_table_context_base& ) = delete;
+
+      ~contract_table_context_base() {
+         table_iterator_cache_pool::thread_pool().release();
+      }
+
       int  db_store_i64( name scope, name table, const account_name& payer, uint64_t id, const char* buffer, size_t buffer_size ) {
          return db_store_i64( receiver, scope, table, payer, id, buffer, buffer_size);
       }
@@ -810,6 +762,8 @@ class contract_table_context_base {
          context.update_db_usage(payer, delta);
       }
 
+      static constexpr bool shared_tables = std::is_same_v<Tables, contract_shared_tables>;
+
       const table_id_object* find_table( name code, name scope, name table ) {
          return db.find<table_id_object, by_code_scope_table>(boost::make_tuple(code, scope, table));
       }
@@ -830,6 +784,9 @@ class contract_table_context_base {
          }
 
          update_db_usage(payer, config::billable_size_v<table_id_object>);
+         // shared tables live in the shared db of every shard, they do not tell where the contract keeps its state
+         if constexpr( !shared_tables )
+            control.get_shard_routing().add(code, trx_context.shard_name);
 
          return db.create<table_id_object>([&](table_id_object &t_id){
             t_id.code = code;
@@ -10,6 +10,9 @@
 #include <eosio/chain/account_object.hpp>
 #include <eosio/chain/snapshot.hpp>
 #include <eosio/chain/protocol_feature_manager.hpp>
+#include <eosio/chain/thread_utils.hpp>
+#include <eosio/chain/shard_routing.hpp>
+#include <eosio/chain/xshard_queue.hpp>
 #include <eosio/chain/webassembly/eos-vm-oc/config.hpp>
 
 namespace chainbase {
@@ -75,8 +78,12 @@ namespace eosio { namespace chain {
             path                     state_dir              =  chain::config::default_state_dir_name;
             uint64_t                 state_size             =  chain::config::default_state_size;
             uint64_t                 state_guard_size       =  chain::config::default_state_guard_size;
+            uint64_t                 shard_state_size       =  chain::config::default_shard_state_size;
+            flat_map<shard_name, uint64_t> shard_state_sizes;  //< overrides shard_state_size of the listed shards
             uint32_t                 sig_cpu_bill_pct       =  chain::config::default_sig_cpu_bill_pct;
             uint16_t                 thread_pool_size       =  chain::config::default_controller_thread_pool_size;
+            uint16_t                 shard_thread_pool_size =  chain::config::default_shard_thread_pool_size;
+            thread_affinity_mode     shard_thread_affinity  =  thread_affinity_mode::none;
             uint32_t   max_nonprivileged_inline_action_size =  chain::config::default_max_nonprivileged_inline_action_size;
             bool                     read_only              =  false;
             bool                     force_all_checks       =  false;
@@ -92,6 +99,8 @@ namespace eosio { namespace chain {
             wasm_interface::vm_type  wasm_runtime = chain::config::default_wasm_runtime;
             eosvmoc::config          eosvmoc_config;
             bool                     eosvmoc_tierup         = false;
+            uint64_t                 wasm_preload_budget    = 0; //< bytes of wasm of the codes most used before shutdown to instantiate at startup, 0 disables
+            uint64_t                 wasm_cache_max_size    = 0; //< estimated bytes of instantiated modules to cache, least recently used evicted first; 0 only evicts codes unused since LIB
 
             db_read_mode             read_mode              = db_read_mode::HEAD;
             validation_mode          block_validation_mode  = validation_mode::FULL;
@@ -162,11 +171,23 @@ namespace eosio { namespace chain {
                                                            fc::time_point block_deadline, fc::microseconds max_transaction_time,
                                                            uint32_t billed_cpu_time_us, bool explicit_billed_cpu_time );
 
+         struct shard_report {
+            size_t             num_trxs = 0;
+            uint32_t           dispatch_order = 0; ///< position of the shard in the heaviest first dispatch of the block
+            fc::microseconds   queue_wait_time{}; ///< time between posting the shard to the shard thread pool and it starting
+            fc::microseconds   recovery_wait_time{}; ///< time the shard was parked waiting on signature recovery
+            fc::microseconds   exec_time{};       ///< wall clock time spent executing the shard's transactions
+         };
+
          struct block_report {
             size_t             total_net_usage = 0;
             size_t             total_cpu_usage_us = 0;
             fc::microseconds   total_elapsed_time{};
             fc::microseconds   total_time{};
+            std::map<shard_name, shard_report> shard_reports;
+            fc::microseconds   shard_critical_path_time{};  ///< from dispatching the first shard until the last shard completed
+            fc::microseconds   shard_ideal_parallel_time{}; ///< max(longest shard, total shard time / threads used), critical path with perfect balance
+            fc::microseconds   recovery_wait_time{};        ///< total time shards were parked waiting on signature recovery
          };
 
          block_state_ptr finalize_block( block_report& br, const signer_callback_type& signer_callback );
@@ -194,6 +215,13 @@ namespace eosio { namespace chain {
          const chainbase::database& db()const;
          const database_manager& dbm()const;
 
+         /// blocks between publishing and consuming cross shard messages, per route since startup
+         const std::map<xshard_queue::route, xshard_latency_histogram>& xshard_latencies()const;
+
+         /// shards holding the contract tables of each account, used to place transactions, safe to use from any thread
+         shard_routing_index& get_shard_routing();
+         const shard_routing_index& get_shard_routing()const;
+
          const fork_database& fork_db()const;
 
          const account_object&                 get_account( account_name n )const;
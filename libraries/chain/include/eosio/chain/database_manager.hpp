@@ -2,6 +2,13 @@
 
 #include <chainbase/chainbase.hpp>
 #include <eosio/chain/types.hpp>
+
+#include <boost/asio/io_context.hpp>
+
+#include <functional>
+#include <future>
+#include <set>
+
 namespace eosio{ namespace chain {
 
    /**
@@ -16,6 +23,8 @@ namespace eosio{ namespace chain {
          typedef database::open_flags              open_flags;
 
          using database_index_row_count_multiset = std::multiset<std::pair<unsigned, std::string>>;
+         /// sets up a newly opened shard db, e.g. adds its indices
+         using shard_db_init = std::function<void(database&)>;
 
          database_manager(const path& dir, open_flags write = open_flags::read_only,
                   uint64_t shared_file_size = 0, uint64_t main_file_size = 0,
@@ -25,8 +34,25 @@ namespace eosio{ namespace chain {
          database_manager(database_manager&&) = default;
          database_manager& operator=(database_manager&&) = default;
          bool is_read_only() const { return _read_only; }
+
+         /// writes the dirty pages of every mapped database back to its file
          void flush();
 
+         /// time the last commit and flush took per database, the shared db is listed under config::share_db_name
+         struct db_timing {
+            fc::microseconds commit_time;
+            fc::microseconds flush_time;
+         };
+         const std::map<db_name, db_timing>& db_timings() const { return _db_timings; }
+
+         /**
+          *  Pool used to commit and flush databases concurrently, the calling thread takes part as well.
+          *  Without a pool databases are committed and flushed one after another.
+          *  Shard dbs being prepared on the previous pool are waited for.
+          *  @pre the pool outlives its use by this database_manager or is reset to nullptr before it stops
+          */
+         void set_thread_pool( boost::asio::io_context* thread_pool );
+
          const database& shared_db() const { return _shared_db; }
          database& shared_db() { return _shared_db; }
 
@@ -39,45 +65,52 @@ namespace eosio{ namespace chain {
          database* find_shard_db(const shard_name& name);
          const database* find_shard_db(const shard_name& name) const;
          std::map<db_name, database>& shard_dbs() { return _shard_db_map; }
+         const std::map<db_name, database>& shard_dbs() const { return _shard_db_map; }
 
+         /**
+          *  Block level undo session. The shared and main databases get their undo state when the session
+          *  is started, a sub-shard database only when it is first written, see start_shard_undo_session().
+          */
          struct session {
             public:
-               session( session&& s ):_db_sessions( std::move(s._db_sessions) ){}
-               session( std::vector<std::unique_ptr<database::session>>&& s ):_db_sessions( std::move(s) )
-               {
-               }
+               session( session&& s );
 
                ~session() {
                   undo();
                }
 
-               void push()
-               {
-                  for( auto& i : _db_sessions ) i->push();
-                  _db_sessions.clear();
-               }
-
-               void squash()
-               {
-                  for( auto& i : _db_sessions ) i->squash();
-                  _db_sessions.clear();
-               }
-
-               void undo()
-               {
-                  for( auto& i : _db_sessions ) i->undo();
-                  _db_sessions.clear();
-               }
+               void push();
+               void squash();
+               void undo();
 
             private:
                friend class database_manager;
                session(){}
+               session( database_manager& dbm, std::vector<std::unique_ptr<database::session>>&& s );
 
-               std::vector< std::unique_ptr<database::session> > _db_sessions;
+               void detach();
+
+               database_manager*                                   _dbm = nullptr;
+               std::vector< std::unique_ptr<database::session> >   _db_sessions;
+               std::vector< db_name >                              _shard_names; // sub-shards opened in the session
          };
 
          session start_undo_session( bool enabled );
 
+         /**
+          *  Opens the undo state of the database of a shard in the active block session, must be called before
+          *  the block writes to it. Does nothing for the main shard, if there is no active session or it is already
+          *  opened.
+          */
+         void start_shard_undo_session( const shard_name& name );
+
+         /**
+          *  Sub-shards whose input transaction dedup list holds a transaction expired at `now`. The earliest expiration
+          *  of every sub-shard is kept here and only read again from the shards written, undone or added since the last
+          *  call, so shards without expired transactions are not visited.
+          */
+         std::vector<shard_name> shards_with_expired_transactions( const fc::time_point& now );
+
          int64_t revision()const {
             return _main_db.revision();
          }
@@ -105,7 +138,25 @@ namespace eosio{ namespace chain {
             }
          }
 
-         database* add_shard_db( const shard_name& name, uint64_t shared_file_size = 0 );
+         /**
+          *  Adds the db of a shard. A db opened by prepare_shard_db() is linked in as is, otherwise the db is opened
+          *  here and init is run on it. Does nothing if the shard db already exists.
+          */
+         database* add_shard_db( const shard_name& name, uint64_t shared_file_size = 0, const shard_db_init& init = {} );
+
+         /**
+          *  Opens the db of a shard and runs init on it in the thread pool, so that a later add_shard_db() of the shard
+          *  does not have to map the file and build the indices. Does nothing without a thread pool, or if the shard db
+          *  exists or is already being prepared.
+          */
+         void prepare_shard_db( const shard_name& name, uint64_t shared_file_size, shard_db_init init );
+         bool is_preparing_shard_db( const shard_name& name ) const { return _prepared_shard_dbs.count( name ); }
+
+         /**
+          *  Drops the shard dbs being prepared for which keep returns false, once their preparation is finished, and
+          *  unmaps them. Used for shards whose registration was undone before it became irreversible.
+          */
+         void drop_prepared_shard_dbs( const std::function<bool(const shard_name&)>& keep );
 
          template<typename MultiIndexType>
          void add_index() {
@@ -143,6 +194,7 @@ namespace eosio{ namespace chain {
             }
          }
 
+         /// the catalog is written whenever a commit follows a newly added shard db, and on destruction
          void enable_saving_catalog() {
             _is_saving_catalog = true;
          }
@@ -154,6 +206,15 @@ namespace eosio{ namespace chain {
          pinnable_mapped_file::map_mode   db_map_mode = pinnable_mapped_file::map_mode::mapped;
 
       private:
+         using database_entry = std::pair<db_name, database*>;
+         using shard_db_node  = std::map<db_name, database>::node_type;
+
+         template<typename F>
+         void for_each_db_parallel( const std::vector<database_entry>& dbs, fc::microseconds db_timing::* timing, F&& f );
+
+         /// @return false if the catalog could not be written, the catalog on disk is then left as it was
+         bool try_save_catalog() noexcept;
+
          database                         _shared_db;
          database                         _main_db;
          std::map<db_name, database>      _shard_db_map;
@@ -169,28 +230,52 @@ namespace eosio{ namespace chain {
           */
          bool                             _read_only_mode      = false;
          bool                             _is_saving_catalog   = false;
+         bool                             _catalog_dirty       = false;
+         boost::asio::io_context*         _thread_pool         = nullptr;
+         std::map<db_name, db_timing>     _db_timings;
+         session*                         _active_session      = nullptr;
+         std::set<db_name>                _dedup_changed_shards;   // dedup list possibly changed since last read
+         std::map<db_name, fc::time_point_sec>                 _dedup_expirations; // earliest expiration per sub-shard
+         std::set<std::pair<fc::time_point_sec, db_name>>      _dedup_expirations_by_time;
+         std::map<db_name, std::future<shard_db_node>> _prepared_shard_dbs;
    };
 
-   // struct shard_db_info {
-
-
-   // };
-
-
+   /// a shard db as recorded in the shard db catalog
+   struct shard_db_info {
+      shard_name     name;
+      int64_t        revision = 0;
+      uint64_t       size     = 0;   ///< size of the db file, the db is reopened at least this large
+      digest_type    row_count_digest; ///< over the row count of every index, empty for catalogs of version 1
+
+      /**
+       *  @return digest over the row count of every index of db. It does not cover row contents, so together
+       *  with the revision it only catches a db which is not the one the catalog was written for.
+       */
+      static digest_type calc_row_count_digest( const chainbase::database& db );
+   };
 
+   /**
+    *  Shard dbs of the state, written next to the databases. Version 2 records the revision, size and row count
+    *  digest of every shard db and protects the whole catalog with a checksum; version 1 only listed the shard names.
+    */
    struct shard_db_catalog {
       static const uint32_t magic_number;
       static const uint32_t min_supported_version;
       static const uint32_t max_supported_version;
 
-      std::vector<shard_name> shards;
+      std::vector<shard_db_info> shards;
       std::string error_msg;
 
       static void save(database_manager& dbm);
       static shard_db_catalog load(const fc::path& dir);
+
+      /**
+       *  Checks an opened shard db against its catalog entry, entries of a version 1 catalog are not checked.
+       *  A mismatch throws shard_db_catalog_exception, or is only logged if dirty databases are allowed.
+       */
+      static void validate( const shard_db_info& info, const chainbase::database& db, bool allow_dirty );
    };
 
 }}  // namepsace chainbase
 
-
-// FC_REFLECT(eosio::chain::shard_db_info, (shards))
+FC_REFLECT(eosio::chain::shard_db_info, (name)(revision)(size)(row_count_digest))
@@ -655,6 +655,8 @@ namespace eosio { namespace chain {
                                     3510002, "Unavailable shard exception" )
       FC_DECLARE_DERIVED_EXCEPTION( only_main_shard_allowed_exception,      shard_exception,
                                     3510002, "Only main shard allowed" )
+      FC_DECLARE_DERIVED_EXCEPTION( misplaced_shard_transaction_exception,   shard_exception,
+                                    3510003, "Transaction is not placed on the shard holding its contracts" )
 
       FC_DECLARE_DERIVED_EXCEPTION( shard_db_exception,      shard_exception,
                                     3511000, "shard database exception" )
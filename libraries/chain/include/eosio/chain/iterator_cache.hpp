@@ -0,0 +1,239 @@
+#pragma once
+#include <eosio/chain/exceptions.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace eosio { namespace chain {
+
+   /**
+    *  Open addressing map of 64 bit keys to iterators.
+    *
+    *  Every entry is tagged with the generation it was written in, so reset() only bumps the generation and keeps
+    *  the slots allocated. Entries cannot be erased, callers overwrite stale entries instead.
+    */
+   class iterator_index_map {
+      public:
+         explicit iterator_index_map( size_t capacity = 32 ) {
+            size_t slots = min_slots;
+            while( slots < capacity * 2 )
+               slots *= 2;
+            resize( slots );
+         }
+
+         /// @return iterator of key, nullptr if not present
+         const int* find( uint64_t key )const {
+            for( size_t i = slot_of( key ); ; i = (i + 1) & _mask ) {
+               const auto& s = _slots[i];
+               if( s.generation != _generation )
+                  return nullptr;
+               if( s.key == key )
+                  return &s.value;
+            }
+         }
+
+         /// inserts key or overwrites its iterator
+         void set( uint64_t key, int value ) {
+            if( (_size + 1) * 2 > _slots.size() )
+               grow();
+            insert( key, value );
+         }
+
+         void reset() {
+            _size = 0;
+            if( ++_generation == 0 ) { // wrapped, entries of generation 0 would look current
+               for( auto& s : _slots )
+                  s.generation = 0;
+               _generation = 1;
+            }
+         }
+
+         size_t size()const { return _size; }
+
+      private:
+         struct slot {
+            uint64_t key        = 0;
+            uint32_t generation = 0;
+            int      value      = 0;
+         };
+
+         static constexpr size_t min_slots = 16;
+
+         std::vector<slot> _slots;
+         size_t            _mask = 0;
+         uint32_t          _shift = 0;
+         uint32_t          _generation = 1;
+         size_t            _size = 0;
+
+         /// fibonacci hashing, spreads aligned pointers and sequential ids over the high bits
+         size_t slot_of( uint64_t key )const { return (key * 0x9E3779B97F4A7C15ull) >> _shift; }
+
+         void resize( size_t slots ) {
+            _slots.assign( slots, slot{} );
+            _mask = slots - 1;
+            _shift = 64;
+            for( size_t s = slots; s > 1; s >>= 1 )
+               --_shift;
+         }
+
+         void insert( uint64_t key, int value ) {
+            for( size_t i = slot_of( key ); ; i = (i + 1) & _mask ) {
+               auto& s = _slots[i];
+               if( s.generation != _generation ) {
+                  s = slot{ key, _generation, value };
+                  ++_size;
+                  return;
+               }
+               if( s.key == key ) {
+                  s.value = value;
+                  return;
+               }
+            }
+         }
+
+         void grow() {
+            std::vector<slot> old;
+            old.swap( _slots );
+            const auto generation = _generation;
+            resize( old.size() * 2 );
+            _size = 0;
+            for( const auto& s : old ) {
+               if( s.generation == generation )
+                  insert( s.key, s.value );
+            }
+         }
+   };
+
+   /**
+    *  Maps the objects and tables a contract reaches through the db intrinsics to the integer iterators handed to
+    *  the wasm. Iterators of objects are >= 0, end iterators of tables are < -1 and -1 is reserved for invalid
+    *  iterators (i.e. when the appropriate table has not yet been created).
+    */
+   template<typename T, typename TableIdObject>
+   class iterator_cache {
+      using table_id_type = typename TableIdObject::id_type;
+
+      public:
+         iterator_cache()
+         :_table_cache(8)
+         ,_object_to_iterator(32)
+         {
+            _end_iterator_to_table.reserve(8);
+            _iterator_to_object.reserve(32);
+         }
+
+         /// Forgets all iterators, keeping the storage for the next action.
+         void reset() {
+            _table_cache.reset();
+            _end_iterator_to_table.clear();
+            _iterator_to_object.clear();
+            _object_to_iterator.reset();
+         }
+
+         /// Returns end iterator of the table.
+         int cache_table( const TableIdObject& tobj ) {
+            if( auto ei = _table_cache.find( table_key(tobj.id) ) )
+               return *ei;
+
+            auto ei = index_to_end_iterator(_end_iterator_to_table.size());
+            _end_iterator_to_table.push_back( &tobj );
+            _table_cache.set( table_key(tobj.id), ei );
+            return ei;
+         }
+
+         const TableIdObject& get_table( table_id_type i )const {
+            auto ei = _table_cache.find( table_key(i) );
+            EOS_ASSERT( ei, table_not_in_cache, "an invariant was broken, table should be in cache" );
+            return *_end_iterator_to_table[end_iterator_to_index(*ei)];
+         }
+
+         int get_end_iterator_by_table_id( table_id_type i )const {
+            auto ei = _table_cache.find( table_key(i) );
+            EOS_ASSERT( ei, table_not_in_cache, "an invariant was broken, table should be in cache" );
+            return *ei;
+         }
+
+         const TableIdObject* find_table_by_end_iterator( int ei )const {
+            EOS_ASSERT( ei < -1, invalid_table_iterator, "not an end iterator" );
+            auto indx = end_iterator_to_index(ei);
+            if( indx >= _end_iterator_to_table.size() ) return nullptr;
+            return _end_iterator_to_table[indx];
+         }
+
+         const T& get( int iterator ) {
+            EOS_ASSERT( iterator != -1, invalid_table_iterator, "invalid iterator" );
+            EOS_ASSERT( iterator >= 0, table_operation_not_permitted, "dereference of end iterator" );
+            EOS_ASSERT( (size_t)iterator < _iterator_to_object.size(), invalid_table_iterator, "iterator out of range" );
+            auto result = _iterator_to_object[iterator];
+            EOS_ASSERT( result, table_operation_not_permitted, "dereference of deleted object" );
+            return *result;
+         }
+
+         void remove( int iterator ) {
+            EOS_ASSERT( iterator != -1, invalid_table_iterator, "invalid iterator" );
+            EOS_ASSERT( iterator >= 0, table_operation_not_permitted, "cannot call remove on end iterators" );
+            EOS_ASSERT( (size_t)iterator < _iterator_to_object.size(), invalid_table_iterator, "iterator out of range" );
+
+            // the entry in _object_to_iterator goes stale and is overwritten by add() if the address is reused
+            _iterator_to_object[iterator] = nullptr;
+         }
+
+         int add( const T& obj ) {
+            auto itr = _object_to_iterator.find( object_key(obj) );
+            if( itr && _iterator_to_object[*itr] == &obj )
+               return *itr;
+
+            _iterator_to_object.push_back( &obj );
+            int result = _iterator_to_object.size() - 1;
+            _object_to_iterator.set( object_key(obj), result );
+
+            return result;
+         }
+
+      private:
+         iterator_index_map                _table_cache;
+         std::vector<const TableIdObject*> _end_iterator_to_table;
+         std::vector<const T*>             _iterator_to_object;
+         iterator_index_map                _object_to_iterator;
+
+         static uint64_t table_key( table_id_type i ) { return static_cast<uint64_t>(i._id); }
+         static uint64_t object_key( const T& obj ) { return reinterpret_cast<uintptr_t>(&obj); }
+
+         /// Precondition: std::numeric_limits<int>::min() < ei < -1
+         inline size_t end_iterator_to_index( int ei )const { return (-ei - 2); }
+         /// Precondition: indx < _end_iterator_to_table.size() <= std::numeric_limits<int>::max()
+         inline int index_to_end_iterator( size_t indx )const { return -(indx + 2); }
+   }; /// class iterator_cache
+
+   /**
+    *  Per thread stack of iterator cache sets, so actions reuse the storage of earlier actions instead of
+    *  allocating their own.
+    *
+    *  Action contexts nest: an inline action runs while the context of the action that sent it is still alive. A
+    *  set is therefore leased for the lifetime of a context and released in reverse order.
+    */
+   template<typename Caches>
+   class iterator_cache_pool {
+      public:
+         Caches& acquire() {
+            if( _in_use == _caches.size() )
+               _caches.emplace_back( std::make_unique<Caches>() );
+            auto& caches = *_caches[_in_use++];
+            caches.reset();
+            return caches;
+         }
+
+         void release() { --_in_use; }
+
+         static iterator_cache_pool& thread_pool() {
+            thread_local iterator_cache_pool pool;
+            return pool;
+         }
+
+      private:
+         std::vector<std::unique_ptr<Caches>> _caches;
+         size_t                               _in_use = 0;
+   };
+
+} } // eosio::chain
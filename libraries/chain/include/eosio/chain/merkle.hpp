@@ -19,4 +19,10 @@ namespace eosio { namespace chain {
     */
    digest_type merkle( deque<digest_type> ids );
 
+   /**
+    *  Calculates the merkle root of a block from the merkle roots of its shards, taken in shard name order.
+    *  A block with a single shard has the root of that shard.
+    */
+   digest_type merkle( const flat_map<shard_name, digest_type>& shard_roots );
+
 } } /// eosio::chain
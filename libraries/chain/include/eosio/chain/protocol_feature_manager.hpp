@@ -35,6 +35,9 @@ enum class builtin_protocol_feature_t : uint32_t {
    configurable_wasm_limits = 18, // configurable_wasm_limits2,
    crypto_primitives = 19,
    get_block_num = 20,
+   shard_resource_accounting = 21,
+   shard_merkle_roots = 22,
+   xshard_target_shard = 23,
    reserved_private_fork_protocol_features = 500000,
 };
 
@@ -4,6 +4,7 @@
 #include <eosio/chain/config.hpp>
 #include <eosio/chain/trace.hpp>
 #include <eosio/chain/snapshot.hpp>
+#include <eosio/chain/chain_snapshot.hpp>
 #include <eosio/chain/block_timestamp.hpp>
 #include <chainbase/chainbase.hpp>
 #include <eosio/chain/database_manager.hpp>
@@ -66,9 +67,13 @@ namespace eosio { namespace chain {
    class resource_limits_manager {
       public:
 
-         explicit resource_limits_manager( eosio::chain::database_manager& dbm, std::function<deep_mind_handler*(bool is_trx_transient)> get_deep_mind_logger )
+         /// @param is_shard_accounting_activated reports whether SHARD_RESOURCE_ACCOUNTING is active for the pending block,
+         ///        until then all shards are billed against the single chain-wide state
+         explicit resource_limits_manager( eosio::chain::database_manager& dbm, std::function<deep_mind_handler*(bool is_trx_transient)> get_deep_mind_logger,
+                                           std::function<bool()> is_shard_accounting_activated = {} )
          :_dbm(dbm)
          ,_get_deep_mind_logger(get_deep_mind_logger)
+         ,_is_shard_accounting_activated(std::move(is_shard_accounting_activated))
          {
          }
 
@@ -79,15 +84,23 @@ namespace eosio { namespace chain {
          void initialize_database();
          void add_to_snapshot( const snapshot_writer_ptr& snapshot ) const;
          void read_from_snapshot( const snapshot_reader_ptr& snapshot );
+         /// resource sections of any shard database, including the block usage and elastic limits of a sub-shard
+         static void add_to_snapshot( const chainbase::database& db, const snapshot_writer_ptr& snapshot );
+         static void read_from_snapshot( chainbase::database& db, const snapshot_reader_ptr& snapshot, const chain_snapshot_header& header );
 
          void initialize_account( const account_name& account, bool is_trx_transient );
          void set_block_parameters( const elastic_limit_parameters& cpu_limit_parameters, const elastic_limit_parameters& net_limit_parameters );
 
-         void update_account_usage( const flat_set<account_name>& accounts, uint32_t ordinal, chainbase::database& db, chainbase::database& shared_db);
-         void add_transaction_usage( const flat_set<account_name>& accounts, uint64_t cpu_usage, uint64_t net_usage, uint32_t ordinal, chainbase::database& db, chainbase::database& shared_db, bool is_trx_transient = false );
+         /**
+          *  Transaction execution only writes the db of its shard, the shared db is read for the limits and weights.
+          *  Usage of a sub-shard is accumulated in its own resource_limits_shard_state_object and merged in
+          *  shard name order by process_block_usage(), so shards executing in parallel never touch a common row.
+          */
+         void update_account_usage( const flat_set<account_name>& accounts, uint32_t ordinal, chainbase::database& db, const chainbase::database& shared_db);
+         void add_transaction_usage( const flat_set<account_name>& accounts, uint64_t cpu_usage, uint64_t net_usage, uint32_t ordinal, chainbase::database& db, const chainbase::database& shared_db, bool is_trx_transient = false );
 
          void add_pending_ram_usage( const account_name account, int64_t ram_delta, chainbase::database& db, bool is_trx_transient = false );
-         void verify_account_ram_usage( const account_name accunt, chainbase::database& db, chainbase::database& shared_db )const;
+         void verify_account_ram_usage( const account_name accunt, chainbase::database& db, const chainbase::database& shared_db )const;
 
          /// set_account_limits returns true if new ram_bytes limit is more restrictive than the previously set one
          bool set_account_limits( const account_name& account, int64_t ram_bytes, int64_t net_weight, int64_t cpu_weight, chainbase::database& shared_db, bool is_trx_transient);
@@ -105,8 +118,17 @@ namespace eosio { namespace chain {
          uint64_t get_virtual_block_cpu_limit() const;
          uint64_t get_virtual_block_net_limit() const;
 
-         uint64_t get_block_cpu_limit( const chainbase::database& shared_db ) const;
-         uint64_t get_block_net_limit( const chainbase::database& shared_db ) const;
+         /// remaining block budget of the shard owning `db`
+         uint64_t get_block_cpu_limit( const chainbase::database& db, const chainbase::database& shared_db ) const;
+         uint64_t get_block_net_limit( const chainbase::database& db, const chainbase::database& shared_db ) const;
+
+         /// usage of the pending block billed to the shard owning `db`
+         uint64_t get_block_cpu_usage( const chainbase::database& db, const chainbase::database& shared_db ) const;
+         uint64_t get_block_net_usage( const chainbase::database& db, const chainbase::database& shared_db ) const;
+
+         /// block-level cap on the sum of the usage of all shards
+         uint64_t get_total_block_cpu_limit( const chainbase::database& shared_db ) const;
+         uint64_t get_total_block_net_limit( const chainbase::database& shared_db ) const;
 
          std::pair<int64_t, bool> get_account_cpu_limit( const account_name& name, chainbase::database& db, const chainbase::database& shared_db, uint32_t greylist_limit = config::maximum_elastic_resource_multiplier ) const;
          std::pair<int64_t, bool> get_account_net_limit( const account_name& name, chainbase::database& db, const chainbase::database& shared_db, uint32_t greylist_limit = config::maximum_elastic_resource_multiplier ) const;
@@ -124,8 +146,11 @@ namespace eosio { namespace chain {
          int64_t get_account_ram_usage( const account_name& name , chainbase::database& db) const;
 
       private:
+         bool shard_accounting_activated() const { return _is_shard_accounting_activated && _is_shard_accounting_activated(); }
+
          eosio::chain::database_manager&     _dbm;
          std::function<deep_mind_handler*(bool is_trx_transient)> _get_deep_mind_logger;
+         std::function<bool()>               _is_shard_accounting_activated;
    };
 } } } /// eosio::chain
 
@@ -324,12 +324,42 @@ namespace eosio { namespace chain { namespace resource_limits {
       >
    >;
 
+   /**
+    * Block usage and elastic limits of a sub-shard. It lives in the shard's own database so that shards
+    * running in parallel never contend on a shared counter; the main shard uses resource_limits_state_object.
+    */
+   class resource_limits_shard_state_object : public chainbase::object<resource_limits_shard_state_object_type, resource_limits_shard_state_object> {
+      OBJECT_CTOR(resource_limits_shard_state_object);
+      id_type id;
+
+      usage_accumulator average_block_net_usage;
+      usage_accumulator average_block_cpu_usage;
+
+      void update_virtual_net_limit( const resource_limits_config_object& cfg );
+      void update_virtual_cpu_limit( const resource_limits_config_object& cfg );
+
+      uint64_t pending_net_usage = 0ULL;
+      uint64_t pending_cpu_usage = 0ULL;
+
+      /// elastic limits of the shard, see resource_limits_state_object
+      uint64_t virtual_net_limit = 0ULL;
+      uint64_t virtual_cpu_limit = 0ULL;
+   };
+
+   using resource_limits_shard_state_index = chainbase::shared_multi_index_container<
+      resource_limits_shard_state_object,
+      indexed_by<
+         ordered_unique<tag<by_id>, member<resource_limits_shard_state_object, resource_limits_shard_state_object::id_type, &resource_limits_shard_state_object::id>>
+      >
+   >;
+
 } } } /// eosio::chain::resource_limits
 
 CHAINBASE_SET_INDEX_TYPE(eosio::chain::resource_limits::resource_limits_object,        eosio::chain::resource_limits::resource_limits_index)
 CHAINBASE_SET_INDEX_TYPE(eosio::chain::resource_limits::resource_usage_object,         eosio::chain::resource_limits::resource_usage_index)
 CHAINBASE_SET_INDEX_TYPE(eosio::chain::resource_limits::resource_limits_config_object, eosio::chain::resource_limits::resource_limits_config_index)
 CHAINBASE_SET_INDEX_TYPE(eosio::chain::resource_limits::resource_limits_state_object,  eosio::chain::resource_limits::resource_limits_state_index)
+CHAINBASE_SET_INDEX_TYPE(eosio::chain::resource_limits::resource_limits_shard_state_object, eosio::chain::resource_limits::resource_limits_shard_state_index)
 
 FC_REFLECT(eosio::chain::resource_limits::usage_accumulator, (last_ordinal)(value_ex)(consumed))
 
@@ -338,3 +368,4 @@ FC_REFLECT(eosio::chain::resource_limits::resource_limits_object, (owner)(net_we
 FC_REFLECT(eosio::chain::resource_limits::resource_usage_object,  (owner)(net_usage)(cpu_usage)(ram_usage))
 FC_REFLECT(eosio::chain::resource_limits::resource_limits_config_object, (cpu_limit_parameters)(net_limit_parameters)(account_cpu_usage_average_window)(account_net_usage_average_window))
 FC_REFLECT(eosio::chain::resource_limits::resource_limits_state_object, (average_block_net_usage)(average_block_cpu_usage)(pending_net_usage)(pending_cpu_usage)(total_net_weight)(total_cpu_weight)(total_ram_bytes)(virtual_net_limit)(virtual_cpu_limit))
+FC_REFLECT(eosio::chain::resource_limits::resource_limits_shard_state_object, (average_block_net_usage)(average_block_cpu_usage)(pending_net_usage)(pending_cpu_usage)(virtual_net_limit)(virtual_cpu_limit))
@@ -0,0 +1,51 @@
+#pragma once
+#include <eosio/chain/types.hpp>
+
+#include <map>
+#include <optional>
+#include <shared_mutex>
+
+namespace chainbase { class database; }
+
+namespace eosio { namespace chain {
+
+   /**
+    *  Records which shard databases hold contract tables of an account, so transactions can be placed on the
+    *  shard holding the state of their contracts.
+    *
+    *  The index is a hint and only ever grows: a shard is added when a contract creates a table on it and is not
+    *  removed when the table is erased or the creating transaction is undone. It is rebuilt from the shard
+    *  databases on startup. Shard threads add to it while api and producer threads read it. Lookups and adds of a
+    *  contract that is already recorded for the shard only take a shared lock, so shard threads do not serialize
+    *  on the index; the exclusive lock is taken only when the hint changes.
+    */
+   class shard_routing_index {
+      public:
+         void add( const account_name& code, const shard_name& shard );
+
+         /// adds the code of every contract table in db
+         void add_shard_db( const shard_name& shard, const chainbase::database& db );
+
+         void clear();
+
+         /// @return shards holding tables of code
+         flat_set<shard_name> get_shards( const account_name& code ) const;
+
+         /// @return true if shard holds tables of any of accounts
+         bool holds_any( const shard_name& shard, const flat_set<account_name>& accounts ) const;
+
+         /// @return true if every one of accounts has tables on some shard
+         bool all_routed( const flat_set<account_name>& accounts ) const;
+
+         /**
+          *  @return the shard holding tables of most of accounts, on a tie main and then the lowest shard name,
+          *  nullopt if no shard holds tables of any of them
+          */
+         std::optional<shard_name> suggest_shard( const flat_set<account_name>& accounts ) const;
+
+      private:
+         mutable std::shared_mutex                        _mtx;
+         std::map<account_name, flat_set<shard_name>>     _shards;
+   };
+
+} } // eosio::chain
@@ -5,13 +5,48 @@
 #include <fc/log/logger_config.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/post.hpp>
+#include <atomic>
 #include <future>
 #include <memory>
 #include <optional>
 #include <thread>
+#include <vector>
 
 namespace eosio { namespace chain {
 
+   enum class thread_affinity_mode {
+      none, ///< threads are left to the OS scheduler
+      core, ///< each thread is pinned to one of the cpus available to the process
+      numa  ///< like core, but cpus are handed out node by node so threads fill one NUMA node before the next
+   };
+
+   /// @return number of threads to start, configured_size of 0 means one thread per available hardware thread
+   size_t resolve_thread_pool_size( size_t configured_size );
+
+   /**
+    * Pins threads of a thread pool to cpus according to a thread_affinity_mode.
+    * Intended to be called from the init function of named_thread_pool::start(), e.g.
+    * @code{.cpp}
+    * thread_affinity affinity( thread_affinity_mode::core );
+    * pool.start( n, on_except, [&]() { affinity.pin_current_thread(); } );
+    * @endcode
+    * start() blocks until all init functions complete, so affinity only needs to outlive start().
+    */
+   class thread_affinity {
+   public:
+      explicit thread_affinity( thread_affinity_mode mode );
+
+      /// Pin the calling thread to the next cpu, wrapping around when there are more threads than cpus.
+      /// No-op for thread_affinity_mode::none or when thread affinity is not supported by the platform.
+      void pin_current_thread();
+
+      const std::vector<uint32_t>& cpus() const { return _cpus; }
+
+   private:
+      std::vector<uint32_t> _cpus;
+      std::atomic<size_t>   _next{0};
+   };
+
    /**
     * Wrapper class for thread pool of boost asio io_context run.
     * Also names threads so that tools like htop can see thread name.
@@ -199,6 +199,7 @@ namespace eosio { namespace chain {
       shared_index256_object_type            = 58,
       shared_index_double_object_type        = 59,
       shared_index_long_double_object_type   = 60,
+      resource_limits_shard_state_object_type = 61,
       OBJECT_TYPE_COUNT ///< Sentry value which contains the number of different object types
    };
 
@@ -3,21 +3,42 @@
 #include <eosio/chain/types.hpp>
 #include <eosio/chain/whitelisted_intrinsics.hpp>
 #include <eosio/chain/exceptions.hpp>
+#include <eosio/chain/webassembly/eos-vm-oc/config.hpp>
 #include <functional>
+#include <memory>
 #include "Runtime/Linker.h"
 #include "Runtime/Runtime.h"
 
+namespace boost { namespace asio { class io_context; } }
+
 namespace eosio { namespace chain {
 
    class apply_context;
    class wasm_runtime_interface;
    class controller;
-   namespace eosvmoc { struct config; }
 
    struct wasm_exit {
       int32_t code = 0;
    };
 
+   /// a code of the instantiation cache, saved at shutdown so a restart can instantiate it ahead of use
+   struct wasm_hot_code {
+      digest_type code_hash;
+      uint8_t     vm_type = 0;
+      uint8_t     vm_version = 0;
+      uint32_t    last_used_lib = 0; ///< LIB when the code was last executed
+      uint64_t    uses = 0;          ///< executions since the code was instantiated
+   };
+
+   /// counters of the instantiation cache since startup
+   struct wasm_cache_stats {
+      uint64_t hits = 0;      ///< executions that found an idle instantiated module
+      uint64_t misses = 0;    ///< executions that had to instantiate a module
+      uint64_t evictions = 0; ///< codes evicted with their modules
+      uint64_t codes = 0;     ///< codes currently cached
+      uint64_t bytes = 0;     ///< estimated size of the cached modules, the size of their code per module
+   };
+
    /**
     * @class wasm_interface
     *
@@ -42,7 +63,9 @@ namespace eosio { namespace chain {
              }
          }
 
-         wasm_interface(vm_type vm, bool eosvmoc_tierup, const boost::filesystem::path data_dir, const eosvmoc::config& eosvmoc_config, bool profile);
+         //max_cache_size bounds the estimated size of the instantiated modules, evicting the least recently used codes
+         //once exceeded. The codes not used since the LIB are evicted either way, 0 does not bound the size.
+         wasm_interface(vm_type vm, bool eosvmoc_tierup, const boost::filesystem::path data_dir, const eosvmoc::config& eosvmoc_config, bool profile, uint64_t max_cache_size);
          ~wasm_interface();
 
          // initialize exec per thread
@@ -57,7 +80,7 @@ namespace eosio { namespace chain {
          //indicate that a particular code probably won't be used after given block_num
          void code_block_num_last_used(const digest_type& code_hash, const uint8_t& vm_type, const uint8_t& vm_version, const uint32_t& block_num);
 
-         //indicate the current LIB. evicts old cache entries
+         //indicate the current LIB. evicts old cache entries, then the least recently used ones over max_cache_size
          void current_lib(const uint32_t lib);
 
          //Calls apply or error on a given code
@@ -66,6 +89,32 @@ namespace eosio { namespace chain {
          //Returns true if the code is cached
          bool is_code_cached(const digest_type& code_hash, const uint8_t& vm_type, const uint8_t& vm_version) const;
 
+         //Returns hits, misses and evictions of the instantiation cache
+         wasm_cache_stats get_cache_stats() const;
+
+         //Returns progress of EOS VM OC tier-up compiles, empty if tier-up is not enabled
+         std::optional<eosvmoc::compile_stats> get_eosvmoc_compile_stats() const;
+
+         //Returns the codes of the instantiation cache, most used first
+         std::vector<wasm_hot_code> get_hot_codes() const;
+
+         //Instantiates code in to the instantiation cache unless an instance exists or is being created. May be
+         //called from any thread, execution of the code waits for a preload in progress instead of duplicating it.
+         void preload(const wasm_hot_code& hot_code, const char* code, size_t code_size);
+
+         //Runs preload() of code on ctx, failures are logged. The preload counts as pending from this call on.
+         void preload_async(boost::asio::io_context& ctx, const wasm_hot_code& hot_code, std::shared_ptr<const std::vector<char>> code);
+
+         //Returns once every preload_async() called so far is done, ctx must keep running until then
+         void wait_for_preloads();
+
+         //Writes hot_codes to file, an empty list is not written so a node stopped before executing any code keeps
+         //the list of its previous run. Errors are logged, not thrown.
+         static void save_hot_codes(const boost::filesystem::path& file, const std::vector<wasm_hot_code>& hot_codes);
+
+         //Returns the codes written by save_hot_codes, empty if file does not exist or is unusable
+         static std::vector<wasm_hot_code> load_hot_codes(const boost::filesystem::path& file);
+
          // If substitute_apply is set, then apply calls it before doing anything else. If substitute_apply returns true,
          // then apply returns immediately.
          std::function<bool(
@@ -82,3 +131,4 @@ namespace eosio{ namespace chain {
 }}
 
 FC_REFLECT_ENUM( eosio::chain::wasm_interface::vm_type, (eos_vm)(eos_vm_jit)(eos_vm_oc) )
+FC_REFLECT( eosio::chain::wasm_hot_code, (code_hash)(vm_type)(vm_version)(last_used_lib)(uses) )
@@ -14,6 +14,12 @@
 #include <eosio/chain/exceptions.hpp>
 #include <fc/scoped_exit.hpp>
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+
 #include "IR/Module.h"
 #include "Runtime/Intrinsics.h"
 #include "Platform/Platform.h"
@@ -35,13 +41,52 @@ namespace eosio { namespace chain {
    namespace eosvmoc { struct config; }
 
    struct wasm_interface_impl {
+      using module_ptr = std::unique_ptr<wasm_instantiated_module_interface>;
+
+      /// instantiated modules of one code, an instantiated module is used by one thread at a time
       struct wasm_cache_entry {
          digest_type                                          code_hash;
-         uint32_t                                             last_block_num_used;
-         std::unique_ptr<wasm_instantiated_module_interface>  module;
+         uint32_t                                             last_block_num_used = UINT32_MAX;
          uint8_t                                              vm_type = 0;
          uint8_t                                              vm_version = 0;
+         std::atomic<uint64_t>                                uses{0};
+         std::atomic<uint32_t>                                last_used_lib{0};
+         std::atomic<uint64_t>                                last_use_tick{0};      // order of last execution among all codes
+
+         std::mutex                                           mtx;
+         std::condition_variable                              cv;
+         std::vector<module_ptr>                              idle_modules;          // protected by mtx
+         bool                                                 instantiating = false; // protected by mtx
+         uint64_t                                             module_bytes = 0;      // protected by mtx
+         bool                                                 evicted = false;       // protected by mtx
       };
+      using wasm_cache_entry_ptr = std::shared_ptr<wasm_cache_entry>;
+
+      /// exclusive use of an instantiated module, handed back to its cache entry on destruction
+      class module_lease {
+         public:
+            module_lease( wasm_cache_entry_ptr entry, module_ptr module )
+            : _entry( std::move(entry) ), _module( std::move(module) ) {}
+            module_lease( module_lease&& ) = default;
+            module_lease( const module_lease& ) = delete;
+
+            ~module_lease() {
+               if( !_module )
+                  return;
+               {
+                  std::lock_guard g( _entry->mtx );
+                  _entry->idle_modules.push_back( std::move(_module) );
+               }
+               _entry->cv.notify_one();
+            }
+
+            wasm_instantiated_module_interface* operator->() const { return _module.get(); }
+
+         private:
+            wasm_cache_entry_ptr  _entry; // kept alive even if evicted while leased
+            module_ptr            _module;
+      };
+
       struct by_hash;
       struct by_first_block_num;
       struct by_last_block_num;
@@ -67,7 +112,8 @@ namespace eosio { namespace chain {
       };
 #endif
 
-      wasm_interface_impl(wasm_interface::vm_type vm, bool eosvmoc_tierup, const boost::filesystem::path data_dir, const eosvmoc::config& eosvmoc_config, bool profile) : wasm_runtime_time(vm) {
+      wasm_interface_impl(wasm_interface::vm_type vm, bool eosvmoc_tierup, const boost::filesystem::path data_dir, const eosvmoc::config& eosvmoc_config, bool profile, uint64_t max_cache_size)
+      : max_cache_size(max_cache_size), wasm_runtime_time(vm) {
 #ifdef EOSIO_EOS_VM_RUNTIME_ENABLED
          if(vm == wasm_interface::vm_type::eos_vm)
             runtime_interface = std::make_unique<webassembly::eos_vm_runtime::eos_vm_runtime<eosio::vm::interpreter>>();
@@ -97,74 +143,283 @@ namespace eosio { namespace chain {
 
       ~wasm_interface_impl() {
          if(is_shutting_down)
-            for(wasm_cache_index::iterator it = wasm_instantiation_cache.begin(); it != wasm_instantiation_cache.end(); ++it)
-               wasm_instantiation_cache.modify(it, [](wasm_cache_entry& e) {
-                  e.module.release()->fast_shutdown();
-               });
+            for(auto& bucket : wasm_instantiation_cache)
+               for(const auto& e : bucket.index)
+                  for(auto& m : e->idle_modules)
+                     m.release()->fast_shutdown();
       }
 
       bool is_code_cached(const digest_type& code_hash, const uint8_t& vm_type, const uint8_t& vm_version) const {
-         wasm_cache_index::iterator it = wasm_instantiation_cache.find( boost::make_tuple(code_hash, vm_type, vm_version) );
-         return it != wasm_instantiation_cache.end();
+         const auto& bucket = bucket_for(code_hash);
+         std::shared_lock g(bucket.mtx);
+         return bucket.index.find( boost::make_tuple(code_hash, vm_type, vm_version) ) != bucket.index.end();
+      }
+
+      wasm_cache_stats get_cache_stats() const {
+         wasm_cache_stats stats;
+         stats.hits      = cache_hits.load(std::memory_order_relaxed);
+         stats.misses    = cache_misses.load(std::memory_order_relaxed);
+         stats.evictions = cache_evictions.load(std::memory_order_relaxed);
+         stats.bytes     = cached_bytes.load(std::memory_order_relaxed);
+         for(const auto& bucket : wasm_instantiation_cache) {
+            std::shared_lock g(bucket.mtx);
+            stats.codes += bucket.index.size();
+         }
+         return stats;
       }
 
+      // may be called from any thread, applied in current_lib() which is the only reader of last_block_num_used
       void code_block_num_last_used(const digest_type& code_hash, const uint8_t& vm_type, const uint8_t& vm_version, const uint32_t& block_num) {
-         wasm_cache_index::iterator it = wasm_instantiation_cache.find(boost::make_tuple(code_hash, vm_type, vm_version));
-         if(it != wasm_instantiation_cache.end())
-            wasm_instantiation_cache.modify(it, [block_num](wasm_cache_entry& e) {
-               e.last_block_num_used = block_num;
-            });
+         std::lock_guard g(last_used_mtx);
+         pending_last_used.push_back({code_hash, vm_type, vm_version, block_num});
       }
 
       void current_lib(uint32_t lib) {
-         //anything last used before or on the LIB can be evicted
-         const auto first_it = wasm_instantiation_cache.get<by_last_block_num>().begin();
-         const auto last_it  = wasm_instantiation_cache.get<by_last_block_num>().upper_bound(lib);
+         lib_num = lib;
+         std::vector<last_used_update> updates;
+         {
+            std::lock_guard g(last_used_mtx);
+            updates.swap(pending_last_used);
+         }
+         for(const auto& u : updates) {
+            auto& bucket = bucket_for(u.code_hash);
+            std::unique_lock g(bucket.mtx);
+            auto it = bucket.index.find(boost::make_tuple(u.code_hash, u.vm_type, u.vm_version));
+            if(it != bucket.index.end())
+               bucket.index.modify(it, [&](wasm_cache_entry_ptr& e) {
+                  e->last_block_num_used = u.block_num;
+               });
+         }
+
 #ifdef EOSIO_EOS_VM_OC_RUNTIME_ENABLED
-         if(eosvmoc) for(auto it = first_it; it != last_it; it++)
-            eosvmoc->cc.free_code(it->code_hash, it->vm_version);
+         if(eosvmoc)
+            eosvmoc->cc.run_pending_eviction();
 #endif
-         wasm_instantiation_cache.get<by_last_block_num>().erase(first_it, last_it);
+
+         //anything last used before or on the LIB can be evicted, modules still leased are destroyed when handed back
+         for(auto& bucket : wasm_instantiation_cache) {
+            std::unique_lock g(bucket.mtx);
+            const auto first_it = bucket.index.get<by_last_block_num>().begin();
+            const auto last_it  = bucket.index.get<by_last_block_num>().upper_bound(lib);
+            for(auto it = first_it; it != last_it; it++) {
+#ifdef EOSIO_EOS_VM_OC_RUNTIME_ENABLED
+               // EOS VM OC code is only freed on the main thread, outside of parallel shard execution
+               if(eosvmoc)
+                  eosvmoc->cc.free_code((*it)->code_hash, (*it)->vm_version);
+#endif
+               retire_entry(**it);
+            }
+            bucket.index.get<by_last_block_num>().erase(first_it, last_it);
+         }
+
+         if(max_cache_size) {
+            std::lock_guard g(evict_mtx);
+            evict_least_recently_used();
+         }
+      }
+
+      // called after a module is instantiated, the thread which went over max_cache_size evicts unless another thread
+      // already is
+      void evict_over_max_cache_size() {
+         if(!max_cache_size || cached_bytes.load() <= max_cache_size)
+            return;
+         std::unique_lock g(evict_mtx, std::try_to_lock);
+         if(g.owns_lock())
+            evict_least_recently_used();
+      }
+
+      // evicts the codes used least recently until the estimated size of the cached modules is within max_cache_size,
+      // called with evict_mtx held so there is a single evicting thread. Only the instantiated modules are dropped, the
+      // EOS VM OC code of a code is freed once it is replaced, in current_lib()
+      void evict_least_recently_used() {
+         if(cached_bytes.load() <= max_cache_size)
+            return;
+         std::vector<std::pair<uint64_t, wasm_cache_entry_ptr>> by_last_use;
+         for(const auto& bucket : wasm_instantiation_cache) {
+            std::shared_lock g(bucket.mtx);
+            for(const auto& e : bucket.index)
+               by_last_use.emplace_back(e->last_use_tick.load(std::memory_order_relaxed), e);
+         }
+         std::sort(by_last_use.begin(), by_last_use.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+         for(const auto& u : by_last_use) {
+            if(cached_bytes.load() <= max_cache_size)
+               break;
+            auto& e = *u.second;
+            auto& bucket = bucket_for(e.code_hash);
+            std::unique_lock g(bucket.mtx);
+            auto it = bucket.index.find(boost::make_tuple(e.code_hash, e.vm_type, e.vm_version));
+            if(it == bucket.index.end())
+               continue;
+            {
+               std::lock_guard eg(e.mtx);
+               if(!e.module_bytes) // executed by EOS VM OC only, nothing to free
+                  continue;
+            }
+            retire_entry(e);
+            bucket.index.erase(it);
+         }
+      }
+
+      // called with the lock of the bucket of e held, right before e is erased from it
+      void retire_entry(wasm_cache_entry& e) {
+         std::lock_guard g(e.mtx);
+         e.evicted = true;
+         cached_bytes -= e.module_bytes;
+         cache_evictions.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      // the size of the code stands in for the footprint of a module instantiated from it, which grows with it
+      void account_module(wasm_cache_entry& e, size_t code_size) {
+         std::lock_guard g(e.mtx);
+         if(e.evicted) // freed with the entry once its last lease is gone
+            return;
+         e.module_bytes += code_size;
+         cached_bytes += code_size;
       }
 
-      const std::unique_ptr<wasm_instantiated_module_interface>& get_instantiated_module( const digest_type& code_hash, const uint8_t& vm_type,
-                                                                                 const uint8_t& vm_version, transaction_context& trx_context )
+      wasm_cache_entry_ptr get_or_create_entry( const digest_type& code_hash, const uint8_t& vm_type, const uint8_t& vm_version ) {
+         auto& bucket = bucket_for(code_hash);
+         const auto key = boost::make_tuple(code_hash, vm_type, vm_version);
+         {
+            std::shared_lock g(bucket.mtx);
+            auto it = bucket.index.find(key);
+            if(it != bucket.index.end())
+               return *it;
+         }
+         std::unique_lock g(bucket.mtx);
+         auto it = bucket.index.find(key);
+         if(it == bucket.index.end()) {
+            auto e = std::make_shared<wasm_cache_entry>();
+            e->code_hash = code_hash;
+            e->vm_type = vm_type;
+            e->vm_version = vm_version;
+            it = bucket.index.insert(std::move(e)).first;
+         }
+         return *it;
+      }
+
+      std::vector<wasm_hot_code> get_hot_codes() const {
+         std::vector<wasm_hot_code> result;
+         for(const auto& bucket : wasm_instantiation_cache) {
+            std::shared_lock g(bucket.mtx);
+            for(const auto& e : bucket.index)
+               result.push_back({e->code_hash, e->vm_type, e->vm_version, e->last_used_lib.load(), e->uses.load()});
+         }
+         std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) {
+            return std::tie(a.uses, a.last_used_lib) > std::tie(b.uses, b.last_used_lib);
+         });
+         return result;
+      }
+
+      void preload( const wasm_hot_code& hot_code, const char* code, size_t code_size ) {
+         auto entry = get_or_create_entry(hot_code.code_hash, hot_code.vm_type, hot_code.vm_version);
+         {
+            std::lock_guard g(entry->mtx);
+            if(!entry->idle_modules.empty() || entry->instantiating)
+               return;
+            entry->instantiating = true;
+            // not used since the restart yet, keeps its place among the codes used before
+            entry->last_used_lib = std::max(entry->last_used_lib.load(), hot_code.last_used_lib);
+            entry->uses.fetch_add(hot_code.uses, std::memory_order_relaxed);
+         }
+         auto done = fc::make_scoped_exit([&](){
+            {
+               std::lock_guard lg(entry->mtx);
+               entry->instantiating = false;
+            }
+            entry->cv.notify_all();
+         });
+         auto m = runtime_interface->instantiate_module(code, code_size, hot_code.code_hash, hot_code.vm_type, hot_code.vm_version);
+         account_module(*entry, code_size);
+         {
+            std::lock_guard g(entry->mtx);
+            entry->idle_modules.push_back(std::move(m));
+         }
+         evict_over_max_cache_size();
+      }
+
+      void preload_queued() {
+         std::lock_guard g(preload_mtx);
+         ++preloads_pending;
+      }
+
+      void preload_done() {
+         {
+            std::lock_guard g(preload_mtx);
+            --preloads_pending;
+         }
+         preload_cv.notify_all();
+      }
+
+      void wait_for_preloads() {
+         std::unique_lock g(preload_mtx);
+         preload_cv.wait(g, [&]() { return preloads_pending == 0; });
+      }
+
+      void mark_used(wasm_cache_entry& e) {
+         e.uses.fetch_add(1, std::memory_order_relaxed);
+         e.last_used_lib.store(lib_num.load(std::memory_order_relaxed), std::memory_order_relaxed);
+         e.last_use_tick.store(use_clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      }
+
+      // a code executed by EOS VM OC keeps its place among the most recently used codes
+      void eosvmoc_code_used(const digest_type& code_hash, const uint8_t& vm_type, const uint8_t& vm_version) {
+         mark_used(*get_or_create_entry(code_hash, vm_type, vm_version));
+      }
+
+      module_lease get_instantiated_module( const digest_type& code_hash, const uint8_t& vm_type,
+                                            const uint8_t& vm_version, transaction_context& trx_context )
       {
-         wasm_cache_index::iterator it = wasm_instantiation_cache.find(
-                                             boost::make_tuple(code_hash, vm_type, vm_version) );
-         const code_object* codeobject = nullptr;
-         if(it == wasm_instantiation_cache.end()) {
-            codeobject = &trx_context.shared_db.get<code_object,by_code_hash>(boost::make_tuple(code_hash, vm_type, vm_version));
+         const auto key = boost::make_tuple(code_hash, vm_type, vm_version);
+         wasm_cache_entry_ptr entry = get_or_create_entry(code_hash, vm_type, vm_version);
+         mark_used(*entry);
 
-            it = wasm_instantiation_cache.emplace( wasm_interface_impl::wasm_cache_entry{
-                                                      .code_hash = code_hash,
-                                                      .last_block_num_used = UINT32_MAX,
-                                                      .module = nullptr,
-                                                      .vm_type = vm_type,
-                                                      .vm_version = vm_version
-                                                   } ).first;
+         std::unique_lock g(entry->mtx);
+         if(!entry->idle_modules.empty()) {
+            auto m = std::move(entry->idle_modules.back());
+            entry->idle_modules.pop_back();
+            cache_hits.fetch_add(1, std::memory_order_relaxed);
+            return module_lease(std::move(entry), std::move(m));
          }
 
-         if(!it->module) {
-            if(!codeobject)
-               codeobject = &trx_context.shared_db.get<code_object,by_code_hash>(boost::make_tuple(code_hash, vm_type, vm_version));
+         auto timer_pause = fc::make_scoped_exit([&](){
+            trx_context.resume_billing_timer();
+         });
+         trx_context.pause_billing_timer();
 
-            auto timer_pause = fc::make_scoped_exit([&](){
-               trx_context.resume_billing_timer();
-            });
-            trx_context.pause_billing_timer();
-            wasm_instantiation_cache.modify(it, [&](auto& c) {
-               c.module = runtime_interface->instantiate_module(codeobject->code.data(), codeobject->code.size(), code_hash, vm_type, vm_version);
-            });
+         // only one thread instantiates a given code at a time, the others take a module handed back meanwhile or
+         // instantiate the next one once it is done
+         entry->cv.wait(g, [&]() { return !entry->idle_modules.empty() || !entry->instantiating; });
+         if(!entry->idle_modules.empty()) {
+            auto m = std::move(entry->idle_modules.back());
+            entry->idle_modules.pop_back();
+            cache_hits.fetch_add(1, std::memory_order_relaxed);
+            return module_lease(std::move(entry), std::move(m));
          }
-         return it->module;
+         entry->instantiating = true;
+         g.unlock();
+         cache_misses.fetch_add(1, std::memory_order_relaxed);
+
+         auto done = fc::make_scoped_exit([&](){
+            {
+               std::lock_guard lg(entry->mtx);
+               entry->instantiating = false;
+            }
+            entry->cv.notify_all();
+         });
+         const code_object& codeobject = trx_context.shared_db.get<code_object,by_code_hash>(key);
+         auto m = runtime_interface->instantiate_module(codeobject.code.data(), codeobject.code.size(), code_hash, vm_type, vm_version);
+         account_module(*entry, codeobject.code.size());
+         // the code just instantiated was used last, it is evicted only if it does not fit on its own
+         evict_over_max_cache_size();
+         return module_lease(entry, std::move(m));
       }
 
       bool is_shutting_down = false;
       std::unique_ptr<wasm_runtime_interface> runtime_interface;
 
       typedef boost::multi_index_container<
-         wasm_cache_entry,
+         wasm_cache_entry_ptr,
          indexed_by<
             ordered_unique<tag<by_hash>,
                composite_key< wasm_cache_entry,
@@ -176,7 +431,43 @@ namespace eosio { namespace chain {
             ordered_non_unique<tag<by_last_block_num>, member<wasm_cache_entry, uint32_t, &wasm_cache_entry::last_block_num_used>>
          >
       > wasm_cache_index;
-      wasm_cache_index wasm_instantiation_cache;
+
+      // the cache is split by code hash so parallel shards looking up different code do not contend on one lock
+      static constexpr size_t wasm_cache_bucket_count = 16;
+      struct wasm_cache_bucket {
+         mutable std::shared_mutex  mtx;
+         wasm_cache_index           index;
+      };
+      std::array<wasm_cache_bucket, wasm_cache_bucket_count> wasm_instantiation_cache;
+
+      wasm_cache_bucket& bucket_for(const digest_type& code_hash) {
+         return wasm_instantiation_cache[code_hash._hash[0] % wasm_cache_bucket_count];
+      }
+      const wasm_cache_bucket& bucket_for(const digest_type& code_hash) const {
+         return wasm_instantiation_cache[code_hash._hash[0] % wasm_cache_bucket_count];
+      }
+
+      struct last_used_update {
+         digest_type code_hash;
+         uint8_t     vm_type;
+         uint8_t     vm_version;
+         uint32_t    block_num;
+      };
+      std::mutex                     last_used_mtx;
+      std::vector<last_used_update>  pending_last_used; // protected by last_used_mtx
+      std::atomic<uint32_t>          lib_num{0};
+
+      const uint64_t                 max_cache_size; // 0 only evicts codes not used since the LIB
+      std::mutex                     evict_mtx;
+      std::atomic<uint64_t>          use_clock{0};
+      std::atomic<uint64_t>          cached_bytes{0};
+      std::atomic<uint64_t>          cache_hits{0};
+      std::atomic<uint64_t>          cache_misses{0};
+      std::atomic<uint64_t>          cache_evictions{0};
+
+      std::mutex                     preload_mtx;
+      std::condition_variable        preload_cv;
+      uint32_t                       preloads_pending = 0; // protected by preload_mtx
 
       const wasm_interface::vm_type wasm_runtime_time;
 
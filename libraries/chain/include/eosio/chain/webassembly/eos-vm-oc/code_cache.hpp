@@ -6,6 +6,7 @@
 #include <eosio/chain/webassembly/eos-vm-oc/ipc_helpers.hpp>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/sequenced_index.hpp>
 #include <boost/multi_index/composite_key.hpp>
 #include <boost/multi_index/key_extractors.hpp>
@@ -14,7 +15,9 @@
 #include <boost/asio/local/datagram_protocol.hpp>
 
 
+#include <atomic>
 #include <thread>
+#include <mutex>
 #include <shared_mutex>
 
 namespace std {
@@ -38,6 +41,48 @@ using allocator_t = bip::rbtree_best_fit<bip::null_mutex_family, bip::offset_ptr
 struct config;
 
 
+//compiles waiting for a compile thread; the most requested code is compiled first, so the contracts
+// executing most often since they were queued leave the baseline VM first
+class compile_queue {
+   public:
+      //queues ct with one request
+      void push(const code_tuple& ct);
+      //counts one more request for ct, returns false if ct is not queued
+      bool add_request(const code_tuple& ct);
+      //removes and returns the most requested code, the earliest queued among equally requested code
+      code_tuple pop();
+      void erase(const code_tuple& ct);
+
+      size_t size() const { return _queue.size(); }
+      bool empty() const { return _queue.empty(); }
+
+   private:
+      struct queued_compile {
+         code_tuple code;
+         uint64_t   requests = 1;
+         uint64_t   sequence = 0; //queue order, breaks ties between equally requested code
+      };
+      struct by_code;
+      struct by_priority;
+
+      typedef boost::multi_index_container<
+         queued_compile,
+         indexed_by<
+            hashed_unique<tag<by_code>, member<queued_compile, code_tuple, &queued_compile::code>, std::hash<code_tuple>>,
+            ordered_unique<tag<by_priority>,
+               composite_key< queued_compile,
+                  member<queued_compile, uint64_t, &queued_compile::requests>,
+                  member<queued_compile, uint64_t, &queued_compile::sequence>
+               >,
+               composite_key_compare< std::greater<uint64_t>, std::less<uint64_t> >
+            >
+         >
+      > queued_compile_index;
+
+      queued_compile_index _queue;
+      uint64_t _next_sequence = 0;
+};
+
 class code_cache_base {
    public:
       code_cache_base(const bfs::path data_dir, const eosvmoc::config& eosvmoc_config );
@@ -80,7 +125,7 @@ class code_cache_base {
 
       //these are really only useful to the async code cache, but keep them here so
       //free_code can be shared
-      std::unordered_set<code_tuple> _queued_compiles;
+      compile_queue _queued_compiles;
       std::unordered_map<code_tuple, bool> _outstanding_compiles_and_poison;
 
       size_t _free_bytes_eviction_threshold;
@@ -103,13 +148,36 @@ class code_cache_async : public code_cache_base {
       //otherwise: return nullptr
       const code_descriptor* const get_descriptor_for_code(const digest_type& code_id, const uint8_t& vm_version, const chainbase::database& shared_db, bool is_write_window, get_cd_failure& failure);
 
+      //must not be called while a code descriptor may be executing, i.e. only on the main thread outside of shard execution
+      void free_code(const digest_type& code_id, const uint8_t& vm_version);
+
+      //runs the eviction round requested by compile results consumed since the last call, which frees the code of
+      // descriptors; same restriction as free_code()
+      void run_pending_eviction();
+
+      //safe to call from any thread
+      compile_stats get_compile_stats() const;
+
    private:
       std::thread _monitor_reply_thread;
       boost::lockfree::spsc_queue<wasm_compilation_result_message> _result_queue;
       void wait_on_compile_monitor_message();
       std::tuple<size_t, size_t> consume_compile_thread_queue();
+      bool start_compile(const code_tuple& ct, const chainbase::database& shared_db);
+      void update_compile_stats();
       std::unordered_set<code_tuple> _blacklist;
+      std::unordered_map<code_tuple, fc::time_point> _compile_start_times;
       size_t _threads;
+      bool _eviction_pending = false;
+
+      //get_descriptor_for_code() is called from every shard thread; the cache index, the queues, the blacklist and the
+      // start times are only touched with _mtx held. Descriptors are erased only by free_code() and
+      // run_pending_eviction(), never while a shard thread may execute one
+      std::mutex _mtx;
+
+      //a copy of the queue state for get_compile_stats(), which does not wait on _mtx
+      mutable std::mutex _stats_mtx;
+      compile_stats      _stats;
 };
 
 class code_cache_sync : public code_cache_base {
@@ -7,6 +7,7 @@
 
 #include <boost/filesystem/path.hpp>
 #include <fc/reflect/reflect.hpp>
+#include <fc/time.hpp>
 
 namespace eosio { namespace chain { namespace eosvmoc {
 
@@ -15,4 +16,10 @@ struct config {
    uint64_t threads    = 1u;
 };
 
+struct compile_stats {
+   size_t           queued = 0;        ///< compiles waiting for a compile thread
+   size_t           compiling = 0;     ///< compiles in flight
+   fc::microseconds last_compile_time; ///< of the latest compile, from dispatch until its result was picked up
+};
+
 }}}
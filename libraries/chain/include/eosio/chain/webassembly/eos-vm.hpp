@@ -46,10 +46,6 @@ class eos_vm_runtime : public eosio::chain::wasm_runtime_interface {
       std::unique_ptr<wasm_instantiated_module_interface> instantiate_module(const char* code_bytes, size_t code_size,
                                                                              const digest_type& code_hash, const uint8_t& vm_type, const uint8_t& vm_version) override;
 
-   private:
-      // todo: managing this will get more complicated with sync calls;
-      eos_vm_backend_t<Backend>* _bkend = nullptr;  // non owning pointer to allow for immediate exit
-
    template<typename Impl>
    friend class eos_vm_instantiated_module;
 };
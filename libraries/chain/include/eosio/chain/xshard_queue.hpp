@@ -0,0 +1,74 @@
+#pragma once
+#include <eosio/chain/contract_types.hpp>
+
+#include <array>
+#include <deque>
+#include <map>
+
+namespace eosio { namespace chain {
+
+   /// an xshout action executed in the building block, waiting to be delivered to its target shard
+   struct xsh_out_action {
+      chain::xshout                 xsh_out;
+      xshard_id_type                xsh_id;
+      transaction_id_type           scheduled_xshin_trx_id;
+      bytes                         scheduled_xshin_trx_packed;
+   };
+
+   /// number of blocks between publishing a cross shard message and consuming it with xshin
+   struct xshard_latency_histogram {
+      /// inclusive upper bound in blocks of each bucket, the last bucket counts everything above
+      static constexpr std::array<uint32_t, 7> bucket_bounds = {{ 1, 2, 4, 8, 16, 32, 64 }};
+
+      std::array<uint64_t, bucket_bounds.size() + 1> buckets{};
+      uint64_t                                       count        = 0;
+      uint64_t                                       total_blocks = 0;
+
+      void record( uint32_t blocks );
+   };
+
+   /**
+    *  Cross shard messages of the building block.
+    *
+    *  The xshout actions of each shard are posted once the shard has finished executing and are delivered
+    *  batched per target shard when the block is finalized. Delivery order is target shard, source shard,
+    *  then execution order within the source shard, so it depends only on block content and never on how
+    *  shards were scheduled on the shard threads.
+    */
+   class xshard_queue {
+      public:
+         /// from shard, to shard
+         using route = std::pair<shard_name, shard_name>;
+
+         void post( const shard_name& from_shard, std::deque<xsh_out_action>&& actions );
+
+         /**
+          *  Calls `f(from_shard, const xsh_out_action&)` for every posted message in delivery order.
+          *  The queue is empty afterwards, also when `f` throws.
+          */
+         template<typename F>
+         void deliver( F&& f ) {
+            auto batches = std::move( _batches );
+            _batches.clear();
+            for( const auto& to : batches ) {
+               for( const auto& from : to.second ) {
+                  for( const auto& act : from.second ) {
+                     f( from.first, act );
+                  }
+               }
+            }
+         }
+
+         void   clear() { _batches.clear(); }
+         bool   empty() const { return _batches.empty(); }
+
+         void   record_delivery( const shard_name& from_shard, const shard_name& to_shard, uint32_t blocks );
+         const std::map<route, xshard_latency_histogram>& latencies() const { return _latencies; }
+
+      private:
+         /// to shard => from shard => messages in execution order
+         std::map<shard_name, std::map<shard_name, std::deque<xsh_out_action>>>  _batches;
+         std::map<route, xshard_latency_histogram>                               _latencies;
+   };
+
+} } // eosio::chain
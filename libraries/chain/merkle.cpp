@@ -49,4 +49,11 @@ digest_type merkle(deque<digest_type> ids) {
    return ids.front();
 }
 
+digest_type merkle( const flat_map<shard_name, digest_type>& shard_roots ) {
+   deque<digest_type> ids;
+   for( const auto& r : shard_roots )
+      ids.emplace_back( r.second );
+   return merkle( std::move(ids) );
+}
+
 } } // eosio::chain
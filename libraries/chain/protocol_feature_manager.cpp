@@ -258,6 +258,44 @@ Adds new cryptographic host functions
 Builtin protocol feature: GET_BLOCK_NUM
 
 Enables new `get_block_num` intrinsic which returns the current block number.
+*/
+            {}
+         } )
+         (  builtin_protocol_feature_t::shard_resource_accounting, builtin_protocol_feature_spec{
+            "SHARD_RESOURCE_ACCOUNTING",
+            fc::variant("5dfddf75584e940f6d632162d802038989debe5046734eee2209cb1370ae078f").as<digest_type>(),
+            // SHA256 hash of the raw message below within the comment delimiters (do not modify message below).
+/*
+Builtin protocol feature: SHARD_RESOURCE_ACCOUNTING
+
+Bills the block cpu and net usage of every sub-shard against elastic limits kept in the database of that shard.
+A sub-shard may fill a whole block, and the usage of all shards together is capped at a multiple of the block limits.
+The usage of the whole block, main shard plus sub-shards, drives the elastic limits of the chain.
+*/
+            {}
+         } )
+         (  builtin_protocol_feature_t::shard_merkle_roots, builtin_protocol_feature_spec{
+            "SHARD_MERKLE_ROOTS",
+            fc::variant("5f586247039a8ccf71372106a02d1e88369a3fcf8dcd99e38e7143cf6c7cebab").as<digest_type>(),
+            // SHA256 hash of the raw message below within the comment delimiters (do not modify message below).
+/*
+Builtin protocol feature: SHARD_MERKLE_ROOTS
+
+Computes the transaction_mroot and action_mroot of a block as the merkle of per-shard merkle roots taken in shard name order,
+instead of a single merkle over the receipts of all shards. A block with transactions of more than one shard carries the
+per-shard transaction roots in the shard_transaction_mroots_extension block header extension.
+*/
+            {}
+         } )
+         (  builtin_protocol_feature_t::xshard_target_shard, builtin_protocol_feature_spec{
+            "XSHARD_TARGET_SHARD",
+            fc::variant("f802fc60226b97bb04037d04ff50aa4a7b760d0f547e182652cba9859c301c15").as<digest_type>(),
+            // SHA256 hash of the raw message below within the comment delimiters (do not modify message below).
+/*
+Builtin protocol feature: XSHARD_TARGET_SHARD
+
+Schedules the xshin transaction of a cross shard message on the shard the message is sent to, which is the shard that
+executes it, instead of on the shard that sent the message.
 */
             {}
          } )
@@ -4,6 +4,7 @@
 #include <eosio/chain/transaction_metadata.hpp>
 #include <eosio/chain/transaction.hpp>
 #include <eosio/chain/deep_mind.hpp>
+#include <eosio/chain/shard_object.hpp>
 #include <boost/tuple/tuple_io.hpp>
 #include <eosio/chain/database_utils.hpp>
 #include <algorithm>
@@ -22,6 +23,10 @@ using resource_shared_index_set = index_set<
    resource_limits_state_index,
    resource_limits_config_index
 >;
+
+using resource_shard_index_set = index_set<
+   resource_limits_shard_state_index
+>;
 static_assert( config::rate_limiting_precision > 0, "config::rate_limiting_precision must be positive" );
 
 static uint64_t update_elastic_limit(uint64_t current_limit, uint64_t average_usage, const elastic_limit_parameters& params) {
@@ -53,8 +58,65 @@ void resource_limits_state_object::update_virtual_net_limit( const resource_limi
    virtual_net_limit = update_elastic_limit(virtual_net_limit, average_block_net_usage.average(), cfg.net_limit_parameters);
 }
 
+void resource_limits_shard_state_object::update_virtual_cpu_limit( const resource_limits_config_object& cfg ) {
+   virtual_cpu_limit = update_elastic_limit(virtual_cpu_limit, average_block_cpu_usage.average(), cfg.cpu_limit_parameters);
+}
+
+void resource_limits_shard_state_object::update_virtual_net_limit( const resource_limits_config_object& cfg ) {
+   virtual_net_limit = update_elastic_limit(virtual_net_limit, average_block_net_usage.average(), cfg.net_limit_parameters);
+}
+
+namespace {
+   /// the main shard runs against main_db, which is also its shared db; sub-shards have their own db
+   bool is_main_shard_db( const chainbase::database& db, const chainbase::database& shared_db ) {
+      return &db == &shared_db;
+   }
+
+   /**
+    * A single shard may fill a whole block, but the sum over all shards is capped at
+    * maximum_block_shard_usage_multiplier blocks, shared evenly between the registered shards.
+    */
+   uint64_t shard_block_limit( uint64_t block_max, const chainbase::database& shared_db ) {
+      uint64_t num_shards = shared_db.get_index<shard_index>().size() + 1; // sub-shards plus the main shard
+      return std::min( block_max, block_max * config::maximum_block_shard_usage_multiplier / num_shards );
+   }
+
+   /// @return true if processing a block without usage would not change the elastic limits of the shard
+   bool is_settled( const resource_limits_shard_state_object& ss, const resource_limits_config_object& config ) {
+      const auto& cpu = config.cpu_limit_parameters;
+      const auto& net = config.net_limit_parameters;
+      return ss.pending_cpu_usage == 0 && ss.average_block_cpu_usage.value_ex == 0 &&
+             ss.virtual_cpu_limit == cpu.max * cpu.max_multiplier &&
+             ss.pending_net_usage == 0 && ss.average_block_net_usage.value_ex == 0 &&
+             ss.virtual_net_limit == net.max * net.max_multiplier;
+   }
+
+   const resource_limits_shard_state_object& get_or_create_shard_state( chainbase::database& db, const resource_limits_state_object& state ) {
+      const auto* shard_state = db.find<resource_limits_shard_state_object>();
+      if( shard_state == nullptr ) {
+         // a new shard starts with the elastic limits of the chain
+         shard_state = &db.create<resource_limits_shard_state_object>([&]( resource_limits_shard_state_object& ss ) {
+            ss.virtual_cpu_limit = state.virtual_cpu_limit;
+            ss.virtual_net_limit = state.virtual_net_limit;
+         });
+      }
+      return *shard_state;
+   }
+
+   uint64_t virtual_block_cpu_limit( const chainbase::database& db, const resource_limits_state_object& state ) {
+      const auto* shard_state = db.find<resource_limits_shard_state_object>();
+      return shard_state ? shard_state->virtual_cpu_limit : state.virtual_cpu_limit;
+   }
+
+   uint64_t virtual_block_net_limit( const chainbase::database& db, const resource_limits_state_object& state ) {
+      const auto* shard_state = db.find<resource_limits_shard_state_object>();
+      return shard_state ? shard_state->virtual_net_limit : state.virtual_net_limit;
+   }
+}
+
 void resource_limits_manager::add_indices(chainbase::database& db) {
    resource_index_set::add_indices(db);
+   resource_shard_index_set::add_indices(db);
 }
 
 void resource_limits_manager::add_shared_indices(chainbase::database& shared_db) {
@@ -87,30 +149,42 @@ void resource_limits_manager::initialize_database() {
       dm_logger->on_init_resource_limits(config, state);
    }
 }
-//TODO: subshard snapshot resource process.
 void resource_limits_manager::add_to_snapshot( const snapshot_writer_ptr& snapshot ) const {
-   resource_index_set::walk_indices([this, &snapshot]( auto utils ){
-      snapshot->write_section<typename decltype(utils)::index_t::value_type>([this]( auto& section ){
-         auto& db = _dbm.main_db();
+   add_to_snapshot( _dbm.main_db(), snapshot );
+}
+
+void resource_limits_manager::read_from_snapshot( const snapshot_reader_ptr& snapshot ) {
+   read_from_snapshot( _dbm.main_db(), snapshot, chain_snapshot_header() );
+}
+
+void resource_limits_manager::add_to_snapshot( const chainbase::database& db, const snapshot_writer_ptr& snapshot ) {
+   auto write_section = [&db, &snapshot]( auto utils ){
+      snapshot->write_section<typename decltype(utils)::index_t::value_type>([&db]( auto& section ){
          decltype(utils)::walk(db, [&section, &db]( const auto &row ) {
             section.add_row(row, db);
          });
       });
-   });
+   };
+   resource_index_set::walk_indices(write_section);
+   resource_shard_index_set::walk_indices(write_section);
 }
-//TODO: subshard snapshot resource process.
-void resource_limits_manager::read_from_snapshot( const snapshot_reader_ptr& snapshot ) {
-   resource_index_set::walk_indices([this, &snapshot]( auto utils ){
-      snapshot->read_section<typename decltype(utils)::index_t::value_type>([this]( auto& section ) {
+
+void resource_limits_manager::read_from_snapshot( chainbase::database& db, const snapshot_reader_ptr& snapshot, const chain_snapshot_header& header ) {
+   auto read_section = [&db, &snapshot]( auto utils ){
+      snapshot->read_section<typename decltype(utils)::index_t::value_type>([&db]( auto& section ) {
          bool more = !section.empty();
-         auto& db = _dbm.main_db();
          while(more) {
             decltype(utils)::create(db, [&section, &more, &db]( auto &row ) {
                more = section.read_row(row, db);
             });
          }
       });
-   });
+   };
+   resource_index_set::walk_indices(read_section);
+   // older snapshots have no sub-shard databases, so no sub-shard usage either
+   if( header.version >= chain_snapshot_header::first_sharded_version ) {
+      resource_shard_index_set::walk_indices(read_section);
+   }
 }
 
 void resource_limits_manager::initialize_account(const account_name& account, bool is_trx_transient) {
@@ -147,7 +221,7 @@ void resource_limits_manager::set_block_parameters(const elastic_limit_parameter
    });
 }
 
-void resource_limits_manager::update_account_usage(const flat_set<account_name>& accounts, uint32_t time_slot, chainbase::database& db, chainbase::database& shared_db ) {
+void resource_limits_manager::update_account_usage(const flat_set<account_name>& accounts, uint32_t time_slot, chainbase::database& db, const chainbase::database& shared_db ) {
    const auto& config = shared_db.get<resource_limits_config_object>();
    for( const auto& a : accounts ) {
       const auto* usage = db.find<resource_usage_object,by_owner>( a );
@@ -165,10 +239,17 @@ void resource_limits_manager::update_account_usage(const flat_set<account_name>&
    }
 }
 
-void resource_limits_manager::add_transaction_usage(const flat_set<account_name>& accounts, uint64_t cpu_usage, uint64_t net_usage, uint32_t time_slot, chainbase::database& db, chainbase::database& shared_db, bool is_trx_transient ) {
+void resource_limits_manager::add_transaction_usage(const flat_set<account_name>& accounts, uint64_t cpu_usage, uint64_t net_usage, uint32_t time_slot, chainbase::database& db, const chainbase::database& shared_db, bool is_trx_transient ) {
    const auto& state = shared_db.get<resource_limits_state_object>();
    const auto& config = shared_db.get<resource_limits_config_object>();
 
+   const bool shard_accounting = shard_accounting_activated();
+   const resource_limits_shard_state_object* shard_state = nullptr;
+   if( shard_accounting && !is_main_shard_db( db, shared_db ) )
+      shard_state = &get_or_create_shard_state( db, state );
+   const uint64_t virtual_cpu_limit = shard_state ? shard_state->virtual_cpu_limit : state.virtual_cpu_limit;
+   const uint64_t virtual_net_limit = shard_state ? shard_state->virtual_net_limit : state.virtual_net_limit;
+
    for( const auto& a : accounts ) {
 
       const auto* usage = db.find<resource_usage_object,by_owner>( a );
@@ -193,7 +274,7 @@ void resource_limits_manager::add_transaction_usage(const flat_set<account_name>
 
       if( cpu_weight >= 0 && state.total_cpu_weight > 0 ) {
          uint128_t window_size = config.account_cpu_usage_average_window;
-         auto virtual_network_capacity_in_window = (uint128_t)state.virtual_cpu_limit * window_size;
+         auto virtual_network_capacity_in_window = (uint128_t)virtual_cpu_limit * window_size;
          auto cpu_used_in_window                 = ((uint128_t)usage->cpu_usage.value_ex * window_size) / (uint128_t)config::rate_limiting_precision;
 
          uint128_t user_weight     = (uint128_t)cpu_weight;
@@ -213,7 +294,7 @@ void resource_limits_manager::add_transaction_usage(const flat_set<account_name>
       if( net_weight >= 0 && state.total_net_weight > 0) {
 
          uint128_t window_size = config.account_net_usage_average_window;
-         auto virtual_network_capacity_in_window = (uint128_t)state.virtual_net_limit * window_size;
+         auto virtual_network_capacity_in_window = (uint128_t)virtual_net_limit * window_size;
          auto net_used_in_window                 = ((uint128_t)usage->net_usage.value_ex * window_size) / (uint128_t)config::rate_limiting_precision;
 
          uint128_t user_weight     = (uint128_t)net_weight;
@@ -232,15 +313,37 @@ void resource_limits_manager::add_transaction_usage(const flat_set<account_name>
       }
    }
 
-   // account for this transaction in the block and do not exceed those limits either
-   // Conflicts arise from transaction parallelism and block level restrictions
-   // shared_db.modify(state, [&](resource_limits_state_object& rls){
-   //    rls.pending_cpu_usage += cpu_usage;
-   //    rls.pending_net_usage += net_usage;
-   // });
+   if( !shard_accounting ) {
+      // before SHARD_RESOURCE_ACCOUNTING the block is billed against the chain-wide state only,
+      // which shards executing in parallel cannot write, so the block usage is not accumulated
+      EOS_ASSERT( state.pending_cpu_usage <= config.cpu_limit_parameters.max, block_resource_exhausted, "Block has insufficient cpu resources" );
+      EOS_ASSERT( state.pending_net_usage <= config.net_limit_parameters.max, block_resource_exhausted, "Block has insufficient net resources" );
+      return;
+   }
+
+   // account for this transaction in the block budget of its shard and do not exceed those limits either,
+   // each shard only touches its own db so shards executing in parallel do not conflict
+   uint64_t pending_cpu_usage = 0;
+   uint64_t pending_net_usage = 0;
+   if( shard_state ) {
+      db.modify(*shard_state, [&](resource_limits_shard_state_object& ss){
+         ss.pending_cpu_usage += cpu_usage;
+         ss.pending_net_usage += net_usage;
+      });
+      pending_cpu_usage = shard_state->pending_cpu_usage;
+      pending_net_usage = shard_state->pending_net_usage;
+   } else {
+      // the main shard is its own shared db, written through db so the shared db of a sub-shard stays read only
+      db.modify(state, [&](resource_limits_state_object& rls){
+         rls.pending_cpu_usage += cpu_usage;
+         rls.pending_net_usage += net_usage;
+      });
+      pending_cpu_usage = state.pending_cpu_usage;
+      pending_net_usage = state.pending_net_usage;
+   }
 
-   EOS_ASSERT( state.pending_cpu_usage <= config.cpu_limit_parameters.max, block_resource_exhausted, "Block has insufficient cpu resources" );
-   EOS_ASSERT( state.pending_net_usage <= config.net_limit_parameters.max, block_resource_exhausted, "Block has insufficient net resources" );
+   EOS_ASSERT( pending_cpu_usage <= shard_block_limit( config.cpu_limit_parameters.max, shared_db ), block_resource_exhausted, "Block has insufficient cpu resources" );
+   EOS_ASSERT( pending_net_usage <= shard_block_limit( config.net_limit_parameters.max, shared_db ), block_resource_exhausted, "Block has insufficient net resources" );
 }
 
 void resource_limits_manager::add_pending_ram_usage( const account_name account, int64_t ram_delta, chainbase::database& db, bool is_trx_transient ) {
@@ -268,7 +371,7 @@ void resource_limits_manager::add_pending_ram_usage( const account_name account,
    });
 }
 
-void resource_limits_manager::verify_account_ram_usage( const account_name account, chainbase::database& db, chainbase::database& shared_db )const {
+void resource_limits_manager::verify_account_ram_usage( const account_name account, chainbase::database& db, const chainbase::database& shared_db )const {
    int64_t ram_bytes; int64_t net_weight; int64_t cpu_weight;
    get_account_limits( account, ram_bytes, net_weight, cpu_weight, shared_db );
    const auto* usage  = db.find<resource_usage_object,by_owner>( account );
@@ -422,14 +525,50 @@ void resource_limits_manager::process_block_usage(uint32_t block_num) {
    auto&     db = _dbm.main_db();
    const auto& s = db.get<resource_limits_state_object>();
    const auto& config = db.get<resource_limits_config_object>();
+
+   // with SHARD_RESOURCE_ACCOUNTING, apply the pending usage of every sub-shard to its own elastic limits, the block as a whole
+   // (main shard plus sub-shards) drives the elastic limits of the chain.
+   // Idle sub-shards take part with zero usage, so their average decays and their limits expand block by block like the
+   // chain's. Only a sub-shard which has fully settled, nothing pending, nothing averaged and both limits at their maximum,
+   // is not written, as the update would leave its limits unchanged.
+   // The shard accumulators are merged in shard name order, independent of the order the shards executed in
+   uint64_t block_cpu_usage = s.pending_cpu_usage;
+   uint64_t block_net_usage = s.pending_net_usage;
+   if( shard_accounting_activated() ) {
+      for( auto& shard_db : _dbm.shard_dbs() ) {
+         auto& sdb = shard_db.second;
+         const auto* shard_state = sdb.find<resource_limits_shard_state_object>();
+         if( shard_state == nullptr || is_settled( *shard_state, config ) )
+            continue;
+         block_cpu_usage += shard_state->pending_cpu_usage;
+         block_net_usage += shard_state->pending_net_usage;
+         // a shard which did not execute in this block has no undo session yet
+         _dbm.start_shard_undo_session( shard_db.first );
+         sdb.modify(*shard_state, [&](resource_limits_shard_state_object& ss){
+            ss.average_block_cpu_usage.add(ss.pending_cpu_usage, block_num, config.cpu_limit_parameters.periods);
+            ss.update_virtual_cpu_limit(config);
+            ss.pending_cpu_usage = 0;
+
+            ss.average_block_net_usage.add(ss.pending_net_usage, block_num, config.net_limit_parameters.periods);
+            ss.update_virtual_net_limit(config);
+            ss.pending_net_usage = 0;
+         });
+      }
+
+      EOS_ASSERT( block_cpu_usage <= config.cpu_limit_parameters.max * config::maximum_block_shard_usage_multiplier,
+                  block_resource_exhausted, "Block exceeds the cpu limit of all shards" );
+      EOS_ASSERT( block_net_usage <= config.net_limit_parameters.max * config::maximum_block_shard_usage_multiplier,
+                  block_resource_exhausted, "Block exceeds the net limit of all shards" );
+   }
+
    db.modify(s, [&](resource_limits_state_object& state){
       // apply pending usage, update virtual limits and reset the pending
 
-      state.average_block_cpu_usage.add(state.pending_cpu_usage, block_num, config.cpu_limit_parameters.periods);
+      state.average_block_cpu_usage.add(block_cpu_usage, block_num, config.cpu_limit_parameters.periods);
       state.update_virtual_cpu_limit(config);
       state.pending_cpu_usage = 0;
 
-      state.average_block_net_usage.add(state.pending_net_usage, block_num, config.net_limit_parameters.periods);
+      state.average_block_net_usage.add(block_net_usage, block_num, config.net_limit_parameters.periods);
       state.update_virtual_net_limit(config);
       state.pending_net_usage = 0;
 
@@ -470,16 +609,50 @@ uint64_t resource_limits_manager::get_virtual_block_net_limit() const {
    return state.virtual_net_limit;
 }
 
-uint64_t resource_limits_manager::get_block_cpu_limit(const chainbase::database& shared_db) const {
-   const auto& state = shared_db.get<resource_limits_state_object>();
+uint64_t resource_limits_manager::get_block_cpu_limit(const chainbase::database& db, const chainbase::database& shared_db) const {
    const auto& config = shared_db.get<resource_limits_config_object>();
-   return config.cpu_limit_parameters.max - state.pending_cpu_usage;
+   if( !shard_accounting_activated() )
+      return config.cpu_limit_parameters.max - shared_db.get<resource_limits_state_object>().pending_cpu_usage;
+   const uint64_t limit = shard_block_limit( config.cpu_limit_parameters.max, shared_db );
+   const uint64_t usage = get_block_cpu_usage( db, shared_db );
+   return usage < limit ? limit - usage : 0;
 }
 
-uint64_t resource_limits_manager::get_block_net_limit(const chainbase::database& shared_db) const {
-   const auto& state = shared_db.get<resource_limits_state_object>();
+uint64_t resource_limits_manager::get_block_net_limit(const chainbase::database& db, const chainbase::database& shared_db) const {
+   const auto& config = shared_db.get<resource_limits_config_object>();
+   if( !shard_accounting_activated() )
+      return config.net_limit_parameters.max - shared_db.get<resource_limits_state_object>().pending_net_usage;
+   const uint64_t limit = shard_block_limit( config.net_limit_parameters.max, shared_db );
+   const uint64_t usage = get_block_net_usage( db, shared_db );
+   return usage < limit ? limit - usage : 0;
+}
+
+uint64_t resource_limits_manager::get_block_cpu_usage(const chainbase::database& db, const chainbase::database& shared_db) const {
+   if( !shard_accounting_activated() || is_main_shard_db( db, shared_db ) )
+      return shared_db.get<resource_limits_state_object>().pending_cpu_usage;
+   const auto* shard_state = db.find<resource_limits_shard_state_object>();
+   return shard_state ? shard_state->pending_cpu_usage : 0;
+}
+
+uint64_t resource_limits_manager::get_block_net_usage(const chainbase::database& db, const chainbase::database& shared_db) const {
+   if( !shard_accounting_activated() || is_main_shard_db( db, shared_db ) )
+      return shared_db.get<resource_limits_state_object>().pending_net_usage;
+   const auto* shard_state = db.find<resource_limits_shard_state_object>();
+   return shard_state ? shard_state->pending_net_usage : 0;
+}
+
+uint64_t resource_limits_manager::get_total_block_cpu_limit(const chainbase::database& shared_db) const {
+   const auto& config = shared_db.get<resource_limits_config_object>();
+   if( !shard_accounting_activated() )
+      return config.cpu_limit_parameters.max;
+   return config.cpu_limit_parameters.max * config::maximum_block_shard_usage_multiplier;
+}
+
+uint64_t resource_limits_manager::get_total_block_net_limit(const chainbase::database& shared_db) const {
    const auto& config = shared_db.get<resource_limits_config_object>();
-   return config.net_limit_parameters.max - state.pending_net_usage;
+   if( !shard_accounting_activated() )
+      return config.net_limit_parameters.max;
+   return config.net_limit_parameters.max * config::maximum_block_shard_usage_multiplier;
 }
 
 std::pair<int64_t, bool> resource_limits_manager::get_account_cpu_limit( const account_name& name, chainbase::database& db, const chainbase::database& shared_db, uint32_t greylist_limit ) const {
@@ -516,19 +689,20 @@ resource_limits_manager::get_account_cpu_limit_ex( const account_name& name, con
    account_resource_limit arl;
 
    uint128_t window_size = config.account_cpu_usage_average_window;
+   const uint64_t virtual_cpu_limit = virtual_block_cpu_limit( db, state );
 
    bool greylisted = false;
    uint128_t virtual_cpu_capacity_in_window = window_size;
    if( greylist_limit < config::maximum_elastic_resource_multiplier ) {
       uint64_t greylisted_virtual_cpu_limit = config.cpu_limit_parameters.max * greylist_limit;
-      if( greylisted_virtual_cpu_limit < state.virtual_cpu_limit ) {
+      if( greylisted_virtual_cpu_limit < virtual_cpu_limit ) {
          virtual_cpu_capacity_in_window *= greylisted_virtual_cpu_limit;
          greylisted = true;
       } else {
-         virtual_cpu_capacity_in_window *= state.virtual_cpu_limit;
+         virtual_cpu_capacity_in_window *= virtual_cpu_limit;
       }
    } else {
-      virtual_cpu_capacity_in_window *= state.virtual_cpu_limit;
+      virtual_cpu_capacity_in_window *= virtual_cpu_limit;
    }
 
    uint128_t user_weight     = (uint128_t)cpu_weight;
@@ -588,19 +762,20 @@ resource_limits_manager::get_account_net_limit_ex( const account_name& name, con
    account_resource_limit arl;
 
    uint128_t window_size = config.account_net_usage_average_window;
+   const uint64_t virtual_net_limit = virtual_block_net_limit( db, state );
 
    bool greylisted = false;
    uint128_t virtual_network_capacity_in_window = window_size;
    if( greylist_limit < config::maximum_elastic_resource_multiplier ) {
       uint64_t greylisted_virtual_net_limit = config.net_limit_parameters.max * greylist_limit;
-      if( greylisted_virtual_net_limit < state.virtual_net_limit ) {
+      if( greylisted_virtual_net_limit < virtual_net_limit ) {
          virtual_network_capacity_in_window *= greylisted_virtual_net_limit;
          greylisted = true;
       } else {
-         virtual_network_capacity_in_window *= state.virtual_net_limit;
+         virtual_network_capacity_in_window *= virtual_net_limit;
       }
    } else {
-      virtual_network_capacity_in_window *= state.virtual_net_limit;
+      virtual_network_capacity_in_window *= virtual_net_limit;
    }
 
    uint128_t user_weight     = (uint128_t)net_weight;
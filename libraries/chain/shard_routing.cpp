@@ -0,0 +1,81 @@
+#include <eosio/chain/shard_routing.hpp>
+#include <eosio/chain/config.hpp>
+#include <eosio/chain/contract_table_objects.hpp>
+
+namespace eosio { namespace chain {
+
+   void shard_routing_index::add( const account_name& code, const shard_name& shard ) {
+      {
+         std::shared_lock g( _mtx );
+         auto itr = _shards.find( code );
+         if( itr != _shards.end() && itr->second.count( shard ) )
+            return;
+      }
+      std::unique_lock g( _mtx );
+      _shards[code].insert( shard );
+   }
+
+   void shard_routing_index::add_shard_db( const shard_name& shard, const chainbase::database& db ) {
+      const auto& idx = db.get_index<table_id_multi_index, by_code_scope_table>();
+      std::unique_lock g( _mtx );
+      // one lookup per contract, skipping over all its scopes and tables
+      for( auto itr = idx.begin(); itr != idx.end(); itr = idx.upper_bound( boost::make_tuple( itr->code ) ) ) {
+         _shards[itr->code].insert( shard );
+      }
+   }
+
+   void shard_routing_index::clear() {
+      std::unique_lock g( _mtx );
+      _shards.clear();
+   }
+
+   flat_set<shard_name> shard_routing_index::get_shards( const account_name& code ) const {
+      std::shared_lock g( _mtx );
+      auto itr = _shards.find( code );
+      return itr != _shards.end() ? itr->second : flat_set<shard_name>{};
+   }
+
+   bool shard_routing_index::holds_any( const shard_name& shard, const flat_set<account_name>& accounts ) const {
+      std::shared_lock g( _mtx );
+      for( const auto& a : accounts ) {
+         auto itr = _shards.find( a );
+         if( itr != _shards.end() && itr->second.count( shard ) )
+            return true;
+      }
+      return false;
+   }
+
+   bool shard_routing_index::all_routed( const flat_set<account_name>& accounts ) const {
+      std::shared_lock g( _mtx );
+      for( const auto& a : accounts ) {
+         if( _shards.find( a ) == _shards.end() )
+            return false;
+      }
+      return true;
+   }
+
+   std::optional<shard_name> shard_routing_index::suggest_shard( const flat_set<account_name>& accounts ) const {
+      std::map<shard_name, uint32_t> counts;
+      {
+         std::shared_lock g( _mtx );
+         for( const auto& a : accounts ) {
+            auto itr = _shards.find( a );
+            if( itr == _shards.end() )
+               continue;
+            for( const auto& s : itr->second )
+               ++counts[s];
+         }
+      }
+
+      std::optional<shard_name> result;
+      uint32_t best = 0;
+      for( const auto& [shard, count] : counts ) { // ordered by name, so ties keep the lowest name
+         if( count > best || (count == best && shard == config::main_shard_name) ) {
+            result = shard;
+            best = count;
+         }
+      }
+      return result;
+   }
+
+} } // eosio::chain
@@ -0,0 +1,127 @@
+#include <eosio/chain/thread_utils.hpp>
+#include <fc/log/logger.hpp>
+
+#include <boost/algorithm/string.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <set>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace eosio { namespace chain {
+
+   size_t resolve_thread_pool_size( size_t configured_size ) {
+      if( configured_size > 0 )
+         return configured_size;
+      return std::max<size_t>( std::thread::hardware_concurrency(), 1 );
+   }
+
+#if defined(__linux__)
+   namespace {
+
+      std::vector<uint32_t> available_cpus() {
+         std::vector<uint32_t> result;
+         cpu_set_t set;
+         CPU_ZERO( &set );
+         if( sched_getaffinity( 0, sizeof(set), &set ) != 0 )
+            return result;
+         for( uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu ) {
+            if( CPU_ISSET( cpu, &set ) )
+               result.push_back( cpu );
+         }
+         return result;
+      }
+
+      /// parse a sysfs cpu list, e.g. "0-7,16-23"
+      std::set<uint32_t> parse_cpu_list( const std::string& list ) {
+         std::set<uint32_t> result;
+         std::vector<std::string> ranges;
+         boost::split( ranges, list, boost::is_any_of( "," ) );
+         for( auto& r : ranges ) {
+            boost::trim( r );
+            if( r.empty() )
+               continue;
+            auto dash = r.find( '-' );
+            uint32_t first = std::stoul( r.substr( 0, dash ) );
+            uint32_t last  = dash == std::string::npos ? first : std::stoul( r.substr( dash + 1 ) );
+            for( uint32_t cpu = first; cpu <= last; ++cpu )
+               result.insert( cpu );
+         }
+         return result;
+      }
+
+      /// @return node number => cpus of that node, empty if NUMA topology is not exposed
+      std::map<uint32_t, std::set<uint32_t>> numa_nodes() {
+         std::map<uint32_t, std::set<uint32_t>> result;
+         for( uint32_t node = 0; ; ++node ) {
+            std::ifstream in( "/sys/devices/system/node/node" + std::to_string( node ) + "/cpulist" );
+            if( !in )
+               break;
+            std::string list;
+            std::getline( in, list );
+            try {
+               result[node] = parse_cpu_list( list );
+            } catch( const std::exception& e ) {
+               wlog( "unable to parse cpu list of NUMA node ${n}: ${e}", ("n", node)("e", e.what()) );
+               return {};
+            }
+         }
+         return result;
+      }
+
+   } // anonymous namespace
+
+   thread_affinity::thread_affinity( thread_affinity_mode mode ) {
+      if( mode == thread_affinity_mode::none )
+         return;
+
+      _cpus = available_cpus();
+      if( mode != thread_affinity_mode::numa || _cpus.empty() )
+         return;
+
+      auto nodes = numa_nodes();
+      if( nodes.size() <= 1 )
+         return;
+
+      std::vector<uint32_t> ordered;
+      ordered.reserve( _cpus.size() );
+      for( const auto& node : nodes ) {
+         for( auto cpu : _cpus ) {
+            if( node.second.count( cpu ) )
+               ordered.push_back( cpu );
+         }
+      }
+      // cpus not listed under any node are appended so no available cpu is lost
+      for( auto cpu : _cpus ) {
+         if( std::find( ordered.begin(), ordered.end(), cpu ) == ordered.end() )
+            ordered.push_back( cpu );
+      }
+      _cpus = std::move( ordered );
+   }
+
+   void thread_affinity::pin_current_thread() {
+      if( _cpus.empty() )
+         return;
+      uint32_t cpu = _cpus[_next++ % _cpus.size()];
+      cpu_set_t set;
+      CPU_ZERO( &set );
+      CPU_SET( cpu, &set );
+      int r = pthread_setaffinity_np( pthread_self(), sizeof(set), &set );
+      if( r != 0 )
+         wlog( "unable to pin thread to cpu ${c}, error ${r}", ("c", cpu)("r", r) );
+   }
+#else
+   thread_affinity::thread_affinity( thread_affinity_mode mode ) {
+      if( mode != thread_affinity_mode::none )
+         wlog( "thread affinity is not supported on this platform, ignoring" );
+   }
+
+   void thread_affinity::pin_current_thread() {}
+#endif
+
+} } // eosio::chain
@@ -19,6 +19,7 @@
 #include <fc/crypto/sha256.hpp>
 #include <fc/crypto/sha1.hpp>
 #include <fc/io/raw.hpp>
+#include <fc/io/fstream.hpp>
 
 #include <softfloat.hpp>
 #include <compiler_builtins.hpp>
@@ -32,8 +33,8 @@
 
 namespace eosio { namespace chain {
 
-   wasm_interface::wasm_interface(vm_type vm, bool eosvmoc_tierup, const boost::filesystem::path data_dir, const eosvmoc::config& eosvmoc_config, bool profile)
-     : my( new wasm_interface_impl(vm, eosvmoc_tierup, data_dir, eosvmoc_config, profile) ), vm( vm ) {}
+   wasm_interface::wasm_interface(vm_type vm, bool eosvmoc_tierup, const boost::filesystem::path data_dir, const eosvmoc::config& eosvmoc_config, bool profile, uint64_t max_cache_size)
+     : my( new wasm_interface_impl(vm, eosvmoc_tierup, data_dir, eosvmoc_config, profile, max_cache_size) ), vm( vm ) {}
 
    wasm_interface::~wasm_interface() {}
 
@@ -105,6 +106,7 @@ namespace eosio { namespace chain {
             once_is_enough = true;
          }
          if(cd) {
+            my->eosvmoc_code_used(code_hash, vm_type, vm_version);
             my->eosvmoc->exec->execute(*cd, my->eosvmoc->mem, context);
             return;
          }
@@ -124,6 +126,105 @@ namespace eosio { namespace chain {
       return my->is_code_cached(code_hash, vm_type, vm_version);
    }
 
+   wasm_cache_stats wasm_interface::get_cache_stats() const {
+      return my->get_cache_stats();
+   }
+
+   std::optional<eosvmoc::compile_stats> wasm_interface::get_eosvmoc_compile_stats() const {
+#ifdef EOSIO_EOS_VM_OC_RUNTIME_ENABLED
+      if(my->eosvmoc)
+         return my->eosvmoc->cc.get_compile_stats();
+#endif
+      return {};
+   }
+
+   std::vector<wasm_hot_code> wasm_interface::get_hot_codes() const {
+      return my->get_hot_codes();
+   }
+
+   void wasm_interface::preload(const wasm_hot_code& hot_code, const char* code, size_t code_size) {
+      // an EOS VM OC instance only refers to the code cache, there is nothing to gain by creating it ahead of use
+      if(vm == wasm_interface::vm_type::eos_vm_oc)
+         return;
+      my->preload(hot_code, code, code_size);
+   }
+
+   void wasm_interface::preload_async(boost::asio::io_context& ctx, const wasm_hot_code& hot_code, std::shared_ptr<const std::vector<char>> code) {
+      my->preload_queued();
+      boost::asio::post(ctx, [this, hot_code, code{std::move(code)}]() {
+         auto done = fc::make_scoped_exit([&](){
+            my->preload_done();
+         });
+         try {
+            preload(hot_code, code->data(), code->size());
+         } catch(const fc::exception& e) {
+            wlog("unable to preload code ${h}: ${e}", ("h", hot_code.code_hash)("e", e.to_detail_string()));
+         } catch(const std::exception& e) {
+            wlog("unable to preload code ${h}: ${e}", ("h", hot_code.code_hash)("e", e.what()));
+         }
+      });
+   }
+
+   void wasm_interface::wait_for_preloads() {
+      my->wait_for_preloads();
+   }
+
+   namespace {
+      constexpr uint32_t hot_codes_magic_number = 0x57A5C0DE;
+      constexpr uint32_t hot_codes_version      = 1;
+   }
+
+   void wasm_interface::save_hot_codes(const boost::filesystem::path& file, const std::vector<wasm_hot_code>& hot_codes) {
+      if(hot_codes.empty())
+         return;
+      try {
+         // written next to the file and renamed over it so a crash never leaves a partially written list
+         auto tmp = file;
+         tmp += ".tmp";
+         std::ofstream out(tmp.generic_string().c_str(), std::ios::out | std::ios::binary | std::ofstream::trunc);
+         fc::raw::pack(out, hot_codes_magic_number);
+         fc::raw::pack(out, hot_codes_version);
+         auto payload = fc::raw::pack(hot_codes);
+         out.write(payload.data(), payload.size());
+         fc::raw::pack(out, digest_type::hash(payload.data(), payload.size()));
+         out.close();
+         EOS_ASSERT(out.good(), wasm_exception, "failed to write ${f}", ("f", tmp.generic_string()));
+         boost::filesystem::rename(tmp, file);
+      } catch(const fc::exception& e) {
+         wlog("unable to save hot wasm codes: ${e}", ("e", e.to_detail_string()));
+      } catch(const std::exception& e) {
+         wlog("unable to save hot wasm codes: ${e}", ("e", e.what()));
+      }
+   }
+
+   std::vector<wasm_hot_code> wasm_interface::load_hot_codes(const boost::filesystem::path& file) {
+      std::vector<wasm_hot_code> hot_codes;
+      if(!boost::filesystem::exists(file))
+         return hot_codes;
+      try {
+         std::string content;
+         fc::read_file_contents(file, content);
+         fc::datastream<const char*> ds(content.data(), content.size());
+
+         uint32_t magic = 0, version = 0;
+         fc::raw::unpack(ds, magic);
+         fc::raw::unpack(ds, version);
+         EOS_ASSERT(magic == hot_codes_magic_number && version == hot_codes_version, wasm_exception,
+                    "unexpected magic number ${m} or version ${v}", ("m", magic)("v", version));
+
+         const char* payload_begin = ds.pos();
+         fc::raw::unpack(ds, hot_codes);
+         const auto computed = digest_type::hash(payload_begin, ds.pos() - payload_begin);
+         digest_type checksum;
+         fc::raw::unpack(ds, checksum);
+         EOS_ASSERT(checksum == computed, wasm_exception, "checksum ${a} does not match ${e}", ("a", computed)("e", checksum));
+      } catch(const fc::exception& e) {
+         wlog("ignoring hot wasm codes of ${f}: ${e}", ("f", file.generic_string())("e", e.to_detail_string()));
+         hot_codes.clear();
+      }
+      return hot_codes;
+   }
+
    wasm_instantiated_module_interface::~wasm_instantiated_module_interface() {}
    wasm_runtime_interface::~wasm_runtime_interface() {}
 
@@ -8,12 +8,19 @@ namespace eosio { namespace chain { namespace webassembly {
 
       // always pack the transaction here as exact pack format is part of consensus
       // and an alternative packed format could be stored in get_packed_transaction()
-      const packed_transaction& packed_trx = context.trx_context.packed_trx;
-      bytes trx = fc::raw::pack( static_cast<const transaction&>( packed_trx.get_transaction() ) );
-      size_t copy_size = std::min( static_cast<size_t>(data.size()), trx.size() );
-      std::memcpy( data.data(), trx.data(), copy_size );
-
-      return copy_size;
+      const transaction& trx = context.trx_context.packed_trx.get_transaction();
+      const size_t trx_size = fc::raw::pack_size( trx );
+      if( data.size() >= trx_size ) {
+         // contracts size the buffer with transaction_size(), pack straight into linear memory
+         fc::datastream<char*> ds( data.data(), trx_size );
+         fc::raw::pack( ds, trx );
+         return trx_size;
+      }
+
+      // a truncated read would overflow the stream part way through, it goes through a temporary instead
+      bytes packed = fc::raw::pack( trx );
+      std::memcpy( data.data(), packed.data(), data.size() );
+      return data.size();
    }
 
    int32_t interface::transaction_size() const {
@@ -84,7 +84,13 @@ void code_cache_async::wait_on_compile_monitor_message() {
 //number processed, bytes available (only if number processed > 0)
 std::tuple<size_t, size_t> code_cache_async::consume_compile_thread_queue() {
    size_t bytes_remaining = 0;
+   const auto now = fc::time_point::now();
    size_t gotsome = _result_queue.consume_all([&](const wasm_compilation_result_message& result) {
+      if(auto it = _compile_start_times.find(result.code); it != _compile_start_times.end()) {
+         std::lock_guard g(_stats_mtx);
+         _stats.last_compile_time = now - it->second;
+         _compile_start_times.erase(it);
+      }
       if(_outstanding_compiles_and_poison[result.code] == false) {
          std::visit(overloaded {
             [&](const code_descriptor& cd) {
@@ -95,7 +101,7 @@ std::tuple<size_t, size_t> code_cache_async::consume_compile_thread_queue() {
                _blacklist.emplace(result.code);
             },
             [&](const compilation_result_toofull&) {
-               run_eviction_round();
+               _eviction_pending = true;
             }
          }, result.result);
       }
@@ -108,30 +114,26 @@ std::tuple<size_t, size_t> code_cache_async::consume_compile_thread_queue() {
 
 
 const code_descriptor* const code_cache_async::get_descriptor_for_code(const digest_type& code_id, const uint8_t& vm_version, const chainbase::database& shared_db, bool is_write_window, get_cd_failure& failure) {
+   std::lock_guard g(_mtx);
+
    //if there are any outstanding compiles, process the result queue now
-   //When app is in write window, all tasks are running sequentially and read-only threads
-   //are not running. Safe to update cache entries.
+   //When app is in write window, read-only threads are not running. Shard threads may be, so results only add
+   //entries here, evicting is left to run_pending_eviction().
    if(is_write_window && _outstanding_compiles_and_poison.size()) {
       auto [count_processed, bytes_remaining] = consume_compile_thread_queue();
 
-      if(count_processed)
-         check_eviction_threshold(bytes_remaining);
+      if(count_processed && bytes_remaining < _free_bytes_eviction_threshold)
+         _eviction_pending = true;
 
-      while(count_processed && _queued_compiles.size()) {
-         auto nextup = _queued_compiles.begin();
+      //refill every free compile thread, most requested code first
+      while(_outstanding_compiles_and_poison.size() < _threads && !_queued_compiles.empty()) {
+         const code_tuple nextup = _queued_compiles.pop();
 
-         //it's not clear this check is required: if apply() was called for code then it existed in the code_index; and then
+         //it's not clear a missing code object is possible: if apply() was called for code then it existed in the code_index; and then
          // if we got notification of it no longer existing we would have removed it from queued_compiles
-         const code_object* const codeobject = shared_db.find<code_object,by_code_hash>(boost::make_tuple(nextup->code_id, 0, nextup->vm_version));
-         if(codeobject) {
-            _outstanding_compiles_and_poison.emplace(*nextup, false);
-            std::vector<wrapped_fd> fds_to_pass;
-            fds_to_pass.emplace_back(memfd_for_bytearray(codeobject->code));
-            FC_ASSERT(write_message_with_fds(_compile_monitor_write_socket, compile_wasm_message{ *nextup }, fds_to_pass), "EOS VM failed to communicate to OOP manager");
-            --count_processed;
-         }
-         _queued_compiles.erase(nextup);
+         start_compile(nextup, shared_db);
       }
+      update_compile_stats();
    }
 
    //check for entry in cache
@@ -157,29 +159,86 @@ const code_descriptor* const code_cache_async::get_descriptor_for_code(const dig
       it->second = false;
       return nullptr;
    }
-   if(_queued_compiles.find(ct) != _queued_compiles.end()) {
+   if(_queued_compiles.add_request(ct)) {
       failure = get_cd_failure::temporary; // Compile might not be done yet
       return nullptr;
    }
 
    if(_outstanding_compiles_and_poison.size() >= _threads) {
-      _queued_compiles.emplace(ct);
+      _queued_compiles.push(ct);
+      update_compile_stats();
       failure = get_cd_failure::temporary; // Compile might not be done yet
       return nullptr;
    }
 
-   const code_object* const codeobject = shared_db.find<code_object,by_code_hash>(boost::make_tuple(code_id, 0, vm_version));
-   if(!codeobject) { //should be impossible right?
+   if(!start_compile(ct, shared_db)) { //should be impossible right?
       failure = get_cd_failure::permanent; // Compile will not start
       return nullptr;
    }
+   update_compile_stats();
+   failure = get_cd_failure::temporary; // Compile might not be done yet
+   return nullptr;
+}
+
+bool code_cache_async::start_compile(const code_tuple& ct, const chainbase::database& shared_db) {
+   const code_object* const codeobject = shared_db.find<code_object,by_code_hash>(boost::make_tuple(ct.code_id, 0, ct.vm_version));
+   if(!codeobject)
+      return false;
 
    _outstanding_compiles_and_poison.emplace(ct, false);
+   _compile_start_times[ct] = fc::time_point::now();
    std::vector<wrapped_fd> fds_to_pass;
    fds_to_pass.emplace_back(memfd_for_bytearray(codeobject->code));
-   write_message_with_fds(_compile_monitor_write_socket, compile_wasm_message{ ct }, fds_to_pass);
-   failure = get_cd_failure::temporary; // Compile might not be done yet
-   return nullptr;
+   FC_ASSERT(write_message_with_fds(_compile_monitor_write_socket, compile_wasm_message{ ct }, fds_to_pass), "EOS VM failed to communicate to OOP manager");
+   return true;
+}
+
+void code_cache_async::update_compile_stats() {
+   std::lock_guard g(_stats_mtx);
+   _stats.queued = _queued_compiles.size();
+   _stats.compiling = _outstanding_compiles_and_poison.size();
+}
+
+compile_stats code_cache_async::get_compile_stats() const {
+   std::lock_guard g(_stats_mtx);
+   return _stats;
+}
+
+void code_cache_async::free_code(const digest_type& code_id, const uint8_t& vm_version) {
+   std::lock_guard g(_mtx);
+   code_cache_base::free_code(code_id, vm_version);
+   update_compile_stats();
+}
+
+void code_cache_async::run_pending_eviction() {
+   std::lock_guard g(_mtx);
+   if(!_eviction_pending)
+      return;
+   _eviction_pending = false;
+   run_eviction_round();
+}
+
+void compile_queue::push(const code_tuple& ct) {
+   _queue.insert(queued_compile{ct, 1, _next_sequence++});
+}
+
+bool compile_queue::add_request(const code_tuple& ct) {
+   auto it = _queue.find(ct);
+   if(it == _queue.end())
+      return false;
+   _queue.modify(it, [](queued_compile& q) { ++q.requests; });
+   return true;
+}
+
+code_tuple compile_queue::pop() {
+   auto& by_prio = _queue.get<by_priority>();
+   const code_tuple ct = by_prio.begin()->code;
+   by_prio.erase(by_prio.begin());
+   return ct;
+}
+
+void compile_queue::erase(const code_tuple& ct) {
+   _queue.erase(ct);
 }
 
 code_cache_sync::~code_cache_sync() {
@@ -377,7 +436,7 @@ void code_cache_base::free_code(const digest_type& code_id, const uint8_t& vm_ve
    }
 
    //if it's in the queued list, erase it
-   _queued_compiles.erase({code_id, vm_version});
+   _queued_compiles.erase(code_tuple{code_id, vm_version});
 
    //however, if it's currently being compiled there is no way to cancel the compile,
    //so instead set a poison boolean that indicates not to insert the code in to the cache
@@ -0,0 +1,26 @@
+#include <eosio/chain/xshard_queue.hpp>
+
+#include <algorithm>
+
+namespace eosio { namespace chain {
+
+   void xshard_latency_histogram::record( uint32_t blocks ) {
+      auto itr = std::lower_bound( bucket_bounds.begin(), bucket_bounds.end(), blocks );
+      ++buckets[itr - bucket_bounds.begin()];
+      ++count;
+      total_blocks += blocks;
+   }
+
+   void xshard_queue::post( const shard_name& from_shard, std::deque<xsh_out_action>&& actions ) {
+      for( auto& act : actions ) {
+         auto to_shard = act.xsh_out.to_shard;
+         _batches[to_shard][from_shard].emplace_back( std::move(act) );
+      }
+      actions.clear();
+   }
+
+   void xshard_queue::record_delivery( const shard_name& from_shard, const shard_name& to_shard, uint32_t blocks ) {
+      _latencies[route{from_shard, to_shard}].record( blocks );
+   }
+
+} } // eosio::chain
@@ -1,5 +1,7 @@
 #include <eosio/state_history/create_deltas.hpp>
 #include <eosio/state_history/serialization.hpp>
+#include <eosio/chain/config.hpp>
+#include <eosio/chain/thread_utils.hpp>
 
 namespace eosio {
 namespace state_history {
@@ -57,9 +59,42 @@ bool include_delta(const chain::protocol_state_object& old, const chain::protoco
    return old.activated_protocol_features != curr.activated_protocol_features;
 }
 
-void pack_deltas(boost::iostreams::filtering_ostreambuf& obuf, const chainbase::database& db, bool full_snapshot) {
+using delta_tables = std::tuple<
+    chain::account_index*, chain::account_metadata_index*, chain::code_index*,
+    chain::table_id_multi_index*, chain::key_value_index*, chain::index64_index*, chain::index128_index*,
+    chain::index256_index*, chain::index_double_index*, chain::index_long_double_index*,
+    chain::shared_table_id_multi_index*, chain::shared_key_value_index*, chain::shared_index64_index*, chain::shared_index128_index*,
+    chain::shared_index256_index*, chain::shared_index_double_index*, chain::shared_index_long_double_index*,
+    chain::global_property_multi_index*, chain::generated_transaction_multi_index*,
+    chain::protocol_state_multi_index*, chain::permission_index*, chain::permission_link_index*,
+    chain::resource_limits::resource_limits_index*, chain::resource_limits::resource_usage_index*,
+    chain::resource_limits::resource_limits_state_index*,
+    chain::resource_limits::resource_limits_config_index*>;
+
+/// @return number of table deltas pack_db_deltas() writes for db
+int count_db_deltas(const chainbase::database& db, bool full_snapshot) {
+   auto has_table = [&](auto x) -> int {
+      auto& index = db.get_index<std::remove_pointer_t<decltype(x)>>();
+      if (full_snapshot) {
+         return !index.indices().empty();
+      } else {
+         auto undo = index.last_undo_session();
+         return std::find_if(undo.old_values.begin(), undo.old_values.end(),
+                           [&index](const auto& old) { return include_delta(old, index.get(old.id)); }) != undo.old_values.end() ||
+             !undo.removed_values.empty() || !undo.new_values.empty();
+      }
+   };
 
-   fc::datastream<boost::iostreams::filtering_ostreambuf&> ds{obuf};
+   return std::apply([&has_table](auto... args) { return (has_table(args) + ... ); }, delta_tables{});
+}
+
+/**
+ *  Packs the table deltas of db without the leading count. Deltas of the main db are written as table_delta_v0,
+ *  deltas of a sub-shard db as table_delta_v1 tagged with its shard name.
+ */
+template <typename ST>
+void pack_db_deltas(fc::datastream<ST>& ds, const chainbase::database& db, bool full_snapshot,
+                    const std::optional<chain::shard_name>& shard) {
 
    const auto&                                       table_id_index = db.get_index<chain::table_id_multi_index>();
    std::map<uint64_t, const chain::table_id_object*> removed_table_id;
@@ -101,6 +136,17 @@ void pack_deltas(boost::iostreams::filtering_ostreambuf& obuf, const chainbase::
       fc::raw::pack(ds, make_history_context_wrapper(db, get_shared_table_id(row.t_id._id), row));
    };
 
+   // table_delta = std::variant<table_delta_v0, table_delta_v1> and fc::unsigned_int struct_version
+   auto pack_delta_header = [&](auto& ds, auto* name) {
+      if (shard) {
+         fc::raw::pack(ds, fc::unsigned_int(1));
+         fc::raw::pack(ds, *shard);
+      } else {
+         fc::raw::pack(ds, fc::unsigned_int(0));
+      }
+      fc::raw::pack(ds, name);
+   };
+
    auto process_table = [&](auto& ds, auto* name, auto& index, auto& pack_row) {
 
       auto pack_row_v0 = [&](auto& ds, bool present, auto& row) {
@@ -115,8 +161,7 @@ void pack_deltas(boost::iostreams::filtering_ostreambuf& obuf, const chainbase::
          if (index.indices().empty())
             return;
 
-         fc::raw::pack(ds, fc::unsigned_int(0)); // table_delta = std::variant<table_delta_v0> and fc::unsigned_int struct_version
-         fc::raw::pack(ds, name);
+         pack_delta_header(ds, name);
          fc::raw::pack(ds, fc::unsigned_int(index.indices().size()));
          for (auto& row : index.indices()) {
             pack_row_v0(ds, true, row);
@@ -131,8 +176,7 @@ void pack_deltas(boost::iostreams::filtering_ostreambuf& obuf, const chainbase::
              std::distance(undo.new_values.begin(), undo.new_values.end());
 
          if (num_entries) {
-            fc::raw::pack(ds, fc::unsigned_int(0)); // table_delta = std::variant<table_delta_v0> and fc::unsigned_int struct_version
-            fc::raw::pack(ds, name);
+            pack_delta_header(ds, name);
             fc::raw::pack(ds, fc::unsigned_int((uint32_t)num_entries));
 
             for (auto& old : undo.old_values) {
@@ -153,33 +197,6 @@ void pack_deltas(boost::iostreams::filtering_ostreambuf& obuf, const chainbase::
       }
    };
 
-   auto has_table = [&](auto x) -> int {
-      auto& index = db.get_index<std::remove_pointer_t<decltype(x)>>();
-      if (full_snapshot) {
-         return !index.indices().empty();
-      } else {
-         auto undo = index.last_undo_session();
-         return std::find_if(undo.old_values.begin(), undo.old_values.end(),
-                           [&index](const auto& old) { return include_delta(old, index.get(old.id)); }) != undo.old_values.end() ||
-             !undo.removed_values.empty() || !undo.new_values.empty();
-      }
-   };
-
-   int num_tables = std::apply(
-       [&has_table](auto... args) { return (has_table(args) + ... ); },
-       std::tuple<chain::account_index*, chain::account_metadata_index*, chain::code_index*,
-                  chain::table_id_multi_index*, chain::key_value_index*, chain::index64_index*, chain::index128_index*,
-                  chain::index256_index*, chain::index_double_index*, chain::index_long_double_index*,
-                  chain::shared_table_id_multi_index*, chain::shared_key_value_index*, chain::shared_index64_index*, chain::shared_index128_index*,
-                  chain::shared_index256_index*, chain::shared_index_double_index*, chain::shared_index_long_double_index*,
-                  chain::global_property_multi_index*, chain::generated_transaction_multi_index*,
-                  chain::protocol_state_multi_index*, chain::permission_index*, chain::permission_link_index*,
-                  chain::resource_limits::resource_limits_index*, chain::resource_limits::resource_usage_index*,
-                  chain::resource_limits::resource_limits_state_index*,
-                  chain::resource_limits::resource_limits_config_index*>());
-
-   fc::raw::pack(ds, fc::unsigned_int(num_tables));
-
    process_table(ds, "account", db.get_index<chain::account_index>(), pack_row);
    process_table(ds, "account_metadata", db.get_index<chain::account_metadata_index>(), pack_row);
    process_table(ds, "code", db.get_index<chain::code_index>(), pack_row);
@@ -214,11 +231,122 @@ void pack_deltas(boost::iostreams::filtering_ostreambuf& obuf, const chainbase::
                  pack_row);
    process_table(ds, "resource_limits_config", db.get_index<chain::resource_limits::resource_limits_config_index>(),
                  pack_row);
+}
 
+void pack_deltas(boost::iostreams::filtering_ostreambuf& obuf, const chainbase::database& db, bool full_snapshot) {
+   fc::datastream<boost::iostreams::filtering_ostreambuf&> ds{obuf};
+   fc::raw::pack(ds, fc::unsigned_int(count_db_deltas(db, full_snapshot)));
+   pack_db_deltas(ds, db, full_snapshot, {});
    obuf.pubsync();
+}
+
+void pack_deltas(boost::iostreams::filtering_ostreambuf& obuf, const chainbase::database& main_db,
+                 const std::vector<shard_database>& shard_dbs, bool full_snapshot,
+                 boost::asio::io_context* thread_pool) {
+
+   // sub-shard undo sessions are opened lazily, a shard db the block did not write to still holds the undo
+   // state of an earlier block and has nothing to report
+   std::vector<const shard_database*> changed;
+   int                                num_tables = count_db_deltas(main_db, full_snapshot);
+   for (const auto& shard : shard_dbs) {
+      if (!full_snapshot && shard.second->revision() != main_db.revision())
+         continue;
+      int n = count_db_deltas(*shard.second, full_snapshot);
+      if (n) {
+         changed.push_back(&shard);
+         num_tables += n;
+      }
+   }
+
+   auto pack_shard = [full_snapshot](const shard_database& shard) {
+      fc::datastream<std::vector<char>> sds;
+      pack_db_deltas(sds, *shard.second, full_snapshot, shard.first);
+      return std::move(sds.storage());
+   };
 
+   std::vector<std::future<std::vector<char>>> futures;
+   if (thread_pool) {
+      futures.reserve(changed.size());
+      for (const auto* shard : changed)
+         futures.emplace_back(chain::post_async_task(*thread_pool, [&pack_shard, shard]() { return pack_shard(*shard); }));
+   }
+
+   fc::datastream<boost::iostreams::filtering_ostreambuf&> ds{obuf};
+   std::exception_ptr except;
+   try {
+      fc::raw::pack(ds, fc::unsigned_int(num_tables));
+      pack_db_deltas(ds, main_db, full_snapshot, {});
+   } catch (...) {
+      except = std::current_exception();
+   }
+
+   // wait for every task before rethrowing so none still references the databases
+   for (size_t i = 0; i < changed.size(); ++i) {
+      try {
+         if (thread_pool) {
+            auto buf = futures[i].get();
+            if (!except)
+               ds.write(buf.data(), buf.size());
+         } else if (!except) {
+            auto buf = pack_shard(*changed[i]);
+            ds.write(buf.data(), buf.size());
+         }
+      } catch (...) {
+         if (!except)
+            except = std::current_exception();
+      }
+   }
+   if (except)
+      std::rethrow_exception(except);
+
+   obuf.pubsync();
 }
 
+std::vector<char> filter_deltas(const std::vector<char>& deltas, const std::set<chain::shard_name>& shards) {
+   fc::datastream<const char*> ds(deltas.data(), deltas.size());
+
+   auto skip = [&ds](size_t n) {
+      EOS_ASSERT(ds.remaining() >= n, chain::plugin_exception, "truncated table delta");
+      ds.skip(n);
+   };
+
+   fc::unsigned_int num_tables;
+   fc::raw::unpack(ds, num_tables);
+
+   std::vector<std::pair<const char*, size_t>> kept;
+   for (uint32_t i = 0; i < num_tables.value; ++i) {
+      const char*      begin = ds.pos();
+      fc::unsigned_int version;
+      fc::raw::unpack(ds, version);
+      EOS_ASSERT(version.value <= 1, chain::plugin_exception, "unknown table_delta version ${v}", ("v", version.value));
+
+      chain::shard_name shard = chain::config::main_shard_name;
+      if (version.value == 1)
+         fc::raw::unpack(ds, shard);
+
+      fc::unsigned_int len;
+      fc::raw::unpack(ds, len);
+      skip(len.value);
+
+      fc::unsigned_int num_rows;
+      fc::raw::unpack(ds, num_rows);
+      for (uint32_t r = 0; r < num_rows.value; ++r) {
+         bool present;
+         fc::raw::unpack(ds, present);
+         fc::raw::unpack(ds, len);
+         skip(len.value);
+      }
+
+      if (shards.count(shard))
+         kept.emplace_back(begin, ds.pos() - begin);
+   }
+
+   fc::datastream<std::vector<char>> out;
+   fc::raw::pack(out, fc::unsigned_int(kept.size()));
+   for (const auto& k : kept)
+      out.write(k.first, k.second);
+   return std::move(out.storage());
+}
 
 } // namespace state_history
 } // namespace eosio
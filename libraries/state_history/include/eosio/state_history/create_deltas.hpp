@@ -1,13 +1,29 @@
 #pragma once
 
 #include <eosio/state_history/types.hpp>
+#include <boost/asio/io_context.hpp>
 #include <boost/iostreams/filtering_streambuf.hpp>
 
+#include <set>
+
 namespace eosio {
 namespace state_history {
 
 void pack_deltas(boost::iostreams::filtering_ostreambuf& ds, const chainbase::database& db, bool full_snapshot);
 
+using shard_database = std::pair<chain::shard_name, const chainbase::database*>;
+
+/**
+ *  Packs the deltas of the main db as table_delta_v0 followed by the deltas of each sub-shard db as table_delta_v1
+ *  tagged with its shard name. Sub-shard dbs are packed concurrently on thread_pool when one is given.
+ */
+void pack_deltas(boost::iostreams::filtering_ostreambuf& ds, const chainbase::database& main_db,
+                 const std::vector<shard_database>& shard_dbs, bool full_snapshot,
+                 boost::asio::io_context* thread_pool = nullptr);
+
+/// @return packed deltas keeping only the tables of shards, table_delta_v0 belongs to the main shard
+std::vector<char> filter_deltas(const std::vector<char>& deltas, const std::set<chain::shard_name>& shards);
+
 
 } // namespace state_history
 } // namespace eosio
@@ -97,6 +97,11 @@ struct get_blocks_request_v0 {
    bool                        fetch_deltas           = false;
 };
 
+/// get_blocks_request_v0 limited to the deltas of shards, an empty list selects every shard
+struct get_blocks_request_v1 : get_blocks_request_v0 {
+   std::vector<chain::shard_name> shards = {};
+};
+
 struct get_blocks_ack_request_v0 {
    uint32_t num_messages = 0;
 };
@@ -114,7 +119,7 @@ struct get_blocks_result_v0 : get_blocks_result_base {
    std::optional<bytes>          deltas;
 };
 
-using state_request = std::variant<get_status_request_v0, get_blocks_request_v0, get_blocks_ack_request_v0>;
+using state_request = std::variant<get_status_request_v0, get_blocks_request_v0, get_blocks_ack_request_v0, get_blocks_request_v1>;
 using state_result  = std::variant<get_status_result_v0, get_blocks_result_v0>;
 
 } // namespace state_history
@@ -126,5 +131,6 @@ FC_REFLECT(eosio::state_history::block_position, (block_num)(block_id));
 FC_REFLECT_EMPTY(eosio::state_history::get_status_request_v0);
 FC_REFLECT(eosio::state_history::get_status_result_v0, (head)(last_irreversible)(trace_begin_block)(trace_end_block)(chain_state_begin_block)(chain_state_end_block)(chain_id));
 FC_REFLECT(eosio::state_history::get_blocks_request_v0, (start_block_num)(end_block_num)(max_messages_in_flight)(have_positions)(irreversible_only)(fetch_block)(fetch_traces)(fetch_deltas));
+FC_REFLECT_DERIVED(eosio::state_history::get_blocks_request_v1, (eosio::state_history::get_blocks_request_v0), (shards));
 FC_REFLECT(eosio::state_history::get_blocks_ack_request_v0, (num_messages));
 // clang-format on
@@ -400,7 +400,8 @@ namespace eosio { namespace testing {
          void schedule_protocol_features_wo_preactivation(const vector<digest_type> feature_digests);
          void preactivate_protocol_features(const vector<digest_type> feature_digests);
          void preactivate_builtin_protocol_features(const std::vector<builtin_protocol_feature_t>& features);
-         void preactivate_all_builtin_protocol_features();
+         /// @param excluded builtin features left inactive
+         void preactivate_all_builtin_protocol_features(const flat_set<builtin_protocol_feature_t>& excluded = {});
 
          static genesis_state default_genesis() {
             genesis_state genesis;
@@ -1221,7 +1221,7 @@ namespace eosio { namespace testing {
       preactivate_protocol_features(features);
    }
 
-   void base_tester::preactivate_all_builtin_protocol_features() {
+   void base_tester::preactivate_all_builtin_protocol_features(const flat_set<builtin_protocol_feature_t>& excluded) {
       const auto& pfm = control->get_protocol_feature_manager();
       const auto& pfs = pfm.get_protocol_feature_set();
       const auto current_block_num  =  control->head_block_num() + (control->is_building_block() ? 1 : 0);
@@ -1232,12 +1232,13 @@ namespace eosio { namespace testing {
       vector<digest_type> preactivations;
 
       std::function<void(const digest_type&)> add_digests =
-      [&pfm, &pfs, current_block_num, current_block_time, &preactivation_set, &preactivations, &add_digests]
+      [&pfm, &pfs, current_block_num, current_block_time, &excluded, &preactivation_set, &preactivations, &add_digests]
       ( const digest_type& feature_digest ) {
          const auto& pf = pfs.get_protocol_feature( feature_digest );
          FC_ASSERT( pf.builtin_feature, "called add_digests on a non-builtin protocol feature" );
          if( !pf.enabled || pf.earliest_allowed_activation_time > current_block_time
              || pfm.is_builtin_activated( *pf.builtin_feature, current_block_num ) ) return;
+         if( excluded.count( *pf.builtin_feature ) ) return;
 
          auto res = preactivation_set.emplace( feature_digest );
          if( !res.second ) return;
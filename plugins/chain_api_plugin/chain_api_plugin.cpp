@@ -133,6 +133,7 @@ void chain_api_plugin::plugin_startup() {
       CHAIN_RO_CALL(get_code, 200, http_params_types::params_required),
       CHAIN_RO_CALL(get_code_hash, 200, http_params_types::params_required),
       CHAIN_RO_CALL(get_consensus_parameters, 200, http_params_types::no_params),
+      CHAIN_RO_CALL(get_suggested_shard, 200, http_params_types::params_required),
       CHAIN_RO_CALL(get_abi, 200, http_params_types::params_required),
       CHAIN_RO_CALL(get_raw_code_and_abi, 200, http_params_types::params_required),
       CHAIN_RO_CALL(get_raw_abi, 200, http_params_types::params_required),
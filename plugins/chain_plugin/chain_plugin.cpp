@@ -116,6 +116,43 @@ void validate(boost::any& v,
   }
 }
 
+std::ostream& operator<<(std::ostream& osm, eosio::chain::thread_affinity_mode m) {
+   if ( m == eosio::chain::thread_affinity_mode::none ) {
+      osm << "none";
+   } else if ( m == eosio::chain::thread_affinity_mode::core ) {
+      osm << "core";
+   } else if ( m == eosio::chain::thread_affinity_mode::numa ) {
+      osm << "numa";
+   }
+
+   return osm;
+}
+
+void validate(boost::any& v,
+              const std::vector<std::string>& values,
+              eosio::chain::thread_affinity_mode* /* target_type */,
+              int)
+{
+  using namespace boost::program_options;
+
+  // Make sure no previous assignment to 'v' was made.
+  validators::check_first_occurrence(v);
+
+  // Extract the first string from 'values'. If there is more than
+  // one string, it's an error, and exception will be thrown.
+  std::string const& s = validators::get_single_string(values);
+
+  if ( s == "none" ) {
+     v = boost::any(eosio::chain::thread_affinity_mode::none);
+  } else if ( s == "core" ) {
+     v = boost::any(eosio::chain::thread_affinity_mode::core);
+  } else if ( s == "numa" ) {
+     v = boost::any(eosio::chain::thread_affinity_mode::numa);
+  } else {
+     throw validation_error(validation_error::invalid_option_value);
+  }
+}
+
 }
 
 using namespace eosio;
@@ -195,6 +232,7 @@ chain_plugin::chain_plugin()
 :my(new chain_plugin_impl()) {
    app().register_config_type<eosio::chain::db_read_mode>();
    app().register_config_type<eosio::chain::validation_mode>();
+   app().register_config_type<eosio::chain::thread_affinity_mode>();
    app().register_config_type<chainbase::pinnable_mapped_file::map_mode>();
    app().register_config_type<eosio::chain::wasm_interface::vm_type>();
 }
@@ -263,14 +301,28 @@ void chain_plugin::set_program_options(options_description& cli, options_descrip
          )
          ("profile-account", boost::program_options::value<vector<string>>()->composing(),
           "The name of an account whose code will be profiled")
+         ("wasm-preload-budget-mb", bpo::value<uint64_t>()->default_value(0),
+          "Maximum size (in MiB) of wasm of the contracts most used before the last shutdown to instantiate in the background at startup. 0 disables preloading")
+         ("wasm-cache-max-size-mb", bpo::value<uint64_t>()->default_value(0),
+          "Maximum estimated size (in MiB) of instantiated contracts to keep cached, each instance counted at the size of its wasm. Once exceeded the least recently used contracts are evicted. Contracts not used since the last irreversible block are evicted either way, 0 does not bound the size")
          ("abi-serializer-max-time-ms", bpo::value<uint32_t>()->default_value(config::default_abi_serializer_max_time_us / 1000),
           "Override default maximum ABI serialization time allowed in ms")
          ("chain-state-db-size-mb", bpo::value<uint64_t>()->default_value(config::default_state_size / (1024  * 1024)), "Maximum size (in MiB) of the chain state database")
          ("chain-state-db-guard-size-mb", bpo::value<uint64_t>()->default_value(config::default_state_guard_size / (1024  * 1024)), "Safely shut down node when free space remaining in the chain state database drops below this size (in MiB).")
+         ("shard-state-db-size-mb", bpo::value<uint64_t>()->default_value(config::default_shard_state_size / (1024  * 1024)), "Maximum size (in MiB) of the state database of a sub-shard. Files are allocated sparse, disk space is only used as the state grows.")
+         ("shard-state-db-size", bpo::value<vector<string>>()->composing(),
+          "Maximum size of the state database of a single sub-shard, overriding shard-state-db-size-mb. Syntax: shard_name:size_in_MiB")
          ("signature-cpu-billable-pct", bpo::value<uint32_t>()->default_value(config::default_sig_cpu_bill_pct / config::percent_1),
           "Percentage of actual signature recovery cpu to bill. Whole number percentages, e.g. 50 for 50%")
          ("chain-threads", bpo::value<uint16_t>()->default_value(config::default_controller_thread_pool_size),
           "Number of worker threads in controller thread pool")
+         ("shard-threads", bpo::value<uint16_t>()->default_value(config::default_shard_thread_pool_size),
+          "Number of worker threads executing shards in parallel, used by both block validation and block production. 0 means one thread per available hardware thread")
+         ("shard-thread-affinity", boost::program_options::value<eosio::chain::thread_affinity_mode>()->default_value(eosio::chain::thread_affinity_mode::none),
+          "CPU placement of shard threads.\n"
+          "In \"none\" mode shard threads are scheduled freely by the OS.\n"
+          "In \"core\" mode each shard thread is pinned to one of the cpus available to nodeos.\n"
+          "In \"numa\" mode shard threads are pinned to cpus filling one NUMA node before the next, keeping them close to each other's memory.")
          ("contracts-console", bpo::bool_switch()->default_value(false),
           "print contract's output to console")
          ("deep-mind", bpo::bool_switch()->default_value(false),
@@ -327,7 +379,7 @@ void chain_plugin::set_program_options(options_description& cli, options_descrip
                   elog("eos-vm-oc-compile-threads must be set to a non-zero value");
                   EOS_ASSERT(false, plugin_exception, "");
                }
-         }), "Number of threads to use for EOS VM OC tier-up")
+         }), "Number of threads to use for EOS VM OC tier-up, compiling the most executed contracts first")
          ("eos-vm-oc-enable", bpo::bool_switch(), "Enable EOS VM OC tier-up runtime")
 #endif
          ("enable-account-queries", bpo::value<bool>()->default_value(false), "enable queries to find accounts by various metadata.")
@@ -605,6 +657,22 @@ void chain_plugin::plugin_initialize(const variables_map& options) {
       if( options.count( "chain-state-db-guard-size-mb" ))
          my->chain_config->state_guard_size = options.at( "chain-state-db-guard-size-mb" ).as<uint64_t>() * 1024 * 1024;
 
+      if( options.count( "shard-state-db-size-mb" ))
+         my->chain_config->shard_state_size = options.at( "shard-state-db-size-mb" ).as<uint64_t>() * 1024 * 1024;
+
+      if( options.count( "shard-state-db-size" )) {
+         for( const auto& entry : options.at( "shard-state-db-size" ).as<vector<string>>() ) {
+            auto pos = entry.find( ':' );
+            EOS_ASSERT( pos != std::string::npos, plugin_config_exception,
+                        "Invalid shard-state-db-size ${e}, expected shard_name:size_in_MiB", ("e", entry) );
+            try {
+               my->chain_config->shard_state_sizes[name( entry.substr( 0, pos ) )] = std::stoull( entry.substr( pos + 1 ) ) * 1024 * 1024;
+            } catch( const std::logic_error& ) {
+               EOS_THROW( plugin_config_exception, "Invalid shard-state-db-size ${e}, expected shard_name:size_in_MiB", ("e", entry) );
+            }
+         }
+      }
+
       if( options.count( "max-nonprivileged-inline-action-size" ))
          my->chain_config->max_nonprivileged_inline_action_size = options.at( "max-nonprivileged-inline-action-size" ).as<uint32_t>();
 
@@ -624,6 +692,9 @@ void chain_plugin::plugin_initialize(const variables_map& options) {
                      "chain-threads ${num} must be greater than 0", ("num", my->chain_config->thread_pool_size) );
       }
 
+      my->chain_config->shard_thread_pool_size = options.at( "shard-threads" ).as<uint16_t>();
+      my->chain_config->shard_thread_affinity = options.at( "shard-thread-affinity" ).as<thread_affinity_mode>();
+
       my->chain_config->sig_cpu_bill_pct = options.at("signature-cpu-billable-pct").as<uint32_t>();
       EOS_ASSERT( my->chain_config->sig_cpu_bill_pct >= 0 && my->chain_config->sig_cpu_bill_pct <= 100, plugin_config_exception,
                   "signature-cpu-billable-pct must be 0 - 100, ${pct}", ("pct", my->chain_config->sig_cpu_bill_pct) );
@@ -631,6 +702,8 @@ void chain_plugin::plugin_initialize(const variables_map& options) {
 
       if( my->wasm_runtime )
          my->chain_config->wasm_runtime = *my->wasm_runtime;
+      my->chain_config->wasm_preload_budget = options.at( "wasm-preload-budget-mb" ).as<uint64_t>() * 1024 * 1024;
+      my->chain_config->wasm_cache_max_size = options.at( "wasm-cache-max-size-mb" ).as<uint64_t>() * 1024 * 1024;
 
       my->chain_config->force_all_checks = options.at( "force-all-checks" ).as<bool>();
       my->chain_config->disable_replay_opts = options.at( "disable-replay-opts" ).as<bool>();
@@ -1178,7 +1251,7 @@ chain_apis::read_write chain_plugin::get_read_write_api(const fc::microseconds&
 }
 
 chain_apis::read_only chain_plugin::get_read_only_api(const fc::microseconds& http_max_response_time) const {
-   return chain_apis::read_only(chain(), my->_account_query_db, get_abi_serializer_max_time(), http_max_response_time, my->producer_plug, my->_trx_finality_status_processing.get());
+   return chain_apis::read_only(chain(), my->_account_query_db, get_abi_serializer_max_time(), http_max_response_time, my->producer_plug, my->_trx_finality_status_processing.get(), &my->chain->get_thread_pool());
 }
 
 
@@ -1278,8 +1351,8 @@ read_only::get_info_results read_only::get_info(const read_only::get_info_params
       db.head_block_producer(),
       rm.get_virtual_block_cpu_limit(),
       rm.get_virtual_block_net_limit(),
-      rm.get_block_cpu_limit(db.dbm().main_db()),
-      rm.get_block_net_limit(db.dbm().main_db()),
+      rm.get_block_cpu_limit(db.dbm().main_db(), db.dbm().main_db()),
+      rm.get_block_net_limit(db.dbm().main_db(), db.dbm().main_db()),
       //std::bitset<64>(db.get_dynamic_global_properties().recent_slots_filled).to_string(),
       //__builtin_popcountll(db.get_dynamic_global_properties().recent_slots_filled) / 64.0,
       app().version_string(),
@@ -1539,40 +1612,187 @@ string get_table_type( const abi_def& abi, const name& table_name ) {
    EOS_ASSERT( false, chain::contract_table_query_exception, "Table ${table} is not specified in the ABI", ("table",table_name) );
 }
 
+namespace {
+
+/// bound of a fan-out read, "shard:key" bounds the (shard, key) order of the merged rows, a plain key bounds every shard.
+/// A cursor "shard:key:base" also keeps the caller's plain bound `base` for the shards after `shard`.
+struct shard_bound {
+   std::optional<name> shard;
+   string              key;
+   string              base; ///< key bound of the shards other than `shard`
+};
+
+shard_bound parse_shard_bound( const string& bound ) {
+   auto pos = bound.find( ':' );
+   if( pos == string::npos )
+      return { {}, bound, bound };
+   auto base_pos = bound.find( ':', pos + 1 );
+   if( base_pos == string::npos )
+      return { name( bound.substr( 0, pos ) ), bound.substr( pos + 1 ), string() };
+   return { name( bound.substr( 0, pos ) ), bound.substr( pos + 1, base_pos - pos - 1 ), bound.substr( base_pos + 1 ) };
+}
+
+/// @return cursor continuing a fan-out read at key of shard, the shards after it start from base
+string shard_cursor( const name& shard, const string& key, const string& base ) {
+   auto cursor = shard.to_string() + ":" + key;
+   if( !base.empty() )
+      cursor += ":" + base;
+   return cursor;
+}
+
+/// @return shards of a fan-out read in the order their rows are merged
+vector<name> fan_out_shards( vector<name> shards, bool reverse ) {
+   std::sort( shards.begin(), shards.end() );
+   shards.erase( std::unique( shards.begin(), shards.end() ), shards.end() );
+   if( reverse )
+      std::reverse( shards.begin(), shards.end() );
+   return shards;
+}
+
+/// sets the key bounds of shard, @return false if shard lies outside of [lower, upper]
+bool shard_range( const name& shard, const shard_bound& lower, const shard_bound& upper, string& lower_key, string& upper_key ) {
+   if( (lower.shard && shard < *lower.shard) || (upper.shard && shard > *upper.shard) )
+      return false;
+   lower_key = lower.shard && shard == *lower.shard ? lower.key : lower.base;
+   upper_key = upper.shard && shard == *upper.shard ? upper.key : upper.base;
+   return true;
+}
+
+/// runs query(i) for i in [0, n) concurrently on thread_pool, or one after another without a pool
+template <typename Result, typename Query>
+vector<Result> query_shards( boost::asio::io_context* thread_pool, size_t n, Query&& query ) {
+   vector<Result> results;
+   results.reserve( n );
+   if( !thread_pool || n <= 1 ) {
+      for( size_t i = 0; i < n; ++i )
+         results.emplace_back( query( i ) );
+      return results;
+   }
+
+   vector<std::future<Result>> futures;
+   futures.reserve( n );
+   for( size_t i = 0; i < n; ++i )
+      futures.emplace_back( post_async_task( *thread_pool, [&query, i]() { return query( i ); } ) );
+
+   // wait for every query before rethrowing, they reference the caller's state
+   std::exception_ptr except;
+   for( auto& f : futures ) {
+      try {
+         results.emplace_back( f.get() );
+      } catch( ... ) {
+         if( !except )
+            except = std::current_exception();
+      }
+   }
+   if( except )
+      std::rethrow_exception( except );
+   return results;
+}
+
+fc::variant shard_row( const name& shard, fc::variant&& row, bool show_payer ) {
+   if( show_payer ) {
+      fc::mutable_variant_object mvo( row.get_object() );
+      mvo( "shard", shard );
+      return mvo;
+   }
+   return fc::mutable_variant_object( "shard", shard )( "data", std::move(row) );
+}
+
+} // anonymous namespace
+
+const chainbase::database& read_only::get_shard_db( const name& shard )const {
+   const auto* d = db.dbm().find_shard_db( shard );
+   EOS_ASSERT( d != nullptr, chain::contract_table_query_exception, "Unknown shard ${s}", ("s", shard) );
+   return *d;
+}
+
 read_only::get_table_rows_result read_only::get_table_rows( const read_only::get_table_rows_params& p, const fc::time_point& deadline )const {
    abi_def abi = eosio::chain_apis::get_abi( db, p.code );
+   if( p.shards.empty() )
+      return get_table_rows_on_shard( p.shard, p, std::move(abi), deadline );
+
+   const bool reverse = p.reverse && *p.reverse;
+   const auto lower = parse_shard_bound( p.lower_bound );
+   const auto upper = parse_shard_bound( p.upper_bound );
+   const auto& base = reverse ? upper.base : lower.base; // the cursor replaces the bound it continues from
+   vector<get_table_rows_params> shard_params;
+   for( const auto& shard : fan_out_shards( p.shards, reverse ) ) {
+      auto sp = p;
+      sp.shards.clear();
+      sp.shard = shard;
+      if( shard_range( shard, lower, upper, sp.lower_bound, sp.upper_bound ) )
+         shard_params.emplace_back( std::move(sp) );
+   }
+
+   auto results = query_shards<get_table_rows_result>( shard_query_pool, shard_params.size(), [&]( size_t i ) {
+      return get_table_rows_on_shard( shard_params[i].shard, shard_params[i], abi_def( abi ), deadline );
+   } );
+
+   const bool show_payer = p.show_payer && *p.show_payer;
+   get_table_rows_result result;
+   uint32_t remaining = p.limit;
+   for( size_t i = 0; i < results.size(); ++i ) {
+      const auto& sp = shard_params[i];
+      if( remaining == 0 ) {
+         result.more = true;
+         result.next_key = shard_cursor( sp.shard, reverse ? sp.upper_bound : sp.lower_bound, base );
+         break;
+      }
+      auto& r = results[i];
+      if( r.rows.size() > remaining ) {
+         // the merged result ends inside this shard, read it again up to the limit to learn where it stops
+         auto cut = sp;
+         cut.limit = remaining;
+         r = get_table_rows_on_shard( cut.shard, cut, abi_def( abi ), deadline );
+      }
+      remaining -= std::min<uint32_t>( remaining, r.rows.size() );
+      for( auto& row : r.rows )
+         result.rows.emplace_back( shard_row( sp.shard, std::move(row), show_payer ) );
+      if( r.more ) {
+         result.more = true;
+         result.next_key = shard_cursor( sp.shard, r.next_key, base );
+         break;
+      }
+   }
+   return result;
+}
+
+read_only::get_table_rows_result read_only::get_table_rows_on_shard( const name& shard,
+                                                                     const read_only::get_table_rows_params& p,
+                                                                     abi_def&& abi, const fc::time_point& deadline )const {
+   const auto& d = get_shard_db( shard );
    bool primary = false;
    auto table_with_index = get_table_index_name( p, primary );
    if( primary ) {
       EOS_ASSERT( p.table == table_with_index, chain::contract_table_query_exception, "Invalid table name ${t}", ( "t", p.table ));
       auto table_type = get_table_type( abi, p.table );
       if( table_type == KEYi64 || p.key_type == "i64" || p.key_type == "name" ) {
-         return get_table_rows_ex<key_value_index>(p,std::move(abi),deadline);
+         return get_table_rows_ex<key_value_index>(d, p,std::move(abi),deadline);
       }
       EOS_ASSERT( false, chain::contract_table_query_exception,  "Invalid table type ${type}", ("type",table_type)("abi",abi));
    } else {
       EOS_ASSERT( !p.key_type.empty(), chain::contract_table_query_exception, "key type required for non-primary index" );
 
       if (p.key_type == chain_apis::i64 || p.key_type == "name") {
-         return get_table_rows_by_seckey<index64_index, uint64_t>(p, std::move(abi), deadline, [](uint64_t v)->uint64_t {
+         return get_table_rows_by_seckey<index64_index, uint64_t>(d, p, std::move(abi), deadline, [](uint64_t v)->uint64_t {
             return v;
          });
       }
       else if (p.key_type == chain_apis::i128) {
-         return get_table_rows_by_seckey<index128_index, uint128_t>(p, std::move(abi), deadline, [](uint128_t v)->uint128_t {
+         return get_table_rows_by_seckey<index128_index, uint128_t>(d, p, std::move(abi), deadline, [](uint128_t v)->uint128_t {
             return v;
          });
       }
       else if (p.key_type == chain_apis::i256) {
          if ( p.encode_type == chain_apis::hex) {
             using  conv = keytype_converter<chain_apis::sha256,chain_apis::hex>;
-            return get_table_rows_by_seckey<conv::index_type, conv::input_type>(p, std::move(abi), deadline, conv::function());
+            return get_table_rows_by_seckey<conv::index_type, conv::input_type>(d, p, std::move(abi), deadline, conv::function());
          }
          using  conv = keytype_converter<chain_apis::i256>;
-         return get_table_rows_by_seckey<conv::index_type, conv::input_type>(p, std::move(abi), deadline, conv::function());
+         return get_table_rows_by_seckey<conv::index_type, conv::input_type>(d, p, std::move(abi), deadline, conv::function());
       }
       else if (p.key_type == chain_apis::float64) {
-         return get_table_rows_by_seckey<index_double_index, double>(p, std::move(abi), deadline, [](double v)->float64_t {
+         return get_table_rows_by_seckey<index_double_index, double>(d, p, std::move(abi), deadline, [](double v)->float64_t {
             float64_t f;
             double_to_float64(v, f);
             return f;
@@ -1580,13 +1800,13 @@ read_only::get_table_rows_result read_only::get_table_rows( const read_only::get
       }
       else if (p.key_type == chain_apis::float128) {
          if ( p.encode_type == chain_apis::hex) {
-            return get_table_rows_by_seckey<index_long_double_index, uint128_t>(p, std::move(abi), deadline, [](uint128_t v)->float128_t{
+            return get_table_rows_by_seckey<index_long_double_index, uint128_t>(d, p, std::move(abi), deadline, [](uint128_t v)->float128_t{
                float128_t f;
                uint128_to_float128(v, f);
                return f;
             });
          }
-         return get_table_rows_by_seckey<index_long_double_index, double>(p, std::move(abi), deadline, [](double v)->float128_t{
+         return get_table_rows_by_seckey<index_long_double_index, double>(d, p, std::move(abi), deadline, [](double v)->float128_t{
             float64_t f;
             double_to_float64(v, f);
             float128_t f128;
@@ -1596,24 +1816,25 @@ read_only::get_table_rows_result read_only::get_table_rows( const read_only::get
       }
       else if (p.key_type == chain_apis::sha256) {
          using  conv = keytype_converter<chain_apis::sha256,chain_apis::hex>;
-         return get_table_rows_by_seckey<conv::index_type, conv::input_type>(p, std::move(abi), deadline, conv::function());
+         return get_table_rows_by_seckey<conv::index_type, conv::input_type>(d, p, std::move(abi), deadline, conv::function());
       }
       else if(p.key_type == chain_apis::ripemd160) {
          using  conv = keytype_converter<chain_apis::ripemd160,chain_apis::hex>;
-         return get_table_rows_by_seckey<conv::index_type, conv::input_type>(p, std::move(abi), deadline, conv::function());
+         return get_table_rows_by_seckey<conv::index_type, conv::input_type>(d, p, std::move(abi), deadline, conv::function());
       }
       EOS_ASSERT(false, chain::contract_table_query_exception,  "Unsupported secondary index type: ${t}", ("t", p.key_type));
    }
 }
 
-read_only::get_table_by_scope_result read_only::get_table_by_scope( const read_only::get_table_by_scope_params& p,
-                                                                    const fc::time_point& deadline )const {
+read_only::get_table_by_scope_result read_only::get_table_by_scope_on_shard( const name& shard,
+                                                                             const read_only::get_table_by_scope_params& p,
+                                                                             const fc::time_point& deadline )const {
 
    fc::microseconds params_time_limit = p.time_limit_ms ? fc::milliseconds(*p.time_limit_ms) : fc::milliseconds(10);
    fc::time_point params_deadline = fc::time_point::now() + params_time_limit;
 
    read_only::get_table_by_scope_result result;
-   const auto& d = db.db();
+   const auto& d = get_shard_db( shard );
 
    const auto& idx = d.get_index<chain::table_id_multi_index, chain::by_code_scope_table>();
    auto lower_bound_lookup_tuple = std::make_tuple( p.code, name(std::numeric_limits<uint64_t>::lowest()), p.table );
@@ -1639,7 +1860,7 @@ read_only::get_table_by_scope_result read_only::get_table_by_scope( const read_o
          FC_CHECK_DEADLINE(deadline);
          if( p.table && itr->table != p.table ) continue;
 
-         result.rows.push_back( {itr->code, itr->scope, itr->table, itr->payer, itr->count} );
+         result.rows.push_back( {itr->code, itr->scope, itr->table, itr->payer, itr->count, shard} );
 
          ++count;
       }
@@ -1659,6 +1880,53 @@ read_only::get_table_by_scope_result read_only::get_table_by_scope( const read_o
    return result;
 }
 
+read_only::get_table_by_scope_result read_only::get_table_by_scope( const read_only::get_table_by_scope_params& p,
+                                                                    const fc::time_point& deadline )const {
+   if( p.shards.empty() )
+      return get_table_by_scope_on_shard( p.shard, p, deadline );
+
+   const bool reverse = p.reverse && *p.reverse;
+   const auto lower = parse_shard_bound( p.lower_bound );
+   const auto upper = parse_shard_bound( p.upper_bound );
+   const auto& base = reverse ? upper.base : lower.base; // the cursor replaces the bound it continues from
+   vector<get_table_by_scope_params> shard_params;
+   for( const auto& shard : fan_out_shards( p.shards, reverse ) ) {
+      auto sp = p;
+      sp.shards.clear();
+      sp.shard = shard;
+      if( shard_range( shard, lower, upper, sp.lower_bound, sp.upper_bound ) )
+         shard_params.emplace_back( std::move(sp) );
+   }
+
+   auto results = query_shards<get_table_by_scope_result>( shard_query_pool, shard_params.size(), [&]( size_t i ) {
+      return get_table_by_scope_on_shard( shard_params[i].shard, shard_params[i], deadline );
+   } );
+
+   get_table_by_scope_result result;
+   uint32_t remaining = p.limit;
+   for( size_t i = 0; i < results.size(); ++i ) {
+      const auto& sp = shard_params[i];
+      if( remaining == 0 ) {
+         result.more = shard_cursor( sp.shard, reverse ? sp.upper_bound : sp.lower_bound, base );
+         break;
+      }
+      auto& r = results[i];
+      if( r.rows.size() > remaining ) {
+         // the merged result ends inside this shard, read it again up to the limit to learn where it stops
+         auto cut = sp;
+         cut.limit = remaining;
+         r = get_table_by_scope_on_shard( cut.shard, cut, deadline );
+      }
+      remaining -= std::min<uint32_t>( remaining, r.rows.size() );
+      result.rows.insert( result.rows.end(), r.rows.begin(), r.rows.end() );
+      if( !r.more.empty() ) {
+         result.more = shard_cursor( sp.shard, r.more, base );
+         break;
+      }
+   }
+   return result;
+}
+
 vector<asset> read_only::get_currency_balance( const read_only::get_currency_balance_params& p, const fc::time_point& deadline )const {
 
    const abi_def abi = eosio::chain_apis::get_abi( db, p.code );
@@ -2662,6 +2930,25 @@ read_only::get_consensus_parameters(const get_consensus_parameters_params&, cons
    return results;
 }
 
+read_only::get_suggested_shard_results
+read_only::get_suggested_shard(const get_suggested_shard_params& params, const fc::time_point& deadline ) const {
+   const auto& routing = db.get_shard_routing();
+   get_suggested_shard_results results;
+
+   flat_set<name> accounts( params.accounts.begin(), params.accounts.end() );
+   results.accounts.reserve( accounts.size() );
+   for( const auto& a : accounts ) {
+      auto shards = routing.get_shards( a );
+      results.accounts.push_back( { a, vector<name>( shards.begin(), shards.end() ) } );
+   }
+
+   if( auto shard = routing.suggest_shard( accounts ) ) {
+      results.shard = *shard;
+      results.found = true;
+   }
+   return results;
+}
+
 } // namespace chain_apis
 
 fc::variant chain_plugin::get_log_trx_trace(const transaction_trace_ptr& trx_trace ) const {
@@ -4,6 +4,7 @@
 #include <eosio/chain/authority.hpp>
 #include <eosio/chain/account_object.hpp>
 #include <eosio/chain/block.hpp>
+#include <eosio/chain/config.hpp>
 #include <eosio/chain/controller.hpp>
 #include <eosio/chain/contract_table_objects.hpp>
 #include <eosio/chain/resource_limits.hpp>
@@ -95,6 +96,7 @@ class read_only {
    bool  shorten_abi_errors = true;
    const producer_plugin* producer_plug;
    const trx_finality_status_processing* trx_finality_status_proc;
+   boost::asio::io_context* shard_query_pool; // runs the per shard queries of a fan-out read, may be null
 
 public:
    static const string KEYi64;
@@ -102,13 +104,15 @@ public:
    read_only(const controller& db, const std::optional<account_query_db>& aqdb,
              const fc::microseconds& abi_serializer_max_time, const fc::microseconds& http_max_response_time,
              const producer_plugin* producer_plug,
-             const trx_finality_status_processing* trx_finality_status_proc)
+             const trx_finality_status_processing* trx_finality_status_proc,
+             boost::asio::io_context* shard_query_pool = nullptr)
       : db(db)
       , aqdb(aqdb)
       , abi_serializer_max_time(abi_serializer_max_time)
       , http_max_response_time(http_max_response_time)
       , producer_plug(producer_plug)
-      , trx_finality_status_proc(trx_finality_status_proc) {
+      , trx_finality_status_proc(trx_finality_status_proc)
+      , shard_query_pool(shard_query_pool) {
    }
 
    void validate() const {}
@@ -378,6 +382,11 @@ public:
       std::optional<bool>  reverse;
       std::optional<bool>  show_payer; // show RAM payer
       std::optional<uint32_t> time_limit_ms; // defaults to 10ms
+      name                 shard = chain::config::main_shard_name;
+      /// fan-out: query these shards concurrently instead of `shard`, rows are ordered by shard then key and
+      /// lower_bound, upper_bound and next_key may be qualified with a shard as "shard:key", a next_key of the form
+      /// "shard:key:base" also carries the original bound for the shards after `shard`
+      vector<name>         shards;
     };
 
    struct get_table_rows_result {
@@ -396,6 +405,8 @@ public:
       uint32_t             limit = 10;
       std::optional<bool>  reverse;
       std::optional<uint32_t> time_limit_ms; // defaults to 10ms
+      name                 shard = chain::config::main_shard_name;
+      vector<name>         shards; // fan-out, see get_table_rows_params::shards
    };
    struct get_table_by_scope_result_row {
       name        code;
@@ -403,6 +414,7 @@ public:
       name        table;
       name        payer;
       uint32_t    count = 0;
+      name        shard;
    };
    struct get_table_by_scope_result {
       vector<get_table_by_scope_result_row> rows;
@@ -497,6 +509,9 @@ public:
       memcpy( data.data(), obj.value.data(), obj.value.size() );
    }
 
+   /// @return database of shard, the main db for config::main_shard_name
+   const chainbase::database& get_shard_db( const name& shard )const;
+
    template<typename Function>
    void walk_key_value_table(const name& code, const name& scope, const name& table, Function f) const
    {
@@ -519,7 +534,8 @@ public:
    static uint64_t get_table_index_name(const read_only::get_table_rows_params& p, bool& primary);
 
    template <typename IndexType, typename SecKeyType, typename ConvFn>
-   read_only::get_table_rows_result get_table_rows_by_seckey( const read_only::get_table_rows_params& p,
+   read_only::get_table_rows_result get_table_rows_by_seckey( const chainbase::database& d,
+                                                              const read_only::get_table_rows_params& p,
                                                               abi_def&& abi,
                                                               const fc::time_point& deadline,
                                                               ConvFn conv )const {
@@ -528,7 +544,6 @@ public:
       fc::time_point params_deadline = fc::time_point::now() + params_time_limit;
 
       read_only::get_table_rows_result result;
-      const auto& d = db.db();
 
       name scope{ convert_to_type<uint64_t>(p.scope, "scope") };
 
@@ -623,7 +638,8 @@ public:
    }
 
    template <typename IndexType>
-   read_only::get_table_rows_result get_table_rows_ex( const read_only::get_table_rows_params& p,
+   read_only::get_table_rows_result get_table_rows_ex( const chainbase::database& d,
+                                                       const read_only::get_table_rows_params& p,
                                                        abi_def&& abi,
                                                        const fc::time_point& deadline )const {
 
@@ -631,7 +647,6 @@ public:
       fc::time_point params_deadline = fc::time_point::now() + params_time_limit;
 
       read_only::get_table_rows_result result;
-      const auto& d = db.db();
 
       uint64_t scope = convert_to_type<uint64_t>(p.scope, "scope");
 
@@ -716,7 +731,26 @@ public:
    };
    get_consensus_parameters_results get_consensus_parameters(const get_consensus_parameters_params&, const fc::time_point& deadline) const;
 
+   struct get_suggested_shard_params {
+      vector<name>  accounts; // contracts the transaction's actions are sent to
+   };
+   struct get_suggested_shard_account {
+      name          account;
+      vector<name>  shards; // shards holding tables of account
+   };
+   struct get_suggested_shard_results {
+      name          shard = chain::config::main_shard_name; // shard holding tables of most accounts, main if none does
+      bool          found = false; // true if any shard holds tables of the accounts
+      vector<get_suggested_shard_account> accounts;
+   };
+   get_suggested_shard_results get_suggested_shard(const get_suggested_shard_params& params, const fc::time_point& deadline) const;
+
 private:
+   get_table_rows_result get_table_rows_on_shard( const name& shard, const get_table_rows_params& p,
+                                                  abi_def&& abi, const fc::time_point& deadline )const;
+   get_table_by_scope_result get_table_by_scope_on_shard( const name& shard, const get_table_by_scope_params& p,
+                                                          const fc::time_point& deadline )const;
+
    template<typename Params, typename Results>
    void send_transient_transaction(const Params& params, next_function<Results> next, chain::transaction_metadata::trx_type trx_type) const;
 };
@@ -919,11 +953,11 @@ FC_REFLECT(eosio::chain_apis::read_only::get_block_header_result, (id)(signed_bl
 FC_REFLECT( eosio::chain_apis::read_write::push_transaction_results, (transaction_id)(processed) )
 FC_REFLECT( eosio::chain_apis::read_write::send_transaction2_params, (return_failure_trace)(retry_trx)(retry_trx_num_blocks)(transaction) )
 
-FC_REFLECT( eosio::chain_apis::read_only::get_table_rows_params, (json)(code)(scope)(table)(table_key)(lower_bound)(upper_bound)(limit)(key_type)(index_position)(encode_type)(reverse)(show_payer)(time_limit_ms) )
+FC_REFLECT( eosio::chain_apis::read_only::get_table_rows_params, (json)(code)(scope)(table)(table_key)(lower_bound)(upper_bound)(limit)(key_type)(index_position)(encode_type)(reverse)(show_payer)(time_limit_ms)(shard)(shards) )
 FC_REFLECT( eosio::chain_apis::read_only::get_table_rows_result, (rows)(more)(next_key) );
 
-FC_REFLECT( eosio::chain_apis::read_only::get_table_by_scope_params, (code)(table)(lower_bound)(upper_bound)(limit)(reverse)(time_limit_ms) )
-FC_REFLECT( eosio::chain_apis::read_only::get_table_by_scope_result_row, (code)(scope)(table)(payer)(count));
+FC_REFLECT( eosio::chain_apis::read_only::get_table_by_scope_params, (code)(table)(lower_bound)(upper_bound)(limit)(reverse)(time_limit_ms)(shard)(shards) )
+FC_REFLECT( eosio::chain_apis::read_only::get_table_by_scope_result_row, (code)(scope)(table)(payer)(count)(shard));
 FC_REFLECT( eosio::chain_apis::read_only::get_table_by_scope_result, (rows)(more) );
 
 FC_REFLECT( eosio::chain_apis::read_only::get_currency_balance_params, (code)(account)(symbol));
@@ -965,3 +999,6 @@ FC_REFLECT( eosio::chain_apis::read_only::compute_transaction_results, (transact
 FC_REFLECT( eosio::chain_apis::read_only::send_read_only_transaction_params, (transaction))
 FC_REFLECT( eosio::chain_apis::read_only::send_read_only_transaction_results, (transaction_id)(processed) )
 FC_REFLECT( eosio::chain_apis::read_only::get_consensus_parameters_results, (chain_config)(wasm_config))
+FC_REFLECT( eosio::chain_apis::read_only::get_suggested_shard_params, (accounts))
+FC_REFLECT( eosio::chain_apis::read_only::get_suggested_shard_account, (account)(shards))
+FC_REFLECT( eosio::chain_apis::read_only::get_suggested_shard_results, (shard)(found)(accounts))
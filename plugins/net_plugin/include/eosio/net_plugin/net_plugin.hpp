@@ -5,6 +5,8 @@
 #include <eosio/chain/plugin_metrics.hpp>
 #include <eosio/chain_plugin/chain_plugin.hpp>
 
+#include <map>
+
 namespace eosio {
    using namespace appbase;
 
@@ -13,12 +15,30 @@ namespace eosio {
       chain::plugin_interface::runtime_metric num_clients{ chain::plugin_interface::metric_type::gauge, "num_clients", "num_clients", 0 };
       chain::plugin_interface::runtime_metric dropped_trxs{ chain::plugin_interface::metric_type::counter, "dropped_trxs", "dropped_trxs", 0 };
 
+      /// connections transactions of the shard are relayed to, peers without a shard subscription count for every shard
+      std::map<chain::shard_name, chain::plugin_interface::runtime_metric> shard_peers;
+
+      void update_shard_peers(const chain::shard_name& shard, int64_t num_connections) {
+         auto itr = shard_peers.find(shard);
+         if (itr == shard_peers.end()) {
+            // prometheus metric names may not contain '.'
+            auto family = shard.to_string();
+            std::replace(family.begin(), family.end(), '.', '_');
+            itr = shard_peers.emplace(shard, chain::plugin_interface::runtime_metric{
+                  chain::plugin_interface::metric_type::gauge, "shard_peers_" + family, "shard_peers_" + family, 0}).first;
+         }
+         itr->second.value = num_connections;
+      }
+
       vector<chain::plugin_interface::runtime_metric> metrics() final {
          vector<chain::plugin_interface::runtime_metric> metrics {
             num_peers,
             num_clients,
             dropped_trxs
          };
+         metrics.reserve(metrics.size() + shard_peers.size());
+         for (const auto& s : shard_peers)
+            metrics.push_back(s.second);
 
          return metrics;
       }
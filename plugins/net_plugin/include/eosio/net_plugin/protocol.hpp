@@ -132,6 +132,14 @@ namespace eosio {
       uint32_t end_block{0};
    };
 
+   /**
+    *  Sent after the handshake by peers supporting proto_shard_subscription, lists the shards whose transactions
+    *  the sender wants relayed. An empty list, or a peer that never sends one, receives transactions of every shard.
+    */
+   struct shard_subscription_message {
+      vector<shard_name> shards;
+   };
+
    using net_message = std::variant<handshake_message,
                                     chain_size_message,
                                     go_away_message,
@@ -140,7 +148,8 @@ namespace eosio {
                                     request_message,
                                     sync_request_message,
                                     signed_block,         // which = 7
-                                    packed_transaction>;  // which = 8
+                                    packed_transaction,   // which = 8
+                                    shard_subscription_message>;
 
 } // namespace eosio
 
@@ -159,6 +168,7 @@ FC_REFLECT( eosio::time_message, (org)(rec)(xmt)(dst) )
 FC_REFLECT( eosio::notice_message, (known_trx)(known_blocks) )
 FC_REFLECT( eosio::request_message, (req_trx)(req_blocks) )
 FC_REFLECT( eosio::sync_request_message, (start_block)(end_block) )
+FC_REFLECT( eosio::shard_subscription_message, (shards) )
 
 /**
  *
@@ -0,0 +1,57 @@
+#pragma once
+#include <eosio/net_plugin/protocol.hpp>
+
+#include <optional>
+
+namespace eosio::shard_subscription {
+
+///
+/// Transactions are relayed only to the peers subscribed to their shard. A node tracking some shards sends a
+/// shard_subscription_message after the handshake of a peer supporting it; a peer that never subscribes, because it
+/// tracks every shard or runs an older protocol version, keeps receiving transactions of every shard.
+///
+
+using chain::flat_set;
+using chain::shard_name;
+
+/// the shards a connected peer subscribed to
+class peer_shards {
+ public:
+   /// an empty list subscribes to every shard again
+   void subscribe( const shard_subscription_message& msg ) {
+      if( msg.shards.empty() ) {
+         shards.reset();
+      } else {
+         shards.emplace( msg.shards.begin(), msg.shards.end() );
+      }
+   }
+
+   void reset() { shards.reset(); }
+
+   /// true if transactions of shard are relayed to the peer
+   bool wants( const shard_name& shard ) const { return !shards || shards->count( shard ); }
+
+   /// the subscribed shards, empty optional for every shard
+   const std::optional<flat_set<shard_name>>& get() const { return shards; }
+
+ private:
+   std::optional<flat_set<shard_name>> shards;
+};
+
+/// @return true if p2p transactions of shard are accepted, an empty tracked_shards accepts every shard
+inline bool tracks( const flat_set<shard_name>& tracked_shards, const shard_name& shard ) {
+   return tracked_shards.empty() || tracked_shards.count( shard );
+}
+
+/// @return subscription to send once the handshake of a peer is received, none for a peer of an older protocol
+/// version or when every shard is tracked
+inline std::optional<shard_subscription_message> on_handshake( bool peer_supports_subscription,
+                                                               const flat_set<shard_name>& tracked_shards ) {
+   if( !peer_supports_subscription || tracked_shards.empty() )
+      return {};
+   shard_subscription_message sub;
+   sub.shards.assign( tracked_shards.begin(), tracked_shards.end() );
+   return sub;
+}
+
+} // namespace eosio::shard_subscription
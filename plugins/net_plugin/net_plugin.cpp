@@ -3,6 +3,7 @@
 #include <eosio/net_plugin/net_plugin.hpp>
 #include <eosio/net_plugin/protocol.hpp>
 #include <eosio/net_plugin/auto_bp_peering.hpp>
+#include <eosio/net_plugin/shard_subscription.hpp>
 #include <eosio/chain/controller.hpp>
 #include <eosio/chain/exceptions.hpp>
 #include <eosio/chain/block.hpp>
@@ -253,6 +254,8 @@ namespace eosio {
       uint32_t                              max_client_count = 0;
       uint32_t                              max_nodes_per_host = 1;
       bool                                  p2p_accept_transactions = true;
+      /// shards whose p2p transactions are accepted and relayed, empty for every shard
+      chain::flat_set<shard_name>           tracked_shards;
       fc::microseconds                      p2p_dedup_cache_expire_time_us{};
 
       /// Peer clock may be no more than 1 second skewed from our clock, including network latency.
@@ -439,9 +442,10 @@ namespace eosio {
    constexpr uint16_t proto_dup_goaway_resolution = 5;     // eosio 2.1: support peer address based duplicate connection resolution
    constexpr uint16_t proto_dup_node_id_goaway = 6;        // eosio 2.1: support peer node_id based duplicate connection resolution
    constexpr uint16_t proto_leap_initial = 7;            // leap client, needed because none of the 2.1 versions are supported
+   constexpr uint16_t proto_shard_subscription = 8;      // supports shard_subscription_message
 #pragma GCC diagnostic pop
 
-   constexpr uint16_t net_version_max = proto_leap_initial;
+   constexpr uint16_t net_version_max = proto_shard_subscription;
 
    /**
     * Index by start_block_num
@@ -651,6 +655,7 @@ namespace eosio {
       fc::time_point          last_dropped_trx_msg_time;
       const uint32_t          connection_id;
       int16_t                 sent_handshake_count = 0;
+      bool                    sent_shard_subscription = false; // only accessed from connection strand
       std::atomic<bool>       connecting{true};
       std::atomic<bool>       syncing{false};
 
@@ -673,9 +678,16 @@ namespace eosio {
       uint32_t                         fork_head_num{0};
       fc::time_point                   last_close;
       string                           remote_endpoint_ip;
+      shard_subscription::peer_shards  peer_shards;
 
       connection_status get_status()const;
 
+      /// thread safe, true if transactions of shard should be relayed to this peer
+      bool wants_shard( const shard_name& shard ) const {
+         std::lock_guard<std::mutex> g_conn( conn_mtx );
+         return peer_shards.wants( shard );
+      }
+
       /** \name Peer Timestamps
        *  Time message handling
        *  @{
@@ -795,6 +807,7 @@ namespace eosio {
       void handle_message( const notice_message& msg );
       void handle_message( const request_message& msg );
       void handle_message( const sync_request_message& msg );
+      void handle_message( const shard_subscription_message& msg );
       void handle_message( const signed_block& msg ) = delete; // signed_block_ptr overload used instead
       void handle_message( const block_id_type& id, signed_block_ptr msg );
       void handle_message( const packed_transaction& msg ) = delete; // packed_transaction_ptr overload used instead
@@ -876,6 +889,12 @@ namespace eosio {
          peer_dlog( c, "handle sync_request_message" );
          c->handle_message( msg );
       }
+
+      void operator()( const shard_subscription_message& msg ) const {
+         // continue call to handle_message on connection strand
+         peer_dlog( c, "handle shard_subscription_message" );
+         c->handle_message( msg );
+      }
    };
 
 
@@ -1038,6 +1057,7 @@ namespace eosio {
          self->last_handshake_sent = handshake_message();
          self->last_close = fc::time_point::now();
          self->conn_node_id = fc::sha256();
+         self->peer_shards.reset();
       }
       if( has_last_req && !shutdown ) {
          my_impl->dispatcher->retry_fetch( self->shared_from_this() );
@@ -1045,6 +1065,7 @@ namespace eosio {
       self->peer_lib_num = 0;
       self->peer_requested.reset();
       self->sent_handshake_count = 0;
+      self->sent_shard_subscription = false;
       if( !shutdown) my_impl->sync_master->sync_reset_lib_num( self->shared_from_this(), true );
       peer_ilog( self, "closing" );
       self->cancel_wait();
@@ -2204,8 +2225,9 @@ namespace eosio {
    void dispatch_manager::bcast_transaction(const packed_transaction_ptr& trx) {
       trx_buffer_factory buff_factory;
       const auto now = fc::time_point::now();
-      for_each_connection( [this, &trx, &now, &buff_factory]( auto& cp ) {
-         if( cp->is_blocks_only_connection() || !cp->current() ) {
+      const shard_name shard = trx->get_shard_name();
+      for_each_connection( [this, &trx, &now, &buff_factory, &shard]( auto& cp ) {
+         if( cp->is_blocks_only_connection() || !cp->current() || !cp->wants_shard( shard ) ) {
             return true;
          }
          if( !add_peer_txn(trx->id(), trx->expiration(), cp->connection_id, now) ) {
@@ -2712,6 +2734,10 @@ namespace eosio {
       fc::raw::unpack( ds, which );
       shared_ptr<packed_transaction> ptr = std::make_shared<packed_transaction>();
       fc::raw::unpack( ds, *ptr );
+      if( !shard_subscription::tracks( my_impl->tracked_shards, ptr->get_shard_name() ) ) {
+         peer_dlog( this, "trx ${id} of untracked shard ${s} - dropping txn", ("id", ptr->id())("s", ptr->get_shard_name()) );
+         return true;
+      }
       if( trx_in_progress_sz > def_max_trx_in_progress_size) {
          ++my_impl->metrics.dropped_trxs.value;
          char reason[72];
@@ -2998,6 +3024,15 @@ namespace eosio {
          }
       }
 
+      if( !sent_shard_subscription ) {
+         auto sub = shard_subscription::on_handshake( protocol_version >= proto_shard_subscription, my_impl->tracked_shards );
+         if( sub ) {
+            sent_shard_subscription = true;
+            peer_ilog( this, "subscribing to shards ${s}", ("s", sub->shards) );
+            enqueue( net_message( std::move( *sub ) ) );
+         }
+      }
+
       my_impl->sync_master->recv_handshake( shared_from_this(), msg );
    }
 
@@ -3198,6 +3233,13 @@ namespace eosio {
       }
    }
 
+   // called from connection strand
+   void connection::handle_message( const shard_subscription_message& msg ) {
+      peer_ilog( this, "peer subscribed to shards ${s}", ("s", msg.shards) );
+      std::lock_guard<std::mutex> g_conn( conn_mtx );
+      peer_shards.subscribe( msg );
+   }
+
    size_t calc_trx_size( const packed_transaction_ptr& trx ) {
       return trx->get_estimated_size();
    }
@@ -3462,6 +3504,8 @@ namespace eosio {
       auto it = (from ? connections.find(from) : connections.begin());
       if (it == connections.end()) it = connections.begin();
       size_t num_rm = 0, num_clients = 0, num_peers = 0, num_bp_peers = 0;
+      size_t num_unfiltered = 0;
+      std::map<shard_name, size_t> shard_subscribers;
       while (it != connections.end()) {
          if (fc::time_point::now() >= max_time) {
             connection_wptr wit = *it;
@@ -3474,6 +3518,15 @@ namespace eosio {
             }
             return;
          }
+         if( !(*it)->is_blocks_only_connection() ) {
+            std::lock_guard<std::mutex> g_conn( (*it)->conn_mtx );
+            if( const auto& shards = (*it)->peer_shards.get() ) {
+               for( const auto& shard : *shards )
+                  ++shard_subscribers[shard];
+            } else {
+               ++num_unfiltered;
+            }
+         }
          if ((*it)->is_bp_connection)
             ++num_bp_peers;
          else if ((*it)->incoming())
@@ -3500,6 +3553,12 @@ namespace eosio {
 
       metrics.num_clients.value = num_clients;
       metrics.num_peers.value = num_peers;
+      for( const auto& shard : tracked_shards )
+         shard_subscribers.try_emplace( shard, 0 );
+      for( const auto& s : metrics.shard_peers )
+         shard_subscribers.try_emplace( s.first, 0 );
+      for( const auto& s : shard_subscribers )
+         metrics.update_shard_peers( s.first, s.second + num_unfiltered );
       metrics.post_metrics();
 
       if( num_clients > 0 || num_peers > 0 )
@@ -3669,6 +3728,9 @@ namespace eosio {
            "    p2p.blk.eos.io:9876:blk\n")
          ( "p2p-max-nodes-per-host", bpo::value<int>()->default_value(def_max_nodes_per_host), "Maximum number of client nodes from any single IP address")
          ( "p2p-accept-transactions", bpo::value<bool>()->default_value(true), "Allow transactions received over p2p network to be evaluated and relayed if valid.")
+         ( "p2p-shard", bpo::value< vector<string> >()->composing(),
+           "Shard whose transactions are accepted over p2p and requested from peers. Use multiple p2p-shard options as needed. "
+           "Transactions of every shard are accepted if not specified.")
          ( "p2p-auto-bp-peer", bpo::value< vector<string> >()->composing(),
            "The account and public p2p endpoint of a block producer node to automatically connect to when the it is in producer schedule proximity\n."
            "   Syntax: account,host:port\n"
@@ -3727,6 +3789,11 @@ namespace eosio {
          my->max_client_count = options.at( "max-clients" ).as<int>();
          my->max_nodes_per_host = options.at( "p2p-max-nodes-per-host" ).as<int>();
          my->p2p_accept_transactions = options.at( "p2p-accept-transactions" ).as<bool>();
+         if( options.count( "p2p-shard" ) ) {
+            for( const auto& s : options.at( "p2p-shard" ).as<vector<string>>() ) {
+               my->tracked_shards.insert( shard_name( s ) );
+            }
+         }
 
          my->use_socket_read_watermark = options.at( "use-socket-read-watermark" ).as<bool>();
          my->keepalive_interval = std::chrono::milliseconds( options.at( "p2p-keepalive-interval-ms" ).as<int>() );
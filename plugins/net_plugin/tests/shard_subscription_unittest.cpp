@@ -0,0 +1,74 @@
+#define BOOST_TEST_MODULE shard_subscription
+#include <boost/test/included/unit_test.hpp>
+#include <eosio/net_plugin/shard_subscription.hpp>
+
+#include <eosio/chain/config.hpp>
+#include <fc/io/raw.hpp>
+
+using namespace eosio;
+using namespace eosio::chain::literals;
+
+namespace {
+
+// the subscription as the peer receives it, through the net_message variant
+shard_subscription_message round_trip( shard_subscription_message msg ) {
+   const auto packed = fc::raw::pack( net_message( std::move( msg ) ) );
+   net_message received;
+   fc::raw::unpack( packed, received );
+   BOOST_REQUIRE( std::holds_alternative<shard_subscription_message>( received ) );
+   return std::get<shard_subscription_message>( received );
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(test_handshake_subscription) {
+   const chain::flat_set<chain::shard_name> tracked{ "shard1"_n, "shard2"_n };
+
+   auto sub = shard_subscription::on_handshake( true, tracked );
+   BOOST_REQUIRE( sub );
+   BOOST_CHECK( sub->shards == std::vector<chain::shard_name>( { "shard1"_n, "shard2"_n } ) );
+
+   // the peer relays only the subscribed shards
+   shard_subscription::peer_shards peer;
+   peer.subscribe( round_trip( *sub ) );
+   BOOST_REQUIRE( peer.get() );
+   BOOST_CHECK( peer.wants( "shard1"_n ) );
+   BOOST_CHECK( peer.wants( "shard2"_n ) );
+   BOOST_CHECK( !peer.wants( "shard3"_n ) );
+   BOOST_CHECK( !peer.wants( chain::config::main_shard_name ) );
+
+   // an empty subscription and a closed connection go back to every shard
+   peer.subscribe( round_trip( shard_subscription_message{} ) );
+   BOOST_CHECK( !peer.get() );
+   BOOST_CHECK( peer.wants( "shard3"_n ) );
+   peer.subscribe( *sub );
+   peer.reset();
+   BOOST_CHECK( peer.wants( "shard3"_n ) );
+}
+
+BOOST_AUTO_TEST_CASE(test_untracked_shards) {
+   // a node tracking every shard does not subscribe and accepts every shard
+   BOOST_CHECK( !shard_subscription::on_handshake( true, {} ) );
+   BOOST_CHECK( shard_subscription::tracks( {}, "shard1"_n ) );
+   BOOST_CHECK( shard_subscription::tracks( {}, chain::config::main_shard_name ) );
+
+   // p2p transactions of other shards are dropped on receipt
+   const chain::flat_set<chain::shard_name> tracked{ "shard1"_n };
+   BOOST_CHECK( shard_subscription::tracks( tracked, "shard1"_n ) );
+   BOOST_CHECK( !shard_subscription::tracks( tracked, "shard2"_n ) );
+   BOOST_CHECK( !shard_subscription::tracks( tracked, chain::config::main_shard_name ) );
+}
+
+BOOST_AUTO_TEST_CASE(test_old_protocol_fallback) {
+   const chain::flat_set<chain::shard_name> tracked{ "shard1"_n };
+
+   // a peer of an older protocol version is never sent the subscription, it could not decode it
+   BOOST_CHECK( !shard_subscription::on_handshake( false, tracked ) );
+
+   // and a peer that never subscribes is relayed every shard
+   shard_subscription::peer_shards peer;
+   BOOST_CHECK( !peer.get() );
+   BOOST_CHECK( peer.wants( "shard1"_n ) );
+   BOOST_CHECK( peer.wants( "shard2"_n ) );
+   BOOST_CHECK( peer.wants( chain::config::main_shard_name ) );
+}
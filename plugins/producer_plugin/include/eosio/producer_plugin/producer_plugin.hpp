@@ -24,6 +24,111 @@ struct producer_plugin_metrics : public plugin_metrics {
    runtime_metric head_block_num{metric_type::gauge, "head_block_num", "head_block_num", 0};
    runtime_metric subjective_bill_account_size{metric_type::gauge, "subjective_bill_account_size", "subjective_bill_account_size", 0};
    runtime_metric scheduled_trxs{metric_type::gauge, "scheduled_trxs", "scheduled_trxs", 0};
+   runtime_metric block_recovery_wait_us{metric_type::gauge, "block_recovery_wait_us", "block_recovery_wait_us", 0};
+   runtime_metric eosvmoc_compile_queue{metric_type::gauge, "eosvmoc_compile_queue", "eosvmoc_compile_queue", 0};
+   runtime_metric eosvmoc_compiling{metric_type::gauge, "eosvmoc_compiling", "eosvmoc_compiling", 0};
+   runtime_metric eosvmoc_compile_time_us{metric_type::gauge, "eosvmoc_compile_time_us", "eosvmoc_compile_time_us", 0};
+   runtime_metric wasm_cache_hits{metric_type::counter, "wasm_cache_hits", "wasm_cache_hits", 0};
+   runtime_metric wasm_cache_misses{metric_type::counter, "wasm_cache_misses", "wasm_cache_misses", 0};
+   runtime_metric wasm_cache_evictions{metric_type::counter, "wasm_cache_evictions", "wasm_cache_evictions", 0};
+   runtime_metric wasm_cache_codes{metric_type::gauge, "wasm_cache_codes", "wasm_cache_codes", 0};
+   runtime_metric wasm_cache_bytes{metric_type::gauge, "wasm_cache_bytes", "wasm_cache_bytes", 0};
+
+   struct shard_metrics {
+      runtime_metric queue_wait_us;
+      runtime_metric exec_time_us;
+   };
+   /// per shard time waiting in the shard thread pool queue vs executing, for the most recent block
+   std::map<chain::shard_name, shard_metrics> shards;
+
+   void update_shard_metrics(const chain::shard_name& shard, fc::microseconds queue_wait, fc::microseconds exec_time) {
+      auto itr = shards.find(shard);
+      if (itr == shards.end()) {
+         // prometheus metric names may not contain '.'
+         auto family = shard.to_string();
+         std::replace(family.begin(), family.end(), '.', '_');
+         itr = shards.emplace(shard, shard_metrics{
+               {metric_type::gauge, "shard_queue_wait_us_" + family, "shard_queue_wait_us_" + family, 0},
+               {metric_type::gauge, "shard_exec_time_us_" + family, "shard_exec_time_us_" + family, 0}}).first;
+      }
+      itr->second.queue_wait_us.value = queue_wait.count();
+      itr->second.exec_time_us.value = exec_time.count();
+   }
+
+   struct shard_schedule_metrics {
+      runtime_metric backlog;
+      runtime_metric sched_wait_us;
+      runtime_metric virtual_cpu_us;
+   };
+   /// per shard queued transactions, time its work waited for a shard thread in the most recent block and its weighted cpu
+   std::map<chain::shard_name, shard_schedule_metrics> shard_schedules;
+
+   void update_shard_schedule_metrics(const chain::shard_name& shard, size_t backlog, fc::microseconds sched_wait, double virtual_cpu_us) {
+      auto itr = shard_schedules.find(shard);
+      if (itr == shard_schedules.end()) {
+         auto family = shard.to_string();
+         std::replace(family.begin(), family.end(), '.', '_');
+         itr = shard_schedules.emplace(shard, shard_schedule_metrics{
+               {metric_type::gauge, "shard_backlog_" + family, "shard_backlog_" + family, 0},
+               {metric_type::gauge, "shard_sched_wait_us_" + family, "shard_sched_wait_us_" + family, 0},
+               {metric_type::gauge, "shard_virtual_cpu_us_" + family, "shard_virtual_cpu_us_" + family, 0}}).first;
+      }
+      itr->second.backlog.value = backlog;
+      itr->second.sched_wait_us.value = sched_wait.count();
+      itr->second.virtual_cpu_us.value = static_cast<int64_t>(virtual_cpu_us);
+   }
+
+   struct db_metrics {
+      runtime_metric commit_time_us;
+      runtime_metric flush_time_us;
+   };
+   /// per database time of the most recent commit and flush
+   std::map<chain::db_name, db_metrics> dbs;
+
+   void update_db_metrics(const chain::db_name& db, fc::microseconds commit_time, fc::microseconds flush_time) {
+      auto itr = dbs.find(db);
+      if (itr == dbs.end()) {
+         auto family = db.to_string();
+         std::replace(family.begin(), family.end(), '.', '_');
+         itr = dbs.emplace(db, db_metrics{
+               {metric_type::gauge, "db_commit_time_us_" + family, "db_commit_time_us_" + family, 0},
+               {metric_type::gauge, "db_flush_time_us_" + family, "db_flush_time_us_" + family, 0}}).first;
+      }
+      itr->second.commit_time_us.value = commit_time.count();
+      itr->second.flush_time_us.value = flush_time.count();
+   }
+
+   struct xshard_route_metrics {
+      runtime_metric              delivered;
+      runtime_metric              latency_blocks;
+      vector<runtime_metric>      latency_buckets; // cumulative, one per bucket bound, delivered is the +Inf bucket
+   };
+   /// cross shard messages consumed, their summed latency in blocks and the latency histogram, per from_to shard route
+   std::map<chain::xshard_queue::route, xshard_route_metrics> xshard_routes;
+
+   void update_xshard_metrics(const chain::xshard_queue::route& r, const chain::xshard_latency_histogram& h) {
+      auto itr = xshard_routes.find(r);
+      if (itr == xshard_routes.end()) {
+         auto family = r.first.to_string() + "_" + r.second.to_string();
+         std::replace(family.begin(), family.end(), '.', '_');
+         xshard_route_metrics m{
+               {metric_type::counter, "xshard_delivered_" + family, "xshard_delivered_" + family, 0},
+               {metric_type::counter, "xshard_latency_blocks_" + family, "xshard_latency_blocks_" + family, 0}};
+         m.latency_buckets.reserve(h.bucket_bounds.size());
+         for (auto bound : h.bucket_bounds) {
+            auto bucket = "xshard_latency_le_" + std::to_string(bound) + "_" + family;
+            m.latency_buckets.push_back({metric_type::counter, bucket, bucket, 0});
+         }
+         itr = xshard_routes.emplace(r, std::move(m)).first;
+      }
+      itr->second.delivered.value = h.count;
+      itr->second.latency_blocks.value = h.total_blocks;
+      uint64_t cumulative = 0;
+      for (size_t i = 0; i < itr->second.latency_buckets.size(); ++i) {
+         cumulative += h.buckets[i];
+         itr->second.latency_buckets[i].value = cumulative;
+      }
+   }
 
    vector<runtime_metric> metrics() final {
       vector<runtime_metric> metrics{
@@ -34,8 +139,39 @@ struct producer_plugin_metrics : public plugin_metrics {
             last_irreversible,
             head_block_num,
             subjective_bill_account_size,
-            scheduled_trxs
+            scheduled_trxs,
+            block_recovery_wait_us,
+            eosvmoc_compile_queue,
+            eosvmoc_compiling,
+            eosvmoc_compile_time_us,
+            wasm_cache_hits,
+            wasm_cache_misses,
+            wasm_cache_evictions,
+            wasm_cache_codes,
+            wasm_cache_bytes
       };
+      metrics.reserve(metrics.size() + shards.size() * 2);
+      for (const auto& s : shards) {
+         metrics.push_back(s.second.queue_wait_us);
+         metrics.push_back(s.second.exec_time_us);
+      }
+      metrics.reserve(metrics.size() + shard_schedules.size() * 3);
+      for (const auto& s : shard_schedules) {
+         metrics.push_back(s.second.backlog);
+         metrics.push_back(s.second.sched_wait_us);
+         metrics.push_back(s.second.virtual_cpu_us);
+      }
+      metrics.reserve(metrics.size() + dbs.size() * 2);
+      for (const auto& d : dbs) {
+         metrics.push_back(d.second.commit_time_us);
+         metrics.push_back(d.second.flush_time_us);
+      }
+      metrics.reserve(metrics.size() + xshard_routes.size() * (2 + chain::xshard_latency_histogram::bucket_bounds.size()));
+      for (const auto& x : xshard_routes) {
+         metrics.push_back(x.second.delivered);
+         metrics.push_back(x.second.latency_blocks);
+         metrics.insert(metrics.end(), x.second.latency_buckets.begin(), x.second.latency_buckets.end());
+      }
 
       return metrics;
    }
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace eosio {
+
+/// A shard as seen by weighted fair queuing of the shard transaction queues. The virtual cpu of a shard is the cpu
+/// billed to it in the building block divided by its weight; the waiting shard with the lowest virtual cpu runs first.
+struct shard_share {
+   double weight      = 1.0;
+   double virtual_cpu = 0.0;
+};
+
+/// A shard is over its fair share when its virtual cpu leads the lowest virtual cpu of the `others`, the shards running
+/// or waiting to run, by more than their even share of `cpu_limit`. Dispatch order and eligibility use the same measure,
+/// so the shard with the lowest virtual cpu is never over its share and a shard alone with work may use the whole block.
+inline bool over_fair_share( const shard_share& shard, const std::vector<shard_share>& others, uint64_t cpu_limit ) {
+   std::optional<double> min_virtual_cpu;
+   double active_weight = shard.weight;
+   for( const auto& s : others ) {
+      min_virtual_cpu = std::min( min_virtual_cpu.value_or( s.virtual_cpu ), s.virtual_cpu );
+      active_weight += s.weight;
+   }
+   if( !min_virtual_cpu )
+      return false;
+   return shard.virtual_cpu > *min_virtual_cpu + cpu_limit / active_weight;
+}
+
+} // namespace eosio
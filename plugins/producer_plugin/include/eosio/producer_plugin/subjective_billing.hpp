@@ -203,4 +203,29 @@ public:
    }
 };
 
+/// Subjective cpu of the transactions a shard thread already executed in its current batch. The batch is prepared
+/// on the main thread with the bills known there, which do not include the trxs ahead of it in the same batch until
+/// the results are posted back, so each executed trx is carried into the bill of the trxs after it.
+class batch_subjective_billing {
+private:
+   bool                                  _bill_success = true; // successful trxs are objectively billed when producing
+   std::map<chain::account_name, int64_t> _account_batch_bill;
+
+public:
+   explicit batch_subjective_billing( bool bill_success )
+   : _bill_success( bill_success ) {}
+
+   /// @param prepared_bill subjective bill of first_auth when the batch was prepared
+   int64_t get_subjective_bill( const chain::account_name& first_auth, int64_t prepared_bill ) const {
+      auto itr = _account_batch_bill.find( first_auth );
+      return itr != _account_batch_bill.end() ? prepared_bill + itr->second : prepared_bill;
+   }
+
+   /// mirrors what the main thread bills for the trx once the batch results are handled
+   void subjective_bill( const chain::account_name& first_auth, const fc::microseconds& elapsed, bool succeeded ) {
+      if( succeeded && !_bill_success ) return;
+      _account_batch_bill[first_auth] += std::max<int64_t>( 0, elapsed.count() );
+   }
+};
+
 } //eosio
@@ -1,6 +1,7 @@
 #include <eosio/producer_plugin/producer_plugin.hpp>
 #include <eosio/producer_plugin/pending_snapshot.hpp>
 #include <eosio/producer_plugin/subjective_billing.hpp>
+#include <eosio/producer_plugin/shard_fair_share.hpp>
 #include <eosio/producer_plugin/snapshot_scheduler.hpp>
 #include <eosio/chain/plugin_interface.hpp>
 #include <eosio/chain/global_property_object.hpp>
@@ -21,6 +22,7 @@
 
 #include <iostream>
 #include <algorithm>
+#include <tuple>
 #include <mutex>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/range/adaptor/map.hpp>
@@ -324,6 +326,14 @@ struct processing_shard {
    int                           num_schedule_trx_processed    = 0;
    int                           num_schedule_trx_failed       = 0;
    int                           num_schedule_trx_applied      = 0;
+   fc::microseconds              queue_wait_time; // time trx tasks of the building block waited in the shard thread pool queue
+   fc::microseconds              exec_time;       // time trx tasks of the building block spent executing
+   uint64_t                      block_cpu_usage               = 0; // usage billed to the shard in the building block,
+   uint64_t                      block_net_usage               = 0; // refreshed on the main thread while the shard is idle
+   bool                          block_exhausted               = false; // the shard's own block budget is used up
+   double                        virtual_cpu                   = 0.0; // billed cpu divided by the shard weight, lowest runs first
+   time_point                    waiting_since;   // has work but waits for a shard thread or its fair share, unset otherwise
+   fc::microseconds              sched_wait_time; // time the shard waited to be dispatched in the building block
 };
 
 using processing_shard_map = std::map<shard_name, processing_shard>;
@@ -343,6 +353,8 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
       void produce_block();
       bool maybe_produce_block();
       bool block_is_exhausted() const;
+      bool block_is_exhausted( const processing_shard& shard ) const;
+      void update_shard_block_usage( processing_shard_map::iterator shard_itr );
       bool remove_expired_trxs( const fc::time_point& deadline );
       bool remove_expired_blacklisted_trxs( const fc::time_point& deadline );
       // bool process_unapplied_trxs( const fc::time_point& deadline );
@@ -350,6 +362,10 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
       bool process_scheduled_trxs( const fc::time_point& deadline, processing_shard_map::iterator shard_itr );
       bool process_incoming_trx_one( const fc::time_point& deadline, processing_shard_map::iterator shard_itr );
       bool process_trx_one( const fc::time_point& deadline, processing_shard_map::iterator shard_itr );
+      size_t shards_in_flight() const;
+      bool over_fair_share( processing_shard_map::const_iterator shard_itr ) const;
+      void wait_for_dispatch( processing_shard_map::iterator shard_itr );
+      void dispatch_shards( const fc::time_point& deadline );
 
       struct push_result {
          bool block_exhausted = false;
@@ -357,8 +373,22 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
          bool failed = false;
       };
 
-      bool push_transaction_one( const fc::time_point& block_deadline, processing_shard_map::iterator shard_itr,
-                                    unapplied_transaction unapplied_trx );
+      // a transaction prepared on the main thread for execution on its shard thread
+      struct shard_trx_work {
+         unapplied_transaction  unapplied_trx;
+         fc::time_point         start;
+         bool                   disable_subjective_enforcement = false;
+         account_name           first_auth;
+         fc::microseconds       max_trx_time;
+         uint32_t               prev_billed_cpu_time_us = 0;
+         int64_t                sub_bill = 0;
+         bool                   subjectively_billed = false; // false when enforcement or billing of first_auth is disabled
+         transaction_trace_ptr  trace; // set by the shard thread
+      };
+
+      std::optional<shard_trx_work> prepare_transaction_one( processing_shard_map::iterator shard_itr, unapplied_transaction unapplied_trx );
+      bool push_transaction_batch( const fc::time_point& block_deadline, processing_shard_map::iterator shard_itr,
+                                   std::vector<shard_trx_work> batch );
       push_result handle_push_result( const transaction_metadata_ptr& trx,
                                       const next_function<transaction_trace_ptr>& next,
                                       const fc::time_point& start,
@@ -496,10 +526,20 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
       std::atomic<uint32_t>           _ro_num_active_exec_tasks{ 0 };
       std::vector<std::future<bool>>  _ro_exec_tasks_fut;
 
+      size_t                           _shard_thread_pool_size{ 0 };
+      uint32_t                         _shard_trx_batch_size{ 32 }; // trxs a shard thread executes per main thread round trip
+      std::map<shard_name, double>     _shard_weights; // share of the shard threads and block cpu, 1.0 if not listed
+      bool                             _reject_misplaced_shard_trx{ false };
+      thread_affinity_mode             _shard_thread_affinity{ thread_affinity_mode::none };
       named_thread_pool<struct shard>  _shard_thread_pool;
       processing_shard_map             _shards;
       uint64_t                         _block_seq{ 0 };
 
+      double shard_weight(const eosio::chain::shard_name& sname) const {
+         auto itr = _shard_weights.find(sname);
+         return itr != _shard_weights.end() ? itr->second : 1.0;
+      }
+
       processing_shard_map::iterator get_shard_itr(const eosio::chain::shard_name& sname) {
          auto itr = _shards.find(sname);
          if (itr == _shards.end()) {
@@ -583,20 +623,41 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
 
       void update_block_metrics() {
          if (_metrics.should_post()) {
-            // TODO: update_block_metrics
-            // _metrics.unapplied_transactions.value = _unapplied_transactions.size();
-            // _metrics.subjective_bill_account_size.value = _subjective_billing.get_account_cache_size();
-            // _metrics.blacklisted_transactions.value = _blacklisted_transactions.size();
-            // _metrics.unapplied_transactions.value = _unapplied_transactions.size();
+            // the unapplied transactions are queued per shard, the scheduled transactions of every shard are in the main db
+            size_t unapplied_transactions = 0;
+            for (const auto& s : _shards) {
+               unapplied_transactions += s.second.unapplied_transactions.size();
+            }
+            _metrics.unapplied_transactions.value = unapplied_transactions;
+            _metrics.subjective_bill_account_size.value = _subjective_billing.get_account_cache_size();
+            _metrics.blacklisted_transactions.value = _blacklisted_transactions.size();
 
-            // auto &chain = chain_plug->chain();
-            // _metrics.last_irreversible.value = chain.last_irreversible_block_num();
-            // _metrics.head_block_num.value = chain.head_block_num();
+            auto &chain = chain_plug->chain();
+            _metrics.last_irreversible.value = chain.last_irreversible_block_num();
+            _metrics.head_block_num.value = chain.head_block_num();
 
-            // const auto& sch_idx = chain.db().get_index<generated_transaction_multi_index, by_delay>();
-            // _metrics.scheduled_trxs.value = sch_idx.size();
+            const auto& sch_idx = chain.db().get_index<generated_transaction_multi_index, by_shard_delay>();
+            _metrics.scheduled_trxs.value = sch_idx.size();
 
-            // _metrics.post_metrics();
+            for (const auto& t : chain_plug->chain().dbm().db_timings()) {
+               _metrics.update_db_metrics(t.first, t.second.commit_time, t.second.flush_time);
+            }
+            for (const auto& l : chain_plug->chain().xshard_latencies()) {
+               _metrics.update_xshard_metrics(l.first, l.second);
+            }
+            if (auto oc = chain_plug->chain().get_wasm_interface().get_eosvmoc_compile_stats()) {
+               _metrics.eosvmoc_compile_queue.value = oc->queued;
+               _metrics.eosvmoc_compiling.value = oc->compiling;
+               _metrics.eosvmoc_compile_time_us.value = oc->last_compile_time.count();
+            }
+            const auto cache = chain_plug->chain().get_wasm_interface().get_cache_stats();
+            _metrics.wasm_cache_hits.value = cache.hits;
+            _metrics.wasm_cache_misses.value = cache.misses;
+            _metrics.wasm_cache_evictions.value = cache.evictions;
+            _metrics.wasm_cache_codes.value = cache.codes;
+            _metrics.wasm_cache_bytes.value = cache.bytes;
+
+            _metrics.post_metrics();
          }
       }
 
@@ -694,6 +755,11 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
             handle_error(fc::std_exception_wrapper::from_current_exception(e));
          }
 
+         for (const auto& sr : br.shard_reports) {
+            _metrics.update_shard_metrics(sr.first, sr.second.queue_wait_time, sr.second.exec_time);
+         }
+         _metrics.block_recovery_wait_us.value = br.recovery_wait_time.count();
+
          const auto& hbs = chain.head_block_state();
          now = fc::time_point::now();
          if( hbs->header.timestamp.next().to_time_point() >= now ) {
@@ -702,11 +768,13 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
 
          if( now - block->timestamp < fc::minutes(5) || (blk_num % 1000 == 0) ) {
             ilog("Received block ${id}... #${n} @ ${t} signed by ${p} "
-                 "[trxs: ${count}, lib: ${lib}, confirmed: ${confs}, net: ${net}, cpu: ${cpu}, elapsed: ${elapsed}, time: ${time}, latency: ${latency} ms]",
+                 "[trxs: ${count}, lib: ${lib}, confirmed: ${confs}, net: ${net}, cpu: ${cpu}, elapsed: ${elapsed}, time: ${time}, "
+                 "shards: ${shards}, critical path: ${cp}, ideal: ${ip}, recovery wait: ${rw}, latency: ${latency} ms]",
                  ("p",block->producer)("id",id.str().substr(8,16))("n",blk_num)("t",block->timestamp)
                  ("count", block->get_trx_size())("lib",chain.last_irreversible_block_num())
                  ("confs", block->confirmed)("net", br.total_net_usage)("cpu", br.total_cpu_usage_us)
                  ("elapsed", br.total_elapsed_time)("time", br.total_time)
+                 ("shards", br.shard_reports.size())("cp", br.shard_critical_path_time)("ip", br.shard_ideal_parallel_time)("rw", br.recovery_wait_time)
                  ("latency", (now - block->timestamp).count()/1000 ) );
             if( chain.get_read_mode() != db_read_mode::IRREVERSIBLE && hbs->id != id && hbs->block != nullptr ) { // not applied to head
                ilog("Block not applied to head ${id}... #${n} @ ${t} signed by ${p} "
@@ -754,11 +822,6 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
          const auto max_trx_time_ms = ( trx_type == transaction_metadata::trx_type::read_only ) ? -1 : _max_transaction_time_ms.load();
          fc::microseconds max_trx_cpu_usage = max_trx_time_ms < 0 ? fc::microseconds::maximum() : fc::milliseconds( max_trx_time_ms );
 
-         auto future = transaction_metadata::start_recover_keys( trx, _thread_pool.get_executor(),
-                                                                 chain.get_chain_id(), fc::microseconds( max_trx_cpu_usage ),
-                                                                 trx_type,
-                                                                 chain.configured_subjective_signature_length_limit() );
-
          auto is_transient = (trx_type == transaction_metadata::trx_type::read_only || trx_type == transaction_metadata::trx_type::dry_run);
          if( !is_transient ) {
             next = [this, trx, next{std::move(next)}]( const std::variant<fc::exception_ptr, transaction_trace_ptr>& response ) {
@@ -775,6 +838,19 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
             };
          }
 
+         if( _reject_misplaced_shard_trx ) {
+            // before key recovery, so a misplaced transaction costs no more than the routing lookup
+            if( auto except_ptr = check_shard_placement( chain, *trx ) ) {
+               next( std::move(except_ptr) );
+               return;
+            }
+         }
+
+         auto future = transaction_metadata::start_recover_keys( trx, _thread_pool.get_executor(),
+                                                                 chain.get_chain_id(), fc::microseconds( max_trx_cpu_usage ),
+                                                                 trx_type,
+                                                                 chain.configured_subjective_signature_length_limit() );
+
          boost::asio::post(_thread_pool.get_executor(), [self = this, future{std::move(future)}, api_trx, is_transient, return_failure_traces,
                                                           next{std::move(next)}, trx=trx]() mutable {
             if( future.valid() ) {
@@ -809,6 +885,29 @@ class producer_plugin_impl : public std::enable_shared_from_this<producer_plugin
          });
       }
 
+      /**
+       * @return exception if none of the contracts of trx have tables on its shard but another shard holds some of them.
+       * A transaction with a contract that has no tables anywhere yet is accepted, it may be the first placement of it.
+       */
+      fc::exception_ptr check_shard_placement(const chain::controller& chain, const packed_transaction& trx) const {
+         const auto& t = trx.get_transaction();
+         flat_set<account_name> accounts;
+         for( const auto& act : t.actions ) {
+            accounts.insert( act.account );
+         }
+
+         const auto& routing = chain.get_shard_routing();
+         const auto& shard = t.get_shard_name();
+         if( routing.holds_any( shard, accounts ) || !routing.all_routed( accounts ) )
+            return {};
+         auto suggested = routing.suggest_shard( accounts );
+         if( !suggested || *suggested == shard )
+            return {};
+         return std::static_pointer_cast<fc::exception>( std::make_shared<misplaced_shard_transaction_exception>(
+               FC_LOG_MESSAGE( error, "transaction ${id} sent to shard ${s} holds no tables of its contracts, send it to shard ${suggested}",
+                               ("id", trx.id())("s", shard)("suggested", *suggested) ) ) );
+      }
+
       bool process_incoming_transaction_async(const transaction_metadata_ptr& trx,
                                               bool api_trx,
                                               bool return_failure_trace,
@@ -993,6 +1092,15 @@ void producer_plugin::set_program_options(
           "Disable subjective CPU billing for API transactions")
          ("producer-threads", bpo::value<uint16_t>()->default_value(my->_thread_pool_size),
           "Number of worker threads in producer thread pool")
+         ("shard-trx-batch-size", bpo::value<uint32_t>()->default_value(my->_shard_trx_batch_size),
+          "Maximum number of transactions a shard thread executes before handing results back to the main thread")
+         ("shard-weight", bpo::value<vector<string>>()->composing(),
+          "Scheduling weight of a shard relative to the default weight of 1.0, sets its share of the shard threads and of the block cpu "
+          "while other shards have work. Syntax: shard_name:weight")
+         ("reject-misplaced-shard-trx", bpo::value<bool>()->default_value(false),
+          "Reject incoming transactions sent to a shard holding none of the tables of their contracts while another shard does, "
+          "before their signatures are recovered. Transactions with a contract that has no tables on any shard yet are accepted. "
+          "The error names the shard to send them to.")
          ("snapshots-dir", bpo::value<bfs::path>()->default_value("snapshots"),
           "the location of the snapshots directory (absolute path or relative to application data dir)")
          ("read-only-threads", bpo::value<uint32_t>(),
@@ -1160,6 +1268,32 @@ void producer_plugin::plugin_initialize(const boost::program_options::variables_
    EOS_ASSERT( my->_thread_pool_size > 0, plugin_config_exception,
                "producer-threads ${num} must be greater than 0", ("num", my->_thread_pool_size));
 
+   // shard threads are configured by chain_plugin and shared with controller for block validation
+   const auto& chain_config = my->chain_plug->chain_config();
+   my->_shard_thread_pool_size = resolve_thread_pool_size( chain_config.shard_thread_pool_size );
+   my->_shard_thread_affinity = chain_config.shard_thread_affinity;
+
+   my->_shard_trx_batch_size = options.at( "shard-trx-batch-size" ).as<uint32_t>();
+   EOS_ASSERT( my->_shard_trx_batch_size > 0, plugin_config_exception,
+               "shard-trx-batch-size ${num} must be greater than 0", ("num", my->_shard_trx_batch_size));
+
+   if( options.count( "shard-weight" ) ) {
+      for( const auto& entry : options.at( "shard-weight" ).as<vector<string>>() ) {
+         auto pos = entry.find( ':' );
+         EOS_ASSERT( pos != std::string::npos, plugin_config_exception, "Invalid shard-weight ${e}, expected shard_name:weight", ("e", entry) );
+         double weight = 0.0;
+         try {
+            weight = std::stod( entry.substr( pos + 1 ) );
+         } catch( const std::logic_error& ) {
+            EOS_THROW( plugin_config_exception, "Invalid shard-weight ${e}, expected shard_name:weight", ("e", entry) );
+         }
+         EOS_ASSERT( weight > 0.0, plugin_config_exception, "shard-weight ${e} must be greater than 0", ("e", entry) );
+         my->_shard_weights[name( entry.substr( 0, pos ) )] = weight;
+      }
+   }
+
+   my->_reject_misplaced_shard_trx = options.at( "reject-misplaced-shard-trx" ).as<bool>();
+
    if( options.count( "snapshots-dir" )) {
       auto sd = options.at( "snapshots-dir" ).as<bfs::path>();
       if( sd.is_relative()) {
@@ -1345,12 +1479,14 @@ void producer_plugin::plugin_startup()
       my->start_write_window();
    }
 
-   my->_shard_thread_pool.start( 8, // TODO: shard thread max size
+   thread_affinity shard_affinity( my->_shard_thread_affinity );
+   my->_shard_thread_pool.start( my->_shard_thread_pool_size,
       []( const fc::exception& e ) {
          fc_elog( _log, "Exception in shard thread pool, exiting: ${e}", ("e", e.to_detail_string()) );
          app().quit();
       },
       [&]() {
+         shard_affinity.pin_current_thread();
          chain.init_thread_local_data();
       });
 
@@ -2061,6 +2197,11 @@ producer_plugin_impl::start_block_result producer_plugin_impl::start_block() {
          trx.num_schedule_trx_processed      = 0;
          trx.num_schedule_trx_failed         = 0;
          trx.num_schedule_trx_applied        = 0;
+         trx.block_cpu_usage                 = 0;
+         trx.block_net_usage                 = 0;
+         trx.block_exhausted                 = false;
+         trx.waiting_since                   = time_point();
+         trx.sched_wait_time                 = fc::microseconds();
       }
 
 
@@ -2160,7 +2301,7 @@ producer_plugin_impl::start_block_result producer_plugin_impl::start_block() {
             const auto& sch_idx = chain.db().get_index<generated_transaction_multi_index, by_shard_delay>();
             auto sch_itr = sch_idx.lower_bound( boost::make_tuple( last_shard_name, time_point(), 0 ) );
             while( sch_itr != sch_idx.end() ) {
-               if (sch_itr->delay_until > pending_block_time) {
+               if (sch_itr->delay_until <= pending_block_time) {
                   auto& shard = _shards[sch_itr->shard_name];
                   shard.has_scheduled_trx = true;
                }
@@ -2176,10 +2317,12 @@ producer_plugin_impl::start_block_result producer_plugin_impl::start_block() {
          }
 
          if (in_producing_mode()) {
+            // shards are started in fair order, not in name order
             for ( auto shard_itr = _shards.begin(); shard_itr != _shards.end(); shard_itr++ ) {
                // TODO: if no any trx, remove shard from _shards?
-               process_trx_one(preprocess_deadline, shard_itr);
+               wait_for_dispatch(shard_itr);
             }
+            dispatch_shards(preprocess_deadline);
          }
 
          return start_block_result::succeeded;
@@ -2376,9 +2519,8 @@ void producer_plugin_impl::log_trx_results( const packed_transaction_ptr& trx,
    }
 }
 
-bool
-producer_plugin_impl::push_transaction_one( const fc::time_point& block_deadline, processing_shard_map::iterator shard_itr,
-                                        unapplied_transaction unapplied_trx)
+std::optional<producer_plugin_impl::shard_trx_work>
+producer_plugin_impl::prepare_transaction_one( processing_shard_map::iterator shard_itr, unapplied_transaction unapplied_trx )
 {
    auto& shard = shard_itr->second;
    auto start = fc::time_point::now();
@@ -2388,7 +2530,6 @@ producer_plugin_impl::push_transaction_one( const fc::time_point& block_deadline
 
    chain::controller& chain = chain_plug->chain();
 
-   shard.trx_seq++;
    fc_dlog( _log, "Processing a pending transaction ${id}, type=${t}, size=${s}, incoming_size=${ins}, block_seq=${bsq}, trx_seq=${tsq}, interval_ns=${it}",
       ("id", trx->id())
       ("t", trx_enum_type_dump(unapplied_trx.trx_type))
@@ -2413,9 +2554,7 @@ producer_plugin_impl::push_transaction_one( const fc::time_point& block_deadline
          unapplied_trx.next( except_ptr );
       }
       _time_tracker.add_fail_time(fc::time_point::now() - start, trx->is_transient());
-      // TODO: process next trx??
-      return true; // TODO: cur trx will be dropped
-      // return push_result{.failed = true};
+      return {};
    }
 
    fc::microseconds max_trx_time = fc::milliseconds( _max_transaction_time_ms.load() );
@@ -2436,51 +2575,95 @@ producer_plugin_impl::push_transaction_one( const fc::time_point& block_deadline
       }
    }
 
+   bool subjectively_billed = !disable_subjective_enforcement && !_subjective_billing.is_account_disabled( first_auth );
+   return shard_trx_work{ std::move(unapplied_trx), start, disable_subjective_enforcement, first_auth, max_trx_time,
+                          prev_billed_cpu_time_us, sub_bill, subjectively_billed };
+}
+
+bool
+producer_plugin_impl::push_transaction_batch( const fc::time_point& block_deadline, processing_shard_map::iterator shard_itr,
+                                              std::vector<shard_trx_work> batch )
+{
+   auto& shard = shard_itr->second;
+   if( batch.empty() ) {
+      return true;
+   }
+
+   chain::controller& chain = chain_plug->chain();
 
    assert(!shard.trx_task_fut.valid());
+   shard.trx_seq++;
 
    auto& building_shard = chain.init_building_shard(shard_itr->first);
-   // TODO: params should use reference &?
+   // The shard thread drains the whole batch, stopping early only at the block deadline or when a trx does not fit.
+   // Results are handed back to the main thread in one post, where the next batch is started.
    shard.trx_task_fut = post_async_task( _shard_thread_pool.get_executor(), [
-                                 self = this, shard_itr{std::move(shard_itr)}, &building_shard,
+                                 self = this, shard_itr, &building_shard,
                                  block_seq{_block_seq}, trx_seq{shard.trx_seq},
-                                 unapplied_trx{std::move(unapplied_trx)}, block_deadline,
-                                 start, disable_subjective_enforcement, first_auth, max_trx_time,
-                                 prev_billed_cpu_time_us, sub_bill] () {
+                                 batch{std::move(batch)}, block_deadline, posted{fc::time_point::now()},
+                                 batch_billing{batch_subjective_billing( _pending_block_mode != pending_block_mode::producing )}] () mutable {
 
             chain::controller& chain = self->chain_plug->chain();
 
             // check block seq to ensure that current thead is running in expected block producing.
             EOS_ASSERT(self->_block_seq == block_seq, producer_exception, "Building block sequence error");
 
-            auto trace = chain.push_transaction( building_shard, unapplied_trx.trx_meta, block_deadline, max_trx_time, prev_billed_cpu_time_us, false, sub_bill );
+            auto exec_start = fc::time_point::now();
+            size_t executed = 0;
+            for( auto& work : batch ) {
+               if( executed > 0 && fc::time_point::now() >= block_deadline )
+                  break;
+               if( work.subjectively_billed )
+                  work.sub_bill = batch_billing.get_subjective_bill( work.first_auth, work.sub_bill );
+               work.trace = chain.push_transaction( building_shard, work.unapplied_trx.trx_meta, block_deadline, work.max_trx_time,
+                                                    work.prev_billed_cpu_time_us, false, work.sub_bill );
+               ++executed;
+               if( work.trace->except && exception_is_exhausted( *work.trace->except ) )
+                  break;
+               if( work.subjectively_billed && ( !work.trace->except || work.trace->except->code() != tx_duplicate::code_value ) )
+                  batch_billing.subjective_bill( work.first_auth, work.trace->elapsed, !work.trace->except );
+            }
+            auto exec_time = fc::time_point::now() - exec_start;
 
-            auto ttt = std::move(unapplied_trx);
-            app().executor().post( priority::low, exec_queue::read_write, [self, shard_itr{std::move(shard_itr)}, block_seq, trx_seq, block_deadline, start, disable_subjective_enforcement, first_auth, prev_billed_cpu_time_us, sub_bill, unapplied_trx{std::move(unapplied_trx)}, trace{std::move(trace)}]() mutable {
-                  chain::controller& chain = self->chain_plug->chain();
+            app().executor().post( priority::low, exec_queue::read_write, [self, shard_itr, block_seq, trx_seq, block_deadline,
+                                                                           batch{std::move(batch)}, executed,
+                                                                           queue_wait{exec_start - posted}, exec_time]() mutable {
+               chain::controller& chain = self->chain_plug->chain();
 
-               // const auto& sname = shard_itr.first;
                auto& shard = shard_itr->second;
+               if (self->_block_seq == block_seq) {
+                  shard.queue_wait_time += queue_wait;
+                  shard.exec_time += exec_time;
+               }
                shard.last_processed_time = fc::time_point::now();
-               fc_dlog( _log, "Processed a pending transaction ${id}, type=${t}, size=${s}, incoming_size=${ins}, block_seq=${bsq}, trx_seq=${tsq}, spent_ns=${st}",
-                  ("id", unapplied_trx.trx_meta->id())
-                  ("t", trx_enum_type_dump(unapplied_trx.trx_type))
-                  ("s", shard.unapplied_transactions.size())
-                  ("ins", shard.unapplied_transactions.incoming_size())
-                  ("bsq", self->_block_seq)
-                  ("tsq", shard.trx_seq)
-                  ("st", (fc::time_point::now() - start).count()) );
-
-               auto pr = self->handle_push_result(unapplied_trx.trx_meta, unapplied_trx.next, start, chain, trace, unapplied_trx.return_failure_trace, disable_subjective_enforcement, first_auth, sub_bill, prev_billed_cpu_time_us);
-               // TODO: clear trx_task_fut?
-               // if( self->in_producing_mode() ) {
-               //    self->schedule_maybe_produce_block( true );
-               // } else {
-               //    self->restart_speculative_block();
-               // }
-
-
-               // auto ret = self->read_only_execution_task(pending_block_num);
+               self->update_shard_block_usage( shard_itr );
+
+               bool block_exhausted = false;
+               for( size_t i = 0; i < batch.size(); ++i ) {
+                  auto& work = batch[i];
+                  if( i >= executed || block_exhausted ) {
+                     // not executed before the deadline or after the block filled up, retry in a later block
+                     shard.unapplied_transactions.add_trx(std::move(work.unapplied_trx));
+                     continue;
+                  }
+                  fc_dlog( _log, "Processed a pending transaction ${id}, type=${t}, size=${s}, incoming_size=${ins}, block_seq=${bsq}, trx_seq=${tsq}, spent_ns=${st}",
+                     ("id", work.unapplied_trx.trx_meta->id())
+                     ("t", trx_enum_type_dump(work.unapplied_trx.trx_type))
+                     ("s", shard.unapplied_transactions.size())
+                     ("ins", shard.unapplied_transactions.incoming_size())
+                     ("bsq", self->_block_seq)
+                     ("tsq", shard.trx_seq)
+                     ("st", (fc::time_point::now() - work.start).count()) );
+
+                  auto pr = self->handle_push_result(work.unapplied_trx.trx_meta, work.unapplied_trx.next, work.start, chain, work.trace,
+                                                     work.unapplied_trx.return_failure_trace, work.disable_subjective_enforcement,
+                                                     work.first_auth, work.sub_bill, work.prev_billed_cpu_time_us);
+                  if (pr.trx_exhausted) {
+                     shard.unapplied_transactions.add_trx(std::move(work.unapplied_trx));
+                  }
+                  block_exhausted = block_exhausted || pr.block_exhausted;
+               }
+
                if (self->_block_seq == block_seq && shard.trx_seq == trx_seq) {
                   shard.trx_task_fut = std::future<bool>();
                } else {
@@ -2491,17 +2674,12 @@ producer_plugin_impl::push_transaction_one( const fc::time_point& block_deadline
                      ("atsq", trx_seq) );
                }
 
-
-               if (pr.block_exhausted) {
-                  // produce block
-                  shard.unapplied_transactions.add_trx(std::move(unapplied_trx));
-                  // TODO: maybe_produce_block
-
-               } else {
-                  // cur trx will be dropped
-                  self->process_trx_one(block_deadline, shard_itr);
+               if (self->_block_seq == block_seq) {
+                  if (!block_exhausted) {
+                     self->wait_for_dispatch(shard_itr);
+                  }
+                  self->dispatch_shards(block_deadline);
                }
-
             });
 
             return true;
@@ -2539,8 +2717,10 @@ producer_plugin_impl::handle_push_result( const transaction_metadata_ptr& trx,
          } else {
             fc_dlog(trx->is_transient() ? _transient_trx_failed_trace_log : _trx_failed_trace_log, "[TRX_TRACE] Speculative execution COULD NOT FIT tx: ${txid} RETRYING", ("txid", trx->id()));
          }
-         if ( !trx->is_read_only() )
-            pr.block_exhausted = block_is_exhausted(); // smaller trx might fit
+         if ( !trx->is_read_only() ) {
+            auto shard_itr = _shards.find( trx->packed_trx()->get_transaction().get_shard_name() );
+            pr.block_exhausted = shard_itr != _shards.end() ? block_is_exhausted( shard_itr->second ) : block_is_exhausted(); // smaller trx might fit
+         }
          pr.trx_exhausted = true;
       } else {
          pr.failed = true;
@@ -2603,10 +2783,16 @@ bool producer_plugin_impl::process_unapplied_trx_one( const fc::time_point& dead
       return true;
    }
 
-   auto trx = *itr;
-   unapplied_transactions.erase( itr ); // pop trx
+   std::vector<shard_trx_work> batch;
+   batch.reserve( _shard_trx_batch_size );
+   while( itr != end_itr && batch.size() < _shard_trx_batch_size ) {
+      auto trx = *itr;
+      itr = unapplied_transactions.erase( itr ); // pop trx
+      if( auto work = prepare_transaction_one( shard_itr, std::move(trx) ) )
+         batch.emplace_back( std::move(*work) );
+   }
 
-   return push_transaction_one( deadline, shard_itr, std::move(trx) );
+   return push_transaction_batch( deadline, shard_itr, std::move(batch) );
 }
 
 bool producer_plugin_impl::process_scheduled_trxs( const fc::time_point& deadline, processing_shard_map::iterator shard_itr )
@@ -2661,6 +2847,7 @@ bool producer_plugin_impl::process_scheduled_trxs( const fc::time_point& deadlin
          continue;
       }
       found = true;
+      break;
    }
 
    shard.next_schedule_trx_delay_until    = time_point::maximum();
@@ -2671,7 +2858,7 @@ bool producer_plugin_impl::process_scheduled_trxs( const fc::time_point& deadlin
       const auto sch_expiration = sch_itr->expiration;
       auto sch_itr_next = sch_itr; // save off next since sch_itr may be invalidated by loop
       ++sch_itr_next;
-      if (sch_itr_next != sch_idx.end()) {
+      if (sch_itr_next != sch_idx.end() && sch_itr_next->shard_name == shard_name) {
          shard.next_schedule_trx_delay_until    = sch_itr_next->delay_until;
          shard.next_schedule_trx_id             = sch_itr_next->id;
       }
@@ -2688,14 +2875,17 @@ bool producer_plugin_impl::process_scheduled_trxs( const fc::time_point& deadlin
                                  self = this, shard_itr{std::move(shard_itr)},
                                  &building_shard, block_seq{_block_seq},
                                  trx_seq{shard.trx_seq}, trx_id{sch_itr->trx_id}, deadline,
-                                 start, max_trx_time, sch_expiration] () {
+                                 start, max_trx_time, sch_expiration, posted{fc::time_point::now()}] () {
          try {
             chain::controller& chain = self->chain_plug->chain();
             // check block seq to ensure that current thead is running in expected block producing.
             EOS_ASSERT(self->_block_seq == block_seq, producer_exception, "Building block sequence error");
+            auto exec_start = fc::time_point::now();
             auto trace = chain.push_scheduled_transaction(building_shard, trx_id, deadline, max_trx_time, 0, false);
+            auto exec_time = fc::time_point::now() - exec_start;
 
-            app().executor().post( priority::low, exec_queue::read_write, [self, shard_itr{std::move(shard_itr)}, block_seq, trx_seq, deadline, start, trace{std::move(trace)}, trx_id{std::move(trx_id)}, sch_expiration]() mutable {
+            app().executor().post( priority::low, exec_queue::read_write, [self, shard_itr{std::move(shard_itr)}, block_seq, trx_seq, deadline, start, trace{std::move(trace)}, trx_id{std::move(trx_id)}, sch_expiration,
+                                                                           queue_wait{exec_start - posted}, exec_time]() mutable {
                chain::controller& chain = self->chain_plug->chain();
 
                auto get_first_authorizer = [&](const transaction_trace_ptr& trace) {
@@ -2707,6 +2897,10 @@ bool producer_plugin_impl::process_scheduled_trxs( const fc::time_point& deadlin
                };
 
                auto& shard = shard_itr->second;
+               if (self->_block_seq == block_seq) {
+                  shard.queue_wait_time += queue_wait;
+                  shard.exec_time += exec_time;
+               }
 
                if (self->_block_seq == block_seq && shard.trx_seq == trx_seq) {
                   shard.trx_task_fut = std::future<bool>();
@@ -2722,7 +2916,8 @@ bool producer_plugin_impl::process_scheduled_trxs( const fc::time_point& deadlin
                if (trace->except) {
                   self->_time_tracker.add_fail_time(end - start, false); // delayed transaction cannot be transient
                   if (exception_is_exhausted(*trace->except)) {
-                     if( self->block_is_exhausted() ) {
+                     self->update_shard_block_usage( shard_itr );
+                     if( self->block_is_exhausted( shard ) ) {
                         // TODO: log
                      }
                   } else {
@@ -2751,7 +2946,10 @@ bool producer_plugin_impl::process_scheduled_trxs( const fc::time_point& deadlin
                   shard.num_schedule_trx_applied++;
                }
 
-               self->process_trx_one(deadline, shard_itr);
+               if (self->_block_seq == block_seq) {
+                  self->wait_for_dispatch(shard_itr);
+                  self->dispatch_shards(deadline);
+               }
             });
 
          } LOG_AND_DROP();
@@ -2776,12 +2974,16 @@ bool producer_plugin_impl::process_incoming_trx_one( const fc::time_point& deadl
       return true;
    }
 
-   auto trx = *itr;
-   unapplied_transactions.erase( itr );
-
-   auto ret = push_transaction_one( deadline, shard_itr, std::move(trx) );
+   std::vector<shard_trx_work> batch;
+   batch.reserve( _shard_trx_batch_size );
+   while( itr != end && batch.size() < _shard_trx_batch_size ) {
+      auto trx = *itr;
+      itr = unapplied_transactions.erase( itr );
+      if( auto work = prepare_transaction_one( shard_itr, std::move(trx) ) )
+         batch.emplace_back( std::move(*work) );
+   }
 
-   return ret;
+   return push_transaction_batch( deadline, shard_itr, std::move(batch) );
 }
 
 
@@ -2799,10 +3001,28 @@ bool producer_plugin_impl::process_trx_one( const fc::time_point& deadline, proc
          fc_dlog( _log, "There is a processing trx");
          return true;
       }
+      // the shard leaves the waiting shards when it is dispatched or has nothing it can run
+      const auto waiting_since = std::exchange( shard.waiting_since, time_point() );
       const auto pending_block_num = chain.pending_block_num();
       if ( should_interrupt_start_block( deadline, pending_block_num ) ) {
          return false;
       }
+      update_shard_block_usage( shard_itr );
+      if ( block_is_exhausted( shard ) ) {
+         fc_dlog( _log, "Block budget of shard ${s} is exhausted", ("s", shard_itr->first) );
+         return false;
+      }
+      if ( shards_in_flight() >= _shard_thread_pool_size || over_fair_share( shard_itr ) ) {
+         if ( waiting_since != time_point() ) {
+            shard.waiting_since = waiting_since;
+         } else {
+            wait_for_dispatch( shard_itr );
+         }
+         return true;
+      }
+      if ( waiting_since != time_point() ) {
+         shard.sched_wait_time += fc::time_point::now() - waiting_since;
+      }
 
       if (!process_unapplied_trx_one(deadline, shard_itr)) {
          return false;
@@ -2829,17 +3049,107 @@ bool producer_plugin_impl::process_trx_one( const fc::time_point& deadline, proc
    return true;
 }
 
+size_t producer_plugin_impl::shards_in_flight() const {
+   return std::count_if( _shards.begin(), _shards.end(), []( const auto& s ) { return s.second.trx_task_fut.valid(); } );
+}
+
+// The shards running or waiting to run are the ones sharing the block cpu limit, see eosio::over_fair_share().
+bool producer_plugin_impl::over_fair_share( processing_shard_map::const_iterator shard_itr ) const {
+   std::vector<shard_share> others;
+   for( auto itr = _shards.cbegin(); itr != _shards.cend(); ++itr ) {
+      if( itr != shard_itr && (itr->second.trx_task_fut.valid() || itr->second.waiting_since != time_point()) )
+         others.push_back( { shard_weight( itr->first ), itr->second.virtual_cpu } );
+   }
+
+   const chain::controller& chain = chain_plug->chain();
+   const uint64_t cpu_limit = chain.get_resource_limits_manager().get_total_block_cpu_limit( chain.dbm().shared_db() );
+   return eosio::over_fair_share( { shard_weight( shard_itr->first ), shard_itr->second.virtual_cpu }, others, cpu_limit );
+}
+
+void producer_plugin_impl::wait_for_dispatch( processing_shard_map::iterator shard_itr ) {
+   auto& shard = shard_itr->second;
+   if( shard.waiting_since != time_point() )
+      return;
+   // a shard coming back from idle starts level with the running shards instead of spending the cpu it left unused
+   std::optional<double> min_active;
+   for( const auto& s : _shards ) {
+      if( &s.second != &shard && (s.second.trx_task_fut.valid() || s.second.waiting_since != time_point()) )
+         min_active = std::min( min_active.value_or( s.second.virtual_cpu ), s.second.virtual_cpu );
+   }
+   if( min_active )
+      shard.virtual_cpu = std::max( shard.virtual_cpu, *min_active );
+   shard.waiting_since = fc::time_point::now();
+}
+
+// Weighted fair queuing over the shards: the waiting shard with the least weighted cpu goes first, the one waiting
+// longest among equals, for as long as shard threads are free. A shard going idle or out of budget leaves the shards
+// sharing the block, which can bring a waiting shard back within its fair share, so all waiting shards are gone over
+// again until a pass leaves none idle.
+void producer_plugin_impl::dispatch_shards( const fc::time_point& deadline ) {
+   for( bool went_idle = true; went_idle; ) {
+      went_idle = false;
+      std::vector<processing_shard_map::iterator> waiting;
+      for( auto itr = _shards.begin(); itr != _shards.end(); ++itr ) {
+         if( itr->second.waiting_since != time_point() )
+            waiting.push_back( itr );
+      }
+      std::sort( waiting.begin(), waiting.end(), []( const auto& a, const auto& b ) {
+         return std::tie( a->second.virtual_cpu, a->second.waiting_since ) < std::tie( b->second.virtual_cpu, b->second.waiting_since );
+      } );
+
+      for( auto itr : waiting ) {
+         if( shards_in_flight() >= _shard_thread_pool_size )
+            return;
+         process_trx_one( deadline, itr ); // keeps waiting if the shard is over its fair share
+         if( !itr->second.trx_task_fut.valid() && itr->second.waiting_since == time_point() )
+            went_idle = true;
+      }
+   }
+}
+
+// Every shard has its own block budget, tracked in its db; the block as a whole is capped on the sum of the shard usage.
+// Shard dbs are only read while the shard is idle, so the block-level check works from the usage recorded in _shards.
 bool producer_plugin_impl::block_is_exhausted() const {
    const chain::controller& chain = chain_plug->chain();
    const auto& rl = chain.get_resource_limits_manager();
 
-   const uint64_t cpu_limit = rl.get_block_cpu_limit( chain.dbm().main_db() );
-   if( cpu_limit < _max_block_cpu_usage_threshold_us ) return true;
-   const uint64_t net_limit = rl.get_block_net_limit( chain.dbm().main_db() );
-   if( net_limit < _max_block_net_usage_threshold_bytes ) return true;
+   uint64_t cpu_usage = 0;
+   uint64_t net_usage = 0;
+   for( const auto& shard : _shards ) {
+      cpu_usage += shard.second.block_cpu_usage;
+      net_usage += shard.second.block_net_usage;
+   }
+
+   const uint64_t cpu_limit = rl.get_total_block_cpu_limit( chain.dbm().shared_db() );
+   if( cpu_usage + _max_block_cpu_usage_threshold_us > cpu_limit ) return true;
+   const uint64_t net_limit = rl.get_total_block_net_limit( chain.dbm().shared_db() );
+   if( net_usage + _max_block_net_usage_threshold_bytes > net_limit ) return true;
    return false;
 }
 
+bool producer_plugin_impl::block_is_exhausted( const processing_shard& shard ) const {
+   return shard.block_exhausted || block_is_exhausted();
+}
+
+// must be called on the main thread while the shard has no trx task running
+void producer_plugin_impl::update_shard_block_usage( processing_shard_map::iterator shard_itr ) {
+   const chain::controller& chain = chain_plug->chain();
+   const auto& rl = chain.get_resource_limits_manager();
+   const auto* db = chain.dbm().find_shard_db( shard_itr->first );
+   if( !db )
+      return;
+   const auto& shared_db = shard_itr->first == config::main_shard_name ? chain.dbm().main_db() : chain.dbm().shared_db();
+
+   auto& shard = shard_itr->second;
+   const uint64_t prev_cpu_usage = shard.block_cpu_usage;
+   shard.block_cpu_usage = rl.get_block_cpu_usage( *db, shared_db );
+   if( shard.block_cpu_usage > prev_cpu_usage )
+      shard.virtual_cpu += (shard.block_cpu_usage - prev_cpu_usage) / shard_weight( shard_itr->first );
+   shard.block_net_usage = rl.get_block_net_usage( *db, shared_db );
+   shard.block_exhausted = rl.get_block_cpu_limit( *db, shared_db ) < _max_block_cpu_usage_threshold_us
+                        || rl.get_block_net_limit( *db, shared_db ) < _max_block_net_usage_threshold_bytes;
+}
+
 // Example:
 // --> Start block A (block time x.500) at time x.000
 // -> start_block()
@@ -3051,6 +3361,13 @@ void producer_plugin_impl::produce_block() {
    auto trx_size = new_bs->block->get_trx_size();
    ++_metrics.blocks_produced.value;
    _metrics.trxs_produced.value += trx_size;
+   for (auto& item : _shards) {
+      auto& shard = item.second;
+      _metrics.update_shard_metrics(item.first, shard.queue_wait_time, shard.exec_time);
+      _metrics.update_shard_schedule_metrics(item.first, shard.unapplied_transactions.size(), shard.sched_wait_time, shard.virtual_cpu);
+      shard.queue_wait_time = fc::microseconds();
+      shard.exec_time = fc::microseconds();
+   }
 
    ilog("Produced block ${id}... #${n} @ ${t} signed by ${p} "
         "[trxs: ${count}, lib: ${lib}, confirmed: ${confs}, net: ${net}, cpu: ${cpu}, elapsed: ${et}, time: ${tt}]",
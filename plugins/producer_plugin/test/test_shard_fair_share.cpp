@@ -0,0 +1,112 @@
+#define BOOST_TEST_MODULE shard_fair_share
+#include <boost/test/included/unit_test.hpp>
+
+#include <eosio/producer_plugin/shard_fair_share.hpp>
+
+#include <cmath>
+#include <map>
+#include <string>
+
+namespace {
+
+using namespace eosio;
+
+constexpr uint64_t cpu_limit = 200'000;
+
+struct sim_shard {
+   double   weight;
+   uint64_t trx_cpu;       // cpu billed to every trx of the shard
+   uint32_t backlog;       // trxs queued for the block
+   uint64_t billed_cpu = 0;
+   double   virtual_cpu = 0.0;
+   uint32_t executed = 0;
+};
+
+// Runs one block on a single shard thread the way dispatch_shards() does: the waiting shard with the lowest virtual cpu
+// goes first, unless it is over its fair share, until the block cpu limit or all backlogs are used up.
+void produce_block( std::map<std::string, sim_shard>& shards ) {
+   uint64_t block_cpu = 0;
+   while( true ) {
+      std::map<std::string, sim_shard>::iterator next = shards.end();
+      for( auto itr = shards.begin(); itr != shards.end(); ++itr ) {
+         if( !itr->second.backlog || block_cpu + itr->second.trx_cpu > cpu_limit )
+            continue;
+         std::vector<shard_share> others;
+         for( const auto& s : shards ) {
+            if( &s.second != &itr->second && s.second.backlog )
+               others.push_back( { s.second.weight, s.second.virtual_cpu } );
+         }
+         if( over_fair_share( { itr->second.weight, itr->second.virtual_cpu }, others, cpu_limit ) )
+            continue;
+         if( next == shards.end() || itr->second.virtual_cpu < next->second.virtual_cpu )
+            next = itr;
+      }
+      if( next == shards.end() )
+         return;
+      auto& s = next->second;
+      --s.backlog;
+      ++s.executed;
+      s.billed_cpu += s.trx_cpu;
+      s.virtual_cpu += s.trx_cpu / s.weight;
+      block_cpu += s.trx_cpu;
+   }
+}
+
+BOOST_AUTO_TEST_SUITE( shard_fair_share_test )
+
+BOOST_AUTO_TEST_CASE( alone_and_lowest_shard ) {
+   // a shard alone with work may use the whole block
+   BOOST_CHECK( !over_fair_share( { 1.0, 1'000'000.0 }, {}, cpu_limit ) );
+   // the shard with the lowest virtual cpu is never over its share, whatever it was billed
+   BOOST_CHECK( !over_fair_share( { 1.0, 500'000.0 }, { { 1.0, 600'000.0 }, { 4.0, 700'000.0 } }, cpu_limit ) );
+   // a lead of more than the even share of the active shards is over the share
+   BOOST_CHECK( !over_fair_share( { 1.0, 100'000.0 }, { { 1.0, 0.0 } }, cpu_limit ) );
+   BOOST_CHECK( over_fair_share( { 1.0, 100'001.0 }, { { 1.0, 0.0 } }, cpu_limit ) );
+   // the share shrinks as more weight is running or waiting
+   BOOST_CHECK( over_fair_share( { 1.0, 50'001.0 }, { { 1.0, 0.0 }, { 2.0, 50'000.0 } }, cpu_limit ) );
+}
+
+BOOST_AUTO_TEST_CASE( skewed_shards_progress_in_block ) {
+   // one shard with heavy trxs, one with light trxs, both with more work than the block holds
+   std::map<std::string, sim_shard> shards = {
+      { "heavy", { 1.0, 5'000, 1'000 } },
+      { "light", { 1.0, 100, 100'000 } } };
+   produce_block( shards );
+
+   const auto& heavy = shards.at( "heavy" );
+   const auto& light = shards.at( "light" );
+   BOOST_TEST( heavy.executed > 0u );
+   BOOST_TEST( light.executed > 0u );
+   // equal weights split the block cpu evenly, up to one trx of the heavy shard
+   BOOST_TEST( heavy.billed_cpu + light.billed_cpu > cpu_limit - heavy.trx_cpu );
+   BOOST_TEST( std::abs( static_cast<int64_t>( heavy.billed_cpu ) - static_cast<int64_t>( light.billed_cpu ) ) <= int64_t( heavy.trx_cpu ) );
+}
+
+BOOST_AUTO_TEST_CASE( skewed_weights_progress_in_block ) {
+   std::map<std::string, sim_shard> shards = {
+      { "heavy", { 3.0, 5'000, 1'000 } },
+      { "light", { 1.0, 100, 100'000 } } };
+   produce_block( shards );
+
+   const auto& heavy = shards.at( "heavy" );
+   const auto& light = shards.at( "light" );
+   BOOST_TEST( heavy.executed > 0u );
+   BOOST_TEST( light.executed > 0u );
+   // the block cpu is split 3:1, up to one trx of the heavy shard
+   BOOST_TEST( std::abs( heavy.virtual_cpu - light.virtual_cpu ) <= heavy.trx_cpu / heavy.weight );
+}
+
+BOOST_AUTO_TEST_CASE( idle_shard_releases_its_share ) {
+   // the light shard runs out of work early, the heavy shard then fills the rest of the block
+   std::map<std::string, sim_shard> shards = {
+      { "heavy", { 1.0, 5'000, 1'000 } },
+      { "light", { 1.0, 100, 10 } } };
+   produce_block( shards );
+
+   BOOST_TEST( shards.at( "light" ).executed == 10u );
+   BOOST_TEST( shards.at( "heavy" ).billed_cpu + shards.at( "light" ).billed_cpu > cpu_limit - shards.at( "heavy" ).trx_cpu );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}
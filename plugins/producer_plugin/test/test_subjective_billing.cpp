@@ -130,6 +130,52 @@ BOOST_AUTO_TEST_CASE( subjective_bill_test ) {
 
 }
 
+BOOST_AUTO_TEST_CASE( batch_subjective_bill_test ) {
+
+   transaction_id_type id1 = sha256::hash( "1" );
+   account_name a = "a"_n;
+   account_name b = "b"_n;
+
+   const auto now = time_point::now();
+
+   subjective_billing sub_bill;
+   sub_bill.subjective_bill( id1, now + fc::seconds( 60 ), a, fc::microseconds( 100 ) );
+   const int64_t prepared_a = sub_bill.get_subjective_bill( a, now );
+   const int64_t prepared_b = sub_bill.get_subjective_bill( b, now );
+
+   {  // speculating, every trx executed ahead in the batch is carried into the bill of the trxs after it
+      batch_subjective_billing batch_bill( true );
+      BOOST_CHECK_EQUAL( 100, batch_bill.get_subjective_bill( a, prepared_a ) );
+
+      batch_bill.subjective_bill( a, fc::microseconds( 13 ), true );
+      BOOST_CHECK_EQUAL( 100 + 13, batch_bill.get_subjective_bill( a, prepared_a ) );
+      BOOST_CHECK_EQUAL( 0, batch_bill.get_subjective_bill( b, prepared_b ) );
+
+      batch_bill.subjective_bill( a, fc::microseconds( 11 ), false );
+      batch_bill.subjective_bill( b, fc::microseconds( 9 ), true );
+      BOOST_CHECK_EQUAL( 100 + 13 + 11, batch_bill.get_subjective_bill( a, prepared_a ) );
+      BOOST_CHECK_EQUAL( 9, batch_bill.get_subjective_bill( b, prepared_b ) );
+
+      batch_bill.subjective_bill( b, fc::microseconds( -1 ), false );
+      BOOST_CHECK_EQUAL( 9, batch_bill.get_subjective_bill( b, prepared_b ) );
+   }
+
+   {  // producing, successful trxs are in objective billing so only failures are carried
+      batch_subjective_billing batch_bill( false );
+      batch_bill.subjective_bill( a, fc::microseconds( 13 ), true );
+      BOOST_CHECK_EQUAL( 100, batch_bill.get_subjective_bill( a, prepared_a ) );
+
+      batch_bill.subjective_bill( a, fc::microseconds( 11 ), false );
+      BOOST_CHECK_EQUAL( 100 + 11, batch_bill.get_subjective_bill( a, prepared_a ) );
+   }
+
+   // the main thread bills the same trxs once the batch is handled, after which a new batch starts from there
+   sub_bill.subjective_bill_failure( a, fc::microseconds( 11 ), now );
+   BOOST_CHECK_EQUAL( 100 + 11, sub_bill.get_subjective_bill( a, now ) );
+   batch_subjective_billing next_batch( false );
+   BOOST_CHECK_EQUAL( 100 + 11, next_batch.get_subjective_bill( a, sub_bill.get_subjective_bill( a, now ) ) );
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 }
@@ -1,5 +1,7 @@
 #define BOOST_TEST_MODULE full_producer_trxs
 #include <boost/test/included/unit_test.hpp>
+#include <boost/test/data/test_case.hpp>
+#include <boost/test/data/monomorphic.hpp>
 
 #include <eosio/producer_plugin/producer_plugin.hpp>
 
@@ -101,7 +103,9 @@ BOOST_AUTO_TEST_SUITE(ordered_trxs_full)
 // Integration test of producer_plugin
 // Test verifies that transactions are processed, reported to caller, and not lost
 // even when blocks are aborted and some transactions fail.
-BOOST_AUTO_TEST_CASE(producer) {
+// Run with one trx per shard thread round trip and with batches larger than a block holds, where most trxs of a batch
+// are handed back to the main thread after other trxs of the batch failed or the block filled up.
+BOOST_DATA_TEST_CASE(producer, boost::unit_test::data::make({"1", "32", "1024"}), batch_size) {
    appbase::scoped_app app;
 
    fc::temp_directory temp;
@@ -114,7 +118,7 @@ BOOST_AUTO_TEST_CASE(producer) {
          fc::logger::get(DEFAULT_LOGGER).set_log_level(fc::log_level::debug);
          std::vector<const char*> argv =
                {"test", "--data-dir", temp_dir_str.c_str(), "--config-dir", temp_dir_str.c_str(),
-                "-p", "gax", "-e", "--disable-subjective-billing=true" };
+                "-p", "gax", "-e", "--disable-subjective-billing=true", "--shard-trx-batch-size", batch_size };
          app->initialize<chain_plugin, producer_plugin>( argv.size(), (char**) &argv[0] );
          app->startup();
          plugin_promise.set_value(
@@ -128,8 +132,8 @@ BOOST_AUTO_TEST_CASE(producer) {
       std::deque<block_state_ptr> all_blocks;
       std::promise<void> empty_blocks_promise;
       std::future<void> empty_blocks_fut = empty_blocks_promise.get_future();
+      int num_empty = std::numeric_limits<int>::max(); // per run, the test case runs once per batch size
       auto ab = chain_plug->chain().accepted_block.connect( [&](const block_state_ptr& bsp) {
-         static int num_empty = std::numeric_limits<int>::max();
          all_blocks.push_back( bsp );
          if( bsp->block->get_trx_size() ) {
             --num_empty;
@@ -212,5 +216,86 @@ BOOST_AUTO_TEST_CASE(producer) {
    }
 }
 
+// Integration test of producer_plugin
+// Test verifies that a delayed transaction is picked up by the producer once it is due and executed exactly once,
+// the start of every block looks for shards with due scheduled transactions and the scan of a shard stops at the
+// first candidate.
+BOOST_AUTO_TEST_CASE(scheduled_trx) {
+   appbase::scoped_app app;
+
+   fc::temp_directory temp;
+   auto temp_dir_str = temp.path().string();
+
+   {
+      std::promise<std::tuple<producer_plugin*, chain_plugin*>> plugin_promise;
+      std::future<std::tuple<producer_plugin*, chain_plugin*>> plugin_fut = plugin_promise.get_future();
+      std::thread app_thread( [&]() {
+         fc::logger::get(DEFAULT_LOGGER).set_log_level(fc::log_level::debug);
+         std::vector<const char*> argv =
+               {"test", "--data-dir", temp_dir_str.c_str(), "--config-dir", temp_dir_str.c_str(),
+                "-p", "gax", "-e", "--disable-subjective-billing=true" };
+         app->initialize<chain_plugin, producer_plugin>( argv.size(), (char**) &argv[0] );
+         app->startup();
+         plugin_promise.set_value(
+               {app->find_plugin<producer_plugin>(), app->find_plugin<chain_plugin>()} );
+         app->exec();
+      } );
+
+      auto[prod_plug, chain_plug] = plugin_fut.get();
+      auto chain_id = chain_plug->get_chain_id();
+
+      signed_transaction trx;
+      trx.expiration = fc::time_point::now() + fc::seconds( 60 );
+      trx.delay_sec = 1;
+      trx.actions.emplace_back( vector<permission_level>{{config::system_account_name, config::active_name}},
+                                testit{ 4242 } );
+      trx.sign( private_key_type::regenerate<fc::ecc::private_key_shim>(fc::sha256::hash(std::string("nathan"))), chain_id );
+      auto ptrx = std::make_shared<packed_transaction>( std::move(trx) );
+
+      // accepted_block is emitted on the main thread, the counts are read after the main thread has been joined
+      uint32_t delayed_block = 0;
+      uint32_t executed_block = 0;
+      size_t   num_executed = 0;
+      std::promise<void> executed_promise;
+      std::future<void> executed_fut = executed_promise.get_future();
+      auto ab = chain_plug->chain().accepted_block.connect( [&](const block_state_ptr& bsp) {
+         for( const auto& trx_receipts : bsp->block->transactions ) {
+            for( const auto& r : trx_receipts.second ) {
+               if( r.status == transaction_receipt::delayed && std::holds_alternative<packed_transaction>( r.trx )
+                   && std::get<packed_transaction>( r.trx ).id() == ptrx->id() ) {
+                  delayed_block = bsp->block_num;
+               } else if( r.status == transaction_receipt::executed && std::holds_alternative<transaction_id_type>( r.trx )
+                          && std::get<transaction_id_type>( r.trx ) == ptrx->id() ) {
+                  executed_block = bsp->block_num;
+                  if( ++num_executed == 1 ) executed_promise.set_value();
+               }
+            }
+         }
+      } );
+
+      std::atomic<bool> pushed = false;
+      app->post( priority::low, [ptrx, &pushed, &app]() {
+         app->get_method<plugin_interface::incoming::methods::transaction_async>()(ptrx,
+            false, // api_trx
+            transaction_metadata::trx_type::input, // trx_type
+            false, // return_failure_traces
+            [&pushed](const std::variant<fc::exception_ptr, transaction_trace_ptr>& result) {
+               pushed = !std::holds_alternative<fc::exception_ptr>( result ) && !std::get<chain::transaction_trace_ptr>( result )->except;
+            });
+      });
+
+      BOOST_CHECK( executed_fut.wait_for(std::chrono::seconds(15)) == std::future_status::ready );
+      // a few more blocks, the scheduled transaction must not be executed again
+      usleep( 4 * config::block_interval_us );
+
+      app->quit();
+      app_thread.join();
+
+      BOOST_CHECK( pushed.load() );
+      BOOST_CHECK( delayed_block > 0 );
+      BOOST_CHECK( executed_block > delayed_block );
+      BOOST_CHECK_EQUAL( num_executed, 1u );
+   }
+}
 
 BOOST_AUTO_TEST_SUITE_END()
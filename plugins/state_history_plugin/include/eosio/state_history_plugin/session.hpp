@@ -1,6 +1,7 @@
 #pragma once
 #include <eosio/chain/block_state.hpp>
 #include <eosio/state_history/compression.hpp>
+#include <eosio/state_history/create_deltas.hpp>
 #include <eosio/state_history/log.hpp>
 #include <eosio/state_history/serialization.hpp>
 #include <eosio/state_history/types.hpp>
@@ -11,6 +12,7 @@
 #include <boost/asio/error.hpp>
 #include <boost/beast/websocket.hpp>
 #include <memory>
+#include <set>
 
 
 extern const char* const state_history_plugin_abi;
@@ -30,6 +32,7 @@ struct session_base {
    virtual ~session_base()                                                    = default;
 
    std::optional<state_history::get_blocks_request_v0> current_request;
+   std::set<chain::shard_name>                          shard_filter; // empty sends the deltas of every shard, v0 requests get main only
    bool need_to_send_update = false;
 };
 
@@ -165,13 +168,17 @@ template <typename Session>
 class blocks_request_send_queue_entry : public send_queue_entry_base {
    std::shared_ptr<Session> session;
    eosio::state_history::get_blocks_request_v0 req;
+   std::set<chain::shard_name>                 shards;
 
 public:
-   blocks_request_send_queue_entry(std::shared_ptr<Session> s, state_history::get_blocks_request_v0&& r)
+   blocks_request_send_queue_entry(std::shared_ptr<Session> s, state_history::get_blocks_request_v0&& r,
+                                   std::set<chain::shard_name> shards = {})
    : session(std::move(s))
-   , req(std::move(r)) {}
+   , req(std::move(r))
+   , shards(std::move(shards)) {}
 
    void send_entry() override {
+      session->shard_filter = std::move(shards);
       session->update_current_request(req);
       session->send_update(true);
    }
@@ -388,7 +395,21 @@ private:
          auto& optional_log = plugin->get_chain_state_log();
          if( optional_log ) {
             buf.emplace( optional_log->create_locked_decompress_stream() );
-            return optional_log->get_unpacked_entry( result.this_block->block_num, *buf );
+            auto size = optional_log->get_unpacked_entry( result.this_block->block_num, *buf );
+            if( !size || shard_filter.empty() )
+               return size;
+
+            // the subscription covers only some shards, drop the deltas of the other shards before sending
+            std::vector<char> deltas = std::visit( [size]( auto& d ) {
+               if constexpr( std::is_same_v<std::decay_t<decltype(d)>, std::vector<char>> ) {
+                  return std::move( d );
+               } else {
+                  std::vector<char> v( size );
+                  bio::read( *d, v.data(), size );
+                  return v;
+               }
+            }, buf->buf );
+            return buf->init( state_history::filter_deltas( deltas, shard_filter ) );
          }
       }
       return 0;
@@ -405,8 +426,20 @@ private:
    void process(state_history::get_blocks_request_v0& req) {
       fc_dlog(plugin->logger(), "received get_blocks_request_v0 = ${req}", ("req", req));
 
+      // table_delta_v1 is unknown to clients of get_blocks_request_v0, they only get the deltas of the main shard
+      auto self = this->shared_from_this();
+      auto entry_ptr = std::make_unique<blocks_request_send_queue_entry<session>>(
+          self, std::move(req), std::set<chain::shard_name>{chain::config::main_shard_name});
+      session_mgr.add_send_queue(std::move(self), std::move(entry_ptr));
+   }
+
+   void process(state_history::get_blocks_request_v1& req) {
+      fc_dlog(plugin->logger(), "received get_blocks_request_v1 = ${req}", ("req", req));
+
+      std::set<chain::shard_name> shards(req.shards.begin(), req.shards.end());
       auto self = this->shared_from_this();
-      auto entry_ptr = std::make_unique<blocks_request_send_queue_entry<session>>(self, std::move(req));
+      auto entry_ptr = std::make_unique<blocks_request_send_queue_entry<session>>(
+          self, std::move(static_cast<state_history::get_blocks_request_v0&>(req)), std::move(shards));
       session_mgr.add_send_queue(std::move(self), std::move(entry_ptr));
    }
 
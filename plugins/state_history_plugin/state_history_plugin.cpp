@@ -354,11 +354,15 @@ struct state_history_plugin_impl : std::enable_shared_from_this<state_history_pl
       if (fresh)
          fc_ilog(_log, "Placing initial state in block ${n}", ("n", block_state->block_num));
 
-      // TODO: store all shard dbs
+      auto& chain = chain_plug->chain();
+      std::vector<state_history::shard_database> shard_dbs;
+      for (const auto& [name, db] : chain.dbm().shard_dbs())
+         shard_dbs.emplace_back(name, &db);
+
       state_history_log_header header{
           .magic = ship_magic(ship_current_version, 0), .block_id = block_state->id, .payload_size = 0};
-      chain_state_log->pack_and_write_entry(header, block_state->header.previous, [this, fresh](auto&& buf) {
-         pack_deltas(buf, chain_plug->chain().db(), fresh);
+      chain_state_log->pack_and_write_entry(header, block_state->header.previous, [&](auto&& buf) {
+         pack_deltas(buf, chain.db(), shard_dbs, fresh, &chain.get_thread_pool());
       });
    } // store_chain_state
 
@@ -23,6 +23,7 @@ namespace eosio { namespace client { namespace http {
    const string get_info_func = chain_func_base + "/get_info";
    const string get_transaction_status_func = chain_func_base + "/get_transaction_status";
    const string get_consensus_parameters_func = chain_func_base + "/get_consensus_parameters";
+   const string get_suggested_shard_func = chain_func_base + "/get_suggested_shard";
    const string send_txn_func = chain_func_base + "/send_transaction";
    const string push_txn_func = chain_func_base + "/push_transaction";
    const string send2_txn_func = chain_func_base + "/send_transaction2";
@@ -178,6 +178,7 @@ bool   tx_use_old_rpc = false;
 bool   tx_use_old_send_rpc = false;
 string tx_json_save_file;
 name   tx_shard_name = config::main_shard_name;
+bool   tx_auto_shard = false;
 eosio::client::http::config_t http_config;
 bool   no_auto_keosd = false;
 bool   verbose = false;
@@ -294,7 +295,9 @@ void add_standard_transaction_options_plus_signing(CLI::App* cmd, string default
 
 
 void add_transaction_shard_options(CLI::App* cmd) {
-   cmd->add_option("--shard", tx_shard_name, localized("Set the shard name of the transaction, defaults to \"main\""));
+   auto shard_opt = cmd->add_option("--shard", tx_shard_name, localized("Set the shard name of the transaction, defaults to \"main\""));
+   cmd->add_flag("--auto-shard", tx_auto_shard, localized("Send the transaction to the shard suggested by the node, the shard holding the tables of most of its contracts"))
+      ->excludes(shard_opt);
 }
 
 vector<chain::permission_level> get_account_permissions(const vector<string>& permissions) {
@@ -422,6 +425,14 @@ fc::variant push_transaction( signed_transaction& trx, const std::vector<public_
    if (trx.signatures.size() == 0) { // #5445 can't change txn content if already signed
       trx.expiration = info.head_block_time + tx_expiration;
 
+      if (tx_auto_shard) {
+         fc::variants accounts;
+         for (const auto& act : trx.actions) {
+            accounts.emplace_back(act.account);
+         }
+         const auto& suggestion = call(get_suggested_shard_func, fc::mutable_variant_object("accounts", accounts));
+         tx_shard_name = suggestion["shard"].as<name>();
+      }
       EOSC_ASSERT( !tx_shard_name.empty(), "ERROR: --shard can not be empty" );
       trx.shard_name = tx_shard_name;
 
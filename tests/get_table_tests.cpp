@@ -673,4 +673,167 @@ BOOST_FIXTURE_TEST_CASE( get_table_next_key_test, TESTER ) try {
 
 } FC_LOG_AND_RETHROW() /// get_table_next_key_test
 
+BOOST_FIXTURE_TEST_CASE( get_table_shards_test, sharding_validating_tester ) try {
+   create_accounts({ "gax.token"_n, "alice"_n });
+   set_code( "gax.token"_n, test_contracts::eosio_token_wasm() );
+   set_abi( "gax.token"_n, test_contracts::eosio_token_abi().data() );
+   produce_block();
+
+   auto push_on_shard = [&]( name shard, action_name act, const variant_object& data ) {
+      signed_transaction trx;
+      trx.set_shard_name( shard );
+      trx.actions.emplace_back( get_action( "gax.token"_n, act, vector<permission_level>{{"gax.token"_n, config::active_name}}, data ) );
+      set_transaction_headers( trx );
+      trx.sign( get_private_key( "gax.token"_n, "active" ), control->get_chain_id() );
+      return push_transaction( trx );
+   };
+
+   // alice holds one balance per shard: CCC on main, AAA on shard1 and BBB on shard2
+   for( auto [shard, sym] : std::vector<std::pair<name, string>>{{config::main_shard_name, "CCC"}, {"shard1"_n, "AAA"}, {"shard2"_n, "BBB"}} ) {
+      push_on_shard( shard, "create"_n, mutable_variant_object()
+                     ("issuer", "gax.token")
+                     ("maximum_supply", asset::from_string("1000000000.0000 " + sym)) );
+      push_on_shard( shard, "issue"_n, mutable_variant_object()
+                     ("to", "gax.token")
+                     ("quantity", asset::from_string("100.0000 " + sym))
+                     ("memo", "") );
+      push_on_shard( shard, "transfer"_n, mutable_variant_object()
+                     ("from", "gax.token")
+                     ("to", "alice")
+                     ("quantity", asset::from_string("10.0000 " + sym))
+                     ("memo", "") );
+      produce_block();
+   }
+
+   named_thread_pool<struct get_table_shards> thread_pool;
+   thread_pool.start( 2, {} );
+   eosio::chain_apis::read_only plugin(*(this->control), {}, fc::microseconds::maximum(), fc::microseconds::maximum(), {}, {}, &thread_pool.get_executor());
+
+   auto balance = []( const fc::variant& row ) { return row.get_object()["data"].get_object()["balance"].as_string(); };
+
+   eosio::chain_apis::read_only::get_table_rows_params p;
+   p.code = "gax.token"_n;
+   p.scope = "alice";
+   p.table = "accounts"_n;
+   p.json = true;
+
+   // a single shard
+   p.shard = "shard1"_n;
+   auto result = plugin.get_table_rows(p, fc::time_point::maximum());
+   BOOST_REQUIRE_EQUAL(1u, result.rows.size());
+   BOOST_REQUIRE_EQUAL("10.0000 AAA", result.rows[0].get_object()["balance"].as_string());
+
+   p.shard = "shard3"_n;
+   BOOST_CHECK_THROW(plugin.get_table_rows(p, fc::time_point::maximum()), contract_table_query_exception);
+
+   // fan-out merges the shards in name order
+   p.shards = { "shard2"_n, "shard1"_n, config::main_shard_name };
+   result = plugin.get_table_rows(p, fc::time_point::maximum());
+   BOOST_REQUIRE_EQUAL(3u, result.rows.size());
+   BOOST_REQUIRE_EQUAL(false, result.more);
+   BOOST_REQUIRE_EQUAL("main", result.rows[0].get_object()["shard"].as_string());
+   BOOST_REQUIRE_EQUAL("10.0000 CCC", balance(result.rows[0]));
+   BOOST_REQUIRE_EQUAL("shard1", result.rows[1].get_object()["shard"].as_string());
+   BOOST_REQUIRE_EQUAL("10.0000 AAA", balance(result.rows[1]));
+   BOOST_REQUIRE_EQUAL("shard2", result.rows[2].get_object()["shard"].as_string());
+   BOOST_REQUIRE_EQUAL("10.0000 BBB", balance(result.rows[2]));
+
+   // paging continues with the shard qualified next_key
+   p.limit = 2;
+   result = plugin.get_table_rows(p, fc::time_point::maximum());
+   BOOST_REQUIRE_EQUAL(2u, result.rows.size());
+   BOOST_REQUIRE_EQUAL(true, result.more);
+   BOOST_REQUIRE_EQUAL("shard2:", result.next_key);
+
+   p.lower_bound = result.next_key;
+   result = plugin.get_table_rows(p, fc::time_point::maximum());
+   BOOST_REQUIRE_EQUAL(1u, result.rows.size());
+   BOOST_REQUIRE_EQUAL(false, result.more);
+   BOOST_REQUIRE_EQUAL("10.0000 BBB", balance(result.rows[0]));
+
+   p.lower_bound = "";
+   p.reverse = true;
+   p.show_payer = true;
+   result = plugin.get_table_rows(p, fc::time_point::maximum());
+   BOOST_REQUIRE_EQUAL(2u, result.rows.size());
+   BOOST_REQUIRE_EQUAL("shard2", result.rows[0].get_object()["shard"].as_string());
+   BOOST_REQUIRE_EQUAL("gax.token", result.rows[0].get_object()["payer"].as_string());
+   BOOST_REQUIRE_EQUAL("shard1", result.rows[1].get_object()["shard"].as_string());
+   BOOST_REQUIRE_EQUAL("main:", result.next_key);
+
+   // a walk from a plain lower_bound keeps that bound on every shard after the one a page stopped in,
+   // alice also holds AAA on main, DDD on shard1 and EEE on shard2
+   for( auto [shard, sym] : std::vector<std::pair<name, string>>{{config::main_shard_name, "AAA"}, {"shard1"_n, "DDD"}, {"shard2"_n, "EEE"}} ) {
+      push_on_shard( shard, "create"_n, mutable_variant_object()
+                     ("issuer", "gax.token")
+                     ("maximum_supply", asset::from_string("1000000000.0000 " + sym)) );
+      push_on_shard( shard, "issue"_n, mutable_variant_object()
+                     ("to", "gax.token")
+                     ("quantity", asset::from_string("20.0000 " + sym))
+                     ("memo", "") );
+      push_on_shard( shard, "transfer"_n, mutable_variant_object()
+                     ("from", "gax.token")
+                     ("to", "alice")
+                     ("quantity", asset::from_string("20.0000 " + sym))
+                     ("memo", "") );
+      produce_block();
+   }
+
+   p.reverse = false;
+   p.show_payer = false;
+   p.limit = 1;
+   p.lower_bound = std::to_string( symbol( 4, "CCC" ).to_symbol_code().value ); // AAA and BBB are below the bound
+   vector<string> walked;
+   vector<string> cursors;
+   do {
+      result = plugin.get_table_rows(p, fc::time_point::maximum());
+      BOOST_REQUIRE( result.rows.size() <= 1u );
+      for( const auto& row : result.rows )
+         walked.push_back( row.get_object()["shard"].as_string() + " " + balance(row) );
+      if( result.more )
+         cursors.push_back( result.next_key );
+      p.lower_bound = result.next_key;
+   } while( result.more && walked.size() < 10 );
+   BOOST_REQUIRE_EQUAL(3u, walked.size());
+   BOOST_REQUIRE_EQUAL("main 10.0000 CCC", walked[0]);
+   BOOST_REQUIRE_EQUAL("shard1 20.0000 DDD", walked[1]);
+   BOOST_REQUIRE_EQUAL("shard2 20.0000 EEE", walked[2]);
+   const auto base = std::to_string( symbol( 4, "CCC" ).to_symbol_code().value );
+   BOOST_REQUIRE_EQUAL(2u, cursors.size());
+   BOOST_REQUIRE_EQUAL("shard1:" + base + ":" + base, cursors[0]);
+   BOOST_REQUIRE_EQUAL("shard2:" + base + ":" + base, cursors[1]);
+
+   // the same walk two rows at a time fills the first page at the end of shard1 and continues on shard2
+   p.limit = 2;
+   p.lower_bound = base;
+   result = plugin.get_table_rows(p, fc::time_point::maximum());
+   BOOST_REQUIRE_EQUAL(2u, result.rows.size());
+   BOOST_REQUIRE_EQUAL(true, result.more);
+   BOOST_REQUIRE_EQUAL("shard2:" + base + ":" + base, result.next_key);
+   p.lower_bound = result.next_key;
+   result = plugin.get_table_rows(p, fc::time_point::maximum());
+   BOOST_REQUIRE_EQUAL(1u, result.rows.size());
+   BOOST_REQUIRE_EQUAL(false, result.more);
+   BOOST_REQUIRE_EQUAL("20.0000 EEE", balance(result.rows[0]));
+
+   // scopes of every shard in one call
+   eosio::chain_apis::read_only::get_table_by_scope_params param{"gax.token"_n, "accounts"_n, "", "", 10};
+   param.shards = { "shard1"_n, "shard2"_n };
+   auto scopes = plugin.get_table_by_scope(param, fc::time_point::maximum());
+   BOOST_REQUIRE_EQUAL(4u, scopes.rows.size());
+   BOOST_REQUIRE_EQUAL("", scopes.more);
+   BOOST_REQUIRE_EQUAL(name("shard1"_n), scopes.rows[0].shard);
+   BOOST_REQUIRE_EQUAL(name("alice"_n), scopes.rows[0].scope);
+   BOOST_REQUIRE_EQUAL(name("shard1"_n), scopes.rows[1].shard);
+   BOOST_REQUIRE_EQUAL(name("gax.token"_n), scopes.rows[1].scope);
+   BOOST_REQUIRE_EQUAL(name("shard2"_n), scopes.rows[2].shard);
+
+   param.limit = 1;
+   scopes = plugin.get_table_by_scope(param, fc::time_point::maximum());
+   BOOST_REQUIRE_EQUAL(1u, scopes.rows.size());
+   BOOST_REQUIRE_EQUAL("shard1:gax.token", scopes.more);
+
+   thread_pool.stop();
+} FC_LOG_AND_RETHROW() /// get_table_shards_test
+
 BOOST_AUTO_TEST_SUITE_END()
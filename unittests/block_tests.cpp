@@ -128,6 +128,32 @@ std::pair<signed_block_ptr, signed_block_ptr> corrupt_trx_in_block(validating_te
    return std::pair<signed_block_ptr, signed_block_ptr>(b, copy_b);
 }
 
+BOOST_AUTO_TEST_CASE(shard_merkle_test)
+{
+   // shard roots appended incrementally match the roots computed from all digests at once
+   deque<digest_type> digests;
+   incremental_merkle inc;
+   for( uint32_t i = 0; i < 33; ++i ) {
+      digests.emplace_back( digest_type::hash( i ) );
+      inc.append( digests.back() );
+      BOOST_REQUIRE_EQUAL( inc.get_root(), merkle( digests ) );
+   }
+
+   // the block root is the merkle of the shard roots, a single shard keeps its own root
+   flat_map<shard_name, digest_type> shard_roots;
+   shard_roots[config::main_shard_name] = merkle( digests );
+   BOOST_REQUIRE_EQUAL( merkle( shard_roots ), merkle( digests ) );
+   shard_roots["shard1"_n] = digest_type::hash( 1 );
+   BOOST_REQUIRE_EQUAL( merkle( shard_roots ), merkle( deque<digest_type>{ shard_roots.begin()->second, shard_roots.rbegin()->second } ) );
+
+   // blocks with transactions of a single shard do not carry per-shard roots
+   tester main;
+   main.create_account("newacc"_n);
+   auto b = main.produce_block();
+   BOOST_REQUIRE_EQUAL( b->transactions.size(), 1u );
+   BOOST_REQUIRE_EQUAL( b->validate_and_extract_header_extensions().count( shard_transaction_mroots_extension::extension_id() ), 0u );
+}
+
 // verify that a block with a transaction with an incorrect signature, is blindly accepted from a trusted producer
 BOOST_AUTO_TEST_CASE(trusted_producer_test)
 {
@@ -1,9 +1,16 @@
 #include <eosio/chain/global_property_object.hpp>
 #include <eosio/chain/database_header_object.hpp>
 #include <eosio/chain/database_manager.hpp>
+#include <eosio/chain/shard_object.hpp>
+#include <eosio/chain/thread_utils.hpp>
+#include <eosio/chain/transaction_object.hpp>
 #include <eosio/testing/tester.hpp>
+#include <eosio/testing/database_manager_fixture.hpp>
 
 #include <fc/crypto/digest.hpp>
+#include <fc/io/fstream.hpp>
+
+#include <fstream>
 
 #include <boost/test/unit_test.hpp>
 
@@ -415,4 +422,323 @@ BOOST_AUTO_TEST_SUITE(database_tests)
       } FC_CAPTURE_AND_RETHROW()
    }
 
+   // sub-shard dbs only get undo state in the blocks that write to them
+   BOOST_AUTO_TEST_CASE(lazy_shard_undo_session_test) {
+      try {
+         database_manager_fixture<1024*1024> fixture;
+         auto& dbm = *fixture._dbm;
+         dbm.add_index<shard_index>();
+         auto& shard1 = *dbm.add_shard_db( "shard1"_n, 1024*1024 );
+         auto& shard2 = *dbm.add_shard_db( "shard2"_n, 1024*1024 );
+         shard1.add_index<shard_index>();
+         shard2.add_index<shard_index>();
+
+         auto write_block = [&]( name shard, name n ) {
+            auto& db = dbm.shard_db( shard );
+            auto session = dbm.start_undo_session( true );
+            dbm.start_shard_undo_session( shard );
+            dbm.start_shard_undo_session( shard ); // opened once per block
+            db.create<shard_object>( [&]( auto& s ) { s.name = n; } );
+            session.push();
+         };
+         auto empty_block = [&]() {
+            dbm.start_undo_session( true ).push();
+         };
+         auto exists = []( const chainbase::database& db, name n ) {
+            return db.find<shard_object, by_name>( n ) != nullptr;
+         };
+
+         write_block( "shard1"_n, "a"_n );
+         write_block( "shard2"_n, "b"_n );
+         empty_block();
+         write_block( "shard1"_n, "c"_n );
+         BOOST_REQUIRE_EQUAL( dbm.revision(), 4 );
+         BOOST_REQUIRE_EQUAL( shard1.revision(), 4 );
+         BOOST_REQUIRE_EQUAL( shard2.revision(), 2 ); // untouched by blocks 3 and 4
+
+         dbm.undo();
+         BOOST_TEST( !exists( shard1, "c"_n ) );
+         BOOST_TEST( exists( shard1, "a"_n ) );
+         BOOST_TEST( exists( shard2, "b"_n ) );
+         BOOST_REQUIRE_EQUAL( shard1.revision(), 3 );
+         dbm.undo();
+         BOOST_TEST( exists( shard2, "b"_n ) );
+         dbm.undo();
+         BOOST_TEST( !exists( shard2, "b"_n ) );
+         BOOST_TEST( exists( shard1, "a"_n ) );
+         dbm.undo();
+         BOOST_TEST( !exists( shard1, "a"_n ) );
+         BOOST_REQUIRE_EQUAL( dbm.revision(), 0 );
+
+         // an aborted block only undoes the dbs it wrote to
+         write_block( "shard1"_n, "a"_n );
+         {
+            auto session = dbm.start_undo_session( true );
+            dbm.start_shard_undo_session( "shard2"_n );
+            shard2.create<shard_object>( [&]( auto& s ) { s.name = "b"_n; } );
+         }
+         BOOST_TEST( !exists( shard2, "b"_n ) );
+         BOOST_TEST( exists( shard1, "a"_n ) );
+         BOOST_REQUIRE_EQUAL( dbm.revision(), 1 );
+
+         // after commit an untouched db is moved up to the block revision without undo levels
+         write_block( "shard2"_n, "b"_n );
+         dbm.commit( dbm.revision() );
+         empty_block();
+         empty_block();
+         write_block( "shard1"_n, "c"_n );
+         BOOST_REQUIRE_EQUAL( shard1.revision(), dbm.revision() );
+         dbm.undo();
+         BOOST_TEST( !exists( shard1, "c"_n ) );
+         BOOST_TEST( exists( shard1, "a"_n ) );
+         BOOST_TEST( exists( shard2, "b"_n ) );
+      } FC_LOG_AND_RETHROW()
+   }
+
+   // only sub-shards with an expired transaction in their dedup list are returned for expiry
+   BOOST_AUTO_TEST_CASE(shards_with_expired_transactions_test) {
+      try {
+         database_manager_fixture<1024*1024> fixture;
+         auto& dbm = *fixture._dbm;
+         dbm.add_index<shard_index>();
+         for( auto shard : { "shard1"_n, "shard2"_n, "shard3"_n } ) {
+            auto* db = dbm.add_shard_db( shard, 1024*1024 );
+            db->add_index<shard_index>();
+            db->add_index<transaction_multi_index>();
+         }
+
+         const fc::time_point_sec start( 1000 );
+         uint64_t next_id = 0;
+         auto record = [&]( name shard, uint32_t expires_in ) {
+            dbm.shard_db( shard ).create<transaction_object>( [&]( auto& t ) {
+               t.trx_id = fc::sha256::hash( std::to_string( ++next_id ) );
+               t.expiration = start + expires_in;
+            } );
+         };
+         auto remove_expired = [&]( name shard, const fc::time_point& now ) {
+            auto& db = dbm.shard_db( shard );
+            const auto& idx = db.get_index<transaction_multi_index, by_expiration>();
+            dbm.start_shard_undo_session( shard );
+            while( !idx.empty() && now > fc::time_point( idx.begin()->expiration ) )
+               db.remove( *idx.begin() );
+         };
+         auto expired_at = [&]( uint32_t secs ) {
+            return dbm.shards_with_expired_transactions( fc::time_point( start + secs ) );
+         };
+         using shards = std::vector<shard_name>;
+
+         BOOST_TEST( expired_at( 100 ).empty() );
+         {
+            auto session = dbm.start_undo_session( true );
+            dbm.start_shard_undo_session( "shard1"_n );
+            record( "shard1"_n, 10 );
+            dbm.start_shard_undo_session( "shard2"_n );
+            record( "shard2"_n, 20 );
+            record( "shard2"_n, 5 );
+            session.push();
+         }
+         BOOST_TEST( expired_at( 5 ).empty() );
+         BOOST_TEST(( expired_at( 6 ) == shards{ "shard2"_n } ));
+         BOOST_TEST(( expired_at( 15 ) == shards{ "shard2"_n, "shard1"_n } ));
+
+         // the shards emptied by a block are dropped, the rest of shard2 expires later
+         {
+            auto session = dbm.start_undo_session( true );
+            remove_expired( "shard1"_n, fc::time_point( start + 15 ) );
+            remove_expired( "shard2"_n, fc::time_point( start + 15 ) );
+            session.push();
+         }
+         BOOST_TEST( expired_at( 15 ).empty() );
+         BOOST_TEST(( expired_at( 25 ) == shards{ "shard2"_n } ));
+
+         // an aborted block and an undone block restore what they removed
+         {
+            auto session = dbm.start_undo_session( true );
+            remove_expired( "shard2"_n, fc::time_point( start + 25 ) );
+            BOOST_TEST( expired_at( 25 ).empty() );
+         }
+         BOOST_TEST(( expired_at( 25 ) == shards{ "shard2"_n } ));
+         dbm.undo();
+         BOOST_TEST(( expired_at( 15 ) == shards{ "shard2"_n, "shard1"_n } ));
+      } FC_LOG_AND_RETHROW()
+   }
+
+   BOOST_AUTO_TEST_CASE(parallel_commit_test) {
+      try {
+         database_manager_fixture<1024*1024> fixture;
+         auto& dbm = *fixture._dbm;
+         named_thread_pool<struct commit_test> thread_pool;
+         thread_pool.start( 2, {} );
+         dbm.set_thread_pool( &thread_pool.get_executor() );
+         dbm.enable_saving_catalog();
+         dbm.add_index<shard_index>();
+
+         std::vector<name> shard_names{ "shard1"_n, "shard2"_n, "shard3"_n };
+         for( const auto& n : shard_names ) {
+            dbm.add_shard_db( n, 1024*1024 )->add_index<shard_index>();
+            dbm.shared_db().create<shard_object>( [&]( auto& s ) { s.name = n; } );
+         }
+
+         auto session = dbm.start_undo_session( true );
+         for( const auto& n : shard_names ) {
+            auto& db = dbm.shard_db( n );
+            dbm.start_shard_undo_session( n );
+            db.create<shard_object>( [&]( auto& s ) { s.name = n; } );
+         }
+         session.push();
+         dbm.commit( dbm.revision() );
+
+         for( const auto& n : shard_names ) {
+            BOOST_TEST( dbm.shard_db( n ).find<shard_object, by_name>( n ) != nullptr );
+            BOOST_TEST( dbm.db_timings().count( n ) == 1u );
+         }
+         BOOST_TEST( dbm.db_timings().count( config::main_shard_name ) == 1u );
+         BOOST_TEST( dbm.db_timings().count( config::share_db_name ) == 1u );
+
+         // the catalog is written at commit, not only when the database_manager is destroyed
+         auto catalog = shard_db_catalog::load( dbm.dir );
+         BOOST_REQUIRE_EQUAL( catalog.shards.size(), shard_names.size() );
+         for( size_t i = 0; i < shard_names.size(); ++i ) {
+            const auto& info = catalog.shards[i];
+            const auto& db = dbm.shard_db( shard_names[i] );
+            BOOST_TEST( info.name == shard_names[i] );
+            BOOST_TEST( info.revision == db.revision() );
+            BOOST_TEST( info.size == db.get_segment_manager()->get_size() );
+            BOOST_TEST( info.row_count_digest == shard_db_info::calc_row_count_digest( db ) );
+         }
+
+         dbm.flush();
+         dbm.set_thread_pool( nullptr );
+      } FC_LOG_AND_RETHROW()
+   }
+
+   // a prepared shard db is opened and initialized on the pool, adding it only links it in
+   BOOST_AUTO_TEST_CASE(prepare_shard_db_test) {
+      try {
+         database_manager_fixture<1024*1024> fixture;
+         auto& dbm = *fixture._dbm;
+         auto init = []( chainbase::database& db ) { db.add_index<shard_index>(); };
+
+         // without a thread pool the db is opened by add_shard_db
+         dbm.prepare_shard_db( "shard1"_n, 1024*1024, init );
+         BOOST_TEST( !dbm.is_preparing_shard_db( "shard1"_n ) );
+
+         named_thread_pool<struct prepare_test> thread_pool;
+         thread_pool.start( 1, {} );
+         dbm.set_thread_pool( &thread_pool.get_executor() );
+
+         std::atomic<int> inits = 0;
+         auto counted_init = [&]( chainbase::database& db ) { ++inits; init( db ); };
+         dbm.prepare_shard_db( "shard1"_n, 1024*1024, counted_init );
+         dbm.prepare_shard_db( "shard1"_n, 1024*1024, counted_init ); // already being prepared
+         BOOST_TEST( dbm.is_preparing_shard_db( "shard1"_n ) );
+         BOOST_TEST( dbm.find_shard_db( "shard1"_n ) == nullptr );
+
+         auto* db = dbm.add_shard_db( "shard1"_n, 1024*1024, counted_init );
+         BOOST_REQUIRE( db != nullptr );
+         BOOST_TEST( !dbm.is_preparing_shard_db( "shard1"_n ) );
+         BOOST_TEST( inits == 1 );
+         db->create<shard_object>( [&]( auto& s ) { s.name = "shard1"_n; } );
+         BOOST_TEST( dbm.find_shard_db( "shard1"_n ) == db );
+
+         // an existing shard db is not prepared again
+         dbm.prepare_shard_db( "shard1"_n, 1024*1024, counted_init );
+         BOOST_TEST( !dbm.is_preparing_shard_db( "shard1"_n ) );
+
+         // a db prepared for a registration undone by a fork switch is dropped with its mapping
+         dbm.prepare_shard_db( "shard3"_n, 1024*1024, counted_init );
+         dbm.prepare_shard_db( "shard4"_n, 1024*1024, counted_init );
+         dbm.drop_prepared_shard_dbs( []( const name& n ) { return n == "shard4"_n; } );
+         BOOST_TEST( !dbm.is_preparing_shard_db( "shard3"_n ) );
+         BOOST_TEST( dbm.is_preparing_shard_db( "shard4"_n ) );
+         BOOST_TEST( dbm.find_shard_db( "shard3"_n ) == nullptr );
+         // registered again, it is prepared again
+         dbm.prepare_shard_db( "shard3"_n, 1024*1024, counted_init );
+         BOOST_TEST( dbm.is_preparing_shard_db( "shard3"_n ) );
+         dbm.drop_prepared_shard_dbs( []( const name& ) { return false; } );
+         BOOST_TEST( !dbm.is_preparing_shard_db( "shard3"_n ) );
+         BOOST_TEST( !dbm.is_preparing_shard_db( "shard4"_n ) );
+         BOOST_TEST( inits == 4 );
+
+         // pending preparations are finished before the pool goes away
+         dbm.prepare_shard_db( "shard2"_n, 1024*1024, counted_init );
+         dbm.set_thread_pool( nullptr );
+         thread_pool.stop();
+         BOOST_REQUIRE( dbm.add_shard_db( "shard2"_n, 1024*1024, counted_init ) != nullptr );
+         BOOST_TEST( inits == 5 );
+      } FC_LOG_AND_RETHROW()
+   }
+
+   BOOST_AUTO_TEST_CASE(shard_db_catalog_validation_test) {
+      try {
+         database_manager_fixture<1024*1024> fixture;
+         auto& dbm = *fixture._dbm;
+         dbm.enable_saving_catalog();
+         dbm.add_index<shard_index>();
+
+         auto& db = *dbm.add_shard_db( "shard1"_n, 1024*1024 );
+         db.add_index<shard_index>();
+         dbm.shared_db().create<shard_object>( [&]( auto& s ) { s.name = "shard1"_n; } );
+         dbm.commit( dbm.revision() );
+
+         auto catalog = shard_db_catalog::load( dbm.dir );
+         BOOST_REQUIRE_EQUAL( catalog.shards.size(), 1u );
+         const auto info = catalog.shards.front();
+         shard_db_catalog::validate( info, db, false );
+
+         // a db which does not match its entry is rejected, unless dirty databases are allowed
+         db.create<shard_object>( [&]( auto& s ) { s.name = "shard1"_n; } );
+         BOOST_CHECK_THROW( shard_db_catalog::validate( info, db, false ), shard_db_catalog_exception );
+         shard_db_catalog::validate( info, db, true );
+         db.set_revision( db.revision() + 1 );
+         BOOST_CHECK_THROW( shard_db_catalog::validate( info, db, false ), shard_db_catalog_exception );
+
+         // entries of a version 1 catalog, without a row count digest, are not checked
+         shard_db_catalog::validate( shard_db_info{ "shard1"_n }, db, false );
+
+         // a corrupted catalog fails its checksum
+         const auto catalog_dat = dbm.dir / config::shard_db_catalog_filename;
+         std::string content;
+         fc::read_file_contents( catalog_dat, content );
+         content[9] ^= 0x1; // in the name of the first shard, after magic number, version and shard count
+         {
+            std::ofstream out( catalog_dat.generic_string(), std::ios::binary | std::ios::trunc );
+            out.write( content.data(), content.size() );
+         }
+         BOOST_CHECK_THROW( shard_db_catalog::load( dbm.dir ), shard_db_catalog_exception );
+      } FC_LOG_AND_RETHROW()
+   }
+
+   // a catalog which cannot be written leaves the previous one in place and is retried on the next commit
+   BOOST_AUTO_TEST_CASE(shard_db_catalog_save_failure_test) {
+      try {
+         database_manager_fixture<1024*1024> fixture;
+         auto& dbm = *fixture._dbm;
+         dbm.enable_saving_catalog();
+         dbm.add_index<shard_index>();
+
+         dbm.add_shard_db( "shard1"_n, 1024*1024 )->add_index<shard_index>();
+         dbm.commit( dbm.revision() );
+         BOOST_REQUIRE_EQUAL( shard_db_catalog::load( dbm.dir ).shards.size(), 1u );
+
+         // a directory in place of the temporary file makes the write fail
+         const auto catalog_tmp = dbm.dir / (std::string( config::shard_db_catalog_filename ) + ".tmp");
+         boost::filesystem::create_directory( catalog_tmp );
+         dbm.add_shard_db( "shard2"_n, 1024*1024 )->add_index<shard_index>();
+         BOOST_CHECK_THROW( shard_db_catalog::save( dbm ), shard_db_catalog_exception );
+         dbm.commit( dbm.revision() );
+         BOOST_TEST( shard_db_catalog::load( dbm.dir ).shards.size() == 1u );
+
+         boost::filesystem::remove( catalog_tmp );
+         dbm.commit( dbm.revision() );
+         BOOST_TEST( shard_db_catalog::load( dbm.dir ).shards.size() == 2u );
+
+         // nor does the destructor throw when the catalog cannot be written
+         boost::filesystem::create_directory( catalog_tmp );
+         const auto dir = dbm.dir;
+         BOOST_CHECK_NO_THROW( fixture._dbm.reset() );
+         BOOST_TEST( shard_db_catalog::load( dir ).shards.size() == 2u );
+      } FC_LOG_AND_RETHROW()
+   }
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -31,7 +31,12 @@ public:
    : eosio_system_tester([](TESTER& ) {}){}
 
    template<typename Lambda>
-   eosio_system_tester(Lambda setup) {
+   eosio_system_tester(Lambda setup)
+   : eosio_system_tester(setup_policy::full, setup){}
+
+   template<typename Lambda>
+   eosio_system_tester(setup_policy policy, Lambda setup)
+   : TESTER(policy) {
       setup(*this);
 
       produce_blocks( 2 );
@@ -0,0 +1,84 @@
+#ifdef EOSIO_EOS_VM_OC_RUNTIME_ENABLED
+
+#include <eosio/chain/webassembly/eos-vm-oc/code_cache.hpp>
+#include <eosio/testing/tester.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <test_contracts.hpp>
+
+#include <thread>
+
+using namespace eosio;
+using namespace eosio::chain;
+using namespace eosio::testing;
+
+BOOST_AUTO_TEST_SUITE(eosvmoc_compile_tests)
+
+// the code executed most often while it waited for a compile thread is compiled first, the earlier queued among equals
+BOOST_AUTO_TEST_CASE(compile_queue_order_test) {
+   const eosvmoc::code_tuple a{ fc::sha256::hash(std::string("a")), 0 };
+   const eosvmoc::code_tuple b{ fc::sha256::hash(std::string("b")), 0 };
+   const eosvmoc::code_tuple c{ fc::sha256::hash(std::string("c")), 0 };
+   const eosvmoc::code_tuple d{ fc::sha256::hash(std::string("d")), 0 };
+
+   eosvmoc::compile_queue queue;
+   queue.push(a);
+   queue.push(b);
+   queue.push(c);
+   queue.push(d);
+   BOOST_CHECK_EQUAL(queue.size(), 4u);
+
+   BOOST_CHECK(queue.add_request(c));
+   BOOST_CHECK(queue.add_request(c));
+   BOOST_CHECK(queue.add_request(b));
+   BOOST_CHECK(queue.add_request(d));
+   BOOST_CHECK(!queue.add_request(eosvmoc::code_tuple{ fc::sha256::hash(std::string("e")), 0 }));
+   BOOST_CHECK_EQUAL(queue.size(), 4u);
+
+   BOOST_CHECK(queue.pop() == c);
+   queue.erase(b);
+   BOOST_CHECK(queue.pop() == d);
+   BOOST_CHECK(queue.pop() == a);
+   BOOST_CHECK(queue.empty());
+   BOOST_CHECK(!queue.add_request(b));
+}
+
+// the compile stats follow a tier-up compile from dispatch until its result is picked up
+BOOST_AUTO_TEST_CASE(compile_stats_test) { try {
+   fc::temp_directory tempdir;
+   tester chain( tempdir, []( controller::config& cfg ) {
+      cfg.wasm_runtime = wasm_interface::vm_type::eos_vm;
+      cfg.eosvmoc_tierup = true;
+      cfg.eosvmoc_config.threads = 1;
+   }, true );
+
+   auto stats = chain.control->get_wasm_interface().get_eosvmoc_compile_stats();
+   BOOST_REQUIRE(stats);
+
+   chain.create_account( "payloadless"_n );
+   chain.set_code( "payloadless"_n, test_contracts::payloadless_wasm() );
+   chain.set_abi( "payloadless"_n, test_contracts::payloadless_abi().data() );
+   chain.produce_block();
+
+   // results are picked up on the next execution in the write window, keep executing until every compile is done
+   const auto deadline = fc::time_point::now() + fc::seconds(30);
+   do {
+      chain.push_action( "payloadless"_n, "doit"_n, "payloadless"_n, mutable_variant_object() );
+      chain.produce_block();
+      stats = chain.control->get_wasm_interface().get_eosvmoc_compile_stats();
+      BOOST_REQUIRE(stats);
+      BOOST_CHECK_LE(stats->compiling, 1u); // eosvmoc_config.threads
+      if( stats->compiling == 0 && stats->queued == 0 && stats->last_compile_time > fc::microseconds() )
+         break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+   } while( fc::time_point::now() < deadline );
+
+   BOOST_CHECK_EQUAL(stats->queued, 0u);
+   BOOST_CHECK_EQUAL(stats->compiling, 0u);
+   BOOST_CHECK(stats->last_compile_time > fc::microseconds());
+} FC_LOG_AND_RETHROW() }
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif
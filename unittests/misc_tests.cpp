@@ -2,6 +2,7 @@
 #include <eosio/chain/authority.hpp>
 #include <eosio/chain/authority_checker.hpp>
 #include <eosio/chain/types.hpp>
+#include <eosio/chain/iterator_cache.hpp>
 #include <eosio/chain/thread_utils.hpp>
 #include <eosio/testing/tester.hpp>
 
@@ -10,8 +11,14 @@
 #include <appbase/application.hpp>
 #include <fc/bitutil.hpp>
 
+#include <set>
 #include <thread>
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include <boost/test/unit_test.hpp>
 
 #ifdef NON_VALIDATING_TEST
@@ -1251,6 +1258,108 @@ BOOST_AUTO_TEST_CASE(named_thread_pool_test) {
    }
 }
 
+BOOST_AUTO_TEST_CASE(thread_affinity_test) {
+   BOOST_TEST( resolve_thread_pool_size( 3 ) == 3u );
+   BOOST_TEST( resolve_thread_pool_size( 0 ) >= 1u );
+
+   thread_affinity none( thread_affinity_mode::none );
+   BOOST_TEST( none.cpus().empty() );
+
+   for( auto mode : { thread_affinity_mode::core, thread_affinity_mode::numa } ) {
+      thread_affinity affinity( mode );
+      // cpus each pool thread is allowed to run on once its init function pinned it
+      std::mutex mtx;
+      std::vector<std::set<uint32_t>> pinned;
+      auto pin = [&]() {
+         affinity.pin_current_thread();
+#if defined(__linux__)
+         cpu_set_t set;
+         CPU_ZERO( &set );
+         std::set<uint32_t> cpus; // left empty if the affinity cannot be read, checked on the test thread
+         if( pthread_getaffinity_np( pthread_self(), sizeof(set), &set ) == 0 ) {
+            for( uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu ) {
+               if( CPU_ISSET( cpu, &set ) )
+                  cpus.insert( cpu );
+            }
+         }
+         std::lock_guard g( mtx );
+         pinned.push_back( std::move( cpus ) );
+#endif
+      };
+      // more threads than cpus wrap around
+      named_thread_pool<struct misc> thread_pool;
+      thread_pool.start( affinity.cpus().size() + 2, {}, pin );
+
+      std::promise<void> p;
+      auto f = p.get_future();
+      boost::asio::post( thread_pool.get_executor(), [&p](){
+         p.set_value();
+      });
+      BOOST_TEST( (f.wait_for( 100ms ) == std::future_status::ready) );
+
+#if defined(__linux__)
+      // every thread is pinned to a single cpu available to the process and every such cpu gets a thread
+      BOOST_TEST( pinned.size() == affinity.cpus().size() + 2 );
+      std::set<uint32_t> used;
+      for( const auto& cpus : pinned ) {
+         BOOST_TEST_REQUIRE( cpus.size() == 1u );
+         BOOST_TEST( std::count( affinity.cpus().begin(), affinity.cpus().end(), *cpus.begin() ) == 1 );
+         used.insert( *cpus.begin() );
+      }
+      BOOST_TEST( used.size() == affinity.cpus().size() );
+#endif
+   }
+}
+
+BOOST_AUTO_TEST_CASE(iterator_cache_test) {
+   struct test_table {
+      struct id_type { int64_t _id; };
+      id_type id;
+   };
+   struct test_row { uint64_t primary_key = 0; };
+
+   std::vector<test_table> tables( 3 );
+   for( size_t i = 0; i < tables.size(); ++i )
+      tables[i].id._id = i;
+   // enough rows to grow the object map several times
+   std::vector<test_row> rows( 1000 );
+
+   iterator_cache<test_row, test_table> cache;
+   BOOST_TEST( cache.cache_table( tables[0] ) == -2 );
+   BOOST_TEST( cache.cache_table( tables[1] ) == -3 );
+   BOOST_TEST( cache.cache_table( tables[0] ) == -2 );
+   BOOST_TEST( cache.get_end_iterator_by_table_id( tables[1].id ) == -3 );
+   BOOST_TEST( &cache.get_table( tables[1].id ) == &tables[1] );
+   BOOST_TEST( cache.find_table_by_end_iterator( -3 ) == &tables[1] );
+   BOOST_TEST( cache.find_table_by_end_iterator( -4 ) == nullptr );
+   BOOST_CHECK_THROW( cache.get_table( tables[2].id ), table_not_in_cache );
+
+   for( size_t i = 0; i < rows.size(); ++i )
+      BOOST_TEST( cache.add( rows[i] ) == int(i) );
+   for( size_t i = 0; i < rows.size(); ++i ) {
+      BOOST_TEST( cache.add( rows[i] ) == int(i) );
+      BOOST_TEST( &cache.get( i ) == &rows[i] );
+   }
+   BOOST_CHECK_THROW( cache.get( -1 ), invalid_table_iterator );
+   BOOST_CHECK_THROW( cache.get( -2 ), table_operation_not_permitted );
+   BOOST_CHECK_THROW( cache.get( int(rows.size()) ), invalid_table_iterator );
+
+   // a removed object gets a new iterator if its address comes back
+   cache.remove( 5 );
+   BOOST_CHECK_THROW( cache.get( 5 ), table_operation_not_permitted );
+   BOOST_TEST( cache.add( rows[5] ) == int(rows.size()) );
+   BOOST_TEST( &cache.get( int(rows.size()) ) == &rows[5] );
+
+   // iterators of the next action start over
+   cache.reset();
+   BOOST_CHECK_THROW( cache.get( 0 ), invalid_table_iterator );
+   BOOST_CHECK_THROW( cache.get_table( tables[0].id ), table_not_in_cache );
+   BOOST_TEST( cache.find_table_by_end_iterator( -2 ) == nullptr );
+   BOOST_TEST( cache.cache_table( tables[2] ) == -2 );
+   BOOST_TEST( cache.add( rows[7] ) == 0 );
+   BOOST_TEST( cache.add( rows[0] ) == 1 );
+}
+
 BOOST_AUTO_TEST_CASE(public_key_from_hash) {
    auto private_key_string = std::string("5KQwrPbwdL6PhXujxW37FSSQZ1JiwsST4cqQzDeyXtP79zkvFD3");
    auto expected_public_key = std::string("GAX6MRyAjQq8ud7hVNYcfnVPJqcVpscN5So8BhtHuGYqET5GDW5CV");
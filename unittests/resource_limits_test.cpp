@@ -3,6 +3,7 @@
 #include <eosio/chain/config.hpp>
 #include <eosio/chain/resource_limits.hpp>
 #include <eosio/chain/config.hpp>
+#include <eosio/chain/shard_object.hpp>
 #include <eosio/testing/chainbase_fixture.hpp>
 #include <eosio/testing/database_manager_fixture.hpp>
 
@@ -17,20 +18,33 @@ class resource_limits_fixture: private database_manager_fixture<1024*1024>, publ
    public:
       resource_limits_fixture()
       :database_manager_fixture()
-      ,resource_limits_manager(*database_manager_fixture::_dbm, [](bool) { return nullptr; })
+      ,resource_limits_manager(*database_manager_fixture::_dbm, [](bool) { return nullptr; }, [this]() { return shard_accounting; })
       {
          add_indices((*database_manager_fixture::_dbm).main_db());
+         (*database_manager_fixture::_dbm).main_db().add_index<shard_index>();
          initialize_database();
       }
 
       ~resource_limits_fixture() {}
 
+      bool shard_accounting = true; ///< stands in for the activation of SHARD_RESOURCE_ACCOUNTING
+
       chainbase::database::session start_session() {
          return database_manager_fixture::_dbm->main_db().start_undo_session(true);
       }
       
       chainbase::database& get_shard() const { return (*database_manager_fixture::_dbm).main_db();}
       chainbase::database& get_shared() const { return (*database_manager_fixture::_dbm).main_db();}
+
+      // registers a sub-shard, the main db doubles as its shared db
+      chainbase::database& add_sub_shard( const shard_name& name ) {
+         auto db_ptr = (*database_manager_fixture::_dbm).add_shard_db( name, 1024*1024 );
+         add_indices( *db_ptr );
+         get_shared().create<shard_object>( [&]( auto& s ) {
+            s.name = name;
+         });
+         return *db_ptr;
+      }
       
       void add_transaction_usage( const flat_set<account_name>& accounts, uint64_t cpu_usage, uint64_t net_usage, uint32_t ordinal,bool is_trx_transient = false ){
          chainbase::database&        db = get_shard();
@@ -280,6 +294,155 @@ BOOST_AUTO_TEST_SUITE(resource_limits_test)
 
    } FC_LOG_AND_RETHROW();
 
+   BOOST_FIXTURE_TEST_CASE(enforce_shard_block_limits, resource_limits_fixture) try {
+      const account_name account(1);
+      initialize_account(account, false);
+      set_account_limits(account, -1, -1, -1, false);
+      process_account_limit_updates();
+
+      chainbase::database& shard_db = add_sub_shard("shard1"_n);
+      chainbase::database& shared_db = get_shared();
+
+      const uint64_t increment = 1000;
+      const uint64_t expected_iterations = config::default_max_block_cpu_usage / increment;
+
+      // the main shard and the sub-shard each have a full block budget
+      for (uint64_t idx = 0; idx < expected_iterations; idx++) {
+         add_transaction_usage({account}, increment, 0, 0 );
+         resource_limits_manager::add_transaction_usage({account}, increment, 0, 0, shard_db, shared_db );
+      }
+
+      BOOST_REQUIRE_EQUAL(get_block_cpu_limit(get_shard(), shared_db), 0u);
+      BOOST_REQUIRE_EQUAL(get_block_cpu_limit(shard_db, shared_db), 0u);
+      BOOST_REQUIRE_EQUAL(get_block_cpu_usage(shard_db, shared_db), config::default_max_block_cpu_usage);
+      BOOST_REQUIRE_THROW(add_transaction_usage({account}, increment, 0, 0 ), block_resource_exhausted);
+      BOOST_REQUIRE_THROW(resource_limits_manager::add_transaction_usage({account}, increment, 0, 0, shard_db, shared_db ), block_resource_exhausted);
+
+      // the usage of all shards drives the elastic limits of the chain, the sub-shard has its own
+      const uint64_t virtual_cpu_limit = get_virtual_block_cpu_limit();
+      process_block_usage(1);
+      BOOST_REQUIRE_EQUAL(get_block_cpu_usage(shard_db, shared_db), 0u);
+      BOOST_REQUIRE_EQUAL(get_block_cpu_limit(shard_db, shared_db), config::default_max_block_cpu_usage);
+      BOOST_REQUIRE_EQUAL(get_virtual_block_cpu_limit(), virtual_cpu_limit * 1000 / 999);
+
+      // once there are more shards than the block-level cap allows for, the budget is split between them
+      const uint32_t num_shards = config::maximum_block_shard_usage_multiplier * 2;
+      for (uint32_t idx = 2; idx < num_shards; idx++) {
+         add_sub_shard(account_name(idx + 100));
+      }
+      BOOST_REQUIRE_EQUAL(get_block_cpu_limit(shard_db, shared_db), config::default_max_block_cpu_usage / 2);
+      BOOST_REQUIRE_EQUAL(get_total_block_cpu_limit(shared_db), config::default_max_block_cpu_usage * config::maximum_block_shard_usage_multiplier);
+   } FC_LOG_AND_RETHROW();
+
+   BOOST_FIXTURE_TEST_CASE(sub_shard_usage_stays_in_shard_db, resource_limits_fixture) try {
+      const account_name account(1);
+      initialize_account(account, false);
+      set_account_limits(account, -1, -1, -1, false);
+      process_account_limit_updates();
+
+      chainbase::database& shard_db = add_sub_shard("shard1"_n);
+      const chainbase::database& shared_db = get_shared();
+      const auto& state = shared_db.get<resource_limits_state_object>();
+
+      // billing a sub-shard only reads the shared db, its usage is kept in the shard db until the block is processed
+      resource_limits_manager::add_transaction_usage({account}, 1000, 100, 0, shard_db, shared_db );
+      BOOST_REQUIRE_EQUAL(state.pending_cpu_usage, 0u);
+      BOOST_REQUIRE_EQUAL(state.pending_net_usage, 0u);
+      BOOST_REQUIRE_EQUAL(get_block_cpu_usage(shard_db, shared_db), 1000u);
+
+      // the main shard is its own shared db
+      add_transaction_usage({account}, 500, 50, 0 );
+      BOOST_REQUIRE_EQUAL(state.pending_cpu_usage, 500u);
+      BOOST_REQUIRE_EQUAL(state.pending_net_usage, 50u);
+
+      process_block_usage(1);
+      BOOST_REQUIRE_EQUAL(state.average_block_cpu_usage.last_ordinal, 1u);
+      BOOST_REQUIRE_EQUAL(get_block_cpu_usage(shard_db, shared_db), 0u);
+   } FC_LOG_AND_RETHROW();
+
+   BOOST_FIXTURE_TEST_CASE(idle_shard_elastic_limits, resource_limits_fixture) try {
+      const account_name account(1);
+      initialize_account(account, false);
+      set_account_limits(account, -1, -1, -1, false);
+      process_account_limit_updates();
+
+      chainbase::database& shard_db = add_sub_shard("shard1"_n);
+      const chainbase::database& shared_db = get_shared();
+      const auto& state = shared_db.get<resource_limits_state_object>();
+
+      // the sub-shard only has usage in the first block, which is all the usage of the chain
+      resource_limits_manager::add_transaction_usage({account}, 1000, 100, 0, shard_db, shared_db );
+      process_block_usage(0);
+      const auto& shard_state = shard_db.get<resource_limits_shard_state_object>();
+
+      // while idle its average decays and its limits relax block by block, in step with the chain
+      const uint64_t desired_cpu_limit = config::default_max_block_cpu_usage * config::maximum_elastic_resource_multiplier;
+      const uint64_t desired_net_limit = config::default_max_block_net_usage * config::maximum_elastic_resource_multiplier;
+      uint32_t block_num = 1;
+      while( state.virtual_cpu_limit < desired_cpu_limit || state.virtual_net_limit < desired_net_limit ) {
+         BOOST_REQUIRE_LT(block_num, 20000u);
+         process_block_usage(block_num++);
+         BOOST_REQUIRE_EQUAL(shard_state.virtual_cpu_limit, state.virtual_cpu_limit);
+         BOOST_REQUIRE_EQUAL(shard_state.virtual_net_limit, state.virtual_net_limit);
+         BOOST_REQUIRE_EQUAL(shard_state.average_block_cpu_usage.average(), state.average_block_cpu_usage.average());
+      }
+
+      // once nothing is left to decay, the sub-shard is no longer written
+      while( shard_state.average_block_cpu_usage.value_ex != 0 || shard_state.average_block_net_usage.value_ex != 0 ) {
+         BOOST_REQUIRE_LT(block_num, 20000u);
+         process_block_usage(block_num++);
+      }
+      const uint32_t settled_ordinal = shard_state.average_block_cpu_usage.last_ordinal;
+      BOOST_REQUIRE_EQUAL(settled_ordinal, block_num - 1);
+      process_block_usage(block_num++);
+      BOOST_REQUIRE_EQUAL(shard_state.average_block_cpu_usage.last_ordinal, settled_ordinal);
+      BOOST_REQUIRE_EQUAL(shard_state.virtual_cpu_limit, desired_cpu_limit);
+      BOOST_REQUIRE_EQUAL(shard_state.virtual_net_limit, desired_net_limit);
+
+      // new usage makes it take part again
+      resource_limits_manager::add_transaction_usage({account}, 1000, 100, block_num, shard_db, shared_db );
+      process_block_usage(block_num);
+      BOOST_REQUIRE_EQUAL(shard_state.average_block_cpu_usage.last_ordinal, block_num);
+      BOOST_REQUIRE_EQUAL(get_block_cpu_usage(shard_db, shared_db), 0u);
+   } FC_LOG_AND_RETHROW();
+
+   BOOST_FIXTURE_TEST_CASE(shard_usage_before_activation, resource_limits_fixture) try {
+      shard_accounting = false;
+
+      const account_name account(1);
+      initialize_account(account, false);
+      set_account_limits(account, -1, -1, -1, false);
+      process_account_limit_updates();
+
+      chainbase::database& shard_db = add_sub_shard("shard1"_n);
+      const chainbase::database& shared_db = get_shared();
+      const auto& state = shared_db.get<resource_limits_state_object>();
+
+      // the chain-wide state is the only state, neither shard accumulates block usage or gets elastic limits of its own
+      const uint64_t increment = 1000;
+      const uint64_t iterations = config::default_max_block_cpu_usage / increment + 1;
+      for (uint64_t idx = 0; idx < iterations; idx++) {
+         add_transaction_usage({account}, increment, 0, 0 );
+         resource_limits_manager::add_transaction_usage({account}, increment, 0, 0, shard_db, shared_db );
+      }
+      BOOST_REQUIRE_EQUAL(state.pending_cpu_usage, 0u);
+      BOOST_REQUIRE(shard_db.find<resource_limits_shard_state_object>() == nullptr);
+      BOOST_REQUIRE_EQUAL(get_block_cpu_usage(shard_db, shared_db), 0u);
+      BOOST_REQUIRE_EQUAL(get_block_cpu_limit(shard_db, shared_db), config::default_max_block_cpu_usage);
+      BOOST_REQUIRE_EQUAL(get_total_block_cpu_limit(shared_db), config::default_max_block_cpu_usage);
+
+      const uint64_t virtual_cpu_limit = get_virtual_block_cpu_limit();
+      process_block_usage(1);
+      BOOST_REQUIRE_EQUAL(state.average_block_cpu_usage.last_ordinal, 1u);
+      BOOST_REQUIRE_EQUAL(get_virtual_block_cpu_limit(), virtual_cpu_limit * 1000 / 999);
+
+      // once activated the sub-shard starts billing against a state of its own
+      shard_accounting = true;
+      resource_limits_manager::add_transaction_usage({account}, increment, 0, 1, shard_db, shared_db );
+      BOOST_REQUIRE(shard_db.find<resource_limits_shard_state_object>() != nullptr);
+      BOOST_REQUIRE_EQUAL(get_block_cpu_usage(shard_db, shared_db), increment);
+   } FC_LOG_AND_RETHROW();
+
    BOOST_FIXTURE_TEST_CASE(enforce_account_ram_limit, resource_limits_fixture) try {
       const uint64_t limit = 1000;
       const uint64_t increment = 77;
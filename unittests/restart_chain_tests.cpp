@@ -1,8 +1,10 @@
+#include <fstream>
 #include <sstream>
 
 #include <eosio/chain/block_log.hpp>
 #include <eosio/chain/global_property_object.hpp>
 #include <eosio/chain/snapshot.hpp>
+#include <eosio/chain/wasm_interface.hpp>
 #include <eosio/testing/tester.hpp>
 
 #include <boost/mpl/list.hpp>
@@ -237,4 +239,72 @@ BOOST_AUTO_TEST_CASE(test_light_validation_restart_from_block_log) {
    BOOST_CHECK_EQUAL(trace->action_traces.at(1).receipt->digest(), other_trace->action_traces.at(1).receipt->digest());
 }
 
+BOOST_AUTO_TEST_CASE(test_restart_preloads_hot_codes) {
+   tester chain(setup_policy::full);
+
+   chain.create_account("testapi"_n);
+   chain.produce_block();
+   chain.set_code("testapi"_n, test_contracts::test_api_wasm());
+   chain.produce_block();
+
+   signed_transaction trx;
+   dummy_action da = {DUMMY_ACTION_DEFAULT_A, DUMMY_ACTION_DEFAULT_B, DUMMY_ACTION_DEFAULT_C};
+   trx.actions.emplace_back(vector<permission_level>{{"testapi"_n, config::active_name}}, da);
+   chain.set_transaction_headers(trx);
+   trx.sign(chain.get_private_key("testapi"_n, "active"), chain.control->get_chain_id());
+   chain.push_transaction(trx);
+   chain.produce_block();
+
+   const auto& testapi   = chain.control->get_account("testapi"_n);
+   const auto code_hash  = testapi.code_hash;
+   const auto vm_type    = testapi.vm_type;
+   const auto vm_version = testapi.vm_version;
+
+   chain.close();
+   controller::config cfg = chain.get_config();
+
+   // the codes executed before shutdown are saved with the state
+   const auto hot_codes_file = cfg.state_dir / config::wasm_hot_codes_filename;
+   auto hot_codes = wasm_interface::load_hot_codes(hot_codes_file);
+   auto hot_code = std::find_if(hot_codes.begin(), hot_codes.end(), [&](const wasm_hot_code& c) {
+      return c.code_hash == code_hash;
+   });
+   BOOST_REQUIRE(hot_code != hot_codes.end());
+   BOOST_REQUIRE(hot_code->uses > 0);
+   const auto uses = hot_code->uses;
+
+   // a damaged list is ignored
+   fc::temp_directory tempdir;
+   const auto damaged_file = tempdir.path() / config::wasm_hot_codes_filename;
+   boost::filesystem::copy_file(hot_codes_file, damaged_file);
+   {
+      // flip a byte of the first code hash
+      std::fstream f(damaged_file.string(), std::ios::in | std::ios::out | std::ios::binary);
+      f.seekg(12);
+      char c = f.get();
+      f.seekp(12);
+      f.put(c ^ 0x01);
+   }
+   BOOST_CHECK(wasm_interface::load_hot_codes(damaged_file).empty());
+
+   if (cfg.wasm_runtime == wasm_interface::vm_type::eos_vm_oc)
+      return; // instances of EOS VM OC are not preloaded
+
+   cfg.wasm_preload_budget = 64 * 1024 * 1024;
+   tester restarted(cfg);
+
+   // restarting on existing state applies no blocks, the code is only cached if it was preloaded
+   auto& wasmif = restarted.control->get_wasm_interface();
+   wasmif.wait_for_preloads();
+   BOOST_CHECK(wasmif.is_code_cached(code_hash, vm_type, vm_version));
+
+   // the uses before the restart are kept, so the code stays as hot at the next shutdown
+   const auto preloaded = wasmif.get_hot_codes();
+   auto preloaded_code = std::find_if(preloaded.begin(), preloaded.end(), [&](const wasm_hot_code& c) {
+      return c.code_hash == code_hash;
+   });
+   BOOST_REQUIRE(preloaded_code != preloaded.end());
+   BOOST_CHECK_EQUAL(preloaded_code->uses, uses);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1,11 +1,16 @@
 #include <eosio/chain/config.hpp>
 #include <eosio/chain/resource_limits.hpp>
+#include <eosio/chain/resource_limits_private.hpp>
 #include <eosio/chain/config.hpp>
+#include <eosio/chain/merkle.hpp>
 #include <eosio/testing/database_manager_fixture.hpp>
 
 #include <boost/test/unit_test.hpp>
 #include <eosio/testing/tester.hpp>
 #include <test_contracts.hpp>
+
+#include <atomic>
+#include <thread>
 #define TEST tester
 using namespace eosio;
 using namespace testing;
@@ -58,7 +63,11 @@ class currency_test : public sharding_validating_tester {
       }
       //TODO: simplify
       asset get_balance_on_shard(const account_name& account) const {
-         const auto& gdb  = const_cast<database_manager&>(control->dbm()).find_shard_db("shard1"_n);
+         return get_balance_on_shard(*control, account);
+      }
+
+      static asset get_balance_on_shard(const controller& chain, const account_name& account) {
+         const auto& gdb  = const_cast<database_manager&>(chain.dbm()).find_shard_db("shard1"_n);
          const auto& db  = *gdb;
          account_name code = "gax.token"_n;
          symbol asset_symbol(SY(4,CUR));
@@ -101,6 +110,25 @@ class currency_test : public sharding_validating_tester {
       currency_test()
          :sharding_validating_tester(),abi_ser(json::from_string(test_contracts::eosio_token_abi().data()).as<abi_def>(), abi_serializer::create_yield_function( abi_serializer_max_time ))
       {
+         create_token();
+      }
+
+      /// set up like setup_policy::full, except that `inactive_features` are left for the test to activate
+      explicit currency_test( const flat_set<builtin_protocol_feature_t>& inactive_features )
+         :sharding_validating_tester(setup_policy::none),abi_ser(json::from_string(test_contracts::eosio_token_abi().data()).as<abi_def>(), abi_serializer::create_yield_function( abi_serializer_max_time ))
+      {
+         execute_setup_policy( setup_policy::preactivate_feature_and_new_bios );
+         preactivate_all_builtin_protocol_features( inactive_features );
+         produce_block();
+         set_bios_contract();
+         for( auto shard : { "shard1"_n, "shard2"_n } ) {
+            control->add_shard_db( shard );
+            validating_node->add_shard_db( shard );
+         }
+         create_token();
+      }
+
+      void create_token() {
          create_account( "gax.token"_n);
          produce_block();
          set_code( "gax.token"_n, test_contracts::eosio_token_wasm() );
@@ -139,6 +167,24 @@ class currency_test : public sharding_validating_tester {
          produce_block();
       }
 
+      // applies a block produced without validation to the validating node and returns the report of applying it
+      controller::block_report validate_block_with_report(const signed_block_ptr& sb) {
+         auto bsf = validating_node->create_block_state_future( sb->calculate_id(), sb );
+         controller::block_report br;
+         validating_node->push_block( br, bsf.get(), forked_branch_callback{}, trx_meta_cache_lookup{} );
+         return br;
+      }
+
+      void fund_alice(shard_name sname, const std::string& memo) {
+         push_action("gax.token"_n, "transfer"_n, mutable_variant_object()
+            ("from", currency_test::gax_token)
+            ("to",   "alice")
+            ("quantity", "1.0000 CUR")
+            ("memo", memo),
+            sname
+         );
+      }
+
       abi_serializer abi_ser;
       static constexpr name gax_token = "gax.token"_n;
 };
@@ -261,4 +307,335 @@ BOOST_FIXTURE_TEST_CASE( shard_tx_test, currency_test ) try {
    BOOST_REQUIRE_EQUAL(get_balance_on_shard("alice"_n), asset::from_string( value ) );
 } FC_LOG_AND_RETHROW ();
 
+// several shards execute the token contract through the one cache entry of its code hash
+BOOST_FIXTURE_TEST_CASE( shared_wasm_cache_test, currency_test ) try {
+   const std::vector<shard_name> shards{ "shard1"_n, "shard2"_n, "shard3"_n, "shard4"_n };
+   for( auto shard : { "shard3"_n, "shard4"_n } ) {
+      control->add_shard_db( shard );
+      validating_node->add_shard_db( shard );
+      push_action("gax.token"_n, "create"_n, mutable_variant_object()
+         ("issuer",       gax_token)
+         ("maximum_supply", "1000000000.0000 CUR")
+         ("can_freeze", 0)
+         ("can_recall", 0)
+         ("can_whitelist", 0),
+         shard
+      );
+   }
+   produce_block();
+   for( auto shard : { "shard3"_n, "shard4"_n } ) {
+      push_action("gax.token"_n, "issue"_n, mutable_variant_object()
+         ("to",       gax_token)
+         ("quantity", "1000000.0000 CUR")
+         ("memo", "gggggggggggg"),
+         shard
+      );
+   }
+   BOOST_CHECK_NO_THROW(create_account("alice"_n));
+   produce_block();
+
+   const auto& acct = control->db().get<account_metadata_object, by_name>("gax.token"_n);
+   auto token_entries = [&]( controller& chain ) {
+      const auto hot_codes = chain.get_wasm_interface().get_hot_codes();
+      return std::count_if( hot_codes.begin(), hot_codes.end(), [&]( const wasm_hot_code& hc ) {
+         return hc.code_hash == acct.code_hash && hc.vm_type == acct.vm_type && hc.vm_version == acct.vm_version;
+      } );
+   };
+
+   const auto validating_start = validating_node->get_wasm_interface().get_cache_stats();
+   for( auto sname : shards )
+      fund_alice( sname, "warm" );
+   produce_block();
+
+   const int blocks = 20;
+   const int trxs_per_shard = 25;
+   const auto producing_start = control->get_wasm_interface().get_cache_stats();
+   for( int b = 0; b < blocks; ++b ) {
+      for( int i = 0; i < trxs_per_shard; ++i ) {
+         for( auto sname : shards )
+            fund_alice( sname, std::to_string(b) + "-" + std::to_string(i) );
+      }
+      produce_block();
+   }
+   std::string value = std::to_string(blocks * trxs_per_shard + 1)+".0000 CUR";
+   BOOST_REQUIRE_EQUAL(get_balance_on_shard("alice"_n), asset::from_string( value ) );
+
+   BOOST_TEST(control->get_wasm_interface().is_code_cached(acct.code_hash, acct.vm_type, acct.vm_version));
+   BOOST_TEST(validating_node->get_wasm_interface().is_code_cached(acct.code_hash, acct.vm_type, acct.vm_version));
+   BOOST_TEST(token_entries( *control ) == 1);
+   BOOST_TEST(token_entries( *validating_node ) == 1);
+
+   // the producer executes the trxs of every shard one after the other, a single instantiation serves them all
+   const auto producing = control->get_wasm_interface().get_cache_stats();
+   BOOST_TEST(producing.misses == producing_start.misses);
+   BOOST_TEST(producing.bytes == producing_start.bytes);
+   BOOST_TEST(producing.hits - producing_start.hits >= uint64_t(blocks * trxs_per_shard * shards.size()));
+
+   // the validating node executes the shards in parallel, a module is instantiated only for a shard finding every
+   // module of the code leased, never per trx
+   const auto validating = validating_node->get_wasm_interface().get_cache_stats();
+   BOOST_TEST(validating.misses - validating_start.misses <= shards.size());
+   BOOST_TEST(validating.hits + validating.misses - validating_start.hits - validating_start.misses >=
+              uint64_t((blocks * trxs_per_shard + 1) * shards.size()));
+
+   // concurrent preloads of a code not cached yet instantiate it once
+   create_account( "payloadless"_n );
+   set_code( "payloadless"_n, test_contracts::payloadless_wasm() );
+   set_abi( "payloadless"_n, test_contracts::payloadless_abi().data() );
+   produce_block();
+   auto& wasmif = control->get_wasm_interface();
+   const auto& pl = control->db().get<account_metadata_object, by_name>("payloadless"_n);
+   const auto& pl_code = control->dbm().shared_db().get<code_object, by_code_hash>( boost::make_tuple(pl.code_hash, pl.vm_type, pl.vm_version) );
+   const wasm_hot_code pl_hot_code{ pl.code_hash, pl.vm_type, pl.vm_version };
+   BOOST_REQUIRE(!wasmif.is_code_cached(pl.code_hash, pl.vm_type, pl.vm_version));
+   const auto before_preload = wasmif.get_cache_stats();
+   std::vector<std::thread> preloads;
+   for( size_t i = 0; i < shards.size(); ++i )
+      preloads.emplace_back( [&]() { wasmif.preload( pl_hot_code, pl_code.code.data(), pl_code.code.size() ); } );
+   for( auto& t : preloads )
+      t.join();
+   const auto after_preload = wasmif.get_cache_stats();
+   BOOST_TEST(after_preload.codes == before_preload.codes + 1);
+   BOOST_TEST(after_preload.bytes == before_preload.bytes + pl_code.code.size());
+
+   // and the preloaded module is leased by the first execution
+   base_tester::push_action( "payloadless"_n, "doit"_n, "payloadless"_n, mutable_variant_object() );
+   BOOST_TEST(wasmif.get_cache_stats().misses == after_preload.misses);
+   BOOST_TEST(wasmif.get_cache_stats().hits == after_preload.hits + 1);
+} FC_LOG_AND_RETHROW ()
+
+// a module still executing when its code is evicted at LIB finishes with it, the code is instantiated again on next use
+BOOST_FIXTURE_TEST_CASE( leased_wasm_module_survives_lib_test, currency_test ) try {
+   const char loop_wast[] = R"=====(
+(module
+ (func (export "apply") (param i64 i64 i64) (loop (br 0)))
+)
+)=====";
+   create_account( "looper"_n );
+   set_code( "looper"_n, loop_wast );
+   produce_block();
+
+   auto& wasmif = control->get_wasm_interface();
+   const auto& acct = control->db().get<account_metadata_object, by_name>("looper"_n);
+   const auto code_hash = acct.code_hash;
+   const auto vm_type = acct.vm_type;
+   const auto vm_version = acct.vm_version;
+   const auto code_size = control->dbm().shared_db().get<code_object, by_code_hash>( boost::make_tuple(code_hash, vm_type, vm_version) ).code.size();
+
+   // the loop runs on a shard until the trx reaches its cpu limit
+   auto push_loop = [&]() {
+      signed_transaction trx;
+      trx.set_shard_name("shard1"_n);
+      trx.actions.emplace_back( vector<permission_level>{{"looper"_n, config::active_name}}, "looper"_n, "loop"_n, bytes() );
+      set_transaction_headers(trx);
+      trx.max_cpu_usage_ms = 100;
+      trx.sign( get_private_key("looper"_n, "active"), control->get_chain_id() );
+      BOOST_CHECK_EXCEPTION( push_transaction(trx), fc::exception, []( const fc::exception& e ) {
+         return e.code() == tx_cpu_usage_exceeded::code_value || e.code() == deadline_exception::code_value;
+      } );
+   };
+
+   // codes replaced before the loop code are evicted up front, so only the loop code is evicted while executing
+   const auto lib = control->head_block_num();
+   wasmif.current_lib( lib );
+   const auto before = wasmif.get_cache_stats();
+   std::atomic<bool> leased = false;
+   std::atomic<bool> evicted = false;
+   std::thread lib_thread( [&]() {
+      const auto deadline = fc::time_point::now() + fc::seconds(5);
+      while( wasmif.get_cache_stats().misses == before.misses && fc::time_point::now() < deadline )
+         std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+      leased = wasmif.get_cache_stats().misses != before.misses;
+      // leased right after its instantiation, well before the loop reaches the cpu limit
+      std::this_thread::sleep_for( std::chrono::milliseconds(20) );
+      // the code is replaced and the block replacing it becomes irreversible
+      wasmif.code_block_num_last_used( code_hash, vm_type, vm_version, lib );
+      wasmif.current_lib( lib );
+      evicted = !wasmif.is_code_cached( code_hash, vm_type, vm_version );
+   } );
+   push_loop();
+   lib_thread.join();
+   BOOST_REQUIRE(leased.load());
+   BOOST_TEST(evicted.load());
+
+   // the module was executed to the end, then freed with its evicted entry
+   auto stats = wasmif.get_cache_stats();
+   BOOST_TEST(stats.misses == before.misses + 1);
+   BOOST_TEST(stats.evictions == before.evictions + 1);
+   BOOST_TEST(stats.bytes == before.bytes);
+   BOOST_TEST(!wasmif.is_code_cached( code_hash, vm_type, vm_version ));
+
+   produce_block();
+   push_loop();
+   stats = wasmif.get_cache_stats();
+   BOOST_TEST(stats.misses == before.misses + 2);
+   BOOST_TEST(stats.bytes == before.bytes + code_size);
+   BOOST_TEST(wasmif.is_code_cached( code_hash, vm_type, vm_version ));
+} FC_LOG_AND_RETHROW ()
+
+// every sub-shard database is written to its own snapshot stream and loaded back from it
+BOOST_FIXTURE_TEST_CASE( shard_db_snapshot_test, currency_test ) try {
+   BOOST_CHECK_NO_THROW(create_account("alice"_n));
+   produce_block();
+   for( int i = 0; i < 10; ++i ) {
+      push_action("gax.token"_n, "transfer"_n, mutable_variant_object()
+         ("from", currency_test::gax_token)
+         ("to",   "alice")
+         ("quantity", "1.0000 CUR")
+         ("memo", std::to_string(i)),
+         "shard1"_n
+      );
+   }
+   produce_block();
+   control->abort_block();
+   BOOST_REQUIRE_EQUAL(get_balance_on_shard("alice"_n), asset::from_string( "10.0000 CUR" ) );
+
+   std::stringstream snapshot_stream;
+   auto writer = std::make_shared<ostream_snapshot_writer>(snapshot_stream);
+   control->write_snapshot(writer);
+   writer->finalize();
+
+   tester snap_chain(setup_policy::none);
+   snap_chain.close();
+   fc::remove_all(snap_chain.get_config().state_dir);
+   fc::remove_all(snap_chain.get_config().blocks_dir);
+   snap_chain.open(std::make_shared<istream_snapshot_reader>(snapshot_stream));
+
+   const auto& snap_dbm = snap_chain.control->dbm();
+   BOOST_REQUIRE(snap_dbm.find_shard_db("shard1"_n) != nullptr);
+   BOOST_REQUIRE(snap_dbm.find_shard_db("shard2"_n) != nullptr);
+   BOOST_REQUIRE_EQUAL(get_balance_on_shard(*snap_chain.control, "alice"_n), asset::from_string( "10.0000 CUR" ) );
+   BOOST_REQUIRE_EQUAL(snap_dbm.shared_db().get_index<account_index>().size(), snap_dbm.main_db().get_index<account_index>().size());
+   BOOST_REQUIRE_EQUAL(control->calculate_integrity_hash().str(), snap_chain.control->calculate_integrity_hash().str());
+} FC_LOG_AND_RETHROW ()
+
+// the block usage and elastic limits of a sub-shard survive a snapshot round trip
+BOOST_FIXTURE_TEST_CASE( shard_resource_state_snapshot_test, currency_test ) try {
+   BOOST_CHECK_NO_THROW(create_account("alice"_n));
+   produce_block();
+   for( int i = 0; i < 10; ++i )
+      fund_alice("shard1"_n, std::to_string(i));
+   produce_blocks(2);
+   control->abort_block();
+
+   using resource_limits::resource_limits_shard_state_object;
+   const auto* shard_state = control->dbm().find_shard_db("shard1"_n)->find<resource_limits_shard_state_object>();
+   BOOST_REQUIRE(shard_state != nullptr);
+   BOOST_REQUIRE(shard_state->average_block_cpu_usage.value_ex > 0);
+
+   std::stringstream snapshot_stream;
+   auto writer = std::make_shared<ostream_snapshot_writer>(snapshot_stream);
+   control->write_snapshot(writer);
+   writer->finalize();
+
+   tester snap_chain(setup_policy::none);
+   snap_chain.close();
+   fc::remove_all(snap_chain.get_config().state_dir);
+   fc::remove_all(snap_chain.get_config().blocks_dir);
+   snap_chain.open(std::make_shared<istream_snapshot_reader>(snapshot_stream));
+
+   const auto* snap_shard_state = snap_chain.control->dbm().find_shard_db("shard1"_n)->find<resource_limits_shard_state_object>();
+   BOOST_REQUIRE(snap_shard_state != nullptr);
+   BOOST_CHECK(fc::raw::pack(*snap_shard_state) == fc::raw::pack(*shard_state));
+   BOOST_REQUIRE_EQUAL(control->calculate_integrity_hash().str(), snap_chain.control->calculate_integrity_hash().str());
+} FC_LOG_AND_RETHROW ()
+
+// the shard with the most cpu in the block is dispatched first
+BOOST_FIXTURE_TEST_CASE( heaviest_shard_dispatched_first_test, currency_test ) try {
+   BOOST_CHECK_NO_THROW(create_account("alice"_n));
+   produce_block();
+   for( int i = 0; i < 20; ++i )
+      fund_alice("shard2"_n, std::to_string(i));
+   fund_alice("shard1"_n, "light");
+
+   auto br = validate_block_with_report(produce_block_no_validation());
+   const auto& heavy = br.shard_reports.at("shard2"_n);
+   const auto& light = br.shard_reports.at("shard1"_n);
+   BOOST_TEST(heavy.num_trxs == 20u);
+   BOOST_TEST(light.num_trxs == 1u);
+   BOOST_TEST(heavy.dispatch_order == 0u);
+   BOOST_TEST(light.dispatch_order == 1u);
+   BOOST_CHECK(br.shard_critical_path_time >= heavy.exec_time);
+   BOOST_CHECK(br.shard_ideal_parallel_time >= heavy.exec_time);
+   BOOST_CHECK(br.shard_ideal_parallel_time >= light.exec_time);
+} FC_LOG_AND_RETHROW ()
+
+// a validating node recovers keys while the shards execute and still applies every shard in receipt order
+BOOST_FIXTURE_TEST_CASE( pipelined_key_recovery_test, currency_test ) try {
+   BOOST_CHECK_NO_THROW(create_account("alice"_n));
+   produce_block();
+   const int trxs_per_shard = 50;
+   for( int i = 0; i < trxs_per_shard; ++i ) {
+      fund_alice("shard1"_n, std::to_string(i));
+      fund_alice("shard2"_n, std::to_string(i));
+   }
+
+   auto sb = produce_block_no_validation();
+   auto br = validate_block_with_report(sb);
+   BOOST_REQUIRE_EQUAL(validating_node->head_block_id(), sb->calculate_id());
+
+   fc::microseconds shard_recovery_wait;
+   for( const auto& sr : br.shard_reports ) {
+      BOOST_TEST(sr.second.num_trxs == static_cast<size_t>(trxs_per_shard));
+      shard_recovery_wait += sr.second.recovery_wait_time;
+   }
+   BOOST_CHECK(br.recovery_wait_time == shard_recovery_wait);
+
+   std::string value = std::to_string(trxs_per_shard)+".0000 CUR";
+   BOOST_REQUIRE_EQUAL(get_balance_on_shard(*validating_node, "alice"_n), asset::from_string( value ));
+   control->abort_block();
+   BOOST_REQUIRE_EQUAL(control->calculate_integrity_hash().str(), validating_node->calculate_integrity_hash().str());
+} FC_LOG_AND_RETHROW ()
+
+// multi-shard blocks keep the flat merkle of all receipts until SHARD_MERKLE_ROOTS activates
+BOOST_AUTO_TEST_CASE( shard_merkle_roots_activation_test ) try {
+   currency_test t( { builtin_protocol_feature_t::shard_merkle_roots } );
+   BOOST_CHECK_NO_THROW(t.create_account("alice"_n));
+   t.produce_block();
+
+   auto shard_trx_mroots = []( const signed_block_ptr& b ) {
+      flat_map<shard_name, digest_type> roots;
+      for( const auto& receipts : b->transactions ) {
+         deque<digest_type> digests;
+         for( const auto& r : receipts.second )
+            digests.emplace_back( r.digest() );
+         roots[receipts.first] = merkle( std::move(digests) );
+      }
+      return roots;
+   };
+   auto flat_trx_mroot = []( const signed_block_ptr& b ) {
+      deque<digest_type> digests;
+      for( const auto& receipts : b->transactions )
+         for( const auto& r : receipts.second )
+            digests.emplace_back( r.digest() );
+      return merkle( std::move(digests) );
+   };
+   // an uneven split, with a power of two receipts per shard both ways of computing the root agree
+   auto produce_multi_shard_block = [&]( const std::string& memo ) {
+      for( int i = 0; i < 3; ++i )
+         t.fund_alice("shard1"_n, memo + std::to_string(i));
+      t.fund_alice("shard2"_n, memo);
+      auto b = t.produce_block(); // also applied by the validating node
+      BOOST_REQUIRE_EQUAL( b->transactions.size(), 2u );
+      BOOST_REQUIRE_EQUAL( t.validating_node->head_block_id(), b->calculate_id() );
+      return b;
+   };
+
+   auto b = produce_multi_shard_block("before");
+   BOOST_CHECK_EQUAL( b->transaction_mroot, flat_trx_mroot( b ) );
+   BOOST_CHECK( b->transaction_mroot != merkle( shard_trx_mroots( b ) ) );
+   BOOST_CHECK_EQUAL( b->validate_and_extract_header_extensions().count( shard_transaction_mroots_extension::extension_id() ), 0u );
+
+   t.preactivate_builtin_protocol_features( { builtin_protocol_feature_t::shard_merkle_roots } );
+   t.produce_block();
+
+   b = produce_multi_shard_block("after");
+   const auto roots = shard_trx_mroots( b );
+   BOOST_CHECK_EQUAL( b->transaction_mroot, merkle( roots ) );
+   BOOST_CHECK( b->transaction_mroot != flat_trx_mroot( b ) );
+   auto exts = b->validate_and_extract_header_extensions();
+   BOOST_REQUIRE_EQUAL( exts.count( shard_transaction_mroots_extension::extension_id() ), 1u );
+   BOOST_CHECK( std::get<shard_transaction_mroots_extension>( exts.lower_bound( shard_transaction_mroots_extension::extension_id() )->second ).transaction_mroots == roots );
+} FC_LOG_AND_RETHROW ()
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
@@ -138,4 +138,38 @@ BOOST_FIXTURE_TEST_CASE( register_shard_test, shard_base_tester ) try {
 
 } FC_LOG_AND_RETHROW()
 
+BOOST_AUTO_TEST_CASE( shard_routing_suggestion_test ) try {
+   shard_routing_index routing;
+   BOOST_REQUIRE( !routing.suggest_shard( { "alice"_n } ) );
+
+   routing.add( "token"_n, config::main_shard_name );
+   routing.add( "game"_n,  "sub.shard1"_n );
+   routing.add( "dex"_n,   "sub.shard1"_n );
+   routing.add( "dex"_n,   "sub.shard2"_n );
+
+   BOOST_REQUIRE( routing.get_shards( "dex"_n ) == (flat_set<shard_name>{ "sub.shard1"_n, "sub.shard2"_n }) );
+   BOOST_REQUIRE( routing.get_shards( "alice"_n ).empty() );
+
+   // the shard holding tables of most of the contracts wins
+   BOOST_REQUIRE( routing.suggest_shard( { "game"_n, "dex"_n } ) == "sub.shard1"_n );
+   BOOST_REQUIRE( routing.suggest_shard( { "token"_n, "game"_n, "dex"_n, "alice"_n } ) == "sub.shard1"_n );
+   // ties go to main, then to the lowest shard name
+   BOOST_REQUIRE( routing.suggest_shard( { "token"_n, "game"_n } ) == config::main_shard_name );
+   BOOST_REQUIRE( routing.suggest_shard( { "dex"_n } ) == "sub.shard1"_n );
+
+   BOOST_REQUIRE( routing.holds_any( "sub.shard2"_n, { "token"_n, "dex"_n } ) );
+   BOOST_REQUIRE( !routing.holds_any( config::main_shard_name, { "game"_n, "dex"_n } ) );
+
+   // a contract without tables anywhere has no hint yet, its first transaction may go to any shard
+   BOOST_REQUIRE( routing.all_routed( { "token"_n, "dex"_n } ) );
+   BOOST_REQUIRE( !routing.all_routed( { "token"_n, "alice"_n } ) );
+
+   // adding a known placement again leaves the hint unchanged
+   routing.add( "game"_n, "sub.shard1"_n );
+   BOOST_REQUIRE( routing.get_shards( "game"_n ) == (flat_set<shard_name>{ "sub.shard1"_n }) );
+
+   routing.clear();
+   BOOST_REQUIRE( routing.get_shards( "dex"_n ).empty() );
+} FC_LOG_AND_RETHROW()
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
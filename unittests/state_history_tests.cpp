@@ -9,6 +9,7 @@
 #include <eosio/testing/tester.hpp>
 #include <fc/io/json.hpp>
 #include <eosio/chain/global_property_object.hpp>
+#include <eosio/chain/thread_utils.hpp>
 
 #include "test_cfd_transaction.hpp"
 #include <boost/filesystem.hpp>
@@ -97,6 +98,90 @@ BOOST_AUTO_TEST_CASE(test_deltas_not_empty) {
    }
 }
 
+BOOST_AUTO_TEST_CASE(test_shard_deltas) {
+   namespace bio = boost::iostreams;
+   sharding_tester chain;
+   chain.create_accounts({"gax.token"_n});
+   chain.set_code("gax.token"_n, test_contracts::eosio_token_wasm());
+   chain.set_abi("gax.token"_n, test_contracts::eosio_token_abi().data());
+   chain.produce_block();
+   {
+      // contract rows written by a shard1 transaction land in the shard1 db
+      base_tester::shard_name_scope scope(chain, "shard1"_n);
+      chain.push_action("gax.token"_n, "create"_n, "gax.token"_n, mutable_variant_object()
+                        ("issuer", "gax.token")
+                        ("maximum_supply", "1000000000.0000 SHA"));
+   }
+   chain.produce_block();
+
+   const auto& main_db = chain.control->db();
+   const auto* shard1_db = chain.control->dbm().find_shard_db("shard1"_n);
+   BOOST_REQUIRE(shard1_db != nullptr);
+
+   // (shard, table name) of every delta, table_delta_v0 is reported as the main shard
+   auto decode = [](const std::vector<char>& buf) {
+      std::vector<std::pair<name, std::string>> result;
+      fc::datastream<const char*> ds{buf.data(), buf.size()};
+      fc::unsigned_int num_tables;
+      fc::raw::unpack(ds, num_tables);
+      for (uint32_t i = 0; i < num_tables.value; ++i) {
+         fc::unsigned_int version;
+         fc::raw::unpack(ds, version);
+         name shard = config::main_shard_name;
+         if (version.value == 1)
+            fc::raw::unpack(ds, shard);
+         std::string table;
+         fc::raw::unpack(ds, table);
+         eosio::state_history::big_vector_wrapper<std::vector<std::pair<bool, bytes>>> rows;
+         fc::raw::unpack(ds, rows);
+         result.emplace_back(shard, table);
+      }
+      BOOST_REQUIRE_EQUAL(ds.remaining(), 0u);
+      return result;
+   };
+
+   auto pack = [&](boost::asio::io_context* thread_pool) {
+      std::vector<char> buf;
+      bio::filtering_ostreambuf obuf;
+      obuf.push(bio::back_inserter(buf));
+      eosio::state_history::pack_deltas(obuf, main_db, {{"shard1"_n, shard1_db}}, true, thread_pool);
+      return buf;
+   };
+
+   auto main_tables = eosio::state_history::create_deltas(main_db, true);
+   auto shard1_tables = eosio::state_history::create_deltas(*shard1_db, true);
+   BOOST_REQUIRE(!main_tables.empty());
+   BOOST_REQUIRE(std::any_of(shard1_tables.begin(), shard1_tables.end(), [](const auto& t) { return t.name == "contract_row"; }));
+
+   auto buf = pack(nullptr);
+   auto deltas = decode(buf);
+   BOOST_REQUIRE_EQUAL(deltas.size(), main_tables.size() + shard1_tables.size());
+   for (size_t i = 0; i < main_tables.size(); ++i) {
+      BOOST_CHECK_EQUAL(deltas[i].first, config::main_shard_name);
+      BOOST_CHECK_EQUAL(deltas[i].second, main_tables[i].name);
+   }
+   for (size_t i = 0; i < shard1_tables.size(); ++i) {
+      BOOST_CHECK_EQUAL(deltas[main_tables.size() + i].first, "shard1"_n);
+      BOOST_CHECK_EQUAL(deltas[main_tables.size() + i].second, shard1_tables[i].name);
+   }
+
+   named_thread_pool<struct ship_test> thread_pool;
+   thread_pool.start( 2, {} );
+   BOOST_CHECK(pack(&thread_pool.get_executor()) == buf);
+   thread_pool.stop();
+
+   auto shard1 = decode(eosio::state_history::filter_deltas(buf, {"shard1"_n}));
+   BOOST_REQUIRE_EQUAL(shard1.size(), shard1_tables.size());
+   BOOST_CHECK(std::all_of(shard1.begin(), shard1.end(), [](const auto& d) { return d.first == "shard1"_n; }));
+
+   // what a get_blocks_request_v0 client receives, it cannot decode table_delta_v1
+   auto main_only = decode(eosio::state_history::filter_deltas(buf, {config::main_shard_name}));
+   BOOST_REQUIRE_EQUAL(main_only.size(), main_tables.size());
+   BOOST_CHECK(std::all_of(main_only.begin(), main_only.end(), [](const auto& d) { return d.first == config::main_shard_name; }));
+
+   BOOST_CHECK(decode(eosio::state_history::filter_deltas(buf, {"shard3"_n})).empty());
+}
+
 BOOST_AUTO_TEST_CASE(test_deltas_account_creation) {
    table_deltas_tester chain;
    chain.produce_block();
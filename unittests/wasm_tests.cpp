@@ -2307,4 +2307,97 @@ BOOST_FIXTURE_TEST_CASE(weighted_net_usage_tests, tester ) try {
 } FC_LOG_AND_RETHROW()
 #endif
 
+// with room for either code but not both, instantiating one code evicts the other one if it was executed less recently
+BOOST_AUTO_TEST_CASE( wasm_cache_evicts_least_recently_used ) try {
+   fc::temp_directory tempdir;
+   auto conf_genesis = tester::default_config( tempdir );
+   conf_genesis.first.wasm_cache_max_size = wast_to_wasm( entry_wast ).size() + wast_to_wasm( entry_wast_2 ).size() - 1;
+   tester t( conf_genesis.first, conf_genesis.second );
+
+   t.create_accounts( {"entrycheck"_n, "entrycheck2"_n} );
+   t.produce_block();
+   t.set_code( "entrycheck"_n, entry_wast );
+   t.set_code( "entrycheck2"_n, entry_wast_2 );
+   t.produce_block();
+
+   auto push = [&]( account_name account ) {
+      signed_transaction trx;
+      action act;
+      act.account = account;
+      act.name = ""_n;
+      act.authorization = vector<permission_level>{{account, config::active_name}};
+      trx.actions.push_back( act );
+      t.set_transaction_headers( trx );
+      trx.sign( t.get_private_key( account, "active" ), t.control->get_chain_id() );
+      t.push_transaction( trx );
+   };
+   auto run = [&]( account_name account ) {
+      push( account );
+      t.produce_block();
+   };
+
+   const auto before = t.control->get_wasm_interface().get_cache_stats();
+   run( "entrycheck"_n );
+   // the cache goes over its size as the second code is instantiated, the first one is evicted right away
+   push( "entrycheck2"_n );
+   BOOST_TEST( !t.is_code_cached( "entrycheck"_n ) );
+   BOOST_TEST( t.is_code_cached( "entrycheck2"_n ) );
+   t.produce_blocks( 2 );
+
+   const auto after = t.control->get_wasm_interface().get_cache_stats();
+   BOOST_TEST( after.misses - before.misses == 2u );
+   BOOST_TEST( after.evictions - before.evictions == 1u );
+   BOOST_TEST( after.bytes <= conf_genesis.first.wasm_cache_max_size );
+   BOOST_TEST( !t.is_code_cached( "entrycheck"_n ) );
+   BOOST_TEST( t.is_code_cached( "entrycheck2"_n ) );
+
+   // executing the evicted code again instantiates it and evicts the other one
+   push( "entrycheck"_n );
+   BOOST_TEST( t.is_code_cached( "entrycheck"_n ) );
+   BOOST_TEST( !t.is_code_cached( "entrycheck2"_n ) );
+   BOOST_TEST( t.control->get_wasm_interface().get_cache_stats().misses - before.misses == 3u );
+   t.produce_block();
+} FC_LOG_AND_RETHROW()
+
+// with a bounded cache a replaced code is still evicted once its replacement is irreversible, whatever the room left
+BOOST_AUTO_TEST_CASE( wasm_cache_bounded_evicts_replaced_code ) try {
+   fc::temp_directory tempdir;
+   auto conf_genesis = tester::default_config( tempdir );
+   conf_genesis.first.wasm_cache_max_size = 64 * 1024 * 1024;
+   tester t( conf_genesis.first, conf_genesis.second );
+
+   t.create_accounts( {"entrycheck"_n} );
+   t.produce_block();
+   t.set_code( "entrycheck"_n, entry_wast );
+   t.produce_block();
+
+   signed_transaction trx;
+   action act;
+   act.account = "entrycheck"_n;
+   act.name = ""_n;
+   act.authorization = vector<permission_level>{{"entrycheck"_n, config::active_name}};
+   trx.actions.push_back( act );
+   t.set_transaction_headers( trx );
+   trx.sign( t.get_private_key( "entrycheck"_n, "active" ), t.control->get_chain_id() );
+   t.push_transaction( trx );
+   t.produce_block();
+
+   const auto& acct = t.control->get_account( "entrycheck"_n );
+   const auto code_hash = acct.code_hash;
+   const auto vm_type = acct.vm_type;
+   const auto vm_version = acct.vm_version;
+   auto& wasmif = t.control->get_wasm_interface();
+   BOOST_REQUIRE( wasmif.is_code_cached( code_hash, vm_type, vm_version ) );
+   const auto before = wasmif.get_cache_stats();
+
+   t.set_code( "entrycheck"_n, entry_wast_2 );
+   const auto replaced_in = t.control->head_block_num() + 1;
+   for( int i = 0; i < 10 && t.control->last_irreversible_block_num() < replaced_in; ++i )
+      t.produce_block();
+   BOOST_REQUIRE( t.control->last_irreversible_block_num() >= replaced_in );
+
+   BOOST_TEST( !wasmif.is_code_cached( code_hash, vm_type, vm_version ) );
+   BOOST_TEST( wasmif.get_cache_stats().evictions - before.evictions == 1u );
+} FC_LOG_AND_RETHROW()
+
 BOOST_AUTO_TEST_SUITE_END()
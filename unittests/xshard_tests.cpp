@@ -15,6 +15,7 @@
 #include "eosio_system_tester.hpp"
 #include <eosio/chain/shard_object.hpp>
 #include <eosio/chain/xshard_object.hpp>
+#include <eosio/chain/xshard_queue.hpp>
 #include <eosio/chain/global_property_object.hpp>
 #include <eosio/chain/generated_transaction_object.hpp>
 
@@ -31,6 +32,22 @@ public:
 
    xshard_tester()
    {
+      register_shard1();
+   }
+
+   /// set up like setup_policy::full, except that `inactive_features` are left for the test to activate
+   explicit xshard_tester( const flat_set<builtin_protocol_feature_t>& inactive_features )
+   : eosio_system_tester( setup_policy::none, [&]( TESTER& t ) {
+        t.execute_setup_policy( setup_policy::preactivate_feature_and_new_bios );
+        t.preactivate_all_builtin_protocol_features( inactive_features );
+        t.produce_block();
+        t.set_bios_contract();
+     } )
+   {
+      register_shard1();
+   }
+
+   void register_shard1() {
       produce_blocks();
       create_account_with_resources( shard1_owner, config::system_account_name, core_from_string("10.0000"), false );
       regshard(config::system_account_name, shard1_name, shard1_owner, true);
@@ -171,6 +188,7 @@ BOOST_FIXTURE_TEST_CASE( xshard_transfer_test, xshard_tester ) try {
    BOOST_REQUIRE(schedule_trx_obj->delay_until == schedule_trx_obj->published + fc::milliseconds(config::block_interval_ms));
    BOOST_REQUIRE(schedule_trx_obj->expiration == schedule_trx_obj->delay_until + fc::seconds(gpo.configuration.deferred_trx_expiration_window));
    BOOST_REQUIRE_EQUAL(schedule_trx_obj->is_xshard, true);
+   BOOST_REQUIRE_EQUAL(schedule_trx_obj->shard_name, shard1_name);
 
    static const asset& balance0 = core_from_string("0.0000");
    BOOST_REQUIRE_EQUAL(get_balance(*shard1_db, "alice1111111"_n), balance0);
@@ -185,6 +203,13 @@ BOOST_FIXTURE_TEST_CASE( xshard_transfer_test, xshard_tester ) try {
    BOOST_REQUIRE_EQUAL(gen_trx_indx.size(), 0);
    BOOST_REQUIRE(gen_trx_indx.find(scheduled_xshin_trx) == gen_trx_indx.end());
 
+   const auto& latencies = control->xshard_latencies();
+   auto latency_itr = latencies.find(xshard_queue::route{config::main_shard_name, shard1_name});
+   BOOST_REQUIRE(latency_itr != latencies.end());
+   BOOST_REQUIRE_EQUAL(latency_itr->second.count, 1u);
+   BOOST_REQUIRE_EQUAL(latency_itr->second.total_blocks, 1u);
+   BOOST_REQUIRE_EQUAL(latency_itr->second.buckets[0], 1u);
+
    auto xshout_data2 = fc::raw::pack( xtoken{core_from_string("1.0000"), ""} );
 
    transfer(config::system_account_name, "bob111111111"_n, core_from_string("100.0000"));
@@ -238,4 +263,76 @@ BOOST_FIXTURE_TEST_CASE( xshard_transfer_test, xshard_tester ) try {
 
 } FC_LOG_AND_RETHROW()
 
+// the xshin transaction is scheduled on the sending shard until XSHARD_TARGET_SHARD activates
+BOOST_AUTO_TEST_CASE( xshard_target_shard_activation_test ) try {
+   xshard_tester t( { builtin_protocol_feature_t::xshard_target_shard } );
+   const auto& shared_db = t.control->dbm().shared_db();
+   t.transfer(config::system_account_name, "alice1111111"_n, core_from_string("100.0000"));
+
+   auto scheduled_shard = [&]( const std::string& quantity ) {
+      auto trx = t.xshout( "alice1111111"_n, xshard_tester::shard1_name, "gax.token"_n, "xtoken"_n,
+                           fc::raw::pack( xtoken{core_from_string(quantity), ""} ) );
+      t.produce_blocks();
+      const auto* xsh = shared_db.find<xshard_object, by_xshard_id>( xshard_object::make_xsh_id(trx->id, 0) );
+      BOOST_REQUIRE( xsh != nullptr );
+      const auto* gto = shared_db.find<generated_transaction_object, by_trx_id>( xsh->scheduled_xshin_trx );
+      BOOST_REQUIRE( gto != nullptr );
+      BOOST_REQUIRE_EQUAL( gto->is_xshard, true );
+      return gto->shard_name;
+   };
+
+   BOOST_REQUIRE_EQUAL( scheduled_shard("1.0000"), config::main_shard_name );
+
+   t.preactivate_builtin_protocol_features( { builtin_protocol_feature_t::xshard_target_shard } );
+   t.produce_block();
+
+   BOOST_REQUIRE_EQUAL( scheduled_shard("2.0000"), xshard_tester::shard1_name );
+} FC_LOG_AND_RETHROW()
+
+BOOST_AUTO_TEST_CASE( xshard_queue_delivery_order_test ) try {
+   auto make_action = [](const shard_name& to_shard, uint32_t seq) {
+      xsh_out_action act;
+      act.xsh_out.to_shard = to_shard;
+      act.xsh_id = xshard_object::make_xsh_id(transaction_id_type(), seq);
+      return act;
+   };
+
+   xshard_queue queue;
+   deque<xsh_out_action> shard2_out;
+   shard2_out.push_back(make_action("shard1"_n, 0));
+   shard2_out.push_back(make_action(config::main_shard_name, 1));
+   shard2_out.push_back(make_action("shard1"_n, 2));
+   queue.post("shard2"_n, std::move(shard2_out));
+   BOOST_REQUIRE(shard2_out.empty());
+
+   deque<xsh_out_action> main_out;
+   main_out.push_back(make_action("shard1"_n, 3));
+   queue.post(config::main_shard_name, std::move(main_out));
+
+   // batched by target shard, then source shard, then execution order
+   vector<std::pair<shard_name, uint32_t>> expected = {
+      {"shard2"_n, 1}, {config::main_shard_name, 3}, {"shard2"_n, 0}, {"shard2"_n, 2}
+   };
+   vector<std::pair<shard_name, xshard_id_type>> delivered;
+   queue.deliver([&](const shard_name& from_shard, const xsh_out_action& act) {
+      delivered.emplace_back(from_shard, act.xsh_id);
+   });
+   BOOST_REQUIRE(queue.empty());
+   BOOST_REQUIRE_EQUAL(delivered.size(), expected.size());
+   for (size_t i = 0; i < expected.size(); ++i) {
+      BOOST_REQUIRE_EQUAL(delivered[i].first, expected[i].first);
+      BOOST_REQUIRE_EQUAL(delivered[i].second, xshard_object::make_xsh_id(transaction_id_type(), expected[i].second));
+   }
+
+   queue.record_delivery(config::main_shard_name, "shard1"_n, 1);
+   queue.record_delivery(config::main_shard_name, "shard1"_n, 3);
+   queue.record_delivery(config::main_shard_name, "shard1"_n, 100);
+   const auto& h = queue.latencies().at(xshard_queue::route{config::main_shard_name, "shard1"_n});
+   BOOST_REQUIRE_EQUAL(h.count, 3u);
+   BOOST_REQUIRE_EQUAL(h.total_blocks, 104u);
+   BOOST_REQUIRE_EQUAL(h.buckets[0], 1u);
+   BOOST_REQUIRE_EQUAL(h.buckets[2], 1u);
+   BOOST_REQUIRE_EQUAL(h.buckets.back(), 1u);
+} FC_LOG_AND_RETHROW()
+
 BOOST_AUTO_TEST_SUITE_END()